@@ -0,0 +1,401 @@
+//! Benchmark harness for performance tests
+//!
+//! This module is only compiled with `test-perf` feature. A benchmark runs
+//! warm-up iterations and then a number of timed samples, statistics of
+//! the samples are printed and optionally appended to a JSON lines file.
+//!
+//! The harness is configured by environment variables:
+//!
+//! - `ZBOX_BENCH_SAMPLES`: number of timed samples, default is 5
+//! - `ZBOX_BENCH_WARMUP`: number of warm-up iterations, default is 1
+//! - `ZBOX_BENCH_THREADS`: comma separated thread counts, default is
+//!   `1,2,4`
+//! - `ZBOX_BENCH_FILTER`: only run benchmarks whose name contains it
+//! - `ZBOX_BENCH_OUT`: file which results are appended to, one JSON
+//!   object per line
+//! - `ZBOX_BENCH_BASELINE`: result file of a previous run, each result is
+//!   compared with its baseline and flagged if it is regressed
+//! - `ZBOX_BENCH_THRESHOLD`: regression threshold in percent, default is 5
+
+use std::collections::HashMap;
+use std::env;
+use std::fmt::{self, Debug};
+use std::fs::{self, OpenOptions};
+use std::io::Write;
+use std::sync::{Barrier, Mutex};
+use std::thread;
+use std::time::{Duration, Instant};
+
+/// Amount of work done in one benchmark iteration
+#[derive(Debug, Clone, Copy)]
+pub enum Work {
+    /// Number of bytes processed
+    Bytes(usize),
+
+    /// Number of operations done
+    Ops(usize),
+}
+
+impl Work {
+    // throughput and its unit for a duration in seconds
+    fn throughput(&self, secs: f64) -> (f64, &'static str) {
+        match *self {
+            Work::Bytes(n) => (n as f64 / (1024.0 * 1024.0) / secs, "MB/s"),
+            Work::Ops(n) => (n as f64 / secs, "ops/s"),
+        }
+    }
+}
+
+// two-sided 95% t-distribution critical values, index is degrees of freedom
+const T_95: [f64; 11] = [
+    0.0, 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+];
+
+/// Benchmark statistics, times are in nanoseconds
+#[derive(Debug, Clone)]
+pub struct Stats {
+    pub name: String,
+    pub backend: String,
+    pub threads: usize,
+    pub samples: usize,
+    pub mean: f64,
+    pub median: f64,
+    pub stddev: f64,
+    pub min: f64,
+    pub max: f64,
+
+    /// Half width of 95% confidence interval of the mean
+    pub ci95: f64,
+
+    /// Throughput based on median time
+    pub throughput: f64,
+    pub unit: &'static str,
+}
+
+impl Stats {
+    fn new(
+        name: &str,
+        backend: &str,
+        threads: usize,
+        work: Work,
+        times: &[Duration],
+    ) -> Self {
+        let mut ns: Vec<f64> = times
+            .iter()
+            .map(|t| t.as_secs() as f64 * 1e9 + f64::from(t.subsec_nanos()))
+            .collect();
+        ns.sort_by(|a, b| a.partial_cmp(b).unwrap());
+
+        let n = ns.len();
+        let mean = ns.iter().sum::<f64>() / n as f64;
+        let median = if n % 2 == 0 {
+            (ns[n / 2 - 1] + ns[n / 2]) / 2.0
+        } else {
+            ns[n / 2]
+        };
+        let stddev = if n > 1 {
+            let var = ns.iter().map(|x| (x - mean) * (x - mean)).sum::<f64>()
+                / (n - 1) as f64;
+            var.sqrt()
+        } else {
+            0.0
+        };
+        let t = T_95.get(n - 1).cloned().unwrap_or(1.96);
+        let (throughput, unit) = work.throughput(median / 1e9);
+
+        Stats {
+            name: name.to_string(),
+            backend: backend.to_string(),
+            threads,
+            samples: n,
+            mean,
+            median,
+            stddev,
+            min: ns[0],
+            max: ns[n - 1],
+            ci95: t * stddev / (n as f64).sqrt(),
+            throughput,
+            unit,
+        }
+    }
+
+    // key to match result in baseline
+    fn key(&self) -> String {
+        format!("{}/{}/{}", self.name, self.backend, self.threads)
+    }
+
+    fn to_json(&self) -> String {
+        format!(
+            "{{\"name\":\"{}\",\"backend\":\"{}\",\"threads\":{},\
+             \"samples\":{},\"mean_ns\":{:.0},\"median_ns\":{:.0},\
+             \"stddev_ns\":{:.0},\"min_ns\":{:.0},\"max_ns\":{:.0},\
+             \"ci95_ns\":{:.0},\"throughput\":{:.2},\"unit\":\"{}\"}}",
+            self.name,
+            self.backend,
+            self.threads,
+            self.samples,
+            self.mean,
+            self.median,
+            self.stddev,
+            self.min,
+            self.max,
+            self.ci95,
+            self.throughput,
+            self.unit
+        )
+    }
+}
+
+// extract a field value from a flat JSON object written by Stats::to_json
+fn json_field<'a>(line: &'a str, field: &str) -> Option<&'a str> {
+    let pat = format!("\"{}\":", field);
+    let begin = line.find(&pat)? + pat.len();
+    let rest = &line[begin..];
+    let end = rest.find(|c| c == ',' || c == '}')?;
+    Some(rest[..end].trim_matches('"'))
+}
+
+/// Benchmark runner
+pub struct Bench {
+    warmup: usize,
+    samples: usize,
+    threads: Vec<usize>,
+    filter: Option<String>,
+    out: Option<Mutex<fs::File>>,
+    baseline: HashMap<String, f64>,
+    threshold: f64,
+}
+
+impl Bench {
+    /// Create benchmark runner from environment variables
+    pub fn from_env() -> Self {
+        fn var<T: ::std::str::FromStr>(key: &str, default: T) -> T {
+            env::var(key)
+                .ok()
+                .and_then(|v| v.trim().parse().ok())
+                .unwrap_or(default)
+        }
+
+        let threads: Vec<usize> = env::var("ZBOX_BENCH_THREADS")
+            .unwrap_or_else(|_| "1,2,4".to_string())
+            .split(',')
+            .filter_map(|s| s.trim().parse().ok())
+            .filter(|&n| n > 0)
+            .collect();
+
+        let out = env::var("ZBOX_BENCH_OUT").ok().map(|path| {
+            let file = OpenOptions::new()
+                .create(true)
+                .append(true)
+                .open(&path)
+                .expect("Open benchmark output file failed");
+            Mutex::new(file)
+        });
+
+        let mut baseline = HashMap::new();
+        if let Ok(path) = env::var("ZBOX_BENCH_BASELINE") {
+            let content = fs::read_to_string(&path)
+                .expect("Read benchmark baseline file failed");
+            for line in content.lines() {
+                let field = |f| json_field(line, f);
+                if let (
+                    Some(name),
+                    Some(backend),
+                    Some(threads),
+                    Some(median),
+                ) = (
+                    field("name"),
+                    field("backend"),
+                    field("threads"),
+                    field("median_ns").and_then(|m| m.parse::<f64>().ok()),
+                ) {
+                    let key = format!("{}/{}/{}", name, backend, threads);
+                    baseline.insert(key, median);
+                }
+            }
+        }
+
+        Bench {
+            warmup: var("ZBOX_BENCH_WARMUP", 1),
+            samples: var("ZBOX_BENCH_SAMPLES", 5usize).max(1),
+            threads: if threads.is_empty() { vec![1] } else { threads },
+            filter: env::var("ZBOX_BENCH_FILTER").ok(),
+            out,
+            baseline,
+            threshold: var("ZBOX_BENCH_THRESHOLD", 5.0),
+        }
+    }
+
+    /// Thread counts each multi-threaded benchmark runs with
+    #[inline]
+    pub fn threads(&self) -> &[usize] {
+        &self.threads
+    }
+
+    /// Check if benchmark is selected by filter
+    pub fn is_selected(&self, name: &str) -> bool {
+        match self.filter {
+            Some(ref filter) => name.contains(filter.as_str()),
+            None => true,
+        }
+    }
+
+    /// Measure time of a closure
+    #[inline]
+    pub fn time<F: FnOnce()>(f: F) -> Duration {
+        let now = Instant::now();
+        f();
+        now.elapsed()
+    }
+
+    /// Run a benchmark
+    ///
+    /// The closure runs one iteration and returns its time, so it can
+    /// exclude its own preparation from timing by using [`time`].
+    ///
+    /// [`time`]: #method.time
+    pub fn run<F>(
+        &self,
+        name: &str,
+        backend: &str,
+        work: Work,
+        mut f: F,
+    ) -> Option<Stats>
+    where
+        F: FnMut() -> Duration,
+    {
+        if !self.is_selected(name) {
+            return None;
+        }
+        for _ in 0..self.warmup {
+            f();
+        }
+        let times: Vec<Duration> = (0..self.samples).map(|_| f()).collect();
+        let stats = Stats::new(name, backend, 1, work, &times);
+        self.report(&stats);
+        Some(stats)
+    }
+
+    /// Run a benchmark on multiple threads
+    ///
+    /// In each iteration the closure is called on every thread with the
+    /// thread index, the iteration time is from all threads are started
+    /// until all of them are finished. The work is the total amount done
+    /// by all threads.
+    pub fn run_threads<F>(
+        &self,
+        name: &str,
+        backend: &str,
+        threads: usize,
+        work: Work,
+        f: F,
+    ) -> Option<Stats>
+    where
+        F: Fn(usize) + Sync,
+    {
+        if !self.is_selected(name) {
+            return None;
+        }
+
+        let iterate = || {
+            let barrier = Barrier::new(threads + 1);
+            thread::scope(|s| {
+                for idx in 0..threads {
+                    let barrier = &barrier;
+                    let f = &f;
+                    s.spawn(move || {
+                        barrier.wait();
+                        f(idx);
+                    });
+                }
+                barrier.wait();
+                Instant::now()
+            })
+            .elapsed()
+        };
+
+        for _ in 0..self.warmup {
+            iterate();
+        }
+        let times: Vec<Duration> =
+            (0..self.samples).map(|_| iterate()).collect();
+        let stats = Stats::new(name, backend, threads, work, &times);
+        self.report(&stats);
+        Some(stats)
+    }
+
+    // print result, compare it with baseline and write it to output file
+    fn report(&self, stats: &Stats) {
+        let change = match self.baseline.get(&stats.key()) {
+            Some(&base) if base > 0.0 => {
+                let pct = (stats.median - base) / base * 100.0;
+                let noise = stats.ci95 / stats.median * 100.0;
+                let flag = if pct > self.threshold.max(noise) {
+                    " REGRESSED"
+                } else {
+                    ""
+                };
+                format!(", change: {:+.1}%{}", pct, flag)
+            }
+            _ => String::new(),
+        };
+        println!(
+            "bench {} [{}, {} threads]: median {:.3} ms (\u{b1}{:.1}%), \
+             {:.2} {}{}",
+            stats.name,
+            stats.backend,
+            stats.threads,
+            stats.median / 1e6,
+            stats.ci95 / stats.median * 100.0,
+            stats.throughput,
+            stats.unit,
+            change
+        );
+
+        if let Some(ref out) = self.out {
+            let mut out = out.lock().unwrap();
+            writeln!(out, "{}", stats.to_json())
+                .expect("Write benchmark output failed");
+        }
+    }
+}
+
+impl Debug for Bench {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        f.debug_struct("Bench")
+            .field("warmup", &self.warmup)
+            .field("samples", &self.samples)
+            .field("threads", &self.threads)
+            .field("filter", &self.filter)
+            .finish()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn bench_stats() {
+        let times: Vec<Duration> = [3u64, 1, 2, 4]
+            .iter()
+            .map(|&n| Duration::from_millis(n))
+            .collect();
+        let stats =
+            Stats::new("foo", "mem", 2, Work::Bytes(1024 * 1024), &times);
+        assert_eq!(stats.samples, 4);
+        assert!((stats.mean - 2.5e6).abs() < 1.0);
+        assert!((stats.median - 2.5e6).abs() < 1.0);
+        assert!((stats.min - 1e6).abs() < 1.0);
+        assert!((stats.max - 4e6).abs() < 1.0);
+        assert!((stats.throughput - 400.0).abs() < 1e-6);
+        assert_eq!(stats.unit, "MB/s");
+
+        // result can be read back as baseline
+        let json = stats.to_json();
+        assert_eq!(json_field(&json, "name"), Some("foo"));
+        assert_eq!(json_field(&json, "threads"), Some("2"));
+        assert_eq!(json_field(&json, "median_ns"), Some("2500000"));
+        assert_eq!(json_field(&json, "unit"), Some("MB/s"));
+    }
+}
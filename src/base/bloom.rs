@@ -0,0 +1,125 @@
+use std::cmp::max;
+use std::fmt::{self, Debug};
+
+/// Bloom filter
+///
+/// The keys are expected to be uniformly distributed already, for example
+/// hashes or entity ids, so the first 16 bytes of a key are used directly
+/// as the two base hashes for double hashing.
+#[derive(Clone, Default, Deserialize, Serialize)]
+pub struct BloomFilter {
+    bits: Vec<u64>,
+    k: u32,
+}
+
+impl BloomFilter {
+    // number of bits per key, together with the number of hash functions
+    // it gives about 1% false positive rate
+    const BITS_PER_KEY: usize = 10;
+    const HASH_CNT: u32 = 7;
+
+    // minimum key length
+    const MIN_KEY_LEN: usize = 16;
+
+    pub fn new(key_cnt: usize) -> Self {
+        let bits_len = max(key_cnt * Self::BITS_PER_KEY, 64);
+        BloomFilter {
+            bits: vec![0; (bits_len + 63) / 64],
+            k: Self::HASH_CNT,
+        }
+    }
+
+    #[inline]
+    fn base_hashes(key: &[u8]) -> (u64, u64) {
+        assert!(key.len() >= Self::MIN_KEY_LEN);
+        let mut h1 = [0u8; 8];
+        let mut h2 = [0u8; 8];
+        h1.copy_from_slice(&key[..8]);
+        h2.copy_from_slice(&key[8..16]);
+        (u64::from_le_bytes(h1), u64::from_le_bytes(h2) | 1)
+    }
+
+    #[inline]
+    fn bits_len(&self) -> u64 {
+        self.bits.len() as u64 * 64
+    }
+
+    pub fn insert(&mut self, key: &[u8]) {
+        let (mut h, delta) = Self::base_hashes(key);
+        let bits_len = self.bits_len();
+        for _ in 0..self.k {
+            let bit = h % bits_len;
+            self.bits[(bit / 64) as usize] |= 1 << (bit % 64);
+            h = h.wrapping_add(delta);
+        }
+    }
+
+    /// Check if key may be in the filter, false means it is definitely not
+    ///
+    /// An empty filter, e.g. deserialized from old data, contains anything.
+    pub fn may_contain(&self, key: &[u8]) -> bool {
+        if self.bits.is_empty() {
+            return true;
+        }
+        let (mut h, delta) = Self::base_hashes(key);
+        let bits_len = self.bits_len();
+        for _ in 0..self.k {
+            let bit = h % bits_len;
+            if self.bits[(bit / 64) as usize] & (1 << (bit % 64)) == 0 {
+                return false;
+            }
+            h = h.wrapping_add(delta);
+        }
+        true
+    }
+}
+
+impl Debug for BloomFilter {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        f.debug_struct("BloomFilter")
+            .field("bits_len", &self.bits_len())
+            .field("k", &self.k)
+            .finish()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use base::crypto::Crypto;
+    use base::init_env;
+
+    #[test]
+    fn bloom_filter() {
+        init_env();
+
+        let key_cnt = 10_000;
+        let keys: Vec<Vec<u8>> = (0..key_cnt * 2)
+            .map(|_| {
+                let mut key = vec![0u8; 32];
+                Crypto::random_buf(&mut key);
+                key
+            })
+            .collect();
+
+        let mut bloom = BloomFilter::new(key_cnt);
+        for key in keys[..key_cnt].iter() {
+            bloom.insert(key);
+        }
+
+        // no false negative
+        for key in keys[..key_cnt].iter() {
+            assert!(bloom.may_contain(key));
+        }
+
+        // false positive rate should be low
+        let fp = keys[key_cnt..]
+            .iter()
+            .filter(|key| bloom.may_contain(key))
+            .count();
+        assert!(fp < key_cnt / 50);
+
+        // empty filter contains anything
+        assert!(BloomFilter::default().may_contain(&keys[0]));
+    }
+}
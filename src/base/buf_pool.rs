@@ -0,0 +1,218 @@
+use std::fmt::{self, Debug};
+use std::ops::{Deref, DerefMut};
+use std::sync::atomic::{AtomicU64, Ordering};
+use std::sync::{Arc, Mutex};
+
+use base::crypto::Crypto;
+
+/// Buffer pool statistics
+///
+/// Counters are accumulated since the repository is opened.
+#[derive(Debug, Clone, Copy, Default)]
+pub struct BufPoolStats {
+    /// Number of buffers taken from the pool without allocation
+    pub hits: u64,
+
+    /// Number of buffers newly allocated because the pool was empty
+    pub allocs: u64,
+
+    /// Number of free buffers currently kept in the pool
+    pub free: usize,
+}
+
+impl BufPoolStats {
+    /// Returns the ratio of buffers reused from the pool
+    ///
+    /// It is 0.0 if no buffer is taken yet.
+    pub fn hit_ratio(&self) -> f64 {
+        let total = self.hits + self.allocs;
+        if total == 0 {
+            0.0
+        } else {
+            self.hits as f64 / total as f64
+        }
+    }
+}
+
+/// Fixed size buffer pool
+///
+/// Buffers are allocated with the same size and returned to the pool when
+/// they are dropped, so frequently created readers and writers don't need
+/// to allocate and page fault large buffers each time. The pool keeps at
+/// most `max_free` free buffers, extra buffers are released.
+///
+/// Buffers may hold decrypted content, so they are zeroed before going
+/// back to the pool or being released.
+pub struct BufPool {
+    buf_size: usize,
+    max_free: usize,
+    free: Mutex<Vec<Vec<u8>>>,
+    hits: AtomicU64,
+    allocs: AtomicU64,
+}
+
+impl BufPool {
+    pub fn new(buf_size: usize, max_free: usize) -> Arc<Self> {
+        Arc::new(BufPool {
+            buf_size,
+            max_free,
+            free: Mutex::new(Vec::new()),
+            hits: AtomicU64::new(0),
+            allocs: AtomicU64::new(0),
+        })
+    }
+
+    /// Take a buffer from pool and set its length
+    ///
+    /// The length must not be greater than pool buffer size. Content of
+    /// the buffer is always zeroed.
+    pub fn get(pool: &Arc<Self>, len: usize) -> PoolBuf {
+        let buf = pool.free.lock().unwrap().pop();
+        let buf = match buf {
+            Some(buf) => {
+                pool.hits.fetch_add(1, Ordering::Relaxed);
+                buf
+            }
+            None => {
+                pool.allocs.fetch_add(1, Ordering::Relaxed);
+                vec![0u8; pool.buf_size]
+            }
+        };
+        let mut buf = PoolBuf {
+            buf,
+            len: 0,
+            used: 0,
+            pool: pool.clone(),
+        };
+        buf.set_len(len);
+        buf
+    }
+
+    // put buffer back to pool, only its first `used` bytes can be non-zero
+    fn put(&self, mut buf: Vec<u8>, used: usize) {
+        Crypto::memzero(&mut buf[..used]);
+        let mut free = self.free.lock().unwrap();
+        if free.len() < self.max_free {
+            free.push(buf);
+        }
+    }
+
+    /// Get pool statistics
+    pub fn stats(&self) -> BufPoolStats {
+        BufPoolStats {
+            hits: self.hits.load(Ordering::Relaxed),
+            allocs: self.allocs.load(Ordering::Relaxed),
+            free: self.free.lock().unwrap().len(),
+        }
+    }
+}
+
+impl Debug for BufPool {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        f.debug_struct("BufPool")
+            .field("buf_size", &self.buf_size)
+            .field("max_free", &self.max_free)
+            .field("stats", &self.stats())
+            .finish()
+    }
+}
+
+/// Buffer borrowed from buffer pool
+///
+/// The underlying buffer always has the pool buffer size, only its first
+/// `len` bytes are used, so changing length doesn't need reallocation or
+/// zeroing. It is returned to the pool when dropped.
+pub struct PoolBuf {
+    buf: Vec<u8>,
+    len: usize,
+    used: usize, // the largest length ever set, to limit zeroing on drop
+    pool: Arc<BufPool>,
+}
+
+impl PoolBuf {
+    /// Set buffer length, it must not be greater than pool buffer size
+    #[inline]
+    pub fn set_len(&mut self, len: usize) {
+        assert!(len <= self.buf.len());
+        self.len = len;
+        self.used = self.used.max(len);
+    }
+
+    /// Get the underlying buffer size, which is the pool buffer size
+    #[inline]
+    pub fn capacity(&self) -> usize {
+        self.buf.len()
+    }
+}
+
+impl Deref for PoolBuf {
+    type Target = [u8];
+
+    #[inline]
+    fn deref(&self) -> &[u8] {
+        &self.buf[..self.len]
+    }
+}
+
+impl DerefMut for PoolBuf {
+    #[inline]
+    fn deref_mut(&mut self) -> &mut [u8] {
+        &mut self.buf[..self.len]
+    }
+}
+
+impl Drop for PoolBuf {
+    fn drop(&mut self) {
+        let buf = ::std::mem::replace(&mut self.buf, Vec::new());
+        self.pool.put(buf, self.used);
+    }
+}
+
+impl Debug for PoolBuf {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        f.debug_struct("PoolBuf").field("len", &self.len).finish()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn buf_pool() {
+        let pool = BufPool::new(16, 2);
+
+        // new buffers are allocated when pool is empty
+        let mut buf = BufPool::get(&pool, 16);
+        buf[0] = 42;
+        let buf2 = BufPool::get(&pool, 8);
+        let buf3 = BufPool::get(&pool, 0);
+        assert_eq!(buf2.len(), 8);
+        let stats = pool.stats();
+        assert_eq!(stats.allocs, 3);
+        assert_eq!(stats.hits, 0);
+
+        // only max_free buffers are kept after returned
+        drop(buf);
+        drop(buf2);
+        drop(buf3);
+        assert_eq!(pool.stats().free, 2);
+
+        // reuse returned buffers, which are zeroed
+        let mut buf = BufPool::get(&pool, 4);
+        assert_eq!(buf.len(), 4);
+        buf.set_len(16);
+        assert_eq!(buf.len(), 16);
+        assert_eq!(buf.capacity(), 16);
+        assert!(buf.iter().all(|b| *b == 0));
+        let buf2 = BufPool::get(&pool, 16);
+        assert!(buf2.iter().all(|b| *b == 0));
+        let stats = pool.stats();
+        assert_eq!(stats.hits, 2);
+        assert_eq!(stats.free, 0);
+        assert!((stats.hit_ratio() - 0.4).abs() < 1e-6);
+        drop(buf);
+        drop(buf2);
+        assert_eq!(pool.stats().free, 2);
+    }
+}
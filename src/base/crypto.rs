@@ -340,7 +340,9 @@ impl RandomSeed {
 /// Hash value
 pub const HASH_SIZE: usize = 32;
 
-#[derive(Clone, Default, Eq, PartialEq, Hash, Serialize, Deserialize)]
+#[derive(
+    Clone, Default, Eq, PartialEq, Ord, PartialOrd, Hash, Serialize, Deserialize,
+)]
 pub struct Hash([u8; HASH_SIZE]);
 
 impl Hash {
@@ -446,6 +448,20 @@ impl HashState {
     }
 }
 
+// hash state is plain data, so it can be duplicated by copying and the
+// copy can continue hashing independently
+impl Clone for HashState {
+    fn clone(&self) -> Self {
+        HashState { state: self.state }
+    }
+}
+
+impl Debug for HashState {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        write!(f, "HashState(..)")
+    }
+}
+
 /// Password hash operation limit.
 ///
 /// It represents a maximum amount of computations to perform. Higher level
@@ -816,6 +832,17 @@ impl Crypto {
         }
     }
 
+    /// Zero buffer content
+    ///
+    /// The zeroing is not optimised away even if the buffer is released
+    /// right after.
+    #[inline]
+    pub fn memzero(buf: &mut [u8]) {
+        unsafe {
+            sodium_memzero(buf.as_mut_ptr(), buf.len());
+        }
+    }
+
     /// Generate a random usize integer
     #[allow(dead_code)]
     pub fn random_usize() -> usize {
@@ -1242,4 +1269,55 @@ mod tests {
         }
         assert!(crypto.decrypt_with_ad(&ctxt, &key, &ad).is_err());
     }
+
+    #[cfg(feature = "test-perf")]
+    #[test]
+    fn bench_crypto() {
+        use base::bench::{Bench, Work};
+
+        Crypto::init().unwrap();
+        let bench = Bench::from_env();
+
+        const DATA_LEN: usize = 16 * 1024 * 1024;
+        const MSG_LEN: usize = 128 * 1024;
+        let mut data = vec![0u8; DATA_LEN];
+        Crypto::random_buf(&mut data);
+
+        // each thread processes its own share of data in messages
+        for &threads in bench.threads() {
+            let share = DATA_LEN / threads;
+            let work = Work::Bytes(share * threads);
+
+            bench.run_threads("hash", "none", threads, work, |idx| {
+                let mut state = Crypto::hash_init();
+                for msg in data[idx * share..(idx + 1) * share].chunks(MSG_LEN)
+                {
+                    Crypto::hash_update(&mut state, msg);
+                }
+                Crypto::hash_final(&mut state);
+            });
+
+            let mut ciphers = vec![("aead_xchacha", Cipher::Xchacha)];
+            if Crypto::is_aes_hardware_available() {
+                ciphers.push(("aead_aes", Cipher::Aes));
+            }
+            for &(name, cipher) in ciphers.iter() {
+                let crypto = Crypto::new(Cost::default(), cipher).unwrap();
+                let key = Key::new_empty();
+                bench.run_threads(name, "none", threads, work, |idx| {
+                    let mut ctxt = vec![0u8; crypto.encrypted_len(MSG_LEN)];
+                    let mut msg_out = vec![0u8; MSG_LEN];
+                    for msg in
+                        data[idx * share..(idx + 1) * share].chunks(MSG_LEN)
+                    {
+                        let len =
+                            crypto.encrypt_to(&mut ctxt, msg, &key).unwrap();
+                        crypto
+                            .decrypt_to(&mut msg_out, &ctxt[..len], &key)
+                            .unwrap();
+                    }
+                });
+            }
+        }
+    }
 }
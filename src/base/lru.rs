@@ -2,8 +2,11 @@ use std::borrow::Borrow;
 use std::fmt::{self, Debug};
 use std::hash::Hash;
 use std::marker::PhantomData;
+use std::sync::Arc;
 
-use linked_hash_map::{Entries, LinkedHashMap};
+use linked_hash_map::{Entries, Iter, Keys, LinkedHashMap};
+
+use super::metrics::CacheCounters;
 
 pub trait Meter<T> {
     fn measure(&self, item: &T) -> isize;
@@ -17,6 +20,9 @@ pub trait Pinnable<T> {
 }
 
 /// LRU
+///
+/// Lookups by `get_refresh` and evictions are counted if cache counters
+/// are set.
 #[derive(Clone, Default)]
 pub struct Lru<K, V, M, P>
 where
@@ -29,6 +35,7 @@ where
     map: LinkedHashMap<K, V>,
     meter: M,
     pin_ckr: P,
+    counters: Option<Arc<CacheCounters>>,
 }
 
 impl<K, V, M, P> Lru<K, V, M, P>
@@ -44,6 +51,25 @@ where
             map: LinkedHashMap::new(),
             meter: M::default(),
             pin_ckr: P::default(),
+            counters: None,
+        }
+    }
+
+    #[inline]
+    pub fn set_counters(&mut self, counters: &Arc<CacheCounters>) {
+        self.counters = Some(counters.clone());
+    }
+
+    #[inline]
+    pub fn has_counters(&self) -> bool {
+        self.counters.is_some()
+    }
+
+    // count a lookup not done by get_refresh as a miss
+    #[inline]
+    pub fn count_miss(&self) {
+        if let Some(ref counters) = self.counters {
+            counters.miss();
         }
     }
 
@@ -81,7 +107,25 @@ where
         K: Borrow<Q>,
         Q: Eq + Hash,
     {
-        self.map.get_refresh(k)
+        let ret = self.map.get_refresh(k);
+        if let Some(ref counters) = self.counters {
+            if ret.is_some() {
+                counters.hit();
+            } else {
+                counters.miss();
+            }
+        }
+        ret
+    }
+
+    #[inline]
+    pub fn iter(&self) -> Iter<K, V> {
+        self.map.iter()
+    }
+
+    #[inline]
+    pub fn keys(&self) -> Keys<K, V> {
+        self.map.keys()
     }
 
     #[inline]
@@ -110,6 +154,9 @@ where
             .and_then(|(_, ent)| Some(ent.remove()));
         if let Some(ref v) = ret {
             self.used = (self.used as isize - self.meter.measure(v)) as usize;
+            if let Some(ref counters) = self.counters {
+                counters.evict(1);
+            }
         }
         ret
     }
@@ -167,3 +214,35 @@ impl<T> Default for PinChecker<T> {
         }
     }
 }
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn lru_counters() {
+        let counters = Arc::new(CacheCounters::default());
+        let mut lru: Lru<usize, usize, CountMeter<usize>, PinChecker<usize>> =
+            Lru::new(2);
+        lru.insert(1, 1);
+        assert!(lru.get_refresh(&1).is_some());
+        assert!(!lru.has_counters());
+
+        lru.set_counters(&counters);
+        lru.insert(2, 2);
+        assert!(lru.get_refresh(&1).is_some());
+        assert!(lru.get_refresh(&2).is_some());
+        assert!(lru.get_refresh(&3).is_none());
+        lru.count_miss();
+
+        // least recently used item is evicted
+        lru.insert(3, 3);
+        assert!(!lru.contains_key(&1));
+        lru.remove(&2);
+
+        let stats = counters.snapshot();
+        assert_eq!(stats.hits, 2);
+        assert_eq!(stats.misses, 2);
+        assert_eq!(stats.evictions, 1);
+    }
+}
@@ -15,6 +15,9 @@ type c_void = std::ffi::c_void;
 #[allow(non_camel_case_types)]
 type c_char = std::os::raw::c_char;
 
+#[allow(non_camel_case_types)]
+type c_int = std::os::raw::c_int;
+
 #[allow(non_camel_case_types)]
 type c_uint = std::os::raw::c_uint;
 
@@ -328,6 +331,38 @@ extern "C" {
         srcSizePtr: &mut size_t,
         optionsPtr: *const LZ4FDecompressOptions,
     ) -> LZ4FErrorCode;
+
+    // int LZ4_compressBound(int inputSize);
+    pub fn LZ4_compressBound(inputSize: c_int) -> c_int;
+
+    // int LZ4_compress_fast(const char* src, char* dst, int srcSize,
+    //                       int dstCapacity, int acceleration);
+    pub fn LZ4_compress_fast(
+        src: *const u8,
+        dst: *mut u8,
+        srcSize: c_int,
+        dstCapacity: c_int,
+        acceleration: c_int,
+    ) -> c_int;
+
+    // int LZ4_compress_HC(const char* src, char* dst, int srcSize,
+    //                     int dstCapacity, int compressionLevel);
+    pub fn LZ4_compress_HC(
+        src: *const u8,
+        dst: *mut u8,
+        srcSize: c_int,
+        dstCapacity: c_int,
+        compressionLevel: c_int,
+    ) -> c_int;
+
+    // int LZ4_decompress_safe(const char* src, char* dst, int compressedSize,
+    //                         int dstCapacity);
+    pub fn LZ4_decompress_safe(
+        src: *const u8,
+        dst: *mut u8,
+        compressedSize: c_int,
+        dstCapacity: c_int,
+    ) -> c_int;
 }
 
 #[derive(Debug)]
@@ -369,6 +404,75 @@ pub fn check_error(code: LZ4FErrorCode) -> IoResult<usize> {
     Ok(code as usize)
 }
 
+/* =============================================
+ * Block
+ * ============================================= */
+
+// max level for high compression mode
+pub const HC_LEVEL_MAX: u32 = 12;
+
+/// Maximum compressed size of a block in worst case
+#[inline]
+pub fn compress_bound(len: usize) -> usize {
+    unsafe { LZ4_compressBound(len as c_int) as usize }
+}
+
+/// Compress a block into dst and return the compressed size
+///
+/// Level 0 uses the fast mode, others use the high compression mode. The
+/// dst should be at least `compress_bound(src.len())` long.
+pub fn compress_block(
+    src: &[u8],
+    dst: &mut [u8],
+    level: u32,
+) -> IoResult<usize> {
+    let len = unsafe {
+        if level == 0 {
+            LZ4_compress_fast(
+                src.as_ptr(),
+                dst.as_mut_ptr(),
+                src.len() as c_int,
+                dst.len() as c_int,
+                1,
+            )
+        } else {
+            LZ4_compress_HC(
+                src.as_ptr(),
+                dst.as_mut_ptr(),
+                src.len() as c_int,
+                dst.len() as c_int,
+                cmp::min(level, HC_LEVEL_MAX) as c_int,
+            )
+        }
+    };
+    if len <= 0 {
+        return Err(IoError::new(
+            ErrorKind::Other,
+            LZ4Error("block compression failed".to_string()),
+        ));
+    }
+    Ok(len as usize)
+}
+
+/// Decompress a block into dst and return the decompressed size
+pub fn decompress_block(src: &[u8], dst: &mut [u8]) -> IoResult<usize> {
+    let len = unsafe {
+        LZ4_decompress_safe(
+            src.as_ptr(),
+            dst.as_mut_ptr(),
+            src.len() as c_int,
+            dst.len() as c_int,
+        )
+    };
+    if len < 0 {
+        return Err(IoError::new(
+            ErrorKind::InvalidData,
+            LZ4Error("corrupted compressed block".to_string()),
+        ));
+    }
+    Ok(len as usize)
+}
+
 /* =============================================
  * Encoder
  * ============================================= */
@@ -566,6 +670,10 @@ struct DecoderContext {
     c: LZ4FDecompressionContext,
 }
 
+// decompression context is only used through &mut, so it is safe to share
+// its owner between threads
+unsafe impl Sync for DecoderContext {}
+
 pub struct Decoder<R> {
     c: DecoderContext,
     r: R,
@@ -0,0 +1,590 @@
+//! Runtime metrics
+//!
+//! Metrics are plain atomic counters and latency histograms updated on the
+//! hot paths with relaxed ordering, so they are always on. A snapshot of
+//! them can be taken at any time, counters in a snapshot are accumulated
+//! since the repository is opened.
+
+use std::fmt::{self, Debug};
+use std::sync::atomic::{AtomicBool, AtomicU64, Ordering};
+use std::sync::Arc;
+use std::time::{Duration, Instant};
+
+/// Cache statistics
+#[derive(Debug, Clone, Copy, Default)]
+pub struct CacheStats {
+    /// Number of lookups found in the cache
+    pub hits: u64,
+
+    /// Number of lookups not found in the cache
+    pub misses: u64,
+
+    /// Number of entries evicted to make room for new entries
+    pub evictions: u64,
+}
+
+impl CacheStats {
+    /// Returns the ratio of lookups found in the cache
+    ///
+    /// It is 0.0 if there is no lookup yet.
+    pub fn hit_ratio(&self) -> f64 {
+        let total = self.hits + self.misses;
+        if total == 0 {
+            0.0
+        } else {
+            self.hits as f64 / total as f64
+        }
+    }
+}
+
+/// Cache counters
+#[derive(Debug, Default)]
+pub struct CacheCounters {
+    hits: AtomicU64,
+    misses: AtomicU64,
+    evictions: AtomicU64,
+}
+
+impl CacheCounters {
+    #[inline]
+    pub fn hit(&self) {
+        self.hits.fetch_add(1, Ordering::Relaxed);
+    }
+
+    #[inline]
+    pub fn miss(&self) {
+        self.misses.fetch_add(1, Ordering::Relaxed);
+    }
+
+    #[inline]
+    pub fn evict(&self, cnt: usize) {
+        self.evictions.fetch_add(cnt as u64, Ordering::Relaxed);
+    }
+
+    pub fn snapshot(&self) -> CacheStats {
+        CacheStats {
+            hits: self.hits.load(Ordering::Relaxed),
+            misses: self.misses.load(Ordering::Relaxed),
+            evictions: self.evictions.load(Ordering::Relaxed),
+        }
+    }
+}
+
+/// Latency statistics
+///
+/// Percentiles are estimated from power-of-two buckets, so they are upper
+/// bounds within a factor of two of the real values. Mean and max are
+/// exact.
+#[derive(Debug, Clone, Copy, Default)]
+pub struct LatencyStats {
+    /// Number of recorded operations
+    pub count: u64,
+
+    /// Total time of all the recorded operations
+    pub total: Duration,
+
+    pub mean: Duration,
+    pub p50: Duration,
+    pub p90: Duration,
+    pub p99: Duration,
+    pub max: Duration,
+}
+
+// number of histogram buckets, bucket 0 is for zero and bucket i is for
+// values in [2^(i-1), 2^i)
+const BUCKETS: usize = 65;
+
+/// Latency histogram, values are in nanoseconds
+pub struct Histogram {
+    buckets: [AtomicU64; BUCKETS],
+    sum: AtomicU64,
+    max: AtomicU64,
+}
+
+impl Histogram {
+    pub fn new() -> Self {
+        #[allow(clippy::declare_interior_mutable_const)]
+        const ZERO: AtomicU64 = AtomicU64::new(0);
+        Histogram {
+            buckets: [ZERO; BUCKETS],
+            sum: AtomicU64::new(0),
+            max: AtomicU64::new(0),
+        }
+    }
+
+    #[inline]
+    fn bucket_of(ns: u64) -> usize {
+        64 - ns.leading_zeros() as usize
+    }
+
+    // the largest value in a bucket
+    #[inline]
+    fn bucket_bound(idx: usize) -> u64 {
+        if idx >= 64 {
+            u64::max_value()
+        } else {
+            (1u64 << idx) - 1
+        }
+    }
+
+    #[inline]
+    pub fn record(&self, dur: Duration) {
+        let ns = dur.as_secs() * 1_000_000_000 + u64::from(dur.subsec_nanos());
+        self.buckets[Self::bucket_of(ns)].fetch_add(1, Ordering::Relaxed);
+        self.sum.fetch_add(ns, Ordering::Relaxed);
+        self.max.fetch_max(ns, Ordering::Relaxed);
+    }
+
+    // record the time elapsed since the specified instant
+    #[inline]
+    pub fn record_since(&self, begin: Instant) {
+        self.record(begin.elapsed());
+    }
+
+    // record a batch of operations which took the specified duration in
+    // total, each operation is accounted with an equal share of it
+    pub fn record_batch(&self, dur: Duration, cnt: usize) {
+        if cnt == 0 {
+            return;
+        }
+        let ns = dur.as_secs() * 1_000_000_000 + u64::from(dur.subsec_nanos());
+        let each = ns / cnt as u64;
+        self.buckets[Self::bucket_of(each)]
+            .fetch_add(cnt as u64, Ordering::Relaxed);
+        self.sum.fetch_add(ns, Ordering::Relaxed);
+        self.max.fetch_max(each, Ordering::Relaxed);
+    }
+
+    pub fn snapshot(&self) -> LatencyStats {
+        let counts: Vec<u64> = self
+            .buckets
+            .iter()
+            .map(|b| b.load(Ordering::Relaxed))
+            .collect();
+        let count: u64 = counts.iter().sum();
+        if count == 0 {
+            return LatencyStats::default();
+        }
+        let sum = self.sum.load(Ordering::Relaxed);
+        let max = self.max.load(Ordering::Relaxed);
+
+        // find the bucket where the quantile falls in
+        let quantile = |q: f64| {
+            let rank = ((count as f64 * q).ceil() as u64).max(1);
+            let mut accum = 0;
+            for (idx, cnt) in counts.iter().enumerate() {
+                accum += cnt;
+                if accum >= rank {
+                    return Duration::from_nanos(
+                        Self::bucket_bound(idx).min(max),
+                    );
+                }
+            }
+            Duration::from_nanos(max)
+        };
+
+        LatencyStats {
+            count,
+            total: Duration::from_nanos(sum),
+            mean: Duration::from_nanos(sum / count),
+            p50: quantile(0.5),
+            p90: quantile(0.9),
+            p99: quantile(0.99),
+            max: Duration::from_nanos(max),
+        }
+    }
+}
+
+impl Default for Histogram {
+    #[inline]
+    fn default() -> Self {
+        Histogram::new()
+    }
+}
+
+impl Debug for Histogram {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        self.snapshot().fmt(f)
+    }
+}
+
+/// Storage operation
+#[derive(Debug, Clone, Copy)]
+pub enum StorageOp {
+    GetSuperBlock,
+    PutSuperBlock,
+    GetWal,
+    PutWal,
+    DelWal,
+    GetAddress,
+    PutAddress,
+    DelAddress,
+    GetBlocks,
+    PutBlocks,
+    DelBlocks,
+    Flush,
+}
+
+impl StorageOp {
+    const COUNT: usize = 12;
+}
+
+/// Underlying storage operation statistics
+///
+/// Batched block reads and writes are counted as one operation per block
+/// span, each accounted with an equal share of the batch latency.
+#[derive(Debug, Clone, Copy, Default)]
+pub struct StorageStats {
+    pub get_super_block: LatencyStats,
+    pub put_super_block: LatencyStats,
+    pub get_wal: LatencyStats,
+    pub put_wal: LatencyStats,
+    pub del_wal: LatencyStats,
+    pub get_address: LatencyStats,
+    pub put_address: LatencyStats,
+    pub del_address: LatencyStats,
+    pub get_blocks: LatencyStats,
+    pub put_blocks: LatencyStats,
+    pub del_blocks: LatencyStats,
+    pub flush: LatencyStats,
+}
+
+/// Encryption statistics
+#[derive(Debug, Clone, Copy, Default)]
+pub struct CryptoStats {
+    /// Number of plain bytes encrypted
+    pub encrypted_bytes: u64,
+
+    /// Number of plain bytes decrypted
+    pub decrypted_bytes: u64,
+}
+
+/// Deduplication statistics
+#[derive(Debug, Clone, Copy, Default)]
+pub struct DedupStats {
+    /// Number of written chunks found as duplicate
+    pub chunk_hits: u64,
+
+    /// Number of bytes in duplicate chunks, which are not stored again
+    pub chunk_bytes: u64,
+
+    /// Number of written file contents found as duplicate
+    pub content_hits: u64,
+}
+
+/// Storage index statistics
+///
+/// Only file storage and zbox storage use the index, all counters are
+/// zero for other storages.
+#[derive(Debug, Clone, Copy, Default)]
+pub struct IndexStats {
+    /// Number of address lookups
+    pub lookups: u64,
+
+    /// Total number of index tables probed by the lookups
+    pub tabs_probed: u64,
+
+    /// Number of finished level compactions
+    pub compactions: u64,
+}
+
+impl IndexStats {
+    /// Returns average number of index tables probed per lookup
+    pub fn tabs_per_lookup(&self) -> f64 {
+        if self.lookups == 0 {
+            0.0
+        } else {
+            self.tabs_probed as f64 / self.lookups as f64
+        }
+    }
+}
+
+/// Transaction statistics
+#[derive(Debug, Clone, Copy, Default)]
+pub struct TxStats {
+    pub begin: LatencyStats,
+    pub commit: LatencyStats,
+    pub abort: LatencyStats,
+}
+
+/// Repository open phase
+#[derive(Debug, Clone, Copy)]
+pub enum OpenPhase {
+    SuperBlock,
+    Storage,
+    Wal,
+    Store,
+    Root,
+    Total,
+}
+
+impl OpenPhase {
+    const COUNT: usize = 6;
+}
+
+/// Repository open statistics
+///
+/// All durations are zero if the repository is created rather than opened.
+#[derive(Debug, Clone, Copy, Default)]
+pub struct OpenStats {
+    /// Time to load super block, including password hashing
+    pub super_block: Duration,
+
+    /// Time to open storage and its index
+    pub storage: Duration,
+
+    /// Time to open transaction manager and recover from write ahead log
+    pub wal: Duration,
+
+    /// Time to load content store
+    pub store: Duration,
+
+    /// Time to load root directory
+    pub root: Duration,
+
+    /// Total time to open the repository
+    pub total: Duration,
+
+    /// Whether the password key was taken from the session key cache
+    pub key_cached: bool,
+}
+
+/// Metrics
+///
+/// Metrics are created with storage and shared by all the components
+/// using the same volume.
+#[derive(Debug, Default)]
+pub struct Metrics {
+    pub frame_cache: Arc<CacheCounters>,
+    pub addr_cache: Arc<CacheCounters>,
+    pub data_cache: Arc<CacheCounters>,
+    pub cow_cache: Arc<CacheCounters>,
+    pub local_cache: Arc<CacheCounters>,
+
+    encrypted_bytes: AtomicU64,
+    decrypted_bytes: AtomicU64,
+
+    chunk_dedup_hits: AtomicU64,
+    chunk_dedup_bytes: AtomicU64,
+    content_dedup_hits: AtomicU64,
+
+    index_lookups: AtomicU64,
+    index_tabs_probed: AtomicU64,
+    index_compactions: AtomicU64,
+
+    storage_ops: [Histogram; StorageOp::COUNT],
+
+    pub tx_begin: Histogram,
+    pub tx_commit: Histogram,
+    pub tx_abort: Histogram,
+
+    open_phases: [AtomicU64; OpenPhase::COUNT],
+    key_cached: AtomicBool,
+}
+
+impl Metrics {
+    #[inline]
+    pub fn new_ref() -> MetricsRef {
+        Arc::new(Metrics::default())
+    }
+
+    #[inline]
+    pub fn add_encrypted(&self, len: usize) {
+        self.encrypted_bytes
+            .fetch_add(len as u64, Ordering::Relaxed);
+    }
+
+    #[inline]
+    pub fn add_decrypted(&self, len: usize) {
+        self.decrypted_bytes
+            .fetch_add(len as u64, Ordering::Relaxed);
+    }
+
+    #[inline]
+    pub fn add_chunk_dedup(&self, len: usize) {
+        self.chunk_dedup_hits.fetch_add(1, Ordering::Relaxed);
+        self.chunk_dedup_bytes
+            .fetch_add(len as u64, Ordering::Relaxed);
+    }
+
+    #[inline]
+    pub fn add_content_dedup(&self) {
+        self.content_dedup_hits.fetch_add(1, Ordering::Relaxed);
+    }
+
+    // record an index lookup and number of tabs it probed
+    #[inline]
+    pub fn add_index_lookup(&self, tabs_probed: usize) {
+        self.index_lookups.fetch_add(1, Ordering::Relaxed);
+        self.index_tabs_probed
+            .fetch_add(tabs_probed as u64, Ordering::Relaxed);
+    }
+
+    #[inline]
+    pub fn add_index_compaction(&self) {
+        self.index_compactions.fetch_add(1, Ordering::Relaxed);
+    }
+
+    // record a storage operation started at the specified instant
+    #[inline]
+    pub fn record_storage_op(&self, op: StorageOp, begin: Instant) {
+        self.storage_ops[op as usize].record_since(begin);
+    }
+
+    // record a batched storage operation started at the specified instant
+    // as one operation per block span
+    #[inline]
+    pub fn record_storage_batch(
+        &self,
+        op: StorageOp,
+        begin: Instant,
+        spans: usize,
+    ) {
+        self.storage_ops[op as usize].record_batch(begin.elapsed(), spans);
+    }
+
+    // record an open phase started at the specified instant
+    #[inline]
+    pub fn record_open_phase(&self, phase: OpenPhase, begin: Instant) {
+        let dur = begin.elapsed();
+        let ns = dur.as_secs() * 1_000_000_000 + u64::from(dur.subsec_nanos());
+        self.open_phases[phase as usize].store(ns, Ordering::Relaxed);
+    }
+
+    #[inline]
+    pub fn set_key_cached(&self, key_cached: bool) {
+        self.key_cached.store(key_cached, Ordering::Relaxed);
+    }
+
+    pub fn crypto_stats(&self) -> CryptoStats {
+        CryptoStats {
+            encrypted_bytes: self.encrypted_bytes.load(Ordering::Relaxed),
+            decrypted_bytes: self.decrypted_bytes.load(Ordering::Relaxed),
+        }
+    }
+
+    pub fn dedup_stats(&self) -> DedupStats {
+        DedupStats {
+            chunk_hits: self.chunk_dedup_hits.load(Ordering::Relaxed),
+            chunk_bytes: self.chunk_dedup_bytes.load(Ordering::Relaxed),
+            content_hits: self.content_dedup_hits.load(Ordering::Relaxed),
+        }
+    }
+
+    pub fn index_stats(&self) -> IndexStats {
+        IndexStats {
+            lookups: self.index_lookups.load(Ordering::Relaxed),
+            tabs_probed: self.index_tabs_probed.load(Ordering::Relaxed),
+            compactions: self.index_compactions.load(Ordering::Relaxed),
+        }
+    }
+
+    pub fn storage_stats(&self) -> StorageStats {
+        let op = |op: StorageOp| self.storage_ops[op as usize].snapshot();
+        StorageStats {
+            get_super_block: op(StorageOp::GetSuperBlock),
+            put_super_block: op(StorageOp::PutSuperBlock),
+            get_wal: op(StorageOp::GetWal),
+            put_wal: op(StorageOp::PutWal),
+            del_wal: op(StorageOp::DelWal),
+            get_address: op(StorageOp::GetAddress),
+            put_address: op(StorageOp::PutAddress),
+            del_address: op(StorageOp::DelAddress),
+            get_blocks: op(StorageOp::GetBlocks),
+            put_blocks: op(StorageOp::PutBlocks),
+            del_blocks: op(StorageOp::DelBlocks),
+            flush: op(StorageOp::Flush),
+        }
+    }
+
+    pub fn open_stats(&self) -> OpenStats {
+        let phase = |phase: OpenPhase| {
+            Duration::from_nanos(
+                self.open_phases[phase as usize].load(Ordering::Relaxed),
+            )
+        };
+        OpenStats {
+            super_block: phase(OpenPhase::SuperBlock),
+            storage: phase(OpenPhase::Storage),
+            wal: phase(OpenPhase::Wal),
+            store: phase(OpenPhase::Store),
+            root: phase(OpenPhase::Root),
+            total: phase(OpenPhase::Total),
+            key_cached: self.key_cached.load(Ordering::Relaxed),
+        }
+    }
+
+    pub fn tx_stats(&self) -> TxStats {
+        TxStats {
+            begin: self.tx_begin.snapshot(),
+            commit: self.tx_commit.snapshot(),
+            abort: self.tx_abort.snapshot(),
+        }
+    }
+}
+
+/// Metrics reference type
+pub type MetricsRef = Arc<Metrics>;
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn histogram() {
+        let hist = Histogram::new();
+        assert_eq!(hist.snapshot().count, 0);
+
+        // 90 fast operations and 10 slow operations
+        for _ in 0..90 {
+            hist.record(Duration::from_nanos(100));
+        }
+        for _ in 0..10 {
+            hist.record(Duration::from_micros(100));
+        }
+        hist.record(Duration::from_nanos(0));
+
+        let stats = hist.snapshot();
+        assert_eq!(stats.count, 101);
+        assert_eq!(stats.max, Duration::from_micros(100));
+        assert_eq!(stats.total, Duration::from_nanos(90 * 100 + 1_000_000));
+        assert_eq!(stats.mean, Duration::from_nanos(9990));
+
+        // percentiles are upper bounds of power-of-two buckets
+        assert_eq!(stats.p50, Duration::from_nanos(127));
+        assert_eq!(stats.p90, Duration::from_nanos(127));
+        assert_eq!(stats.p99, Duration::from_micros(100));
+        assert!(stats.p50 >= Duration::from_nanos(100));
+    }
+
+    #[test]
+    fn cache_counters() {
+        let counters = CacheCounters::default();
+        counters.hit();
+        counters.hit();
+        counters.hit();
+        counters.miss();
+        counters.evict(2);
+        let stats = counters.snapshot();
+        assert_eq!(stats.hits, 3);
+        assert_eq!(stats.misses, 1);
+        assert_eq!(stats.evictions, 2);
+        assert!((stats.hit_ratio() - 0.75).abs() < 1e-6);
+        assert_eq!(CacheStats::default().hit_ratio(), 0.0);
+    }
+
+    #[test]
+    fn open_stats() {
+        let metrics = Metrics::default();
+        assert_eq!(metrics.open_stats().total, Duration::default());
+
+        let begin = Instant::now();
+        metrics.record_open_phase(OpenPhase::Store, begin);
+        metrics.record_open_phase(OpenPhase::Total, begin);
+        metrics.set_key_cached(true);
+        let stats = metrics.open_stats();
+        assert_eq!(stats.super_block, Duration::default());
+        assert!(stats.total >= stats.store);
+        assert!(stats.key_cached);
+    }
+}
@@ -1,10 +1,19 @@
 //! base module document
 //!
 
+#[cfg(feature = "test-perf")]
+pub mod bench;
+pub(crate) mod bloom;
+pub(crate) mod buf_pool;
 pub(crate) mod crypto;
 pub(crate) mod lru;
+// lz4 stream encoder is not used for writing any more, it is kept for
+// testing entities written in the legacy lz4 stream format
+#[allow(dead_code)]
 pub(crate) mod lz4;
+pub(crate) mod metrics;
 mod refcnt;
+pub(crate) mod thread_pool;
 mod time;
 pub(crate) mod utils;
 pub(crate) mod version;
@@ -0,0 +1,152 @@
+use std::fmt::{self, Debug};
+use std::sync::mpsc::{channel, Receiver, Sender};
+use std::sync::{Arc, Mutex};
+use std::thread::{self, Builder, JoinHandle};
+
+use error::Result;
+
+// job running in thread pool
+type Job = Box<dyn FnOnce() + Send + 'static>;
+
+/// Thread pool
+///
+/// A fixed number of worker threads which run jobs in background. All the
+/// pending jobs will be finished before the pool is dropped.
+pub struct ThreadPool {
+    name: String,
+    sender: Option<Mutex<Sender<Job>>>,
+    workers: Vec<JoinHandle<()>>,
+}
+
+impl ThreadPool {
+    pub fn new(name: &str, size: usize) -> Result<Self> {
+        assert!(size > 0);
+
+        let (sender, receiver) = channel::<Job>();
+        let receiver = Arc::new(Mutex::new(receiver));
+        let mut workers = Vec::with_capacity(size);
+
+        for idx in 0..size {
+            let receiver = receiver.clone();
+            let worker = Builder::new()
+                .name(format!("{}-{}", name, idx))
+                .spawn(move || Self::run(&receiver))?;
+            workers.push(worker);
+        }
+
+        Ok(ThreadPool {
+            name: name.to_string(),
+            sender: Some(Mutex::new(sender)),
+            workers,
+        })
+    }
+
+    // worker thread loop, exit when the pool is dropped
+    fn run(receiver: &Mutex<Receiver<Job>>) {
+        loop {
+            let job = {
+                let receiver = receiver.lock().unwrap();
+                receiver.recv()
+            };
+            match job {
+                Ok(job) => job(),
+                Err(_) => break,
+            }
+        }
+    }
+
+    #[inline]
+    pub fn size(&self) -> usize {
+        self.workers.len()
+    }
+
+    /// Send a job to the pool, it will be run by one of the workers
+    pub fn execute<F>(&self, job: F)
+    where
+        F: FnOnce() + Send + 'static,
+    {
+        if let Some(ref sender) = self.sender {
+            let sender = sender.lock().unwrap();
+            if sender.send(Box::new(job)).is_err() {
+                warn!("thread pool {} has no worker", self.name);
+            }
+        }
+    }
+}
+
+impl ThreadPool {
+    /// Send a job to the pool and return the receiver of its result
+    pub fn submit<F, T>(&self, job: F) -> JobResult<T>
+    where
+        F: FnOnce() -> T + Send + 'static,
+        T: Send + 'static,
+    {
+        let (tx, rx) = channel();
+        self.execute(move || {
+            let _ = tx.send(job());
+        });
+        JobResult(rx)
+    }
+}
+
+/// Result of a job sent to thread pool
+///
+/// The result can only be received through `&mut`, so unlike the channel
+/// receiver it is safe to share between threads.
+pub struct JobResult<T>(Receiver<T>);
+
+unsafe impl<T: Send> Sync for JobResult<T> {}
+
+impl<T> JobResult<T> {
+    /// Wait for the job result, return `None` if the job failed
+    #[inline]
+    pub fn wait(&mut self) -> Option<T> {
+        self.0.recv().ok()
+    }
+}
+
+impl Drop for ThreadPool {
+    fn drop(&mut self) {
+        // close job channel and wait for all workers to exit, the pool
+        // could be dropped by a job holding its last owner, in that case the
+        // worker itself cannot be joined and it will exit after the job
+        self.sender.take();
+        let curr = thread::current().id();
+        for worker in self.workers.drain(..) {
+            if worker.thread().id() != curr {
+                let _ = worker.join();
+            }
+        }
+    }
+}
+
+impl Debug for ThreadPool {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        f.debug_struct("ThreadPool")
+            .field("name", &self.name)
+            .field("size", &self.size())
+            .finish()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::sync::atomic::{AtomicUsize, Ordering};
+
+    #[test]
+    fn thread_pool() {
+        let cnt = Arc::new(AtomicUsize::new(0));
+        {
+            let pool = ThreadPool::new("test", 4).unwrap();
+            assert_eq!(pool.size(), 4);
+            for _ in 0..100 {
+                let cnt = cnt.clone();
+                pool.execute(move || {
+                    cnt.fetch_add(1, Ordering::SeqCst);
+                });
+            }
+        }
+        assert_eq!(cnt.load(Ordering::SeqCst), 100);
+    }
+}
@@ -2,6 +2,7 @@ use std::time::Duration;
 
 #[cfg(any(
     feature = "storage-file",
+    feature = "storage-sqlite",
     all(feature = "storage-zbox", not(target_arch = "wasm32"))
 ))]
 use error::{Error, Result};
@@ -100,3 +101,41 @@ pub fn remove_empty_parent_dir(path: &std::path::Path) -> Result<()> {
     }
     Ok(())
 }
+
+/// Split storage location into path and its trailing option query
+///
+/// Path can contain '?', so only the query after the last '?' whose keys
+/// are all in `keys` is split out, otherwise the whole location is the
+/// path. If the query looks like options but has unknown keys, it is
+/// rejected when some of its keys are known as it must be mistyped, or a
+/// warning is logged otherwise.
+#[cfg(any(feature = "storage-file", feature = "storage-sqlite"))]
+pub fn split_loc_query<'a>(
+    loc: &'a str,
+    keys: &[&str],
+) -> Result<(&'a str, &'a str)> {
+    let idx = match loc.rfind('?') {
+        Some(idx) => idx,
+        None => return Ok((loc, "")),
+    };
+    let query = &loc[idx + 1..];
+    let params: Vec<&str> =
+        query.split('&').filter(|param| !param.is_empty()).collect();
+    let is_known =
+        |param: &&str| keys.contains(&param.split('=').next().unwrap());
+
+    if params.iter().all(is_known) {
+        return Ok((&loc[..idx], query));
+    }
+
+    if params
+        .iter()
+        .all(|param| param.find('=').map_or(false, |idx| idx > 0))
+    {
+        if params.iter().any(is_known) {
+            return Err(Error::InvalidUri);
+        }
+        warn!("unknown options '{}' are used as part of the path", query);
+    }
+    Ok((loc, ""))
+}
@@ -6,3 +6,158 @@ pub use std::fs::{
     copy, create_dir, create_dir_all, metadata, read_dir, remove_dir,
     remove_dir_all, remove_file, rename, File, OpenOptions, ReadDir,
 };
+
+#[cfg(feature = "storage-file")]
+pub use self::positional::{read_exact_at, write_all_at};
+
+#[cfg(all(unix, feature = "storage-file"))]
+pub use self::mmap::Mmap;
+
+// positional read and write, they don't use or change file cursor so the
+// same file can be read by multiple threads concurrently
+#[cfg(all(unix, feature = "storage-file"))]
+mod positional {
+    use std::fs::File;
+    use std::io::Result;
+    use std::os::unix::fs::FileExt;
+
+    #[inline]
+    pub fn read_exact_at(
+        file: &File,
+        buf: &mut [u8],
+        offset: u64,
+    ) -> Result<()> {
+        file.read_exact_at(buf, offset)
+    }
+
+    #[inline]
+    pub fn write_all_at(file: &File, buf: &[u8], offset: u64) -> Result<()> {
+        file.write_all_at(buf, offset)
+    }
+}
+
+#[cfg(all(windows, feature = "storage-file"))]
+mod positional {
+    use std::fs::File;
+    use std::io::{Error, ErrorKind, Result};
+    use std::os::windows::fs::FileExt;
+
+    pub fn read_exact_at(
+        file: &File,
+        mut buf: &mut [u8],
+        mut offset: u64,
+    ) -> Result<()> {
+        while !buf.is_empty() {
+            match file.seek_read(buf, offset) {
+                Ok(0) => {
+                    return Err(Error::new(
+                        ErrorKind::UnexpectedEof,
+                        "failed to fill whole buffer",
+                    ));
+                }
+                Ok(n) => {
+                    let tmp = buf;
+                    buf = &mut tmp[n..];
+                    offset += n as u64;
+                }
+                Err(ref err) if err.kind() == ErrorKind::Interrupted => {}
+                Err(err) => return Err(err),
+            }
+        }
+        Ok(())
+    }
+
+    pub fn write_all_at(
+        file: &File,
+        mut buf: &[u8],
+        mut offset: u64,
+    ) -> Result<()> {
+        while !buf.is_empty() {
+            match file.seek_write(buf, offset) {
+                Ok(0) => {
+                    return Err(Error::new(
+                        ErrorKind::WriteZero,
+                        "failed to write whole buffer",
+                    ));
+                }
+                Ok(n) => {
+                    buf = &buf[n..];
+                    offset += n as u64;
+                }
+                Err(ref err) if err.kind() == ErrorKind::Interrupted => {}
+                Err(err) => return Err(err),
+            }
+        }
+        Ok(())
+    }
+}
+
+// read-only memory map of a whole file
+#[cfg(all(unix, feature = "storage-file"))]
+mod mmap {
+    use std::fs::File;
+    use std::io::{Error, ErrorKind, Result};
+    use std::ops::Deref;
+    use std::os::unix::io::AsRawFd;
+    use std::ptr;
+    use std::slice;
+
+    use libc;
+
+    /// Read-only memory map
+    ///
+    /// The file must not be truncated while it is mapped.
+    pub struct Mmap {
+        ptr: *mut libc::c_void,
+        len: usize,
+    }
+
+    impl Mmap {
+        pub fn map(file: &File) -> Result<Self> {
+            let len = file.metadata()?.len() as usize;
+            if len == 0 {
+                return Err(Error::new(
+                    ErrorKind::InvalidInput,
+                    "cannot map empty file",
+                ));
+            }
+
+            let ptr = unsafe {
+                libc::mmap(
+                    ptr::null_mut(),
+                    len,
+                    libc::PROT_READ,
+                    libc::MAP_SHARED,
+                    file.as_raw_fd(),
+                    0,
+                )
+            };
+            if ptr == libc::MAP_FAILED {
+                return Err(Error::last_os_error());
+            }
+
+            Ok(Mmap { ptr, len })
+        }
+    }
+
+    impl Deref for Mmap {
+        type Target = [u8];
+
+        #[inline]
+        fn deref(&self) -> &[u8] {
+            unsafe { slice::from_raw_parts(self.ptr as *const u8, self.len) }
+        }
+    }
+
+    impl Drop for Mmap {
+        fn drop(&mut self) {
+            unsafe {
+                libc::munmap(self.ptr, self.len);
+            }
+        }
+    }
+
+    // the mapped memory is read-only, so it is safe to be shared
+    unsafe impl Send for Mmap {}
+    unsafe impl Sync for Mmap {}
+}
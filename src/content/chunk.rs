@@ -1,11 +1,16 @@
+use std::collections::BTreeMap;
 use std::fmt::{self, Debug};
+use std::mem;
 
 use linked_hash_map::LinkedHashMap;
 
+use base::bloom::BloomFilter;
 use base::crypto::Hash;
 use base::RefCnt;
 use error::Result;
-use trans::Eid;
+use trans::cow::{CowCache, CowRef, Cowable, IntoCow};
+use trans::{Eid, Id, TxMgrRef};
+use volume::VolumeRef;
 
 /// Data chunk
 #[derive(Clone, Deserialize, Serialize)]
@@ -13,14 +18,19 @@ pub struct Chunk {
     pub(super) pos: usize, // chunk start position in segment data
     pub(super) len: usize, // chunk length, in bytes
     refcnt: RefCnt,
+
+    // chunk data hash, only kept when the chunk is in repo-wide chunk index
+    #[serde(default)]
+    pub(super) hash: Option<Hash>,
 }
 
 impl Chunk {
-    pub fn new(pos: usize, len: usize) -> Self {
+    pub fn new(pos: usize, len: usize, hash: Option<&Hash>) -> Self {
         Chunk {
             pos,
             len,
             refcnt: RefCnt::new(),
+            hash: hash.cloned(),
         }
     }
 
@@ -58,7 +68,9 @@ impl Debug for Chunk {
 }
 
 /// Chunk location
-#[derive(Debug, Hash, Eq, PartialEq, Deserialize, Serialize)]
+#[derive(
+    Debug, Clone, Default, Hash, Eq, PartialEq, Deserialize, Serialize,
+)]
 pub struct ChunkLoc {
     pub(super) seg_id: Eid,
     pub(super) idx: usize, // index in segment chunk list
@@ -99,6 +111,11 @@ impl ChunkMap {
         }
     }
 
+    #[inline]
+    pub fn is_enabled(&self) -> bool {
+        self.is_enabled
+    }
+
     pub fn get_refresh(&mut self, hash: &Hash) -> Option<ChunkLoc> {
         if !self.is_enabled {
             return None;
@@ -182,3 +199,296 @@ impl Debug for ChunkMap {
             .finish()
     }
 }
+
+/// Chunk index table
+///
+/// An immutable table of chunk index entries sorted by chunk hash.
+#[derive(Debug, Default, Clone, Deserialize, Serialize)]
+pub struct ChunkTab {
+    // empty location is deletion mark
+    items: Vec<(Hash, Option<ChunkLoc>)>,
+}
+
+impl ChunkTab {
+    #[inline]
+    fn len(&self) -> usize {
+        self.items.len()
+    }
+
+    fn search(&self, hash: &Hash) -> Option<&Option<ChunkLoc>> {
+        self.items
+            .binary_search_by(|item| item.0.cmp(hash))
+            .map(|idx| &self.items[idx].1)
+            .ok()
+    }
+
+    // sorted merge with an older table, items in self take precedence,
+    // deletion marks are dropped if there is no older table anymore
+    fn merge(&self, older: &ChunkTab, is_bottom: bool) -> ChunkTab {
+        let mut items = Vec::with_capacity(self.len() + older.len());
+        let (mut i, mut j) = (0, 0);
+
+        while i < self.len() || j < older.len() {
+            let item = if j >= older.len()
+                || (i < self.len() && self.items[i].0 <= older.items[j].0)
+            {
+                if j < older.len() && self.items[i].0 == older.items[j].0 {
+                    j += 1;
+                }
+                i += 1;
+                &self.items[i - 1]
+            } else {
+                j += 1;
+                &older.items[j - 1]
+            };
+
+            if !is_bottom || item.1.is_some() {
+                items.push(item.clone());
+            }
+        }
+
+        ChunkTab { items }
+    }
+}
+
+impl Cowable for ChunkTab {}
+
+impl<'de> IntoCow<'de> for ChunkTab {}
+
+// chunk index table info, kept in memory
+#[derive(Debug, Clone, Deserialize, Serialize)]
+struct ChunkTabInfo {
+    id: Eid,
+    begin: Hash,
+    end: Hash,
+    cnt: usize,
+    bloom: BloomFilter,
+}
+
+impl ChunkTabInfo {
+    fn new(id: &Eid, tab: &ChunkTab) -> Self {
+        let mut bloom = BloomFilter::new(tab.len());
+        for item in tab.items.iter() {
+            bloom.insert(&item.0);
+        }
+        ChunkTabInfo {
+            id: id.clone(),
+            begin: tab.items.first().unwrap().0.clone(),
+            end: tab.items.last().unwrap().0.clone(),
+            cnt: tab.len(),
+            bloom,
+        }
+    }
+
+    #[inline]
+    fn may_contain(&self, hash: &Hash) -> bool {
+        self.begin <= *hash && *hash <= self.end && self.bloom.may_contain(hash)
+    }
+}
+
+/// Repo-wide chunk index, used for chunk dedup across files
+///
+/// This is a simplified log structured merge tree. New entries are put in
+/// a memory table first, which is saved along with the index. When it is
+/// full, it is written out as a sorted table and merged with the older
+/// tables which are not larger than it, so there are only logarithmic
+/// number of tables. Each table has a bloom filter kept in memory, thus
+/// most of the misses don't need to load any table.
+///
+/// The index is a separate entity from the store, so saving the store does
+/// not write out the index and its bloom filters again.
+///
+/// Entries are not removed when chunks are retired, they should be validated
+/// against the chunk hash kept in segment when found.
+#[derive(Default, Clone, Deserialize, Serialize)]
+pub struct ChunkIndex {
+    // empty location is deletion mark
+    memtab: BTreeMap<Hash, Option<ChunkLoc>>,
+
+    // tables info, from old to new
+    tabs: Vec<ChunkTabInfo>,
+
+    is_enabled: bool,
+
+    #[serde(skip_serializing, skip_deserializing, default)]
+    tab_cache: CowCache<ChunkTab>,
+}
+
+impl ChunkIndex {
+    // max number of entries in memory table
+    const MEMTAB_CAPACITY: usize = 1024;
+
+    // table cache size
+    const TAB_CACHE_SIZE: usize = 8;
+
+    pub fn new(is_enabled: bool) -> Self {
+        ChunkIndex {
+            memtab: BTreeMap::new(),
+            tabs: Vec::new(),
+            is_enabled,
+            tab_cache: CowCache::new(Self::TAB_CACHE_SIZE),
+        }
+    }
+
+    #[inline]
+    pub fn is_enabled(&self) -> bool {
+        self.is_enabled
+    }
+
+    #[inline]
+    pub fn init_cache(&mut self) {
+        self.tab_cache = CowCache::new(Self::TAB_CACHE_SIZE);
+    }
+
+    pub fn get(
+        &self,
+        hash: &Hash,
+        vol: &VolumeRef,
+    ) -> Result<Option<ChunkLoc>> {
+        if let Some(loc) = self.memtab.get(hash) {
+            return Ok(loc.clone());
+        }
+
+        for tab_info in self.tabs.iter().rev().filter(|t| t.may_contain(hash)) {
+            let tab_ref = self.tab_cache.get(&tab_info.id, vol)?;
+            let tab = tab_ref.read().unwrap();
+            if let Some(loc) = tab.search(hash) {
+                return Ok(loc.clone());
+            }
+        }
+
+        Ok(None)
+    }
+
+    // insert an entry, empty location will remove the entry
+    pub fn insert(
+        &mut self,
+        hash: &Hash,
+        loc: Option<ChunkLoc>,
+        txmgr: &TxMgrRef,
+        vol: &VolumeRef,
+    ) -> Result<()> {
+        if !self.is_enabled {
+            return Ok(());
+        }
+        self.memtab.insert(hash.clone(), loc);
+        if self.memtab.len() >= Self::MEMTAB_CAPACITY {
+            self.flush_memtab(txmgr, vol)?;
+        }
+        Ok(())
+    }
+
+    // write memory table out as a new table and merge older tables into it
+    fn flush_memtab(
+        &mut self,
+        txmgr: &TxMgrRef,
+        vol: &VolumeRef,
+    ) -> Result<()> {
+        let memtab = mem::replace(&mut self.memtab, BTreeMap::new());
+        let mut tab = ChunkTab {
+            items: memtab.into_iter().collect(),
+        };
+
+        while self.tabs.last().map_or(false, |t| t.cnt <= tab.len()) {
+            let tab_info = self.tabs.pop().unwrap();
+            let older_ref = self.tab_cache.get(&tab_info.id, vol)?;
+            let mut older = older_ref.write().unwrap();
+            tab = tab.merge(&older, self.tabs.is_empty());
+            older.make_del(txmgr)?;
+            self.tab_cache.remove(&tab_info.id);
+        }
+
+        if self.tabs.is_empty() {
+            tab.items.retain(|item| item.1.is_some());
+        }
+        if tab.items.is_empty() {
+            return Ok(());
+        }
+
+        let tab_ref = tab.into_cow(txmgr)?;
+        {
+            let tab = tab_ref.read().unwrap();
+            debug!(
+                "chunk index table created: {:?}, len: {}",
+                tab.id(),
+                tab.len()
+            );
+            self.tabs.push(ChunkTabInfo::new(tab.id(), &tab));
+        }
+        self.tab_cache.insert(&tab_ref);
+
+        Ok(())
+    }
+}
+
+impl Debug for ChunkIndex {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        f.debug_struct("ChunkIndex")
+            .field("memtab_len", &self.memtab.len())
+            .field("tabs", &self.tabs.len())
+            .field("is_enabled", &self.is_enabled)
+            .finish()
+    }
+}
+
+impl Cowable for ChunkIndex {}
+
+impl<'de> IntoCow<'de> for ChunkIndex {}
+
+/// Chunk index reference type
+pub type ChunkIndexRef = CowRef<ChunkIndex>;
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use base::crypto::Crypto;
+    use base::init_env;
+
+    fn tab_of(items: &[(u8, Option<usize>)]) -> ChunkTab {
+        let seg_id = Eid::new();
+        ChunkTab {
+            items: items
+                .iter()
+                .map(|&(h, idx)| {
+                    (
+                        Crypto::hash(&[h]),
+                        idx.map(|idx| ChunkLoc {
+                            seg_id: seg_id.clone(),
+                            idx,
+                        }),
+                    )
+                })
+                .collect(),
+        }
+    }
+
+    fn sorted(mut tab: ChunkTab) -> ChunkTab {
+        tab.items.sort_by(|a, b| a.0.cmp(&b.0));
+        tab
+    }
+
+    #[test]
+    fn chunk_tab_merge() {
+        init_env();
+
+        let newer = sorted(tab_of(&[(1, Some(10)), (2, None), (3, Some(30))]));
+        let older = sorted(tab_of(&[(1, Some(1)), (2, Some(2)), (4, Some(4))]));
+        let h = |b: u8| Crypto::hash(&[b]);
+
+        let merged = newer.merge(&older, false);
+        assert_eq!(merged.len(), 4);
+        assert_eq!(merged.search(&h(1)).unwrap().as_ref().unwrap().idx, 10);
+        assert!(merged.search(&h(2)).unwrap().is_none());
+        assert_eq!(merged.search(&h(3)).unwrap().as_ref().unwrap().idx, 30);
+        assert_eq!(merged.search(&h(4)).unwrap().as_ref().unwrap().idx, 4);
+        assert!(merged.search(&h(5)).is_none());
+        for pair in merged.items.windows(2) {
+            assert!(pair[0].0 < pair[1].0);
+        }
+
+        // deletion marks are dropped at bottom
+        let merged = newer.merge(&older, true);
+        assert_eq!(merged.len(), 3);
+        assert!(merged.search(&h(2)).is_none());
+    }
+}
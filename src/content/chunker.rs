@@ -1,4 +1,4 @@
-use std::cmp::min;
+use std::cmp::{max, min};
 use std::fmt::{self, Debug};
 use std::io::{Result as IoResult, Seek, SeekFrom, Write};
 use std::ptr;
@@ -28,17 +28,117 @@ const WIN_SLIDE_POS: usize = MIN_SIZE - WIN_SLIDE_OFFSET;
 // writer buffer length
 const WTR_BUF_LEN: usize = 8 * MAX_SIZE;
 
+// FastCDC chunk size limits
+const FASTCDC_MIN_SIZE: usize = 64; // must not be smaller than gear window
+const FASTCDC_MAX_SIZE: usize = 1024 * 1024;
+
+lazy_static! {
+    // gear hash table, generated by splitmix64 with a fixed seed so chunk
+    // cut points are stable across runs
+    static ref GEAR: [u64; 256] = {
+        let mut gear = [0u64; 256];
+        let mut seed = 0x2545_f491_4f6c_dd1du64;
+        for val in gear.iter_mut() {
+            seed = seed.wrapping_add(0x9e37_79b9_7f4a_7c15);
+            let mut z = seed;
+            z = (z ^ (z >> 30)).wrapping_mul(0xbf58_476d_1ce4_e5b9);
+            z = (z ^ (z >> 27)).wrapping_mul(0x94d0_49bb_1331_11eb);
+            *val = z ^ (z >> 31);
+        }
+        gear
+    };
+
+    // gear hash table left shifted by one bit, used for rolling two bytes
+    // in one step
+    static ref GEAR_LS: [u64; 256] = {
+        let mut gear_ls = [0u64; 256];
+        for (val, gear) in gear_ls.iter_mut().zip(GEAR.iter()) {
+            *val = gear << 1;
+        }
+        gear_ls
+    };
+}
+
+/// Content chunking algorithm.
+///
+/// File content is split into variable-length chunks, which are the units
+/// of deduplication and storage.
+#[derive(Debug, Clone, Copy, PartialEq, Deserialize, Serialize)]
+pub enum Chunking {
+    /// Rabin rolling hash, chunk size is 16 KiB minimum, 32 KiB average and
+    /// 64 KiB maximum.
+    Rabin,
+
+    /// Gear hash based FastCDC with normalized chunking.
+    ///
+    /// `avg_size` must be power of 2, and `min_size < avg_size < max_size`.
+    /// `min_size` must be at least 64 bytes, `max_size` must be no more than
+    /// 1 MiB.
+    FastCdc {
+        min_size: usize,
+        avg_size: usize,
+        max_size: usize,
+    },
+}
+
+impl Chunking {
+    /// FastCDC with the same chunk sizes as Rabin.
+    pub fn fastcdc() -> Self {
+        Chunking::FastCdc {
+            min_size: MIN_SIZE,
+            avg_size: AVG_SIZE,
+            max_size: MAX_SIZE,
+        }
+    }
+
+    pub(crate) fn is_valid(&self) -> bool {
+        match *self {
+            Chunking::Rabin => true,
+            Chunking::FastCdc {
+                min_size,
+                avg_size,
+                max_size,
+            } => {
+                min_size >= FASTCDC_MIN_SIZE
+                    && min_size < avg_size
+                    && avg_size < max_size
+                    && max_size <= FASTCDC_MAX_SIZE
+                    && avg_size.is_power_of_two()
+            }
+        }
+    }
+}
+
+impl Default for Chunking {
+    #[inline]
+    fn default() -> Self {
+        Chunking::Rabin
+    }
+}
+
 /// Pre-calculated chunker parameters
 #[derive(Clone, Deserialize, Serialize)]
 pub struct ChunkerParams {
     poly_pow: u64,     // poly power
     out_map: Vec<u64>, // pre-computed out byte map, length is 256
     ir: Vec<u64>,      // irreducible polynomial, length is 256
+
+    // chunking algorithm, Rabin if it is not present
+    #[serde(default)]
+    chunking: Chunking,
 }
 
 impl ChunkerParams {
-    pub fn new() -> Self {
+    pub fn new(chunking: Chunking) -> Self {
         let mut cp = ChunkerParams::default();
+        cp.chunking = chunking;
+
+        // Rabin tables are not needed by FastCDC
+        if chunking != Chunking::Rabin {
+            cp.out_map.clear();
+            cp.ir.clear();
+            return cp;
+        }
 
         // calculate poly power, it is actually PRIME ^ WIN_SIZE
         for _ in 0..WIN_SIZE {
@@ -67,7 +167,7 @@ impl ChunkerParams {
 
 impl Debug for ChunkerParams {
     fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
-        write!(f, "ChunkerParams()")
+        write!(f, "ChunkerParams({:?})", self.chunking)
     }
 }
 
@@ -77,6 +177,7 @@ impl Default for ChunkerParams {
             poly_pow: 1,
             out_map: vec![0u64; 256],
             ir: vec![0u64; 256],
+            chunking: Chunking::default(),
         };
         ret.out_map.shrink_to_fit();
         ret.ir.shrink_to_fit();
@@ -84,29 +185,128 @@ impl Default for ChunkerParams {
     }
 }
 
+// FastCDC cut point finder
+//
+// Gear hash bit k only depends on the last k + 1 bytes, so the masks are
+// placed on the high bits below the top bit. Keeping the top bit out of
+// masks allows rolling two bytes in one step with the left shifted gear
+// table, which gives the same cut points as rolling byte by byte.
+#[derive(Debug, Clone, Copy)]
+struct FastCdc {
+    min_size: usize,
+    avg_size: usize,
+    max_size: usize,
+    mask_s: u64, // harder mask used before average size
+    mask_l: u64, // easier mask used after average size
+}
+
+impl FastCdc {
+    fn new(min_size: usize, avg_size: usize, max_size: usize) -> Self {
+        let bits = avg_size.trailing_zeros();
+        FastCdc {
+            min_size,
+            avg_size,
+            max_size,
+            mask_s: Self::mask(bits + 2),
+            mask_l: Self::mask(bits - 2),
+        }
+    }
+
+    #[inline]
+    fn mask(bits: u32) -> u64 {
+        ((1u64 << bits) - 1) << (63 - bits)
+    }
+
+    // roll gear hash over data, return index of the byte where hash
+    // matches the mask
+    #[inline]
+    fn roll(hash: &mut u64, data: &[u8], mask: u64) -> Option<usize> {
+        let (gear, gear_ls): (&[u64; 256], &[u64; 256]) = (&GEAR, &GEAR_LS);
+        let mask_ls = mask << 1;
+        let mut pairs = data.chunks_exact(2);
+
+        for (idx, pair) in pairs.by_ref().enumerate() {
+            *hash = (*hash << 2).wrapping_add(gear_ls[pair[0] as usize]);
+            if *hash & mask_ls == 0 {
+                return Some(idx * 2);
+            }
+            *hash = hash.wrapping_add(gear[pair[1] as usize]);
+            if *hash & mask == 0 {
+                return Some(idx * 2 + 1);
+            }
+        }
+
+        if let Some(&ch) = pairs.remainder().first() {
+            *hash = (*hash << 1).wrapping_add(gear[ch as usize]);
+            if *hash & mask == 0 {
+                return Some(data.len() - 1);
+            }
+        }
+
+        None
+    }
+
+    // find cut point in data and return the chunk length
+    fn cut(&self, data: &[u8]) -> usize {
+        let len = min(data.len(), self.max_size);
+        if len <= self.min_size {
+            return len;
+        }
+        let normal = min(len, self.avg_size);
+        let mut hash = 0u64;
+
+        if let Some(idx) =
+            Self::roll(&mut hash, &data[self.min_size..normal], self.mask_s)
+        {
+            return self.min_size + idx + 1;
+        }
+        if let Some(idx) =
+            Self::roll(&mut hash, &data[normal..len], self.mask_l)
+        {
+            return normal + idx + 1;
+        }
+
+        len
+    }
+}
+
 /// Chunker
 pub struct Chunker<W: Write + Seek> {
     dst: W,                // destination writer
     params: ChunkerParams, // chunker parameters
+    cdc: Option<FastCdc>,  // FastCDC cut point finder, None for Rabin
     pos: usize,
     chunk_len: usize,
     buf_clen: usize,
     win_idx: usize,
     roll_hash: u64,
     win: [u8; WIN_SIZE], // rolling hash circle window
-    buf: Vec<u8>,        // chunker buffer, fixed size: WTR_BUF_LEN
+    buf: Vec<u8>,        // chunker buffer, fixed size
 }
 
 impl<W: Write + Seek> Chunker<W> {
     pub fn new(params: ChunkerParams, dst: W) -> Self {
-        let mut buf = vec![0u8; WTR_BUF_LEN];
+        let (cdc, buf_len, pos) = match params.chunking {
+            Chunking::Rabin => (None, WTR_BUF_LEN, WIN_SLIDE_POS),
+            Chunking::FastCdc {
+                min_size,
+                avg_size,
+                max_size,
+            } => (
+                Some(FastCdc::new(min_size, avg_size, max_size)),
+                max(WTR_BUF_LEN, 2 * max_size),
+                0,
+            ),
+        };
+        let mut buf = vec![0u8; buf_len];
         buf.shrink_to_fit();
 
         Chunker {
             dst,
             params,
-            pos: WIN_SLIDE_POS,
-            chunk_len: WIN_SLIDE_POS,
+            cdc,
+            pos,
+            chunk_len: pos,
             buf_clen: 0,
             win_idx: 0,
             roll_hash: 0,
@@ -119,22 +319,24 @@ impl<W: Write + Seek> Chunker<W> {
         self.flush()?;
         Ok(self.dst)
     }
-}
 
-impl<W: Write + Seek> Write for Chunker<W> {
-    // consume bytes stream, output chunks
-    fn write(&mut self, buf: &[u8]) -> IoResult<usize> {
-        if buf.is_empty() {
-            return Ok(0);
+    // not enough space in buffer, copy remaining to the head of buffer and
+    // reset buf position
+    fn compact_buf(&mut self) {
+        let left_len = self.buf_clen - self.pos;
+        unsafe {
+            ptr::copy::<u8>(
+                self.buf[self.pos..].as_ptr(),
+                self.buf.as_mut_ptr(),
+                left_len,
+            );
         }
+        self.buf_clen = left_len;
+        self.pos = 0;
+    }
 
-        // copy source data into chunker buffer
-        let in_len = min(WTR_BUF_LEN - self.buf_clen, buf.len());
-        assert!(in_len > 0);
-        self.buf[self.buf_clen..self.buf_clen + in_len]
-            .copy_from_slice(&buf[..in_len]);
-        self.buf_clen += in_len;
-
+    // cut chunks using Rabin rolling hash
+    fn chunk_rabin(&mut self) -> IoResult<()> {
         while self.pos < self.buf_clen {
             // get current byte and pushed out byte
             let ch = self.buf[self.pos];
@@ -164,19 +366,8 @@ impl<W: Write + Seek> Write for Chunker<W> {
                     let written = self.dst.write(&self.buf[p..self.pos])?;
                     assert_eq!(written, self.chunk_len);
 
-                    // not enough space in buffer, copy remaining to
-                    // the head of buffer and reset buf position
                     if self.pos + MAX_SIZE >= WTR_BUF_LEN {
-                        let left_len = self.buf_clen - self.pos;
-                        unsafe {
-                            ptr::copy::<u8>(
-                                self.buf[self.pos..].as_ptr(),
-                                self.buf.as_mut_ptr(),
-                                left_len,
-                            );
-                        }
-                        self.buf_clen = left_len;
-                        self.pos = 0;
+                        self.compact_buf();
                     }
 
                     // jump to next start sliding position
@@ -186,24 +377,83 @@ impl<W: Write + Seek> Write for Chunker<W> {
             }
         }
 
+        Ok(())
+    }
+
+    // cut chunks using FastCDC, position is the start of pending chunk and
+    // it will be cut only when there is enough data or at the end of stream
+    fn chunk_fastcdc(&mut self, cdc: &FastCdc, at_end: bool) -> IoResult<()> {
+        loop {
+            let left = self.buf_clen - self.pos;
+            if left == 0 || (!at_end && left < cdc.max_size) {
+                break;
+            }
+
+            // write the chunk to destination writer,
+            // ensure it is consumed in whole
+            let len = cdc.cut(&self.buf[self.pos..self.buf_clen]);
+            let written =
+                self.dst.write(&self.buf[self.pos..self.pos + len])?;
+            assert_eq!(written, len);
+            self.pos += len;
+        }
+
+        if self.pos + cdc.max_size > self.buf.len() {
+            self.compact_buf();
+        }
+
+        Ok(())
+    }
+}
+
+impl<W: Write + Seek> Write for Chunker<W> {
+    // consume bytes stream, output chunks
+    fn write(&mut self, buf: &[u8]) -> IoResult<usize> {
+        if buf.is_empty() {
+            return Ok(0);
+        }
+
+        // copy source data into chunker buffer
+        let in_len = min(self.buf.len() - self.buf_clen, buf.len());
+        assert!(in_len > 0);
+        self.buf[self.buf_clen..self.buf_clen + in_len]
+            .copy_from_slice(&buf[..in_len]);
+        self.buf_clen += in_len;
+
+        match self.cdc {
+            Some(cdc) => self.chunk_fastcdc(&cdc, false)?,
+            None => self.chunk_rabin()?,
+        }
+
         Ok(in_len)
     }
 
     fn flush(&mut self) -> IoResult<()> {
-        // flush remaining data to destination
-        let p = self.pos - self.chunk_len;
-        if p < self.buf_clen {
-            self.chunk_len = self.buf_clen - p;
-            let _ = self.dst.write(&self.buf[p..(p + self.chunk_len)])?;
-        }
+        match self.cdc {
+            Some(cdc) => {
+                // flush remaining data to destination and reset chunker
+                self.chunk_fastcdc(&cdc, true)?;
+                self.pos = 0;
+                self.buf_clen = 0;
+            }
+            None => {
+                // flush remaining data to destination
+                let p = self.pos - self.chunk_len;
+                if p < self.buf_clen {
+                    self.chunk_len = self.buf_clen - p;
+                    let _ =
+                        self.dst.write(&self.buf[p..(p + self.chunk_len)])?;
+                }
 
-        // reset chunker
-        self.pos = WIN_SLIDE_POS;
-        self.chunk_len = WIN_SLIDE_POS;
-        self.buf_clen = 0;
-        self.win_idx = 0;
-        self.roll_hash = 0;
-        self.win = [0u8; WIN_SIZE];
+                // reset chunker
+                self.pos = WIN_SLIDE_POS;
+                self.chunk_len = WIN_SLIDE_POS;
+                self.buf_clen = 0;
+                self.win_idx = 0;
+                self.roll_hash = 0;
+                self.win = [0u8; WIN_SIZE];
+            }
+        }
 
         self.dst.flush()
     }
@@ -232,6 +482,9 @@ mod tests {
     use base::utils::speed_str;
     use content::chunk::Chunk;
 
+    #[cfg(feature = "test-perf")]
+    use base::bench::{Bench, Work};
+
     #[derive(Debug)]
     struct Sinker {
         len: usize,
@@ -240,7 +493,7 @@ mod tests {
 
     impl Write for Sinker {
         fn write(&mut self, buf: &[u8]) -> IoResult<usize> {
-            self.chks.push(Chunk::new(self.len, buf.len()));
+            self.chks.push(Chunk::new(self.len, buf.len(), None));
             self.len += buf.len();
             Ok(buf.len())
         }
@@ -285,13 +538,10 @@ mod tests {
         }
     }
 
-    #[test]
-    fn chunker() {
-        init_env();
-
+    fn chunker_test(chunking: Chunking) {
         // perpare test data
         const DATA_LEN: usize = 765 * 1024;
-        let params = ChunkerParams::new();
+        let params = ChunkerParams::new(chunking);
         let mut data = vec![0u8; DATA_LEN];
         Crypto::random_buf(&mut data);
         let mut cur = Cursor::new(data);
@@ -309,15 +559,87 @@ mod tests {
     }
 
     #[test]
-    fn chunker_perf() {
+    fn chunker() {
         init_env();
+        chunker_test(Chunking::Rabin);
+        chunker_test(Chunking::fastcdc());
+        chunker_test(Chunking::FastCdc {
+            min_size: 100,
+            avg_size: 256,
+            max_size: 1000,
+        });
+    }
 
-        // perpare test data
-        const DATA_LEN: usize = 10 * 1024 * 1024;
-        let params = ChunkerParams::new();
-        let mut data = vec![0u8; DATA_LEN];
-        let seed = RandomSeed::from(&[0u8; RANDOM_SEED_SIZE]);
+    // reference FastCDC implementation, rolling byte by byte
+    fn fastcdc_ref(cdc: &FastCdc, data: &[u8]) -> usize {
+        let len = min(data.len(), cdc.max_size);
+        if len <= cdc.min_size {
+            return len;
+        }
+        let normal = min(len, cdc.avg_size);
+        let mut hash = 0u64;
+        for (idx, ch) in data[..len].iter().enumerate().skip(cdc.min_size) {
+            hash = (hash << 1).wrapping_add(GEAR[*ch as usize]);
+            let mask = if idx < normal { cdc.mask_s } else { cdc.mask_l };
+            if hash & mask == 0 {
+                return idx + 1;
+            }
+        }
+        len
+    }
+
+    #[test]
+    fn fastcdc_cut() {
+        init_env();
+
+        let mut data = vec![0u8; 3 * 1024 * 1024 + 17];
+        let seed = RandomSeed::from(&[1u8; RANDOM_SEED_SIZE]);
         Crypto::random_buf_deterministic(&mut data, &seed);
+
+        for &(min_size, avg_size, max_size) in [
+            (MIN_SIZE, AVG_SIZE, MAX_SIZE),
+            (64, 128, 255),
+            (100, 512, 3000),
+        ]
+        .iter()
+        {
+            let cdc = FastCdc::new(min_size, avg_size, max_size);
+
+            // rolling two bytes a step must give the same cut points as
+            // rolling byte by byte
+            let mut pos = 0;
+            let mut cuts = Vec::new();
+            while pos < data.len() {
+                let len = cdc.cut(&data[pos..]);
+                assert_eq!(len, fastcdc_ref(&cdc, &data[pos..]));
+                assert!(len <= max_size);
+                assert!(len > min_size || pos + len == data.len());
+                cuts.push(len);
+                pos += len;
+            }
+
+            // chunker must produce the same chunks when writing in pieces
+            let params = ChunkerParams::new(Chunking::FastCdc {
+                min_size,
+                avg_size,
+                max_size,
+            });
+            let sinker = Sinker {
+                len: 0,
+                chks: Vec::new(),
+            };
+            let mut ckr = Chunker::new(params, sinker);
+            for piece in data.chunks(12345) {
+                ckr.write_all(piece).unwrap();
+            }
+            let sinker = ckr.into_inner().unwrap();
+            let lens: Vec<usize> = sinker.chks.iter().map(|c| c.len).collect();
+            assert_eq!(lens, cuts);
+        }
+    }
+
+    fn chunker_perf_test(chunking: Chunking, data: &[u8]) {
+        let params = ChunkerParams::new(chunking);
         let mut cur = Cursor::new(data);
         let sinker = VoidSinker {};
 
@@ -328,6 +650,62 @@ mod tests {
         ckr.flush().unwrap();
         let time = now.elapsed();
 
-        println!("Chunker perf: {}", speed_str(&time, DATA_LEN));
+        println!(
+            "Chunker {:?} perf: {}",
+            chunking,
+            speed_str(&time, data.len())
+        );
+    }
+
+    #[test]
+    fn chunker_perf() {
+        init_env();
+
+        // perpare test data
+        const DATA_LEN: usize = 10 * 1024 * 1024;
+        let mut data = vec![0u8; DATA_LEN];
+        let seed = RandomSeed::from(&[0u8; RANDOM_SEED_SIZE]);
+        Crypto::random_buf_deterministic(&mut data, &seed);
+
+        // compare chunking algorithms on the same data
+        chunker_perf_test(Chunking::Rabin, &data);
+        chunker_perf_test(Chunking::fastcdc(), &data);
+    }
+
+    #[cfg(feature = "test-perf")]
+    #[test]
+    fn bench_chunker() {
+        init_env();
+        let bench = Bench::from_env();
+
+        const DATA_LEN: usize = 16 * 1024 * 1024;
+        let mut data = vec![0u8; DATA_LEN];
+        let seed = RandomSeed::from(&[0u8; RANDOM_SEED_SIZE]);
+        Crypto::random_buf_deterministic(&mut data, &seed);
+
+        // each thread chunks its own share of data
+        for &(name, chunking) in [
+            ("chunker_rabin", Chunking::Rabin),
+            ("chunker_fastcdc", Chunking::fastcdc()),
+        ]
+        .iter()
+        {
+            for &threads in bench.threads() {
+                let share = DATA_LEN / threads;
+                bench.run_threads(
+                    name,
+                    "none",
+                    threads,
+                    Work::Bytes(share * threads),
+                    |idx| {
+                        let params = ChunkerParams::new(chunking);
+                        let mut ckr = Chunker::new(params, VoidSinker {});
+                        ckr.write_all(&data[idx * share..(idx + 1) * share])
+                            .unwrap();
+                        ckr.flush().unwrap();
+                    },
+                );
+            }
+        }
     }
 }
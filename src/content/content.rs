@@ -1,19 +1,21 @@
 use std::cmp::min;
+use std::collections::VecDeque;
 use std::error::Error as StdError;
 use std::fmt::{self, Debug};
 use std::io::{
-    Error as IoError, ErrorKind, Read, Result as IoResult, Seek, SeekFrom,
-    Write,
+    Error as IoError, ErrorKind, IoSliceMut, Read, Result as IoResult, Seek,
+    SeekFrom, Write,
 };
 use std::sync::Arc;
 
-use super::chunk::ChunkMap;
+use super::chunk::{ChunkLoc, ChunkMap};
 use super::entry::{CutableList, EntryList};
 use super::merkle_tree::{Leaves, MerkleTree, Writer as MerkleTreeWriter};
-use super::segment::Writer as SegWriter;
+use super::segment::{DataReader as SegDataReader, Writer as SegWriter};
 use super::span::{Extent, Span};
-use super::{StoreRef, StoreWeakRef};
+use super::{Store, StoreRef, StoreWeakRef};
 use base::crypto::{Crypto, Hash};
+use base::thread_pool::{JobResult, ThreadPool};
 use error::{Error, Result};
 use trans::cow::{CowCache, CowRef, Cowable, IntoCow};
 use trans::{Eid, Finish, Id, TxMgrRef, TxMgrWeakRef, Txid};
@@ -66,23 +68,23 @@ impl Content {
         other: &Content,
         store: &StoreRef,
     ) -> Result<()> {
+        let store = store.read().unwrap();
+
         // write other content into self
-        {
-            let store = store.read().unwrap();
-            let (_head, _tail) = self.ents.write_with(&other.ents, &store)?;
-        }
+        let (_head, _tail) = self.ents.write_with(&other.ents, &store)?;
 
         // merge merkle tree
-        let mut rdr = Reader::new(self.clone(), &Arc::downgrade(store));
+        let mut rdr = EntryListReader::new(&self.ents, &store);
         self.mtree.merge(&other.leaves, &mut rdr)?;
 
         Ok(())
     }
 
     pub fn truncate(&mut self, at: usize, store: &StoreRef) -> Result<()> {
+        let store = store.read().unwrap();
+
         // truncate content
         {
-            let store = store.read().unwrap();
             assert!(at <= self.len());
             let pos = self.ents.locate(at);
             let seg_ref = store.get_seg(self.ents[pos].seg_id())?;
@@ -91,7 +93,7 @@ impl Content {
         }
 
         // truncate merkle tree
-        let mut rdr = Reader::new(self.clone(), &Arc::downgrade(store));
+        let mut rdr = EntryListReader::new(&self.ents, &store);
         self.mtree.truncate(at, &mut rdr)?;
 
         Ok(())
@@ -128,6 +130,83 @@ impl Content {
         self.ents
             .unlink_weak(chk_map, store.make_mut_naive(), txmgr)
     }
+
+    /// Positional vectored read, fill buffers in order with data starting
+    /// from the offset
+    ///
+    /// This doesn't need a reader, so it can be called concurrently on the
+    /// same content.
+    pub fn read_vectored_at(
+        &self,
+        bufs: &mut [IoSliceMut],
+        offset: usize,
+        store: &Store,
+    ) -> Result<usize> {
+        let mut data_rdr = SegDataReader::new();
+        let mut read = 0;
+        for buf in bufs.iter_mut() {
+            let buf_read = read_data(
+                &self.ents,
+                buf,
+                offset + read,
+                store,
+                &mut data_rdr,
+            )?;
+            read += buf_read;
+            if buf_read < buf.len() {
+                break;
+            }
+        }
+        Ok(read)
+    }
+}
+
+// read data at offset into buffer, return number of bytes read. The
+// buffer is always filled up unless the end of content is reached.
+fn read_data(
+    ents: &EntryList,
+    buf: &mut [u8],
+    offset: usize,
+    store: &Store,
+    data_rdr: &mut SegDataReader,
+) -> Result<usize> {
+    let mut pos = offset;
+    let mut buf_read = 0;
+
+    for ent in ents.iter_from(offset) {
+        let seg_ref = store.get_seg(ent.seg_id())?;
+        let seg = seg_ref.read().unwrap();
+
+        for span in ent.iter_from(pos) {
+            let over_span = pos - span.offset;
+            let mut seg_offset = span.offset_in_seg(&seg) + over_span;
+            let mut span_left = span.len - over_span;
+
+            while span_left > 0 {
+                let dst = &mut buf[buf_read..];
+
+                // if destination buffer is full, stop reading
+                if dst.is_empty() {
+                    return Ok(buf_read);
+                }
+
+                let read_len = min(span_left, dst.len());
+                let read = store.read_segdata(
+                    &mut dst[..read_len],
+                    seg_offset,
+                    &seg,
+                    span.begin..span.end,
+                    data_rdr,
+                )?;
+                buf_read += read;
+                seg_offset += read;
+                span_left -= read;
+                pos += read;
+            }
+        }
+    }
+
+    Ok(buf_read)
 }
 
 impl Seek for Content {
@@ -158,6 +237,7 @@ pub type ContentRef = CowRef<Content>;
 pub struct Reader {
     pos: u64,
     content: Content,
+    data_rdr: SegDataReader,
     store: StoreWeakRef,
 }
 
@@ -166,6 +246,7 @@ impl Reader {
         Reader {
             pos: 0,
             content,
+            data_rdr: SegDataReader::new(),
             store: store.clone(),
         }
     }
@@ -179,44 +260,40 @@ impl Read for Reader {
 
         let store = map_io_err!(self.store.upgrade().ok_or(Error::RepoClosed))?;
         let store = store.read().unwrap();
-        let start = self.pos as usize;
-        let mut buf_read = 0;
-
-        for ent in self
-            .content
-            .ents
-            .iter()
-            .skip_while(|e| e.end_offset() <= start)
-        {
-            let seg_ref = map_io_err!(store.get_seg(ent.seg_id()))?;
-            let seg = seg_ref.read().unwrap();
-            let segdata_ref = map_io_err!(store.get_segdata(seg.data_id()))?;
-            let segdata = segdata_ref.read().unwrap();
-
-            for span in ent.iter().skip_while(|s| s.end_offset() <= start) {
-                let over_span = self.pos as usize - span.offset;
-                let mut seg_offset = span.offset_in_seg(&seg) + over_span;
-                let mut span_left = span.len - over_span;
-
-                while span_left > 0 {
-                    let dst = &mut buf[buf_read..];
-
-                    // if destination buffer is full, stop reading
-                    if dst.is_empty() {
-                        return Ok(buf_read);
-                    }
-
-                    let read_len = min(span_left, dst.len());
-                    let read = segdata.read(&mut dst[..read_len], seg_offset);
-                    buf_read += read;
-                    seg_offset += read;
-                    span_left -= read;
-                    self.pos += read as u64;
+        let read = map_io_err!(read_data(
+            &self.content.ents,
+            buf,
+            self.pos as usize,
+            &store,
+            &mut self.data_rdr,
+        ))?;
+        self.pos += read as u64;
+
+        Ok(read)
+    }
+
+    // content length is known, so destination can be allocated only once
+    // and filled with large reads, which can go straight to volume
+    fn read_to_end(&mut self, buf: &mut Vec<u8>) -> IoResult<usize> {
+        let start = buf.len();
+        let left = self.content.len().saturating_sub(self.pos as usize);
+        buf.resize(start + left, 0);
+
+        let mut read = 0;
+        while read < left {
+            match self.read(&mut buf[start + read..]) {
+                Ok(0) => break,
+                Ok(len) => read += len,
+                Err(ref err) if err.kind() == ErrorKind::Interrupted => {}
+                Err(err) => {
+                    buf.truncate(start + read);
+                    return Err(err);
                 }
             }
         }
+        buf.truncate(start + read);
 
-        Ok(buf_read)
+        Ok(read)
     }
 }
 
@@ -237,14 +314,118 @@ impl Seek for Reader {
     }
 }
 
+// entry list reader, it borrows entries from content and is used to
+// re-hash merkle tree pieces without cloning the content
+struct EntryListReader<'a> {
+    pos: usize,
+    ents: &'a EntryList,
+    data_rdr: SegDataReader,
+    store: &'a Store,
+}
+
+impl<'a> EntryListReader<'a> {
+    fn new(ents: &'a EntryList, store: &'a Store) -> Self {
+        EntryListReader {
+            pos: 0,
+            ents,
+            data_rdr: SegDataReader::new(),
+            store,
+        }
+    }
+}
+
+impl<'a> Read for EntryListReader<'a> {
+    fn read(&mut self, buf: &mut [u8]) -> IoResult<usize> {
+        let read = map_io_err!(read_data(
+            self.ents,
+            buf,
+            self.pos,
+            self.store,
+            &mut self.data_rdr,
+        ))?;
+        self.pos += read;
+        Ok(read)
+    }
+}
+
+impl<'a> Seek for EntryListReader<'a> {
+    fn seek(&mut self, pos: SeekFrom) -> IoResult<u64> {
+        self.pos = match pos {
+            SeekFrom::Start(pos) => pos as usize,
+            SeekFrom::End(pos) => {
+                (self.ents.end_offset() as i64 + pos) as usize
+            }
+            SeekFrom::Current(pos) => (self.pos as i64 + pos) as usize,
+        };
+        Ok(self.pos as u64)
+    }
+}
+
+// chunks hashed in parallel by thread pool
+struct ChunkPool {
+    pool: Arc<ThreadPool>,
+    depth: usize, // max number of chunks in flight
+    pending: VecDeque<(Arc<Vec<u8>>, JobResult<Hash>)>, // in write order
+}
+
+impl ChunkPool {
+    fn new(pool: &Arc<ThreadPool>) -> Self {
+        ChunkPool {
+            pool: pool.clone(),
+            depth: 4 * pool.size(),
+            pending: VecDeque::new(),
+        }
+    }
+
+    // send chunk to thread pool for hashing
+    fn send(&mut self, chunk: Arc<Vec<u8>>) {
+        let data = chunk.clone();
+        let hash = self.pool.submit(move || Crypto::hash(&data));
+        self.pending.push_back((chunk, hash));
+    }
+
+    // receive the first chunk in flight and its hash
+    fn recv(&mut self) -> IoResult<Option<(Arc<Vec<u8>>, Hash)>> {
+        match self.pending.pop_front() {
+            Some((chunk, mut hash)) => {
+                let hash = hash.wait().ok_or_else(|| {
+                    IoError::new(
+                        ErrorKind::Other,
+                        "Chunk hashing worker failed",
+                    )
+                })?;
+                Ok(Some((chunk, hash)))
+            }
+            None => Ok(None),
+        }
+    }
+}
+
+impl Debug for ChunkPool {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        f.debug_struct("ChunkPool")
+            .field("pool", &self.pool)
+            .field("depth", &self.depth)
+            .field("pending", &self.pending.len())
+            .finish()
+    }
+}
+
 /// Content Writer
+///
+/// If hashing thread pool is used, chunks and merkle tree pieces are hashed
+/// in parallel, and hashed chunks are then deduped and appended to segment
+/// in the same order as they are written.
 #[derive(Debug)]
 pub struct Writer {
     txid: Txid,
     ctn: Content,
     chk_map: ChunkMap,
+    use_index: bool,
+    idx_updates: Vec<(Hash, Option<ChunkLoc>)>,
     seg_wtr: SegWriter,
     mtree_wtr: MerkleTreeWriter,
+    chunks: Option<ChunkPool>,
     store: StoreWeakRef,
 }
 
@@ -252,16 +433,30 @@ impl Writer {
     pub fn new(
         txid: Txid,
         chk_map: ChunkMap,
+        use_index: bool,
         store: &StoreWeakRef,
+        seg_wtr: Option<SegWriter>,
         txmgr: &TxMgrWeakRef,
         vol: &VolumeWeakRef,
+        hash_pool: Option<&Arc<ThreadPool>>,
     ) -> Self {
+        let (mtree_wtr, chunks) = match hash_pool {
+            Some(pool) => (
+                MerkleTreeWriter::with_pool(pool),
+                Some(ChunkPool::new(pool)),
+            ),
+            None => (MerkleTreeWriter::new(), None),
+        };
         Writer {
             txid,
             ctn: Content::new(),
             chk_map,
-            seg_wtr: SegWriter::new(txid, store, txmgr, vol),
-            mtree_wtr: MerkleTreeWriter::new(),
+            use_index,
+            idx_updates: Vec::new(),
+            seg_wtr: seg_wtr
+                .unwrap_or_else(|| SegWriter::new(txid, store, txmgr, vol)),
+            mtree_wtr,
+            chunks,
             store: store.clone(),
         }
     }
@@ -272,11 +467,12 @@ impl Writer {
 
         // write to segment, if segment is full then
         // create a new one and try it again
-        let mut written = self.seg_wtr.write(chunk)?;
+        let idx_hash = if self.use_index { Some(hash) } else { None };
+        let mut written = self.seg_wtr.write_chunk(chunk, idx_hash)?;
         if written == 0 {
             // segment is full
             map_io_err!(self.seg_wtr.renew())?;
-            written = self.seg_wtr.write(chunk)?;
+            written = self.seg_wtr.write_chunk(chunk, idx_hash)?;
         }
         assert_eq!(written, chunk_len); // must written in whole
 
@@ -290,38 +486,77 @@ impl Writer {
 
         // and update chunk map
         self.chk_map.insert(hash, seg.id(), begin);
+        if self.use_index {
+            self.idx_updates.push((
+                hash.clone(),
+                Some(ChunkLoc {
+                    seg_id: seg.id().clone(),
+                    idx: begin,
+                }),
+            ));
+        }
 
         Ok(())
     }
 
-    // finish writer, return stage content and updated chunk map
-    pub fn finish(mut self) -> Result<(Content, ChunkMap)> {
-        // finish segment writer
-        self.seg_wtr.finish()?;
-
-        // finish merkel tree
-        self.ctn.leaves = self.mtree_wtr.finish_with_leaves();
+    // find chunk in repo-wide chunk index, the found chunk must be still in
+    // use by other contents and have the same hash kept in segment, because
+    // the index entry could be stale
+    fn find_indexed(
+        &mut self,
+        chunk_len: usize,
+        hash: &Hash,
+    ) -> IoResult<Option<ChunkLoc>> {
+        if !self.use_index {
+            return Ok(None);
+        }
 
-        Ok((self.ctn, self.chk_map))
+        let store = map_io_err!(self.store.upgrade().ok_or(Error::RepoClosed))?;
+        let store = store.read().unwrap();
+        let loc = match map_io_err!(store.find_chunk(hash))? {
+            Some(loc) => loc,
+            None => return Ok(None),
+        };
+
+        match store.get_seg(&loc.seg_id) {
+            Ok(seg_ref) => {
+                let seg = seg_ref.read().unwrap();
+                if loc.idx < seg.chunk_cnt()
+                    && !seg[loc.idx].is_orphan()
+                    && seg[loc.idx].len == chunk_len
+                    && seg[loc.idx].hash.as_ref() == Some(hash)
+                {
+                    Ok(Some(loc))
+                } else {
+                    Ok(None)
+                }
+            }
+            Err(ref err) if *err == Error::NotFound => {
+                // the segment has been removed, remove it from index
+                self.idx_updates.push((hash.clone(), None));
+                Ok(None)
+            }
+            Err(err) => Err(IoError::new(ErrorKind::Other, err.description())),
+        }
     }
-}
 
-impl Write for Writer {
-    fn write(&mut self, chunk: &[u8]) -> IoResult<usize> {
+    // dedup hashed chunk, or append it to content if no duplication
+    fn process_chunk(&mut self, chunk: &[u8], hash: &Hash) -> IoResult<()> {
         let chunk_len = chunk.len();
 
-        // calculate chunk hash
-        let hash = Crypto::hash(chunk);
-
-        // update merkel tree
-        let _ = self.mtree_wtr.write(chunk)?;
+        // look up in the file chunk map first, then the repo-wide index
+        let found = match self.chk_map.get_refresh(hash) {
+            Some(loc) => Some(loc),
+            None => self.find_indexed(chunk_len, hash)?,
+        };
 
         // if duplicate chunk is found,
-        if let Some(ref loc) = self.chk_map.get_refresh(&hash) {
+        if let Some(ref loc) = found {
             // get referred segment, it could be the current segment
             let store =
                 map_io_err!(self.store.upgrade().ok_or(Error::RepoClosed))?;
             let store = store.read().unwrap();
+            store.metrics().add_chunk_dedup(chunk_len);
             let rseg = {
                 let curr_seg = self.seg_wtr.seg();
                 let seg = curr_seg.read().unwrap();
@@ -348,13 +583,97 @@ impl Write for Writer {
             assert_eq!(chunk_len, chunk.len);
         } else {
             // no duplication found, then append chunk to content
-            self.append_chunk(chunk, &hash)?;
+            self.append_chunk(chunk, hash)?;
+        }
+
+        Ok(())
+    }
+
+    // process the first hashed chunk in flight, return false if there is
+    // no chunk in flight
+    fn process_next(&mut self) -> IoResult<bool> {
+        let next = match self.chunks {
+            Some(ref mut chunks) => chunks.recv()?,
+            None => None,
+        };
+        match next {
+            Some((chunk, hash)) => {
+                self.process_chunk(&chunk, &hash)?;
+                Ok(true)
+            }
+            None => Ok(false),
+        }
+    }
+
+    // process all the chunks in flight
+    fn drain(&mut self) -> IoResult<()> {
+        while self.process_next()? {}
+        Ok(())
+    }
+
+    // finish writer, return stage content and updated chunk map
+    pub fn finish(self) -> Result<(Content, ChunkMap)> {
+        let (ctn, chk_map, seg_wtr) = self.finish_shared()?;
+
+        // finish segment writer
+        seg_wtr.finish()?;
+
+        Ok((ctn, chk_map))
+    }
+
+    // finish writer but keep the segment writer open, so it can be shared
+    // with the next content writer in the same transaction
+    pub fn finish_shared(mut self) -> Result<(Content, ChunkMap, SegWriter)> {
+        self.drain()?;
+
+        // add new chunks to repo-wide chunk index
+        if !self.idx_updates.is_empty() {
+            let store = self.store.upgrade().ok_or(Error::RepoClosed)?;
+            Store::update_chunk_index(&store, &self.idx_updates)?;
+        }
+
+        // finish merkel tree
+        self.ctn.leaves = self.mtree_wtr.finish_with_leaves()?;
+
+        Ok((self.ctn, self.chk_map, self.seg_wtr))
+    }
+}
+
+impl Write for Writer {
+    fn write(&mut self, chunk: &[u8]) -> IoResult<usize> {
+        let chunk_len = chunk.len();
+
+        if self.chunks.is_none() {
+            // calculate chunk hash
+            let hash = Crypto::hash(chunk);
+
+            // update merkel tree
+            let _ = self.mtree_wtr.write(chunk)?;
+
+            self.process_chunk(chunk, &hash)?;
+            return Ok(chunk_len);
+        }
+
+        // send chunk and merkle tree pieces to thread pool for hashing
+        let chunk = Arc::new(chunk.to_vec());
+        self.mtree_wtr.write_shared(&chunk)?;
+        let mut in_flight = {
+            let chunks = self.chunks.as_mut().unwrap();
+            chunks.send(chunk);
+            chunks.pending.len().saturating_sub(chunks.depth)
+        };
+
+        // process hashed chunks so chunks in flight are bounded
+        while in_flight > 0 {
+            self.process_next()?;
+            in_flight -= 1;
         }
 
         Ok(chunk_len)
     }
 
     fn flush(&mut self) -> IoResult<()> {
+        self.drain()?;
         self.seg_wtr.flush()?;
         self.mtree_wtr.flush()
     }
@@ -362,6 +681,7 @@ impl Write for Writer {
 
 impl Seek for Writer {
     fn seek(&mut self, pos: SeekFrom) -> IoResult<u64> {
+        self.drain()?;
         self.ctn.seek(pos)?;
         self.mtree_wtr.seek(pos)
     }
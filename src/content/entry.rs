@@ -118,6 +118,13 @@ impl Entry {
         self.spans.iter()
     }
 
+    // iterate spans starting from the one which contains the offset
+    #[inline]
+    pub fn iter_from(&self, at: usize) -> Iter<Span> {
+        let pos = self.spans.partition_point(|s| s.end_offset() <= at);
+        self.spans[pos..].iter()
+    }
+
     pub fn append(&mut self, span: &Span) {
         // try to merge with the last span
         if let Some(last) = self.spans.last_mut() {
@@ -232,6 +239,13 @@ impl EntryList {
         self.ents.iter()
     }
 
+    // iterate entries starting from the one which contains the offset
+    #[inline]
+    pub fn iter_from(&self, at: usize) -> Iter<Entry> {
+        let pos = self.ents.partition_point(|e| e.end_offset() <= at);
+        self.ents[pos..].iter()
+    }
+
     // append span
     pub fn append(&mut self, seg_id: &Eid, span: &Span) {
         // try to merge with the last entry
@@ -328,7 +342,7 @@ impl EntryList {
 
             if seg_cow.is_orphan() {
                 // if segment is not used anymore, remove it
-                Segment::remove(&mut seg_cow, txmgr)?;
+                Segment::remove(&mut seg_cow, store, txmgr)?;
                 chk_map.remove_segment(seg_cow.id());
             } else if seg_cow.is_shrinkable() {
                 // shrink segment if it is small enough and remove retired
@@ -356,7 +370,7 @@ impl EntryList {
 
             if seg_cow.is_orphan() {
                 // if segment is not used anymore, remove it
-                Segment::remove(&mut seg_cow, txmgr)?;
+                Segment::remove(&mut seg_cow, store, txmgr)?;
                 chk_map.remove_segment(seg_cow.id());
             }
         }
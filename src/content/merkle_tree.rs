@@ -1,8 +1,16 @@
 use std::cmp::{max, min};
+use std::collections::VecDeque;
 use std::fmt::{self, Debug};
-use std::io::{Read, Result as IoResult, Seek, SeekFrom, Write};
+use std::io::{
+    Error as IoError, ErrorKind, Read, Result as IoResult, Seek, SeekFrom,
+    Write,
+};
+use std::mem;
+use std::ops::Range;
+use std::sync::Arc;
 
 use base::crypto::{Crypto, Hash, HashState};
+use base::thread_pool::{JobResult, ThreadPool};
 use base::utils;
 use error::Result;
 
@@ -39,8 +47,12 @@ fn parent(n: usize, lvl_begin: usize, lvl_node_cnt: usize) -> usize {
     upper_lvl_begin + (n - lvl_begin) / 2
 }
 
-// read one data piece and calculate its hash
-fn piece_hash<R: Read + Seek>(offset: usize, rdr: &mut R) -> IoResult<Hash> {
+// read one data piece and calculate its hash state, the state is not
+// finalised so it can be kept if the piece is the last partial piece
+fn piece_state<R: Read + Seek>(
+    offset: usize,
+    rdr: &mut R,
+) -> IoResult<HashState> {
     rdr.seek(SeekFrom::Start(align_piece_floor(offset) as u64))?;
     let mut buf = vec![0u8; PIECE_SIZE];
     let mut pos = 0;
@@ -55,7 +67,7 @@ fn piece_hash<R: Read + Seek>(offset: usize, rdr: &mut R) -> IoResult<Hash> {
         pos += read;
     }
 
-    Ok(Crypto::hash_final(&mut state))
+    Ok(state)
 }
 
 // calculate total number of tree nodes, including leaf nodes
@@ -69,11 +81,17 @@ fn tree_node_cnt(leaf_cnt: usize) -> usize {
     s
 }
 
-#[derive(Debug, Default, Clone)]
+#[derive(Default, Clone)]
 pub struct Leaves {
     offset: usize,
     len: usize,
     nodes: Vec<Hash>,
+
+    // data of the head piece if leaves don't start from piece boundary
+    head: Vec<u8>,
+
+    // hash state of the tail piece if it is partial
+    tail: Option<HashState>,
 }
 
 impl Leaves {
@@ -86,12 +104,37 @@ impl Leaves {
     fn end_offset(&self) -> usize {
         self.offset + self.len
     }
+
+    // keep data in the head piece, hash_offset is the data offset
+    fn keep_head(&mut self, hash_offset: usize, data: &[u8]) {
+        if align_piece_offset(self.offset) != 0
+            && align_piece_floor(hash_offset) == align_piece_floor(self.offset)
+        {
+            self.head.extend_from_slice(data);
+        }
+    }
+}
+
+impl Debug for Leaves {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        f.debug_struct("Leaves")
+            .field("offset", &self.offset)
+            .field("len", &self.len)
+            .field("nodes", &self.nodes)
+            .field("head_len", &self.head.len())
+            .finish()
+    }
 }
 
 #[derive(Debug, Clone, Deserialize, Serialize)]
 pub struct MerkleTree {
     len: usize,
     nodes: Vec<Hash>,
+
+    // hash state of the last piece if it is partial, it is only kept in
+    // memory so appending to the last piece doesn't need to read it back
+    #[serde(skip_serializing, skip_deserializing, default)]
+    tail: Option<HashState>,
 }
 
 impl MerkleTree {
@@ -146,6 +189,11 @@ impl MerkleTree {
         let mut mtree = MerkleTree {
             len: leaves.len,
             nodes: vec![Hash::new_empty(); inner_node_cnt],
+            tail: if align_piece_offset(leaves.len) != 0 {
+                leaves.tail.clone()
+            } else {
+                None
+            },
         };
 
         // append leaf nodes
@@ -168,6 +216,29 @@ impl MerkleTree {
         mtree
     }
 
+    // re-calculate inner nodes hash from bottom up, only the ancestors of
+    // leaf nodes in range [begin, end) are updated
+    fn hash_up_range(&mut self, mut begin: usize, mut end: usize) {
+        let mut lvl_begin = self.inner_cnt();
+        let mut lvl_node_cnt = self.leaf_cnt();
+        while lvl_begin >= 1 {
+            let lvl_end = lvl_begin + lvl_node_cnt;
+            let mut m = begin - ((begin - lvl_begin) & 1);
+            while m < end {
+                if m + 1 < lvl_end {
+                    self.hash_up(&[m, m + 1], lvl_begin, lvl_node_cnt);
+                } else {
+                    self.hash_up(&[m], lvl_begin, lvl_node_cnt);
+                }
+                m += 2;
+            }
+            begin = parent(begin, lvl_begin, lvl_node_cnt);
+            end = parent(end - 1, lvl_begin, lvl_node_cnt) + 1;
+            lvl_begin = parent(lvl_begin, lvl_begin, lvl_node_cnt);
+            lvl_node_cnt = (lvl_node_cnt + 1) / 2;
+        }
+    }
+
     // merge other merkle tree to self
     pub fn merge<R: Read + Seek>(
         &mut self,
@@ -182,34 +253,80 @@ impl MerkleTree {
         let leaves_begin = node_cnt - leaf_cnt;
         let mut old_begin = self.inner_cnt();
         let old_leaf_cnt = self.leaf_cnt();
+        let old_tail = self.tail.take();
 
         let mut overlap_begin =
             leaves_begin + align_piece_floor_chunk(leaves.offset);
         let overlap_end_offset = min(self.len, leaves.end_offset());
         let mut overlap_end =
             leaves_begin + align_piece_ceil_chunk(overlap_end_offset);
+        let changed_begin = overlap_begin;
+        let changed_end = max(overlap_end, overlap_begin + leaves.nodes.len());
+
+        // if leaves reach the end, the last piece is from leaves, otherwise
+        // it is not changed unless it is re-hashed below
+        let mut tail = if leaves.end_offset() >= self.len {
+            leaves.tail.clone()
+        } else {
+            old_tail.clone()
+        };
 
-        // resize nodes and move old leaf nodes
-        let old_leaves = self.nodes[old_begin..].to_vec();
-        self.nodes.resize(node_cnt, Hash::new_empty());
-        self.nodes[leaves_begin..leaves_begin + old_leaves.len()]
-            .clone_from_slice(&old_leaves[..]);
+        // resize nodes and move old leaf nodes if tree shape is changed
+        if leaf_cnt != old_leaf_cnt {
+            let old_leaves = self.nodes[old_begin..].to_vec();
+            self.nodes.resize(node_cnt, Hash::new_empty());
+            self.nodes[leaves_begin..leaves_begin + old_leaves.len()]
+                .clone_from_slice(&old_leaves[..]);
+        }
 
         // copy in leave nodes
         self.nodes[overlap_begin..overlap_begin + leaves.nodes.len()]
             .clone_from_slice(&leaves.nodes[..]);
 
-        // re-hash head and tail overlapping pieces
+        // re-hash head piece, if appending to the last partial piece, its
+        // hash state can be continued without reading the piece again
         let head_is_rehashed = if align_piece_offset(leaves.offset) != 0 {
-            self.nodes[overlap_begin] = piece_hash(leaves.offset, rdr)?;
+            let mut state = match old_tail {
+                Some(ref old_tail) if leaves.offset == self.len => {
+                    let mut state = old_tail.clone();
+                    Crypto::hash_update(&mut state, &leaves.head);
+                    state
+                }
+                _ => piece_state(leaves.offset, rdr)?,
+            };
+            if overlap_begin == node_cnt - 1 {
+                tail = Some(state.clone());
+            }
+            self.nodes[overlap_begin] = Crypto::hash_final(&mut state);
             true
         } else {
             false
         };
-        if align_piece_offset(overlap_end_offset) != 0
+
+        // re-hash tail piece if it has old data after the leaves
+        if leaves.end_offset() < self.len
+            && align_piece_offset(overlap_end_offset) != 0
             && !(overlap_begin == overlap_end - 1 && head_is_rehashed)
         {
-            self.nodes[overlap_end - 1] = piece_hash(overlap_end_offset, rdr)?;
+            let mut state = piece_state(overlap_end_offset, rdr)?;
+            if overlap_end == node_cnt {
+                tail = Some(state.clone());
+            }
+            self.nodes[overlap_end - 1] = Crypto::hash_final(&mut state);
+        }
+
+        self.len = end_offset;
+        self.tail = if align_piece_offset(end_offset) != 0 {
+            tail
+        } else {
+            None
+        };
+
+        // if tree shape is not changed, only update ancestors of the
+        // changed leaf nodes
+        if leaf_cnt == old_leaf_cnt {
+            self.hash_up_range(changed_begin, changed_end);
+            return Ok(());
         }
 
         // re-calculate inner nodes hash from bottom up
@@ -248,8 +365,6 @@ impl MerkleTree {
             }
         }
 
-        self.len = end_offset;
-
         Ok(())
     }
 
@@ -271,6 +386,7 @@ impl MerkleTree {
         let mut new = MerkleTree {
             len: at,
             nodes: vec![Hash::new_empty(); node_cnt],
+            tail: None,
         };
 
         // copy leaf nodes
@@ -280,7 +396,11 @@ impl MerkleTree {
 
         // re-hash the last piece at cut position
         if align_piece_offset(at) != 0 || at == 0 {
-            new.nodes[node_cnt - 1] = piece_hash(at, rdr)?;
+            let mut state = piece_state(at, rdr)?;
+            if at > 0 {
+                new.tail = Some(state.clone());
+            }
+            new.nodes[node_cnt - 1] = Crypto::hash_final(&mut state);
         }
 
         // re-calculate inner nodes hash from bottom up
@@ -324,16 +444,63 @@ impl MerkleTree {
 impl Default for MerkleTree {
     fn default() -> Self {
         let wtr = Writer::new();
-        let leaves = wtr.finish_with_leaves();
+        let leaves = wtr.finish_with_leaves().unwrap();
         MerkleTree::build(&leaves)
     }
 }
 
+// data slices which make up a piece
+type PieceData = Vec<(Arc<Vec<u8>>, Range<usize>)>;
+
+// pieces hashed in parallel by thread pool
+struct PiecePool {
+    pool: Arc<ThreadPool>,
+    depth: usize,     // max number of pieces in flight
+    piece: PieceData, // current piece in building
+    pending: VecDeque<JobResult<Hash>>, // pieces in flight, in order
+}
+
+impl PiecePool {
+    fn new(pool: &Arc<ThreadPool>) -> Self {
+        PiecePool {
+            pool: pool.clone(),
+            depth: 2 * pool.size(),
+            piece: Vec::new(),
+            pending: VecDeque::new(),
+        }
+    }
+
+    // send current piece to thread pool for hashing
+    fn send(&mut self) {
+        let piece = mem::replace(&mut self.piece, Vec::new());
+        let hash = self.pool.submit(move || {
+            let mut state = Crypto::hash_init();
+            for (data, range) in piece.iter() {
+                Crypto::hash_update(&mut state, &data[range.clone()]);
+            }
+            Crypto::hash_final(&mut state)
+        });
+        self.pending.push_back(hash);
+    }
+
+    // receive the first piece hash in flight
+    fn recv(&mut self) -> IoResult<Hash> {
+        let mut hash = self.pending.pop_front().unwrap();
+        hash.wait().ok_or_else(|| {
+            IoError::new(ErrorKind::Other, "Piece hashing worker failed")
+        })
+    }
+}
+
 // merkle tree pieces writer
+//
+// If thread pool is used, pieces are hashed in parallel but leaves are
+// still in the same order as they are written.
 pub struct Writer {
     hash_offset: usize,
     state: HashState,
     leaves: Leaves,
+    pieces: Option<PiecePool>,
 }
 
 impl Writer {
@@ -342,19 +509,91 @@ impl Writer {
             hash_offset: 0,
             state: Crypto::hash_init(),
             leaves: Leaves::new(),
+            pieces: None,
+        }
+    }
+
+    pub fn with_pool(pool: &Arc<ThreadPool>) -> Self {
+        let mut wtr = Writer::new();
+        wtr.pieces = Some(PiecePool::new(pool));
+        wtr
+    }
+
+    // write shared data, pieces will be hashed in thread pool if it is used
+    pub fn write_shared(&mut self, data: &Arc<Vec<u8>>) -> IoResult<usize> {
+        let pieces = match self.pieces {
+            Some(ref mut pieces) => pieces,
+            None => return self.write(data),
+        };
+
+        let mut data_pos = 0;
+        let data_len = data.len();
+
+        while data_pos < data_len {
+            let pos = align_piece_offset(self.hash_offset);
+            let hash_len = min(PIECE_SIZE - pos, data_len - data_pos);
+
+            pieces
+                .piece
+                .push((data.clone(), data_pos..data_pos + hash_len));
+            self.leaves.keep_head(
+                self.hash_offset,
+                &data[data_pos..data_pos + hash_len],
+            );
+
+            // reached piece boundary, send it to hash
+            if align_piece_offset(self.hash_offset + hash_len) <= pos {
+                pieces.send();
+            }
+
+            data_pos += hash_len;
+            self.hash_offset += hash_len;
+        }
+
+        // collect finished pieces so pieces in flight are bounded
+        while pieces.pending.len() > pieces.depth {
+            let hash = pieces.recv()?;
+            self.leaves.nodes.push(hash);
         }
+
+        self.leaves.len += data_len;
+
+        Ok(data_len)
     }
 
-    pub fn finish_with_leaves(mut self) -> Leaves {
-        if self.leaves.len == 0 || align_piece_offset(self.hash_offset) != 0 {
+    pub fn finish_with_leaves(mut self) -> Result<Leaves> {
+        let is_partial =
+            self.leaves.len == 0 || align_piece_offset(self.hash_offset) != 0;
+
+        if let Some(ref mut pieces) = self.pieces {
+            while !pieces.pending.is_empty() {
+                let hash = pieces.recv()?;
+                self.leaves.nodes.push(hash);
+            }
+
+            // hash the last partial piece here so its state can be kept
+            if is_partial {
+                for (data, range) in pieces.piece.iter() {
+                    Crypto::hash_update(&mut self.state, &data[range.clone()]);
+                }
+            }
+        }
+
+        if is_partial {
+            self.leaves.tail = Some(self.state.clone());
             self.leaves.nodes.push(Crypto::hash_final(&mut self.state));
         }
-        self.leaves
+
+        Ok(self.leaves)
     }
 }
 
 impl Write for Writer {
     fn write(&mut self, data: &[u8]) -> IoResult<usize> {
+        if self.pieces.is_some() {
+            return self.write_shared(&Arc::new(data.to_vec()));
+        }
+
         let mut data_pos = 0;
         let data_len = data.len();
 
@@ -366,6 +605,10 @@ impl Write for Writer {
                 &mut self.state,
                 &data[data_pos..data_pos + hash_len],
             );
+            self.leaves.keep_head(
+                self.hash_offset,
+                &data[data_pos..data_pos + hash_len],
+            );
 
             // reached piece boundary, finish its hash and start a new round
             if align_piece_offset(self.hash_offset + hash_len) <= pos {
@@ -407,6 +650,7 @@ impl Debug for Writer {
         f.debug_struct("Writer")
             .field("hash_offset", &self.hash_offset)
             .field("leaves", &self.leaves)
+            .field("parallel", &self.pieces.is_some())
             .finish()
     }
 }
@@ -453,7 +697,7 @@ mod tests {
         for chunk in buf.chunks(PIECE_SIZE) {
             wtr.write(&chunk[..]).unwrap();
         }
-        wtr.finish_with_leaves()
+        wtr.finish_with_leaves().unwrap()
     }
 
     fn build_mtree(buf: &[u8]) -> MerkleTree {
@@ -482,6 +726,39 @@ mod tests {
         }
     }
 
+    fn test_parallel_write(pool: &Arc<ThreadPool>, offset: usize, len: usize) {
+        let mut buf = vec![0u8; len];
+        Crypto::random_buf_deterministic(&mut buf, &RandomSeed::default());
+
+        let mut wtr = Writer::with_pool(pool);
+        wtr.seek(SeekFrom::Start(offset as u64)).unwrap();
+        for chunk in buf.chunks(12345) {
+            wtr.write_shared(&Arc::new(chunk.to_vec())).unwrap();
+        }
+        let leaves = wtr.finish_with_leaves().unwrap();
+        let ctl = make_leaves(offset, &buf);
+        assert_eq!(leaves.offset, ctl.offset);
+        assert_eq!(leaves.len, ctl.len);
+        assert_eq!(leaves.nodes, ctl.nodes);
+        assert_eq!(leaves.head, ctl.head);
+        assert_eq!(
+            leaves.tail.map(|mut s| Crypto::hash_final(&mut s)),
+            ctl.tail.map(|mut s| Crypto::hash_final(&mut s))
+        );
+    }
+
+    #[test]
+    fn parallel_writer() {
+        init_env();
+        let pool = Arc::new(ThreadPool::new("test", 3).unwrap());
+
+        for &len in [0, 3, PIECE_SIZE, PIECE_SIZE * 5 + 7].iter() {
+            test_parallel_write(&pool, 0, len);
+            test_parallel_write(&pool, 1, len);
+            test_parallel_write(&pool, PIECE_SIZE, len);
+        }
+    }
+
     fn test_merge(dst_len: usize, src_len: usize, offset: usize) {
         let mut src = vec![0u8; src_len];
         Crypto::random_buf_deterministic(&mut src, &RandomSeed::default());
@@ -541,6 +818,99 @@ mod tests {
         }
     }
 
+    // reader which fails the test if any piece is read back
+    struct NoReader;
+
+    impl Read for NoReader {
+        fn read(&mut self, _: &mut [u8]) -> IoResult<usize> {
+            panic!("piece should not be read");
+        }
+    }
+
+    impl Seek for NoReader {
+        fn seek(&mut self, _: SeekFrom) -> IoResult<u64> {
+            panic!("piece should not be read");
+        }
+    }
+
+    // append to merkle tree, the last piece should not be read if the tree
+    // has its hash state
+    fn test_append(mtree: &mut MerkleTree, buf: &[u8], len: usize) {
+        let leaves = make_leaves(mtree.len, &buf[mtree.len..len]);
+        if mtree.tail.is_some() || align_piece_offset(mtree.len) == 0 {
+            mtree.merge(&leaves, &mut NoReader).unwrap();
+        } else {
+            let mut rdr = Cursor::new(&buf[..len]);
+            mtree.merge(&leaves, &mut rdr).unwrap();
+        }
+        assert_eq!(mtree.len, len);
+        assert_eq!(mtree.root_hash(), &calculate_merkle_hash(&buf[..len]));
+    }
+
+    #[test]
+    fn append_merkle_tree() {
+        init_env();
+
+        let mut buf = vec![0u8; PIECE_SIZE * 8];
+        Crypto::random_buf_deterministic(&mut buf, &RandomSeed::default());
+
+        // small appends and appends crossing piece boundaries
+        let mut mtree = build_mtree(&buf[..7]);
+        assert!(mtree.tail.is_some());
+        let mut len = 7;
+        for &step in [1, 3, 100, 12345, PIECE_SIZE - 3, PIECE_SIZE + 1].iter() {
+            len += step;
+            test_append(&mut mtree, &buf, len);
+        }
+        len = align_piece_floor(len) + PIECE_SIZE;
+        test_append(&mut mtree, &buf, len);
+        assert!(mtree.tail.is_none());
+        len += 2;
+        test_append(&mut mtree, &buf, len);
+        assert!(mtree.tail.is_some());
+
+        // tree without tail state, such as loaded from storage, must
+        // read the last piece back
+        mtree.tail = None;
+        len += 5;
+        test_append(&mut mtree, &buf, len);
+        assert!(mtree.tail.is_some());
+        len += 5;
+        test_append(&mut mtree, &buf, len);
+
+        // overwrite the last piece and then append
+        let mut dst = buf[..len].to_vec();
+        let src = [42u8; 10];
+        let offset = len - 20;
+        dst[offset..offset + src.len()].copy_from_slice(&src);
+        let mut rdr = Cursor::new(&dst);
+        mtree.merge(&make_leaves(offset, &src), &mut rdr).unwrap();
+        assert_eq!(mtree.root_hash(), &calculate_merkle_hash(&dst));
+        dst.extend_from_slice(&buf[len..len + 10]);
+        len += 10;
+        test_append(&mut mtree, &dst, len);
+
+        // overwrite a middle piece and then append
+        let offset = PIECE_SIZE + 1;
+        dst[offset..offset + src.len()].copy_from_slice(&src);
+        let mut rdr = Cursor::new(&dst);
+        mtree.merge(&make_leaves(offset, &src), &mut rdr).unwrap();
+        assert_eq!(mtree.root_hash(), &calculate_merkle_hash(&dst));
+        dst.extend_from_slice(&buf[len..len + 10]);
+        len += 10;
+        test_append(&mut mtree, &dst, len);
+
+        // truncate and then append
+        len -= 100;
+        dst.truncate(len);
+        let mut rdr = Cursor::new(&dst);
+        mtree.truncate(len, &mut rdr).unwrap();
+        assert_eq!(mtree.root_hash(), &calculate_merkle_hash(&dst));
+        dst.extend_from_slice(&buf[len..len + 1000]);
+        len += 1000;
+        test_append(&mut mtree, &dst, len);
+    }
+
     fn test_truncate(len: usize, at: usize) {
         let mut buf = vec![0u8; len];
         Crypto::random_buf_deterministic(&mut buf, &RandomSeed::default());
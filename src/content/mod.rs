@@ -12,5 +12,7 @@ mod span;
 mod store;
 
 pub use self::chunk::ChunkMap;
+pub use self::chunker::Chunking;
 pub use self::content::{Content, ContentRef, Reader as ContentReader};
+pub use self::segment::Writer as SegWriter;
 pub use self::store::{Store, StoreRef, StoreWeakRef, Writer};
@@ -1,12 +1,18 @@
+use std::cmp::min;
 use std::error::Error as StdError;
 use std::fmt::{self, Debug};
-use std::io::{Error as IoError, ErrorKind, Read, Result as IoResult, Write};
+use std::io::{
+    Error as IoError, ErrorKind, Read, Result as IoResult, Seek, SeekFrom,
+    Write,
+};
 use std::ops::{Index, IndexMut, Range};
 use std::sync::{Arc, RwLock};
 
 use super::chunk::Chunk;
 use super::{Store, StoreWeakRef};
+use base::crypto::Hash;
 use base::lru::{Lru, Meter, PinChecker};
+use base::metrics::CacheCounters;
 use base::IntoRef;
 use error::{Error, Result};
 use trans::cow::{Cow, CowCache, CowRef, Cowable, IntoCow};
@@ -33,15 +39,6 @@ impl SegData {
         }
     }
 
-    // Note: offset is in the segment data
-    #[inline]
-    pub fn read(&self, dst: &mut [u8], offset: usize) -> usize {
-        let read_len = dst.len();
-        assert!(offset + read_len <= self.data.len());
-        dst.copy_from_slice(&self.data[offset..(offset + read_len)]);
-        read_len
-    }
-
     pub fn add_to_trans(
         data_id: &Eid,
         action: Action,
@@ -72,7 +69,7 @@ impl SegData {
 
     fn load(id: &Eid, vol: &VolumeRef) -> Result<Self> {
         let mut rdr = VolReader::new(id, vol)?;
-        let mut buf = Vec::new();
+        let mut buf = Vec::with_capacity(rdr.len_hint().unwrap_or(0));
         rdr.read_to_end(&mut buf)?;
 
         Ok(SegData {
@@ -153,66 +150,178 @@ impl Debug for SegData {
 /// Segment data reference type
 pub type SegDataRef = Arc<RwLock<SegData>>;
 
-// Segment data meter, measured by segment data bytes size
+/// Chunk data, a piece of segment data covered by a chunk
+pub type ChunkData = Arc<Vec<u8>>;
+
+// Chunk data meter, measured by chunk data bytes size
 #[derive(Debug, Default)]
-struct SegDataMeter;
+struct ChunkDataMeter;
 
-impl Meter<SegDataRef> for SegDataMeter {
-    fn measure(&self, item: &SegDataRef) -> isize {
-        let seg_data = item.read().unwrap();
-        seg_data.data.len() as isize
+impl Meter<ChunkData> for ChunkDataMeter {
+    #[inline]
+    fn measure(&self, item: &ChunkData) -> isize {
+        item.len() as isize
     }
 }
 
-// Segment data LRU
-type SegDataLru = Lru<Eid, SegDataRef, SegDataMeter, PinChecker<SegDataRef>>;
+// Chunk data LRU, keyed by segment data id and chunk index
+type ChunkDataLru =
+    Lru<(Eid, usize), ChunkData, ChunkDataMeter, PinChecker<ChunkData>>;
+
+/// Segment data reader
+///
+/// It reads a range of segment data directly from volume. The underlying
+/// volume reader is kept open, so reading consecutive ranges in the same
+/// segment data doesn't need to seek.
+#[derive(Debug, Default)]
+pub struct DataReader {
+    data_id: Eid,
+    rdr: Option<VolReader>,
+    pos: usize,
+}
+
+impl DataReader {
+    #[inline]
+    pub fn new() -> Self {
+        DataReader::default()
+    }
+
+    // Note: offset is in the segment data
+    fn read_exact_at(
+        &mut self,
+        dst: &mut [u8],
+        data_id: &Eid,
+        offset: usize,
+        vol: &VolumeRef,
+    ) -> Result<()> {
+        if self.rdr.is_none() || self.data_id != *data_id {
+            self.rdr = Some(VolReader::new(data_id, vol)?);
+            self.data_id = data_id.clone();
+            self.pos = 0;
+        }
+
+        let rdr = self.rdr.as_mut().unwrap();
+        if self.pos != offset {
+            self.pos = rdr.seek(SeekFrom::Start(offset as u64))? as usize;
+        }
+        rdr.read_exact(dst)?;
+        self.pos += dst.len();
+
+        Ok(())
+    }
+}
 
 /// Segment data cache
+///
+/// Segment data is cached in chunk granularity, only the chunks have been
+/// read are loaded from volume.
 #[derive(Debug, Clone, Default)]
 pub struct DataCache {
-    lru: Arc<RwLock<SegDataLru>>,
+    lru: Arc<RwLock<ChunkDataLru>>,
 }
 
 impl DataCache {
-    pub fn new(capacity: usize) -> Self {
+    pub fn new(capacity: usize, counters: &Arc<CacheCounters>) -> Self {
+        let mut lru = ChunkDataLru::new(capacity);
+        lru.set_counters(counters);
         DataCache {
-            lru: Arc::new(RwLock::new(SegDataLru::new(capacity))),
+            lru: Arc::new(RwLock::new(lru)),
         }
     }
 
-    pub fn get(&self, id: &Eid, vol: &VolumeRef) -> Result<SegDataRef> {
-        let mut lru = self.lru.write().unwrap();
-
-        // get from cache first
-        if let Some(val) = lru.get_refresh(id) {
-            return Ok(val.clone());
+    // read segment data from the offset, return bytes read which will not
+    // go beyond the end of chunk at that offset
+    //
+    // Note: only chunks in the range are searched, they must be in use.
+    // Orphan chunks keep their stale positions after shrinking, so the
+    // chunk list is not sorted by position as a whole.
+    pub fn read(
+        &self,
+        dst: &mut [u8],
+        offset: usize,
+        seg: &Segment,
+        chunks: Range<usize>,
+        rdr: &mut DataReader,
+        vol: &VolumeRef,
+    ) -> Result<usize> {
+        let idx = seg.locate_chunk(offset, chunks.clone());
+
+        // if destination covers whole chunks which are not in cache, read
+        // them straight from volume without going through cache
+        if offset == seg[idx].pos
+            && dst.len() >= seg[idx].len
+            && !self.contains(&seg.data_id, idx)
+        {
+            let mut read_len = seg[idx].len;
+            for chunk in seg.chunks[idx + 1..chunks.end].iter() {
+                if read_len + chunk.len > dst.len() {
+                    break;
+                }
+                read_len += chunk.len;
+            }
+            rdr.read_exact_at(&mut dst[..read_len], &seg.data_id, offset, vol)?;
+            return Ok(read_len);
         }
 
-        // if not in cache, load it from volume
-        // then insert into cache
-        let ent = SegData::load(id, vol)?.into_ref();
-        lru.insert(id.clone(), ent.clone());
+        let chunk_data = self.get_chunk(seg, idx, rdr, vol)?;
+        let begin = offset - seg[idx].pos;
+        let read_len = min(dst.len(), chunk_data.len() - begin);
+        dst[..read_len].copy_from_slice(&chunk_data[begin..begin + read_len]);
+        Ok(read_len)
+    }
 
-        Ok(ent)
+    // check if chunk is in cache, chunk not in cache will be read straight
+    // from volume so it is counted as a miss
+    #[inline]
+    fn contains(&self, data_id: &Eid, idx: usize) -> bool {
+        let lru = self.lru.read().unwrap();
+        let ret = lru.contains_key(&(data_id.clone(), idx));
+        if !ret {
+            lru.count_miss();
+        }
+        ret
     }
 
-    pub fn remove(&self, id: &Eid) -> Option<SegDataRef> {
+    fn get_chunk(
+        &self,
+        seg: &Segment,
+        idx: usize,
+        rdr: &mut DataReader,
+        vol: &VolumeRef,
+    ) -> Result<ChunkData> {
+        let key = (seg.data_id.clone(), idx);
+
+        // get from cache first
+        {
+            let mut lru = self.lru.write().unwrap();
+            if let Some(val) = lru.get_refresh(&key) {
+                return Ok(val.clone());
+            }
+        }
+
+        // if not in cache, load the chunk from volume without holding the
+        // cache lock, then insert it into cache
+        let chunk = &seg[idx];
+        let mut data = vec![0u8; chunk.len];
+        rdr.read_exact_at(&mut data, &seg.data_id, chunk.pos, vol)?;
+        let data = Arc::new(data);
         let mut lru = self.lru.write().unwrap();
-        lru.remove(id)
+        lru.insert(key, data.clone());
+
+        Ok(data)
     }
 
-    // remove deleted segment data from cache
-    pub fn remove_deleted(&self) {
+    // remove all chunks of the segment data from cache
+    pub fn remove(&self, data_id: &Eid) {
         let mut lru = self.lru.write().unwrap();
-        lru.entries()
-            .filter(|ent| {
-                let cow_ref = ent.get();
-                let cow = cow_ref.read().unwrap();
-                cow.in_trans() && cow.action() == Action::Delete
-            })
-            .for_each(|ent| {
-                ent.remove();
-            });
+        let keys: Vec<(Eid, usize)> = lru
+            .entries()
+            .filter(|ent| ent.key().0 == *data_id)
+            .map(|ent| ent.key().clone())
+            .collect();
+        for key in keys {
+            lru.remove(&key);
+        }
     }
 }
 
@@ -263,9 +372,21 @@ impl Segment {
         self.used < self.len >> 2
     }
 
+    // find index of the chunk in the range which covers the offset in
+    // segment data
+    fn locate_chunk(&self, offset: usize, range: Range<usize>) -> usize {
+        let chunks = &self.chunks[range.clone()];
+        let idx = match chunks.binary_search_by_key(&offset, |c| c.pos) {
+            Ok(idx) => idx,
+            Err(idx) => idx - 1,
+        };
+        assert!(offset < chunks[idx].end_pos());
+        range.start + idx
+    }
+
     // create a new chunk and append to segment
-    fn append_chunk(&mut self, data_len: usize) {
-        let chunk = Chunk::new(self.len, data_len);
+    fn append_chunk(&mut self, data_len: usize, hash: Option<&Hash>) {
+        let chunk = Chunk::new(self.len, data_len, hash);
         self.chunks.push(chunk);
         self.len += data_len;
     }
@@ -302,7 +423,14 @@ impl Segment {
     }
 
     // remove segment and its associated segment data
-    pub fn remove(seg_cow: &mut Cow<Segment>, txmgr: &TxMgrRef) -> Result<()> {
+    pub fn remove(
+        seg_cow: &mut Cow<Segment>,
+        store: &Store,
+        txmgr: &TxMgrRef,
+    ) -> Result<()> {
+        // segment data is going to be deleted, remove its chunks from cache
+        store.remove_segdata_from_cache(seg_cow.data_id());
+
         // add segment data to transaction for deletion
         SegData::add_to_trans(
             seg_cow.data_id(),
@@ -332,11 +460,13 @@ impl Segment {
             seg.data_id, seg.len, seg.used
         );
 
-        // load the segment data for shrinking, because it is going to be
-        // shrank we remove it from cache immediately
-        let seg_data_ref = {
-            store.get_segdata(seg.data_id())?;
-            store.remove_segdata_from_cache(seg.data_id()).unwrap()
+        // load the whole segment data for shrinking, because it is going to
+        // be shrank we remove its chunks from cache immediately
+        let vol = store.get_vol_weak();
+        let seg_data = {
+            let vol = vol.upgrade().ok_or(Error::RepoClosed)?;
+            store.remove_segdata_from_cache(seg.data_id());
+            SegData::load(seg.data_id(), &vol)?
         };
 
         // add the old segment data to transaction for deletion as it will
@@ -347,7 +477,6 @@ impl Segment {
         let mut retired = Vec::new();
 
         // start the actual shrink, firstly re-position chunks
-        let seg_data = seg_data_ref.read().unwrap();
         for (idx, chunk) in seg.chunks.iter_mut().enumerate() {
             if chunk.is_orphan() {
                 retired.push(idx);
@@ -364,7 +493,6 @@ impl Segment {
         // stub to transaction
         let new_data_id = Eid::new();
         let mut new_seg_data = SegData::new(&new_data_id);
-        let vol = store.get_vol_weak();
         new_seg_data.data = buf;
         new_seg_data.save(&vol)?;
         SegData::add_to_trans(&new_data_id, Action::New, txid, txmgr)?;
@@ -470,6 +598,12 @@ impl Writer {
         self.seg.clone()
     }
 
+    // check if current segment is removed in transaction
+    fn is_seg_removed(&self) -> bool {
+        let seg = self.seg.read().unwrap();
+        seg.in_trans() && seg.action() == Action::Delete
+    }
+
     pub fn renew(&mut self) -> Result<()> {
         let txmgr = self.txmgr.upgrade().ok_or(Error::RepoClosed)?;
 
@@ -497,12 +631,18 @@ impl Writer {
 
         Ok(())
     }
-}
 
-impl Write for Writer {
-    fn write(&mut self, chunk: &[u8]) -> IoResult<usize> {
-        // create segment and segment data if they are not created yet
-        if self.data_wtr.is_none() {
+    // write a whole chunk to segment, return 0 if segment is full, the
+    // chunk hash is kept in segment if it is given
+    pub fn write_chunk(
+        &mut self,
+        chunk: &[u8],
+        hash: Option<&Hash>,
+    ) -> IoResult<usize> {
+        // create segment and segment data if they are not created yet, or
+        // if the segment has been removed in this transaction, which can
+        // happen when a file written to it is deduped in a batch
+        if self.data_wtr.is_none() || self.is_seg_removed() {
             map_io_err!(self.renew())?;
         }
 
@@ -519,10 +659,17 @@ impl Write for Writer {
 
         // and then append chunk to segment
         let txmgr = map_io_err!(self.txmgr.upgrade().ok_or(Error::RepoClosed))?;
-        map_io_err!(seg.make_mut(&txmgr))?.append_chunk(chunk.len());
+        map_io_err!(seg.make_mut(&txmgr))?.append_chunk(chunk.len(), hash);
 
         Ok(chunk.len())
     }
+}
+
+impl Write for Writer {
+    #[inline]
+    fn write(&mut self, chunk: &[u8]) -> IoResult<usize> {
+        self.write_chunk(chunk, None)
+    }
 
     fn flush(&mut self) -> IoResult<()> {
         // nothing need to do here, use finish() to finish writing
@@ -597,7 +744,7 @@ mod tests {
     fn single_span() {
         let seg_id = Eid::new();
         let mut seg = Segment::new();
-        seg.append_chunk(10);
+        seg.append_chunk(10, None);
         let mut elst = EntryList::new();
         elst.append(&seg_id, &Span::new(0, 1, 0, 10, 0));
         test_split_off(&elst, &seg, &seg);
@@ -647,9 +794,9 @@ mod tests {
     fn multiple_spans() {
         let seg_id = Eid::new();
         let mut seg = Segment::new();
-        seg.append_chunk(5);
-        seg.append_chunk(5);
-        seg.append_chunk(5);
+        seg.append_chunk(5, None);
+        seg.append_chunk(5, None);
+        seg.append_chunk(5, None);
         let mut elst = EntryList::new();
         elst.append(&seg_id, &Span::new(0, 1, 0, 5, 0));
         elst.append(&seg_id, &Span::new(2, 3, 0, 5, 5));
@@ -734,14 +881,14 @@ mod tests {
         let seg_id = Eid::new();
         let seg2_id = Eid::new();
         let mut seg = Segment::new();
-        seg.append_chunk(5);
-        seg.append_chunk(5);
-        seg.append_chunk(5);
+        seg.append_chunk(5, None);
+        seg.append_chunk(5, None);
+        seg.append_chunk(5, None);
         let mut seg2 = Segment::new();
-        seg2.append_chunk(5);
-        seg2.append_chunk(5);
-        seg2.append_chunk(5);
-        seg2.append_chunk(5);
+        seg2.append_chunk(5, None);
+        seg2.append_chunk(5, None);
+        seg2.append_chunk(5, None);
+        seg2.append_chunk(5, None);
         let mut elst = EntryList::new();
         elst.append(&seg_id, &Span::new(0, 1, 0, 5, 0));
         elst.append(&seg_id, &Span::new(2, 3, 0, 5, 5));
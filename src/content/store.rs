@@ -1,18 +1,22 @@
 use std::collections::HashMap;
 use std::fmt::{self, Debug};
 use std::io::{Result as IoResult, Seek, SeekFrom, Write};
+use std::ops::Range;
 use std::sync::Arc;
 
-use super::chunk::ChunkMap;
-use super::chunker::{Chunker, ChunkerParams};
+use super::chunk::{ChunkIndex, ChunkIndexRef, ChunkLoc, ChunkMap};
+use super::chunker::{Chunker, ChunkerParams, Chunking};
 use super::content::{
     Cache as ContentCache, ContentRef, Writer as ContentWriter,
 };
 use super::segment::{
-    Cache as SegCache, DataCache as SegDataCache, SegDataRef, SegRef,
+    Cache as SegCache, DataCache as SegDataCache, DataReader as SegDataReader,
+    SegRef, Segment, Writer as SegWriter,
 };
 use super::Content;
 use base::crypto::Hash;
+use base::metrics::MetricsRef;
+use base::thread_pool::ThreadPool;
 use base::RefCnt;
 use error::{Error, Result};
 use trans::cow::{Cow, CowRef, CowWeakRef, Cowable, IntoCow};
@@ -52,6 +56,13 @@ pub struct Store {
     dedup_file: bool,
     content_map: HashMap<Hash, ContentMapEntry>,
 
+    // repo-wide chunk index id, empty if chunk index is not enabled
+    #[serde(default)]
+    chunk_index_id: Eid,
+
+    #[serde(skip_serializing, skip_deserializing, default)]
+    chunk_index: Option<ChunkIndexRef>,
+
     #[serde(skip_serializing, skip_deserializing, default)]
     content_cache: ContentCache,
 
@@ -61,11 +72,17 @@ pub struct Store {
     #[serde(skip_serializing, skip_deserializing, default)]
     segdata_cache: SegDataCache,
 
+    #[serde(skip_serializing, skip_deserializing, default)]
+    hash_pool: Option<Arc<ThreadPool>>,
+
     #[serde(skip_serializing, skip_deserializing, default)]
     txmgr: TxMgrRef,
 
     #[serde(skip_serializing, skip_deserializing, default)]
     vol: VolumeRef,
+
+    #[serde(skip_serializing, skip_deserializing, default)]
+    metrics: MetricsRef,
 }
 
 impl Store {
@@ -78,17 +95,44 @@ impl Store {
     // default content cache size
     const CONTENT_CACHE_SIZE: usize = 16;
 
-    pub fn new(dedup_file: bool, txmgr: &TxMgrRef, vol: &VolumeRef) -> Self {
-        Store {
-            chunker_params: ChunkerParams::new(),
+    pub fn new(
+        dedup_file: bool,
+        chunk_index: bool,
+        chunking: Chunking,
+        txmgr: &TxMgrRef,
+        vol: &VolumeRef,
+    ) -> Result<Self> {
+        let metrics = vol.read().unwrap().metrics();
+
+        // chunk index is a separate entity, so it must be created in
+        // a transaction along with the store
+        let chunk_index = if chunk_index {
+            Some(ChunkIndex::new(true).into_cow(txmgr)?)
+        } else {
+            None
+        };
+        let chunk_index_id =
+            chunk_index.as_ref().map_or_else(Eid::new_empty, |idx| {
+                idx.read().unwrap().id().clone()
+            });
+
+        Ok(Store {
+            chunker_params: ChunkerParams::new(chunking),
             dedup_file,
             content_map: HashMap::new(),
+            chunk_index_id,
+            chunk_index,
             content_cache: ContentCache::new(Self::CONTENT_CACHE_SIZE),
             seg_cache: SegCache::new(Self::SEG_CACHE_SIZE),
-            segdata_cache: SegDataCache::new(Self::SEG_DATA_CACHE_SIZE),
+            segdata_cache: SegDataCache::new(
+                Self::SEG_DATA_CACHE_SIZE,
+                &metrics.data_cache,
+            ),
+            hash_pool: None,
             txmgr: txmgr.clone(),
             vol: vol.clone(),
-        }
+            metrics,
+        })
     }
 
     pub fn open(
@@ -102,13 +146,39 @@ impl Store {
             let store = store_cow.make_mut_naive();
             store.content_cache = ContentCache::new(Self::CONTENT_CACHE_SIZE);
             store.seg_cache = SegCache::new(Self::SEG_CACHE_SIZE);
-            store.segdata_cache = SegDataCache::new(Self::SEG_DATA_CACHE_SIZE);
+            store.metrics = vol.read().unwrap().metrics();
+            store.segdata_cache = SegDataCache::new(
+                Self::SEG_DATA_CACHE_SIZE,
+                &store.metrics.data_cache,
+            );
+            if !store.chunk_index_id.is_empty() {
+                let chunk_index =
+                    Cow::<ChunkIndex>::load(&store.chunk_index_id, vol)?;
+                chunk_index.write().unwrap().make_mut_naive().init_cache();
+                store.chunk_index = Some(chunk_index);
+            }
             store.txmgr = txmgr.clone();
             store.vol = vol.clone();
         }
         Ok(store)
     }
 
+    // set number of threads for chunk hashing in content writer, 0 means
+    // hashing is done in the writing thread
+    pub fn set_hash_workers(&mut self, workers: usize) -> Result<()> {
+        self.hash_pool = if workers > 0 {
+            Some(Arc::new(ThreadPool::new("zbox-hash", workers)?))
+        } else {
+            None
+        };
+        Ok(())
+    }
+
+    #[inline]
+    pub fn metrics(&self) -> &MetricsRef {
+        &self.metrics
+    }
+
     #[inline]
     pub fn get_vol_weak(&self) -> VolumeWeakRef {
         Arc::downgrade(&self.vol)
@@ -125,25 +195,76 @@ impl Store {
         self.seg_cache.insert(seg)
     }
 
+    // read segment data at offset, return bytes read which will not go
+    // beyond the chunk at that offset, the offset must be covered by the
+    // chunks range
     #[inline]
-    pub fn get_segdata(&self, segdata_id: &Eid) -> Result<SegDataRef> {
-        self.segdata_cache.get(segdata_id, &self.vol)
+    pub fn read_segdata(
+        &self,
+        dst: &mut [u8],
+        offset: usize,
+        seg: &Segment,
+        chunks: Range<usize>,
+        rdr: &mut SegDataReader,
+    ) -> Result<usize> {
+        self.segdata_cache
+            .read(dst, offset, seg, chunks, rdr, &self.vol)
     }
 
     #[inline]
-    pub fn remove_segdata_from_cache(
-        &self,
-        segdata_id: &Eid,
-    ) -> Option<SegDataRef> {
+    pub fn remove_segdata_from_cache(&self, segdata_id: &Eid) {
         self.segdata_cache.remove(segdata_id)
     }
 
+    #[inline]
+    pub fn is_chunk_indexed(&self) -> bool {
+        self.chunk_index.is_some()
+    }
+
+    // find chunk location in repo-wide chunk index, the chunk could have
+    // been retired so it should be validated by caller
+    #[inline]
+    pub fn find_chunk(&self, hash: &Hash) -> Result<Option<ChunkLoc>> {
+        match self.chunk_index {
+            Some(ref chunk_index) => {
+                chunk_index.read().unwrap().get(hash, &self.vol)
+            }
+            None => Ok(None),
+        }
+    }
+
+    /// Update repo-wide chunk index, empty location removes the chunk
+    ///
+    /// Only the chunk index is added to transaction, the store itself is
+    /// not changed.
+    pub fn update_chunk_index(
+        store: &StoreRef,
+        updates: &[(Hash, Option<ChunkLoc>)],
+    ) -> Result<()> {
+        let store = store.read().unwrap();
+
+        let chunk_index = match store.chunk_index {
+            Some(ref chunk_index) if !updates.is_empty() => chunk_index,
+            _ => return Ok(()),
+        };
+
+        let mut chunk_index = chunk_index.write().unwrap();
+        let chunk_index = chunk_index.make_mut(&store.txmgr)?;
+        for (hash, loc) in updates.iter() {
+            chunk_index.insert(hash, loc.clone(), &store.txmgr, &store.vol)?;
+        }
+        Ok(())
+    }
+
     #[inline]
     pub fn get_content(&self, content_id: &Eid) -> Result<ContentRef> {
         self.content_cache.get(content_id, &self.vol)
     }
 
     /// Dedup content based on its hash
+    ///
+    /// New content is put in content cache, so it can be found by id in
+    /// the same transaction before it is committed.
     pub fn dedup_content(
         store: &StoreRef,
         content: &Content,
@@ -152,6 +273,7 @@ impl Store {
 
         if !store.dedup_file {
             let ctn = content.clone().into_cow(&store.txmgr)?;
+            store.content_cache.insert(&ctn);
             let ctn = ctn.read().unwrap();
             return Ok((true, ctn.id().clone()));
         }
@@ -168,9 +290,12 @@ impl Store {
         if ent.content_id.is_empty() {
             // no duplication found
             let ctn = content.clone().into_cow(&txmgr)?;
+            store.content_cache.insert(&ctn);
             let ctn = ctn.read().unwrap();
             ent.content_id = ctn.id().clone();
             no_dup = true;
+        } else {
+            store.metrics.add_content_dedup();
         }
         Ok((no_dup, ent.content_id.clone()))
     }
@@ -213,6 +338,7 @@ impl Debug for Store {
         f.debug_struct("Store")
             .field("dedup_file", &self.dedup_file)
             .field("content_map", &self.content_map)
+            .field("chunk_index", &self.chunk_index)
             .finish()
     }
 }
@@ -222,7 +348,6 @@ impl Cowable for Store {
         // remove deleted objects from cache
         self.content_cache.remove_deleted();
         self.seg_cache.remove_deleted();
-        self.segdata_cache.remove_deleted();
         Ok(())
     }
 }
@@ -240,18 +365,44 @@ pub struct Writer {
 }
 
 impl Writer {
+    #[inline]
     pub fn new(
         txid: Txid,
         chk_map: ChunkMap,
         txmgr: &TxMgrWeakRef,
         store: &StoreWeakRef,
     ) -> Result<Self> {
-        let (params, vol) = {
+        Self::with_seg_writer(txid, chk_map, None, txmgr, store)
+    }
+
+    /// Create writer with an existing segment writer
+    pub fn with_seg_writer(
+        txid: Txid,
+        chk_map: ChunkMap,
+        seg_wtr: Option<SegWriter>,
+        txmgr: &TxMgrWeakRef,
+        store: &StoreWeakRef,
+    ) -> Result<Self> {
+        let (params, hash_pool, use_index, vol) = {
             let store = store.upgrade().ok_or(Error::RepoClosed)?;
             let store = store.read().unwrap();
-            (store.chunker_params.clone(), Arc::downgrade(&store.vol))
+            (
+                store.chunker_params.clone(),
+                store.hash_pool.clone(),
+                chk_map.is_enabled() && store.is_chunk_indexed(),
+                Arc::downgrade(&store.vol),
+            )
         };
-        let ctn_wtr = ContentWriter::new(txid, chk_map, store, txmgr, &vol);
+        let ctn_wtr = ContentWriter::new(
+            txid,
+            chk_map,
+            use_index,
+            store,
+            seg_wtr,
+            txmgr,
+            &vol,
+            hash_pool.as_ref(),
+        );
         Ok(Writer {
             inner: Chunker::new(params, ctn_wtr),
         })
@@ -261,6 +412,12 @@ impl Writer {
         let ctn_wtr = self.inner.into_inner()?;
         ctn_wtr.finish()
     }
+
+    /// Finish writer and return the segment writer still open
+    pub fn finish_shared(self) -> Result<(Content, ChunkMap, SegWriter)> {
+        let ctn_wtr = self.inner.into_inner()?;
+        ctn_wtr.finish_shared()
+    }
 }
 
 impl Write for Writer {
@@ -1,6 +1,8 @@
 use std::error::Error as StdError;
 use std::fmt::{self, Debug};
-use std::io::{self, Error as IoError, ErrorKind, Read, Seek, SeekFrom, Write};
+use std::io::{
+    self, Error as IoError, ErrorKind, IoSliceMut, Read, Seek, SeekFrom, Write,
+};
 
 use super::{Error, Result};
 use fs::fnode::{
@@ -46,6 +48,11 @@ impl Read for VersionReader {
     fn read(&mut self, buf: &mut [u8]) -> io::Result<usize> {
         self.rdr.read(buf)
     }
+
+    #[inline]
+    fn read_to_end(&mut self, buf: &mut Vec<u8>) -> io::Result<usize> {
+        self.rdr.read_to_end(buf)
+    }
 }
 
 impl Seek for VersionReader {
@@ -398,6 +405,62 @@ impl File {
         VersionReader::new(&self.handle, ver_num)
     }
 
+    /// Reads bytes of current version content starting from the offset.
+    ///
+    /// Returns the number of bytes read, which is less than the buffer
+    /// length only if the end of content is reached.
+    ///
+    /// Unlike [`Read`], this method doesn't use or change the file cursor,
+    /// so it can be called concurrently on a shared `File` from multiple
+    /// threads.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// # use zbox::{init_env, Result, RepoOpener};
+    /// # fn foo() -> Result<()> {
+    /// # init_env();
+    /// # let mut repo = RepoOpener::new().create(true).open("mem://foo", "pwd")?;
+    /// let mut file = repo.create_file("/foo.txt")?;
+    /// file.write_once(b"Hello, world!")?;
+    ///
+    /// let mut buf = [0u8; 5];
+    /// file.read_at(&mut buf, 7)?;
+    /// assert_eq!(&buf, b"world");
+    /// # Ok(())
+    /// # }
+    /// # foo().unwrap();
+    /// ```
+    ///
+    /// [`Read`]: https://doc.rust-lang.org/std/io/trait.Read.html
+    #[inline]
+    pub fn read_at(&self, buf: &mut [u8], offset: u64) -> Result<usize> {
+        self.read_vectored_at(&mut [IoSliceMut::new(buf)], offset)
+    }
+
+    /// Like [`read_at`], except that it reads into a slice of buffers.
+    ///
+    /// Buffers are filled in order, a buffer is only read into if all the
+    /// previous buffers are full.
+    ///
+    /// [`read_at`]: struct.File.html#method.read_at
+    pub fn read_vectored_at(
+        &self,
+        bufs: &mut [IoSliceMut],
+        offset: u64,
+    ) -> Result<usize> {
+        self.check_closed()?;
+        if !self.can_read {
+            return Err(Error::CannotRead);
+        }
+        Fnode::read_vectored_at(
+            &self.handle.fnode,
+            bufs,
+            offset as usize,
+            &self.handle.store,
+        )
+    }
+
     // calculate the seek position from the start based on file current size
     fn seek_pos(&self, pos: SeekFrom) -> SeekFrom {
         let curr_len = self.curr_len();
@@ -466,6 +529,24 @@ impl File {
         Ok(())
     }
 
+    // prepare reader for reading, create a new reader if it is not created
+    // yet and seek to the current file position
+    fn prepare_read(&mut self) -> io::Result<()> {
+        map_io_err!(self.check_closed())?;
+        if !self.can_read {
+            return Err(IoError::new(
+                ErrorKind::Other,
+                Error::CannotRead.description(),
+            ));
+        }
+
+        if self.rdr.is_none() {
+            map_io_err!(self.renew_reader())?;
+        }
+
+        Ok(())
+    }
+
     /// Complete multi-part write to file and create a new version.
     ///
     /// This method will try to commit the transaction internally, no data will
@@ -579,19 +660,7 @@ impl File {
 
 impl Read for File {
     fn read(&mut self, buf: &mut [u8]) -> io::Result<usize> {
-        map_io_err!(self.check_closed())?;
-        if !self.can_read {
-            return Err(IoError::new(
-                ErrorKind::Other,
-                Error::CannotRead.description(),
-            ));
-        }
-
-        // if reader is not created yet, create a new reader and seek to
-        // the current file position
-        if self.rdr.is_none() {
-            map_io_err!(self.renew_reader())?;
-        }
+        self.prepare_read()?;
 
         match self.rdr {
             Some(ref mut rdr) => {
@@ -603,6 +672,20 @@ impl Read for File {
             None => unreachable!(),
         }
     }
+
+    fn read_to_end(&mut self, buf: &mut Vec<u8>) -> io::Result<usize> {
+        self.prepare_read()?;
+
+        match self.rdr {
+            Some(ref mut rdr) => {
+                let result = rdr.read_to_end(buf);
+                let new_pos = rdr.seek(SeekFrom::Current(0)).unwrap();
+                self.pos = SeekFrom::Start(new_pos);
+                result
+            }
+            None => unreachable!(),
+        }
+    }
 }
 
 impl Write for File {
@@ -0,0 +1,156 @@
+use std::fmt::{self, Debug};
+use std::path::{Path, PathBuf};
+use std::sync::{Arc, Mutex};
+
+use super::fnode::{FnodeRef, FnodeWeakRef};
+use base::lru::{CountMeter, Lru, PinChecker};
+
+type PosLru = Lru<
+    PathBuf,
+    FnodeWeakRef,
+    CountMeter<FnodeWeakRef>,
+    PinChecker<FnodeWeakRef>,
+>;
+type NegLru = Lru<PathBuf, (), CountMeter<()>, PinChecker<()>>;
+
+/// Look up result in dentry cache
+pub enum Dentry {
+    /// Path is resolved to the fnode
+    Found(FnodeRef),
+
+    /// Path is known to be not existing
+    Missing,
+}
+
+/// Dentry cache
+///
+/// This is a cache from absolute path to resolved fnode, so a path can be
+/// resolved without walking through each of its components. Paths which
+/// don't exist are also cached as negative entries.
+///
+/// Only weak references to fnodes are kept, thus this cache doesn't extend
+/// fnode life time, a dead entry is treated as a cache miss. The file system
+/// must invalidate related entries when a path is created, removed or
+/// renamed.
+pub struct DentryCache {
+    pos: Option<Mutex<PosLru>>,
+    neg: Option<Mutex<NegLru>>,
+}
+
+impl DentryCache {
+    pub fn new(pos_capacity: usize, neg_capacity: usize) -> Self {
+        DentryCache {
+            pos: if pos_capacity > 0 {
+                Some(Mutex::new(Lru::new(pos_capacity)))
+            } else {
+                None
+            },
+            neg: if neg_capacity > 0 {
+                Some(Mutex::new(Lru::new(neg_capacity)))
+            } else {
+                None
+            },
+        }
+    }
+
+    /// Look up path in the cache
+    pub fn get(&self, path: &Path) -> Option<Dentry> {
+        if let Some(ref pos) = self.pos {
+            let mut pos = pos.lock().unwrap();
+            if let Some(fnode) = pos.get_refresh(path).and_then(|w| w.upgrade())
+            {
+                return Some(Dentry::Found(fnode));
+            }
+        }
+        if let Some(ref neg) = self.neg {
+            let mut neg = neg.lock().unwrap();
+            if neg.get_refresh(path).is_some() {
+                return Some(Dentry::Missing);
+            }
+        }
+        None
+    }
+
+    /// Find the nearest cached ancestor of path, excluding root
+    ///
+    /// Return the ancestor fnode and its number of path components.
+    pub fn get_ancestor(&self, path: &Path) -> Option<(FnodeRef, usize)> {
+        let pos = match self.pos {
+            Some(ref pos) => pos,
+            None => return None,
+        };
+        let mut pos = pos.lock().unwrap();
+        for ancestor in path.ancestors().skip(1) {
+            if ancestor.parent().is_none() {
+                break;
+            }
+            if let Some(fnode) =
+                pos.get_refresh(ancestor).and_then(|w| w.upgrade())
+            {
+                return Some((fnode, ancestor.components().count()));
+            }
+        }
+        None
+    }
+
+    /// Add a resolved path
+    pub fn insert(&self, path: &Path, fnode: &FnodeRef) {
+        if let Some(ref pos) = self.pos {
+            let mut pos = pos.lock().unwrap();
+            pos.insert(path.to_path_buf(), Arc::downgrade(fnode));
+        }
+    }
+
+    /// Add a not existing path
+    pub fn insert_missing(&self, path: &Path) {
+        if let Some(ref neg) = self.neg {
+            let mut neg = neg.lock().unwrap();
+            neg.insert(path.to_path_buf(), ());
+        }
+    }
+
+    /// Remove entries of the path
+    pub fn remove(&self, path: &Path) {
+        if let Some(ref pos) = self.pos {
+            pos.lock().unwrap().remove(path);
+        }
+        if let Some(ref neg) = self.neg {
+            neg.lock().unwrap().remove(path);
+        }
+    }
+
+    /// Remove entries of the path and all its descendants
+    pub fn remove_tree(&self, path: &Path) {
+        if let Some(ref pos) = self.pos {
+            let mut pos = pos.lock().unwrap();
+            let keys = Self::descendants(pos.keys(), path);
+            for key in keys {
+                pos.remove(&key);
+            }
+        }
+        if let Some(ref neg) = self.neg {
+            let mut neg = neg.lock().unwrap();
+            let keys = Self::descendants(neg.keys(), path);
+            for key in keys {
+                neg.remove(&key);
+            }
+        }
+    }
+
+    // collect keys which are the path or under the path
+    fn descendants<'a, I>(keys: I, path: &Path) -> Vec<PathBuf>
+    where
+        I: Iterator<Item = &'a PathBuf>,
+    {
+        keys.filter(|key| key.starts_with(path)).cloned().collect()
+    }
+}
+
+impl Debug for DentryCache {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        f.debug_struct("DentryCache")
+            .field("pos", &self.pos.is_some())
+            .field("neg", &self.neg.is_some())
+            .finish()
+    }
+}
@@ -0,0 +1,276 @@
+use std::fmt::{self, Debug};
+
+use super::fnode::FileType;
+use error::{Error, Result};
+use trans::cow::{CowCache, Cowable, IntoCow};
+use trans::{Eid, Id, TxMgrRef};
+use volume::VolumeRef;
+
+// fnode child entry
+#[derive(Debug, Clone, Deserialize, Serialize)]
+pub struct ChildEntry {
+    pub id: Eid,
+    pub ftype: FileType,
+    pub name: String,
+}
+
+impl ChildEntry {
+    pub fn new(id: &Eid, ftype: FileType, name: &str) -> Self {
+        ChildEntry {
+            id: id.clone(),
+            ftype,
+            name: name.to_string(),
+        }
+    }
+}
+
+/// Directory children shard
+///
+/// A block of child entries sorted by name, it is saved as a separate
+/// entity so it can be updated independently.
+#[derive(Debug, Default, Clone, Deserialize, Serialize)]
+pub struct DirShard {
+    kids: Vec<ChildEntry>,
+}
+
+impl DirShard {
+    #[inline]
+    fn search(&self, name: &str) -> ::std::result::Result<usize, usize> {
+        self.kids
+            .binary_search_by(|kid| kid.name.as_str().cmp(name))
+    }
+
+    #[inline]
+    pub fn kids(&self) -> &[ChildEntry] {
+        &self.kids
+    }
+}
+
+impl Cowable for DirShard {}
+
+impl<'de> IntoCow<'de> for DirShard {}
+
+// directory shard info, saved in the directory fnode
+#[derive(Debug, Clone, Deserialize, Serialize)]
+struct ShardInfo {
+    id: Eid,
+    first: String, // the smallest child name in the shard
+    cnt: usize,
+}
+
+/// Directory children index
+///
+/// Children of a large directory are split into shards sorted by name, and
+/// this index keeps the first name of each shard. Looking up a child only
+/// needs to load one shard, and adding or removing a child only rewrites
+/// one shard besides the index.
+///
+/// Shards are split when they are full and removed when they are empty.
+/// An empty index means the directory children are kept inline in the
+/// fnode.
+#[derive(Clone, Deserialize, Serialize)]
+pub struct DirIndex {
+    shards: Vec<ShardInfo>,
+    cnt: usize,
+
+    #[serde(
+        skip_serializing,
+        skip_deserializing,
+        default = "DirIndex::default_cache"
+    )]
+    cache: CowCache<DirShard>,
+}
+
+impl DirIndex {
+    // max number of child entries in a shard, a full shard is split into
+    // two halves
+    const SHARD_CAPACITY: usize = 1024;
+
+    // number of shards cached in each directory
+    const SHARD_CACHE_SIZE: usize = 4;
+
+    #[inline]
+    fn default_cache() -> CowCache<DirShard> {
+        CowCache::new(Self::SHARD_CACHE_SIZE)
+    }
+
+    /// Build index from inline child entries
+    pub fn build(
+        &mut self,
+        mut kids: Vec<ChildEntry>,
+        txmgr: &TxMgrRef,
+    ) -> Result<()> {
+        assert!(self.shards.is_empty());
+        kids.sort_by(|a, b| a.name.cmp(&b.name));
+        self.cnt = kids.len();
+
+        for chunk in kids.chunks(Self::SHARD_CAPACITY / 2) {
+            let shard = DirShard {
+                kids: chunk.to_vec(),
+            };
+            self.add_shard(self.shards.len(), shard, txmgr)?;
+        }
+
+        Ok(())
+    }
+
+    #[inline]
+    pub fn is_empty(&self) -> bool {
+        self.shards.is_empty()
+    }
+
+    #[inline]
+    pub fn len(&self) -> usize {
+        self.cnt
+    }
+
+    #[inline]
+    pub fn shard_cnt(&self) -> usize {
+        self.shards.len()
+    }
+
+    // locate the shard which may contain the name
+    fn locate(&self, name: &str) -> usize {
+        match self
+            .shards
+            .binary_search_by(|shard| shard.first.as_str().cmp(name))
+        {
+            Ok(idx) => idx,
+            Err(0) => 0,
+            Err(idx) => idx - 1,
+        }
+    }
+
+    // save a new shard and insert its info at the position
+    fn add_shard(
+        &mut self,
+        idx: usize,
+        shard: DirShard,
+        txmgr: &TxMgrRef,
+    ) -> Result<()> {
+        let first = shard.kids[0].name.clone();
+        let cnt = shard.kids.len();
+        let shard_ref = shard.into_cow(txmgr)?;
+        let id = shard_ref.read().unwrap().id().clone();
+        self.shards.insert(idx, ShardInfo { id, first, cnt });
+        self.cache.insert(&shard_ref);
+        Ok(())
+    }
+
+    /// Get a shard by its index
+    pub fn shard(&self, idx: usize, vol: &VolumeRef) -> Result<DirShard> {
+        let shard_ref = self.cache.get(&self.shards[idx].id, vol)?;
+        let shard = shard_ref.read().unwrap();
+        Ok(DirShard::clone(&shard))
+    }
+
+    /// Find a child entry by name
+    pub fn get(
+        &self,
+        name: &str,
+        vol: &VolumeRef,
+    ) -> Result<Option<ChildEntry>> {
+        if self.shards.is_empty() || name < self.shards[0].first.as_str() {
+            return Ok(None);
+        }
+        let idx = self.locate(name);
+        let shard_ref = self.cache.get(&self.shards[idx].id, vol)?;
+        let shard = shard_ref.read().unwrap();
+        Ok(shard.search(name).ok().map(|pos| shard.kids[pos].clone()))
+    }
+
+    /// Insert a child entry
+    pub fn insert(
+        &mut self,
+        kid: ChildEntry,
+        txmgr: &TxMgrRef,
+        vol: &VolumeRef,
+    ) -> Result<()> {
+        let idx = self.locate(&kid.name);
+        let shard_ref = self.cache.get(&self.shards[idx].id, vol)?;
+        let mut shard_cow = shard_ref.write().unwrap();
+        let shard = shard_cow.make_mut(txmgr)?;
+
+        let pos = match shard.search(&kid.name) {
+            Ok(_) => return Err(Error::AlreadyExists),
+            Err(pos) => pos,
+        };
+        if pos == 0 {
+            self.shards[idx].first = kid.name.clone();
+        }
+        shard.kids.insert(pos, kid);
+        self.shards[idx].cnt += 1;
+        self.cnt += 1;
+
+        // split the shard if it is full
+        if shard.kids.len() > Self::SHARD_CAPACITY {
+            let half = shard.kids.len() / 2;
+            let split = DirShard {
+                kids: shard.kids.split_off(half),
+            };
+            self.shards[idx].cnt = shard.kids.len();
+            self.add_shard(idx + 1, split, txmgr)?;
+        }
+
+        Ok(())
+    }
+
+    /// Remove child entry by name and id
+    pub fn remove(
+        &mut self,
+        name: &str,
+        id: &Eid,
+        txmgr: &TxMgrRef,
+        vol: &VolumeRef,
+    ) -> Result<()> {
+        if self.shards.is_empty() {
+            return Err(Error::NotFound);
+        }
+        let idx = self.locate(name);
+        let shard_ref = self.cache.get(&self.shards[idx].id, vol)?;
+        let mut shard_cow = shard_ref.write().unwrap();
+        let shard_id = shard_cow.id().clone();
+        let shard = shard_cow.make_mut(txmgr)?;
+
+        let pos = match shard.search(name) {
+            Ok(pos) if shard.kids[pos].id == *id => pos,
+            _ => return Err(Error::NotFound),
+        };
+        shard.kids.remove(pos);
+        self.cnt -= 1;
+
+        // remove the whole shard if it is empty
+        if shard.kids.is_empty() {
+            shard_cow.make_del(txmgr)?;
+            self.cache.remove(&shard_id);
+            self.shards.remove(idx);
+            return Ok(());
+        }
+
+        if pos == 0 {
+            self.shards[idx].first = shard.kids[0].name.clone();
+        }
+        self.shards[idx].cnt -= 1;
+
+        Ok(())
+    }
+}
+
+impl Default for DirIndex {
+    fn default() -> Self {
+        DirIndex {
+            shards: Vec::new(),
+            cnt: 0,
+            cache: Self::default_cache(),
+        }
+    }
+}
+
+impl Debug for DirIndex {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        f.debug_struct("DirIndex")
+            .field("shards", &self.shards.len())
+            .field("cnt", &self.cnt)
+            .finish()
+    }
+}
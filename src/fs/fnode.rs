@@ -3,16 +3,18 @@
 use std::cmp::min;
 use std::collections::VecDeque;
 use std::fmt::{self, Debug};
-use std::io::{Read, Result as IoResult, Seek, SeekFrom, Write};
+use std::io::{IoSliceMut, Read, Result as IoResult, Seek, SeekFrom, Write};
+use std::mem;
 use std::path::{Path, PathBuf};
-use std::sync::Arc;
+use std::sync::{Arc, Mutex};
 use std::time::SystemTime;
 
+use super::dir_index::{ChildEntry, DirIndex};
 use super::{Handle, Options};
 use base::lru::{CountMeter, Lru, PinChecker};
 use base::Time;
 use content::{
-    ChunkMap, Content, ContentReader, Store, StoreRef, StoreWeakRef,
+    ChunkMap, Content, ContentReader, SegWriter, Store, StoreRef, StoreWeakRef,
     Writer as StoreWriter,
 };
 use error::{Error, Result};
@@ -24,6 +26,10 @@ use volume::VolumeRef;
 // maximum sub nodes for a fnode
 const SUB_NODES_CNT: usize = 8;
 
+// maximum number of children kept inline in a directory fnode, more
+// children will be moved to directory index
+const INLINE_KIDS_MAX: usize = 256;
+
 /// A structure representing a type of file with accessors for each file type.
 #[derive(Debug, Copy, Clone, PartialEq, Deserialize, Serialize)]
 pub enum FileType {
@@ -67,24 +73,6 @@ impl Into<String> for FileType {
     }
 }
 
-// fnode child entry
-#[derive(Debug, Clone, Deserialize, Serialize)]
-struct ChildEntry {
-    id: Eid,
-    ftype: FileType,
-    name: String,
-}
-
-impl ChildEntry {
-    fn new(id: &Eid, ftype: FileType, name: &str) -> Self {
-        ChildEntry {
-            id: id.clone(),
-            ftype,
-            name: name.to_string(),
-        }
-    }
-}
-
 /// A representation of a permanent file content.
 #[derive(Debug, Default, Clone, Deserialize, Serialize)]
 pub struct Version {
@@ -209,13 +197,78 @@ impl DirEntry {
     }
 }
 
-type SubNodes = Lru<
+type SubNodesLru = Lru<
     String,
     FnodeWeakRef,
     CountMeter<FnodeWeakRef>,
     PinChecker<FnodeWeakRef>,
 >;
 
+// sub node list, it is behind its own lock so loaded children can be added
+// while the fnode is only locked for reading
+struct SubNodes(Mutex<SubNodesLru>);
+
+impl SubNodes {
+    fn new() -> Self {
+        SubNodes(Mutex::new(Lru::new(SUB_NODES_CNT)))
+    }
+
+    fn get(&self, name: &str) -> Option<FnodeRef> {
+        let mut lru = self.0.lock().unwrap();
+        lru.get_refresh(name).and_then(|sub| sub.upgrade())
+    }
+
+    fn insert(&self, name: &str, fnode: &FnodeRef) {
+        let mut lru = self.0.lock().unwrap();
+        lru.insert(name.to_string(), Arc::downgrade(fnode));
+    }
+
+    fn remove(&self, name: &str) {
+        let mut lru = self.0.lock().unwrap();
+        lru.remove(name);
+    }
+
+    // remove sub nodes deleted in transaction
+    fn remove_deleted(&self) {
+        let mut lru = self.0.lock().unwrap();
+        let deleted: Vec<String> = lru
+            .iter()
+            .filter(|&(_, sub)| {
+                sub.upgrade()
+                    .map(|fnode_ref| {
+                        let cow = fnode_ref.read().unwrap();
+                        cow.in_trans() && cow.action() == Action::Delete
+                    })
+                    .unwrap_or(false)
+            })
+            .map(|(name, _)| name.clone())
+            .collect();
+        for name in deleted {
+            lru.remove(&name);
+        }
+    }
+}
+
+impl Default for SubNodes {
+    #[inline]
+    fn default() -> Self {
+        SubNodes::new()
+    }
+}
+
+impl Clone for SubNodes {
+    fn clone(&self) -> Self {
+        let lru = self.0.lock().unwrap();
+        SubNodes(Mutex::new(lru.clone()))
+    }
+}
+
+impl Debug for SubNodes {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        self.0.lock().unwrap().fmt(f)
+    }
+}
+
 /// File node
 #[derive(Default, Clone, Deserialize, Serialize)]
 pub struct Fnode {
@@ -227,15 +280,16 @@ pub struct Fnode {
     vers: VecDeque<Version>,
     chk_map: ChunkMap,
 
+    // children index for large directory, fnodes saved by earlier versions
+    // don't have it
+    #[serde(default)]
+    kid_index: DirIndex,
+
     // parent fnode
     #[serde(skip_serializing, skip_deserializing, default)]
     parent: Option<FnodeRef>,
 
-    #[serde(
-        skip_serializing,
-        skip_deserializing,
-        default = "Fnode::default_sub_nodes"
-    )]
+    #[serde(skip_serializing, skip_deserializing, default)]
     sub_nodes: SubNodes,
 }
 
@@ -249,8 +303,9 @@ impl Fnode {
             kids: Vec::new(),
             vers: VecDeque::new(),
             chk_map: ChunkMap::new(opts.dedup_chunk),
+            kid_index: DirIndex::default(),
             parent: None,
-            sub_nodes: Self::default_sub_nodes(),
+            sub_nodes: SubNodes::new(),
         }
     }
 
@@ -280,14 +335,46 @@ impl Fnode {
         };
 
         // add child to parent
-        Fnode::add_child(parent, &kid, name, txmgr)?;
+        let vol = store.read().unwrap().get_vol_weak();
+        let vol = vol.upgrade().ok_or(Error::RepoClosed)?;
+        Fnode::add_child(parent, &kid, name, txmgr, &vol)?;
 
         Ok(kid)
     }
 
-    #[inline]
-    fn default_sub_nodes() -> SubNodes {
-        Lru::new(SUB_NODES_CNT)
+    /// Create new file fnode under parent with initial content
+    ///
+    /// The segment writer is shared with other writes in the same
+    /// transaction and returned after writing.
+    pub fn new_file_under(
+        parent: &FnodeRef,
+        name: &str,
+        opts: Options,
+        data: &[u8],
+        seg_wtr: SegWriter,
+        txmgr: &TxMgrRef,
+        store: &StoreRef,
+    ) -> Result<(FnodeRef, SegWriter)> {
+        let (kid, seg_wtr) = {
+            let mut pfnode_cow = parent.write().unwrap();
+            let pfnode = pfnode_cow.make_mut(txmgr)?;
+            if !pfnode.is_dir() {
+                return Err(Error::NotDir);
+            }
+
+            // create child fnode and write data as its initial version
+            let mut kid = Fnode::new(FileType::File, opts);
+            let seg_wtr = kid.write_version(data, seg_wtr, txmgr, store)?;
+
+            (kid.into_cow(txmgr)?, seg_wtr)
+        };
+
+        // add child to parent
+        let vol = store.read().unwrap().get_vol_weak();
+        let vol = vol.upgrade().ok_or(Error::RepoClosed)?;
+        Fnode::add_child(parent, &kid, name, txmgr, &vol)?;
+
+        Ok((kid, seg_wtr))
     }
 
     /// Check if fnode is regular file
@@ -348,26 +435,23 @@ impl Fnode {
     }
 
     // load one child fnode
+    //
+    // only read lock of this fnode is needed, so children can be loaded
+    // concurrently
     fn load_child(
-        &mut self,
+        &self,
         name: &str,
         self_ref: FnodeRef,
         cache: &Cache,
         vol: &VolumeRef,
     ) -> Result<FnodeRef> {
         // get child fnode from sub node list first
-        if let Some(fnode) = self
-            .sub_nodes
-            .get_refresh(name)
-            .and_then(|sub| sub.upgrade())
-        {
+        if let Some(fnode) = self.sub_nodes.get(name) {
             return Ok(fnode);
         }
 
         // if child is not in sub node list, load it from fnode cache
-        self.kids
-            .iter()
-            .find(|ref c| c.name == name)
+        self.find_child(name, vol)?
             .ok_or(Error::NotFound)
             .and_then(|child| cache.get(&child.id, vol).map_err(Error::from))
             .and_then(|child| {
@@ -379,20 +463,32 @@ impl Fnode {
                 }
 
                 // add to parent's sub node list
-                self.sub_nodes
-                    .insert(name.to_string(), Arc::downgrade(&child));
+                self.sub_nodes.insert(name, &child);
                 Ok(child)
             })
     }
 
+    // find child entry by name
+    fn find_child(
+        &self,
+        name: &str,
+        vol: &VolumeRef,
+    ) -> Result<Option<ChildEntry>> {
+        if self.kid_index.is_empty() {
+            Ok(self.kids.iter().find(|ref c| c.name == name).cloned())
+        } else {
+            self.kid_index.get(name, vol)
+        }
+    }
+
     #[inline]
-    pub fn has_child(&self, name: &str) -> bool {
-        self.kids.iter().any(|ref c| c.name == name)
+    pub fn has_child(&self, name: &str, vol: &VolumeRef) -> Result<bool> {
+        self.find_child(name, vol).map(|child| child.is_some())
     }
 
     #[inline]
     pub fn children_cnt(&self) -> usize {
-        self.kids.len()
+        self.kids.len() + self.kid_index.len()
     }
 
     /// Get single child fnode
@@ -402,24 +498,21 @@ impl Fnode {
         cache: &Cache,
         vol: &VolumeRef,
     ) -> Result<FnodeRef> {
-        let mut par = parent.write().unwrap();
-        par.make_mut_naive()
-            .load_child(name, parent.clone(), cache, vol)
-    }
-
-    fn children_names(&self) -> Vec<String> {
-        self.kids.iter().map(|ref k| k.name.clone()).collect()
+        let par = parent.read().unwrap();
+        par.load_child(name, parent.clone(), cache, vol)
     }
 
     /// Get children dir entry list
+    ///
+    /// Inline children are listed in insertion order, children in directory
+    /// index are listed in name order.
     pub fn read_dir(
         parent: FnodeRef,
         path: &Path,
         cache: &Cache,
         vol: &VolumeRef,
     ) -> Result<Vec<DirEntry>> {
-        let mut par = parent.write().unwrap();
-        let par = par.make_mut_naive();
+        let par = parent.read().unwrap();
         if !par.is_dir() {
             return Err(Error::NotDir);
         }
@@ -439,18 +532,31 @@ impl Fnode {
             }
         };
 
-        let mut ret = Vec::new();
-        let child_names = par.children_names();
-
-        for name in child_names.iter() {
-            let child_ref =
-                par.load_child(&name, parent.clone(), cache, vol)?;
-            let child = child_ref.read().unwrap();
-            ret.push(DirEntry {
-                path: parent_path.join(name),
-                metadata: child.metadata(),
-                name: name.clone(),
-            });
+        let mut ret = Vec::with_capacity(par.children_cnt());
+        let mut add_entries =
+            |par: &Fnode, kids: &[ChildEntry]| -> Result<()> {
+                for kid in kids.iter() {
+                    let child_ref =
+                        par.load_child(&kid.name, parent.clone(), cache, vol)?;
+                    let child = child_ref.read().unwrap();
+                    ret.push(DirEntry {
+                        path: parent_path.join(&kid.name),
+                        metadata: child.metadata(),
+                        name: kid.name.clone(),
+                    });
+                }
+                Ok(())
+            };
+
+        // inline children are in insertion order, indexed children are in
+        // name order and loaded shard by shard
+        if par.kid_index.is_empty() {
+            add_entries(&par, &par.kids)?;
+        } else {
+            for idx in 0..par.kid_index.shard_cnt() {
+                let shard = par.kid_index.shard(idx, vol)?;
+                add_entries(&par, shard.kids())?;
+            }
         }
 
         Ok(ret)
@@ -462,20 +568,30 @@ impl Fnode {
         child: &FnodeRef,
         name: &str,
         txmgr: &TxMgrRef,
+        vol: &VolumeRef,
     ) -> Result<()> {
         let mut parent_cow = parent.write().unwrap();
         let par = parent_cow.make_mut(txmgr)?;
 
-        // add to child to parent's children list
+        // add to child to parent's children list, move all the children to
+        // directory index if there are too many of them
         let mut kid = child.write().unwrap();
-        par.kids.push(ChildEntry::new(kid.id(), kid.ftype, name));
+        let entry = ChildEntry::new(kid.id(), kid.ftype, name);
+        if par.kid_index.is_empty() {
+            par.kids.push(entry);
+            if par.kids.len() > INLINE_KIDS_MAX {
+                let kids = mem::replace(&mut par.kids, Vec::new());
+                par.kid_index.build(kids, txmgr)?;
+            }
+        } else {
+            par.kid_index.insert(entry, txmgr, vol)?;
+        }
 
         // update child's parent
         kid.make_mut(txmgr)?.parent = Some(parent.clone());
 
         // add to parent's sub node list and update modified time
-        par.sub_nodes
-            .insert(name.to_string(), Arc::downgrade(child));
+        par.sub_nodes.insert(name, child);
         par.mtime = Time::now();
 
         Ok(())
@@ -484,23 +600,27 @@ impl Fnode {
     /// Remove child fnode from parent
     pub fn remove_from_parent(
         fnode: &FnodeRef,
+        name: &str,
         txmgr: &TxMgrRef,
+        vol: &VolumeRef,
     ) -> Result<()> {
         let child = fnode.read().unwrap();
         match child.parent {
             Some(ref parent) => {
                 let mut par = parent.write().unwrap();
                 let par = par.make_mut(txmgr)?;
-                let child_idx = par
-                    .kids
-                    .iter()
-                    .position(|ref c| c.id == *child.id())
-                    .ok_or(Error::NotFound)?;
-                {
-                    let name = &par.kids[child_idx].name;
+                if par.kid_index.is_empty() {
+                    let child_idx = par
+                        .kids
+                        .iter()
+                        .position(|ref c| c.id == *child.id())
+                        .ok_or(Error::NotFound)?;
+                    let kid = par.kids.remove(child_idx);
+                    par.sub_nodes.remove(&kid.name);
+                } else {
+                    par.kid_index.remove(name, child.id(), txmgr, vol)?;
                     par.sub_nodes.remove(name);
                 }
-                par.kids.remove(child_idx);
                 Ok(())
             }
             None => Err(Error::IsRoot),
@@ -594,6 +714,45 @@ impl Fnode {
         Ok(no_dup)
     }
 
+    /// Write data as a new version using a shared segment writer
+    ///
+    /// The data replaces the whole file content, the segment writer is not
+    /// finished and returned for next writing in the same transaction.
+    pub fn write_version(
+        &mut self,
+        data: &[u8],
+        seg_wtr: SegWriter,
+        txmgr: &TxMgrRef,
+        store: &StoreRef,
+    ) -> Result<SegWriter> {
+        let txid = Txid::current()?;
+        let mut wtr = StoreWriter::with_seg_writer(
+            txid,
+            self.chk_map.clone(),
+            Some(seg_wtr),
+            &Arc::downgrade(txmgr),
+            &Arc::downgrade(store),
+        )?;
+        wtr.write_all(data)?;
+        let (stg_ctn, chk_map, seg_wtr) = wtr.finish_shared()?;
+
+        // stage content starts from the beginning, so it is merged to an
+        // empty content as the new version
+        let mut ctn = Content::new();
+        ctn.merge_from(&stg_ctn, store)?;
+
+        // dedup content and add deduped content as a new version
+        if !self.add_version(ctn, store, txmgr)? {
+            // content is duplicated, weak unlink the stage content
+            stg_ctn.unlink_weak(&mut self.chk_map, store, txmgr)?;
+        }
+
+        // udpate fnode chunk map
+        self.chk_map = chk_map;
+
+        Ok(seg_wtr)
+    }
+
     /// Get reader for sepcified version number
     pub fn version_reader(
         &self,
@@ -611,6 +770,27 @@ impl Fnode {
         Ok(ContentReader::new(content, store))
     }
 
+    /// Read current version content at offset without a reader
+    ///
+    /// Fnode lock is only held while getting the current content, so
+    /// positional reads on the same fnode can run concurrently.
+    pub fn read_vectored_at(
+        fnode: &FnodeRef,
+        bufs: &mut [IoSliceMut],
+        offset: usize,
+        store: &StoreWeakRef,
+    ) -> Result<usize> {
+        let content_id = {
+            let fnode = fnode.read().unwrap();
+            fnode.curr_ver().content_id.clone()
+        };
+        let store = store.upgrade().ok_or(Error::RepoClosed)?;
+        let st = store.read().unwrap();
+        let ctn_ref = st.get_content(&content_id)?;
+        let ctn = ctn_ref.read().unwrap();
+        ctn.read_vectored_at(bufs, offset, &st)
+    }
+
     /// Clone a new current content
     pub fn clone_current_content(&self, store: &StoreRef) -> Result<Content> {
         let store = store.read().unwrap();
@@ -669,6 +849,7 @@ impl Debug for Fnode {
             .field("ctime", &self.ctime)
             .field("mtime", &self.mtime)
             .field("kids", &self.kids)
+            .field("kid_index", &self.kid_index)
             .field("vers", &self.vers)
             .field("chk_map", &self.chk_map)
             .field("sub_nodes", &self.sub_nodes)
@@ -679,20 +860,7 @@ impl Debug for Fnode {
 impl Cowable for Fnode {
     fn on_commit(&mut self, _vol: &VolumeRef) -> Result<()> {
         // remove deleted fnode from sub nodes cache
-        self.sub_nodes
-            .entries()
-            .filter(|ent| {
-                ent.get()
-                    .upgrade()
-                    .map(|fnode_ref| {
-                        let cow = fnode_ref.read().unwrap();
-                        cow.in_trans() && cow.action() == Action::Delete
-                    })
-                    .unwrap_or(false)
-            })
-            .for_each(|ent| {
-                ent.remove();
-            });
+        self.sub_nodes.remove_deleted();
         Ok(())
     }
 }
@@ -743,6 +911,11 @@ impl Read for Reader {
     fn read(&mut self, buf: &mut [u8]) -> IoResult<usize> {
         self.rdr.read(buf)
     }
+
+    #[inline]
+    fn read_to_end(&mut self, buf: &mut Vec<u8>) -> IoResult<usize> {
+        self.rdr.read_to_end(buf)
+    }
 }
 
 impl Seek for Reader {
@@ -1,20 +1,28 @@
-use std::path::Path;
+use std::collections::HashMap;
+use std::mem;
+use std::path::{Path, PathBuf};
 use std::sync::{Arc, RwLock};
+use std::time::Instant;
 
 use rmp_serde::{Deserializer, Serializer};
 use serde::{Deserialize, Serialize};
 
+use super::dentry::{Dentry, DentryCache};
 use super::fnode::{
     Cache as FnodeCache, DirEntry, FileType, Fnode, FnodeRef, Metadata, Version,
 };
 use super::{Config, Handle, Options};
+use base::buf_pool::BufPoolStats;
 use base::crypto::Cost;
+use base::metrics::{MetricsRef, OpenPhase};
 use base::IntoRef;
-use content::{Store, StoreRef};
+use content::{SegWriter, Store, StoreRef};
 use error::{Error, Result};
 use trans::cow::IntoCow;
-use trans::{Eid, Id, TxMgr, TxMgrRef};
-use volume::{Info as VolumeInfo, Volume, VolumeRef};
+use trans::{Eid, Finish, Id, TxMgr, TxMgrRef};
+use volume::{
+    CompressStats, Info as VolumeInfo, Volume, VolumeRef, VolumeWeakRef,
+};
 
 // mask secrets in uri
 fn mask_uri(uri: &str) -> String {
@@ -95,11 +103,25 @@ impl Payload {
     }
 }
 
+/// Batch operation
+#[derive(Debug)]
+pub enum BatchOp {
+    /// Create a directory if it doesn't exist
+    CreateDir(PathBuf),
+
+    /// Create a file, or add a new version if it exists, with whole content
+    CreateFile(PathBuf, Vec<u8>),
+
+    /// Copy a regular file to another
+    Copy(PathBuf, PathBuf),
+}
+
 /// File system
 #[derive(Debug)]
 pub struct Fs {
     root: FnodeRef,
     fcache: FnodeCache,
+    dcache: DentryCache,
     store: StoreRef,
     txmgr: TxMgrRef,
     vol: VolumeRef,
@@ -109,8 +131,8 @@ pub struct Fs {
 }
 
 impl Fs {
-    // default cache size
-    const FNODE_CACHE_SIZE: usize = 16;
+    // maximum number of batch operations in one transaction
+    pub const BATCH_TX_OPS: usize = 1024;
 
     /// Check if fs exists
     pub fn exists(uri: &str) -> Result<bool> {
@@ -129,21 +151,31 @@ impl Fs {
         let mut vol = Volume::new(uri)?;
         info!("create repo: {}", mask_uri(&vol.info().uri));
 
+        vol.set_compress_level(cfg.compress_level)?;
         vol.init(pwd, cfg, &payload.seri()?)?;
+        vol.set_encrypt_workers(cfg.encrypt_workers)?;
+        vol.set_read_ahead(cfg.read_ahead, cfg.read_ahead_trigger)?;
 
         let vol = vol.into_ref();
 
         // create tx manager and fnode cache
         let txmgr = TxMgr::new(&walq_id, &vol).into_ref();
-        let fcache = FnodeCache::new(Self::FNODE_CACHE_SIZE);
+        let fcache = FnodeCache::new(cfg.fnode_cache_size);
 
         // the initial transaction to create root fnode and save store,
         // it must be successful
         let mut store_ref: Option<StoreRef> = None;
         let mut root_ref: Option<FnodeRef> = None;
         TxMgr::begin_trans(&txmgr)?.run_all(|| {
-            let store_cow = Store::new(cfg.opts.dedup_file, &txmgr, &vol)
-                .into_cow_with_id(&store_id, &txmgr)?;
+            let mut store = Store::new(
+                cfg.opts.dedup_file,
+                cfg.chunk_index,
+                cfg.chunking,
+                &txmgr,
+                &vol,
+            )?;
+            store.set_hash_workers(cfg.hash_workers)?;
+            let store_cow = store.into_cow_with_id(&store_id, &txmgr)?;
             let root_cow = Fnode::new(FileType::Dir, cfg.opts)
                 .into_cow_with_id(&root_id, &txmgr)?;
             root_ref = Some(root_cow);
@@ -156,6 +188,10 @@ impl Fs {
         Ok(Fs {
             root: root_ref.unwrap(),
             fcache,
+            dcache: DentryCache::new(
+                cfg.dentry_cache_size,
+                cfg.neg_dentry_cache_size,
+            ),
             store: store_ref.unwrap(),
             txmgr,
             vol,
@@ -169,10 +205,13 @@ impl Fs {
     pub fn open(
         uri: &str,
         pwd: &str,
+        cfg: &Config,
         read_only: bool,
         force: bool,
     ) -> Result<Fs> {
+        let begin = Instant::now();
         let mut vol = Volume::new(uri)?;
+        let metrics = vol.metrics();
 
         info!(
             "open repo: {}, read_only: {}",
@@ -181,25 +220,47 @@ impl Fs {
         );
 
         // open volume
+        vol.set_key_cache(cfg.key_cache);
         let payload = vol.open(pwd, force)?;
+        vol.set_encrypt_workers(cfg.encrypt_workers)?;
+        vol.set_read_ahead(cfg.read_ahead, cfg.read_ahead_trigger)?;
+        vol.set_compress_level(cfg.compress_level)?;
         let vol = vol.into_ref();
 
         // deserialize payload
         let payload = Payload::deseri(&payload)?;
 
-        // open transaction manager
+        // open transaction manager, it also recovers from write ahead log
+        // if there are unfinished transactions
+        let phase_begin = Instant::now();
         let txmgr = TxMgr::open(&payload.walq_id, &vol)?.into_ref();
+        metrics.record_open_phase(OpenPhase::Wal, phase_begin);
 
         // create other file sytem components
+        let phase_begin = Instant::now();
         let store = Store::open(&payload.store_id, &txmgr, &vol)?;
+        {
+            let mut store_cow = store.write().unwrap();
+            store_cow
+                .make_mut_naive()
+                .set_hash_workers(cfg.hash_workers)?;
+        }
+        metrics.record_open_phase(OpenPhase::Store, phase_begin);
+        let phase_begin = Instant::now();
         let root = Fnode::load_root(&payload.root_id, &vol)?;
-        let fcache = FnodeCache::new(Self::FNODE_CACHE_SIZE);
+        metrics.record_open_phase(OpenPhase::Root, phase_begin);
+        let fcache = FnodeCache::new(cfg.fnode_cache_size);
 
+        metrics.record_open_phase(OpenPhase::Total, begin);
         info!("repo opened");
 
         Ok(Fs {
             root,
             fcache,
+            dcache: DentryCache::new(
+                cfg.dentry_cache_size,
+                cfg.neg_dentry_cache_size,
+            ),
             store,
             txmgr,
             vol,
@@ -229,6 +290,32 @@ impl Fs {
         }
     }
 
+    /// Get data compression statistics
+    #[inline]
+    pub fn compress_stats(&self) -> CompressStats {
+        let vol = self.vol.read().unwrap();
+        vol.compress_stats()
+    }
+
+    /// Get frame buffer pool statistics
+    #[inline]
+    pub fn buf_pool_stats(&self) -> BufPoolStats {
+        let vol = self.vol.read().unwrap();
+        vol.buf_pool_stats()
+    }
+
+    /// Get runtime metrics
+    #[inline]
+    pub fn metrics(&self) -> MetricsRef {
+        let vol = self.vol.read().unwrap();
+        vol.metrics()
+    }
+
+    #[inline]
+    pub fn get_vol_weak(&self) -> VolumeWeakRef {
+        Arc::downgrade(&self.vol)
+    }
+
     /// Reset volume password
     pub fn reset_password(
         &mut self,
@@ -258,13 +345,44 @@ impl Fs {
             return Err(Error::InvalidPath);
         }
 
-        let mut fnode = self.root.clone();
+        // look up dentry cache first
+        match self.dcache.get(path) {
+            Some(Dentry::Found(fnode)) => return Ok(fnode),
+            Some(Dentry::Missing) => return Err(Error::NotFound),
+            None => {}
+        }
+
+        // start from the nearest cached ancestor, or from root
+        let (mut fnode, skip) = self
+            .dcache
+            .get_ancestor(path)
+            .unwrap_or_else(|| (self.root.clone(), 1));
+        let mut parent = None;
 
-        // loop through path component and skip root
-        for name in path.iter().skip(1) {
+        // loop through the rest path components
+        for name in path.iter().skip(skip) {
             let name = name.to_str().unwrap();
-            fnode = Fnode::child(&fnode, name, &self.fcache, &self.vol)?;
+            match Fnode::child(&fnode, name, &self.fcache, &self.vol) {
+                Ok(child) => parent = Some(mem::replace(&mut fnode, child)),
+                Err(ref err) if *err == Error::NotFound => {
+                    self.dcache.insert_missing(path);
+                    return Err(Error::NotFound);
+                }
+                Err(err) => return Err(err),
+            }
+        }
+
+        // cache the resolved fnode and its parent, so its siblings can also
+        // be resolved quickly
+        if let Some(parent) = parent {
+            self.dcache.insert(path, &fnode);
+            if let Some(parent_path) = path.parent() {
+                if parent_path.parent().is_some() {
+                    self.dcache.insert(parent_path, &parent);
+                }
+            }
         }
+
         Ok(fnode)
     }
 
@@ -308,11 +426,13 @@ impl Fs {
             if !parent.is_dir() {
                 return Err(Error::NotDir);
             }
-            if parent.has_child(&name) {
+            if parent.has_child(&name, &self.vol)? {
                 return Err(Error::AlreadyExists);
             }
         }
 
+        self.dcache.remove(path);
+
         let mut fnode = FnodeRef::default();
         let tx_handle = TxMgr::begin_trans(&self.txmgr)?;
         tx_handle.run_all_exclusive(|| {
@@ -411,21 +531,24 @@ impl Fs {
 
         // begin and run transaction
         let tx_handle = TxMgr::begin_trans(&self.txmgr)?;
-        tx_handle.run_all_exclusive(|| {
-            // get current version of source
-            let ctn = {
-                let fnode = src.read().unwrap();
-                fnode.clone_current_content(&self.store)?
-            };
+        tx_handle.run_all_exclusive(|| self.copy_content(&src, &tgt.fnode))?;
 
-            // then add it to target
-            let mut fnode_cow = tgt.fnode.write().unwrap();
-            let fnode = fnode_cow.make_mut(&self.txmgr)?;
-            let result = fnode.add_version(ctn, &self.store, &self.txmgr)?;
-            assert!(!(self.opts.dedup_file && result));
+        Ok(())
+    }
 
-            Ok(())
-        })?;
+    // add current content of source as a new version of target
+    fn copy_content(&self, src: &FnodeRef, tgt: &FnodeRef) -> Result<()> {
+        // get current version of source
+        let ctn = {
+            let fnode = src.read().unwrap();
+            fnode.clone_current_content(&self.store)?
+        };
+
+        // then add it to target
+        let mut fnode_cow = tgt.write().unwrap();
+        let fnode = fnode_cow.make_mut(&self.txmgr)?;
+        let result = fnode.add_version(ctn, &self.store, &self.txmgr)?;
+        assert!(!(self.opts.dedup_file && result));
 
         Ok(())
     }
@@ -471,19 +594,245 @@ impl Fs {
             }
         }
 
-        // copy dir tree
+        // copy dir tree in batches
+        let mut ops = Vec::new();
+        self.copy_dir_ops(from, to, &mut ops)?;
+        while !ops.is_empty() {
+            let rest = ops.split_off(Self::BATCH_TX_OPS.min(ops.len()));
+            self.apply_batch(&ops)?;
+            ops = rest;
+        }
+
+        Ok(())
+    }
+
+    // collect batch operations for copying a dir tree
+    fn copy_dir_ops(
+        &self,
+        from: &Path,
+        to: &Path,
+        ops: &mut Vec<BatchOp>,
+    ) -> Result<()> {
         for child in self.read_dir(from)? {
-            let child_from = child.path();
+            let child_from = child.path().to_path_buf();
             let child_to = to.join(child.file_name());
             match child.metadata().file_type() {
-                FileType::File => self.copy(&child_from, &child_to)?,
-                FileType::Dir => self.copy_dir_all(&child_from, &child_to)?,
+                FileType::File => ops.push(BatchOp::Copy(child_from, child_to)),
+                FileType::Dir => {
+                    ops.push(BatchOp::CreateDir(child_to.clone()));
+                    self.copy_dir_ops(&child_from, &child_to, ops)?;
+                }
             }
         }
-
         Ok(())
     }
 
+    // resolve path in batch, return None if it doesn't exist
+    //
+    // fnodes created in the batch are not committed yet, so they are kept
+    // in the batch node map rather than resolved from parent
+    fn resolve_in_batch(
+        &self,
+        path: &Path,
+        nodes: &mut HashMap<PathBuf, FnodeRef>,
+    ) -> Result<Option<FnodeRef>> {
+        if !path.has_root() {
+            return Err(Error::InvalidPath);
+        }
+        if let Some(fnode) = nodes.get(path) {
+            return Ok(Some(fnode.clone()));
+        }
+
+        let parent_path = match path.parent() {
+            Some(parent_path) => parent_path,
+            None => return Ok(Some(self.root.clone())),
+        };
+        let name = path
+            .file_name()
+            .and_then(|s| s.to_str())
+            .ok_or(Error::InvalidPath)?;
+        let parent = match self.resolve_in_batch(parent_path, nodes)? {
+            Some(parent) => parent,
+            None => return Ok(None),
+        };
+
+        match Fnode::child(&parent, name, &self.fcache, &self.vol) {
+            Ok(fnode) => {
+                // keep resolved dir so its children can be resolved quickly
+                if fnode.read().unwrap().is_dir() {
+                    nodes.insert(path.to_path_buf(), fnode.clone());
+                }
+                Ok(Some(fnode))
+            }
+            Err(ref err) if *err == Error::NotFound => Ok(None),
+            Err(err) => Err(err),
+        }
+    }
+
+    // resolve parent fnode and child name in batch
+    fn resolve_parent_in_batch(
+        &self,
+        path: &Path,
+        nodes: &mut HashMap<PathBuf, FnodeRef>,
+    ) -> Result<(FnodeRef, String)> {
+        let parent_path = path.parent().ok_or(Error::IsRoot)?;
+        let name = path
+            .file_name()
+            .and_then(|s| s.to_str())
+            .ok_or(Error::InvalidPath)?;
+        let parent = self
+            .resolve_in_batch(parent_path, nodes)?
+            .ok_or(Error::NotFound)?;
+        Ok((parent, name.to_string()))
+    }
+
+    // apply one batch operation, return the segment writer for next
+    // operation
+    fn apply_batch_op(
+        &self,
+        op: &BatchOp,
+        nodes: &mut HashMap<PathBuf, FnodeRef>,
+        seg_wtr: SegWriter,
+    ) -> Result<SegWriter> {
+        match *op {
+            BatchOp::CreateDir(ref path) => {
+                match self.resolve_in_batch(path, nodes)? {
+                    Some(fnode) => {
+                        if !fnode.read().unwrap().is_dir() {
+                            return Err(Error::NotDir);
+                        }
+                    }
+                    None => {
+                        let (parent, name) =
+                            self.resolve_parent_in_batch(path, nodes)?;
+                        let fnode = Fnode::new_under(
+                            &parent,
+                            &name,
+                            FileType::Dir,
+                            Options::default(),
+                            &self.txmgr,
+                            &self.store,
+                        )?;
+                        nodes.insert(path.clone(), fnode);
+                    }
+                }
+                Ok(seg_wtr)
+            }
+
+            BatchOp::CreateFile(ref path, ref data) => {
+                match self.resolve_in_batch(path, nodes)? {
+                    Some(fnode_ref) => {
+                        let mut fnode_cow = fnode_ref.write().unwrap();
+                        if !fnode_cow.is_file() {
+                            return Err(Error::IsDir);
+                        }
+                        let fnode = fnode_cow.make_mut(&self.txmgr)?;
+                        fnode.write_version(
+                            data,
+                            seg_wtr,
+                            &self.txmgr,
+                            &self.store,
+                        )
+                    }
+                    None => {
+                        let (parent, name) =
+                            self.resolve_parent_in_batch(path, nodes)?;
+                        let (fnode, seg_wtr) = Fnode::new_file_under(
+                            &parent,
+                            &name,
+                            self.opts,
+                            data,
+                            seg_wtr,
+                            &self.txmgr,
+                            &self.store,
+                        )?;
+                        nodes.insert(path.clone(), fnode);
+                        Ok(seg_wtr)
+                    }
+                }
+            }
+
+            BatchOp::Copy(ref from, ref to) => {
+                let src = self
+                    .resolve_in_batch(from, nodes)?
+                    .ok_or(Error::NotFound)?;
+                let opts = {
+                    let fnode = src.read().unwrap();
+                    if !fnode.is_file() {
+                        return Err(Error::NotFile);
+                    }
+                    fnode.get_opts()
+                };
+
+                let tgt = match self.resolve_in_batch(to, nodes)? {
+                    Some(tgt) => {
+                        // if target and source are same fnode, do nothing
+                        if Arc::ptr_eq(&tgt, &src) {
+                            return Ok(seg_wtr);
+                        }
+                        if !tgt.read().unwrap().is_file() {
+                            return Err(Error::NotFile);
+                        }
+                        tgt
+                    }
+                    None => {
+                        let (parent, name) =
+                            self.resolve_parent_in_batch(to, nodes)?;
+                        let tgt = Fnode::new_under(
+                            &parent,
+                            &name,
+                            FileType::File,
+                            opts,
+                            &self.txmgr,
+                            &self.store,
+                        )?;
+                        nodes.insert(to.clone(), tgt.clone());
+                        tgt
+                    }
+                };
+
+                self.copy_content(&src, &tgt)?;
+                Ok(seg_wtr)
+            }
+        }
+    }
+
+    /// Apply a batch of operations in one transaction
+    ///
+    /// Each parent directory is updated only once in the transaction, and
+    /// contents of new files are packed in shared segments.
+    pub fn apply_batch(&mut self, ops: &[BatchOp]) -> Result<()> {
+        if self.read_only {
+            return Err(Error::ReadOnly);
+        }
+        if ops.is_empty() {
+            return Ok(());
+        }
+
+        for op in ops {
+            match *op {
+                BatchOp::CreateDir(ref path)
+                | BatchOp::CreateFile(ref path, _)
+                | BatchOp::Copy(_, ref path) => self.dcache.remove(path),
+            }
+        }
+
+        let tx_handle = TxMgr::begin_trans(&self.txmgr)?;
+        tx_handle.run_all_exclusive(|| {
+            let mut nodes = HashMap::new();
+            let mut seg_wtr = SegWriter::new(
+                tx_handle.txid,
+                &Arc::downgrade(&self.store),
+                &Arc::downgrade(&self.txmgr),
+                &Arc::downgrade(&self.vol),
+            );
+            for op in ops {
+                seg_wtr = self.apply_batch_op(op, &mut nodes, seg_wtr)?;
+            }
+            seg_wtr.finish()
+        })
+    }
+
     /// Remove a regular file
     pub fn remove_file(&mut self, path: &Path) -> Result<()> {
         if self.read_only {
@@ -491,17 +840,26 @@ impl Fs {
         }
 
         let fnode_ref = self.resolve(path)?;
-        {
+        let name = {
             let fnode = fnode_ref.read().unwrap();
             if !fnode.is_file() {
                 return Err(Error::NotFile);
             }
-        }
+            path.file_name()
+                .and_then(|s| s.to_str())
+                .ok_or(Error::InvalidPath)?
+        };
+        self.dcache.remove(path);
 
         // begin and run transaction
         let tx_handle = TxMgr::begin_trans(&self.txmgr)?;
         tx_handle.run_all_exclusive(move || {
-            Fnode::remove_from_parent(&fnode_ref, &self.txmgr)?;
+            Fnode::remove_from_parent(
+                &fnode_ref,
+                name,
+                &self.txmgr,
+                &self.vol,
+            )?;
             let mut fnode = fnode_ref.write().unwrap();
             fnode
                 .make_mut(&self.txmgr)?
@@ -521,7 +879,7 @@ impl Fs {
         }
 
         let fnode_ref = self.resolve(path)?;
-        {
+        let name = {
             let fnode = fnode_ref.read().unwrap();
             if !fnode.is_dir() {
                 return Err(Error::NotDir);
@@ -532,12 +890,21 @@ impl Fs {
             if fnode.children_cnt() > 0 {
                 return Err(Error::NotEmpty);
             }
-        }
+            path.file_name()
+                .and_then(|s| s.to_str())
+                .ok_or(Error::InvalidPath)?
+        };
+        self.dcache.remove_tree(path);
 
         // begin and run transaction
         let tx_handle = TxMgr::begin_trans(&self.txmgr)?;
         tx_handle.run_all(move || {
-            Fnode::remove_from_parent(&fnode_ref, &self.txmgr)?;
+            Fnode::remove_from_parent(
+                &fnode_ref,
+                name,
+                &self.txmgr,
+                &self.vol,
+            )?;
             let mut fnode = fnode_ref.write().unwrap();
             fnode.make_del(&self.txmgr)?;
             self.fcache.remove(fnode.id());
@@ -584,7 +951,7 @@ impl Fs {
             Err(err) => return Err(err),
         };
 
-        {
+        let src_is_dir = {
             let src_fnode = src.read().unwrap();
             if src_fnode.is_root() {
                 return Err(Error::IsRoot);
@@ -607,18 +974,38 @@ impl Fs {
                     }
                 }
             }
-        }
 
+            src_fnode.is_dir()
+        };
+
+        let src_name = from
+            .file_name()
+            .and_then(|s| s.to_str())
+            .ok_or(Error::InvalidPath)?;
         let (tgt_parent, name) = self.resolve_parent(to)?;
 
+        // paths under the renamed directory are changed as well
+        if src_is_dir {
+            self.dcache.remove_tree(from);
+            self.dcache.remove_tree(to);
+        } else {
+            self.dcache.remove(from);
+            self.dcache.remove(to);
+        }
+
         // begin and run transaction
         TxMgr::begin_trans(&self.txmgr)?.run_all_exclusive(|| {
             // remove from source
-            Fnode::remove_from_parent(&src, &self.txmgr)?;
+            Fnode::remove_from_parent(&src, src_name, &self.txmgr, &self.vol)?;
 
             // remove target if it exists
             if let Some(tgt_fnode) = tgt {
-                Fnode::remove_from_parent(&tgt_fnode, &self.txmgr)?;
+                Fnode::remove_from_parent(
+                    &tgt_fnode,
+                    &name,
+                    &self.txmgr,
+                    &self.vol,
+                )?;
                 let mut tgt_fnode = tgt_fnode.write().unwrap();
                 if tgt_fnode.is_file() {
                     tgt_fnode
@@ -630,7 +1017,7 @@ impl Fs {
             }
 
             // and then add to target
-            Fnode::add_child(&tgt_parent, &src, &name, &self.txmgr)
+            Fnode::add_child(&tgt_parent, &src, &name, &self.txmgr, &self.vol)
         })
     }
 
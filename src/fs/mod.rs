@@ -2,14 +2,16 @@
 //! fs module document
 //!
 
+mod dentry;
+mod dir_index;
 pub mod fnode;
 mod fs;
 
 pub use self::fnode::{DirEntry, FileType, Fnode, FnodeRef, Metadata, Version};
-pub use self::fs::{Fs, ShutterRef};
+pub use self::fs::{BatchOp, Fs, ShutterRef};
 
 use base::crypto::{Cipher, Cost, Crypto};
-use content::StoreWeakRef;
+use content::{Chunking, StoreWeakRef};
 use trans::TxMgrWeakRef;
 
 // Default file versoin limit
@@ -39,7 +41,20 @@ pub struct Config {
     pub cost: Cost,
     pub cipher: Cipher,
     pub compress: bool,
+    pub chunking: Chunking,
+    pub chunk_index: bool,
     pub opts: Options,
+
+    // runtime options, not persisted
+    pub encrypt_workers: usize,
+    pub read_ahead: usize,
+    pub read_ahead_trigger: usize,
+    pub hash_workers: usize,
+    pub compress_level: u32,
+    pub fnode_cache_size: usize,
+    pub dentry_cache_size: usize,
+    pub neg_dentry_cache_size: usize,
+    pub key_cache: bool,
 }
 
 impl Default for Config {
@@ -52,7 +67,18 @@ impl Default for Config {
                 Cipher::Xchacha
             },
             compress: false,
+            chunking: Chunking::default(),
+            chunk_index: false,
             opts: Options::default(),
+            encrypt_workers: 0,
+            read_ahead: 0,
+            read_ahead_trigger: 2,
+            hash_workers: 0,
+            compress_level: 0,
+            fnode_cache_size: 16,
+            dentry_cache_size: 1024,
+            neg_dentry_cache_size: 256,
+            key_cache: false,
         }
     }
 }
@@ -98,6 +98,8 @@
 #[macro_use]
 extern crate cfg_if;
 extern crate env_logger;
+#[cfg(all(unix, feature = "storage-file"))]
+extern crate libc;
 extern crate linked_hash_map;
 #[macro_use]
 extern crate log;
@@ -136,13 +138,22 @@ mod trans;
 mod version;
 mod volume;
 
+pub use self::base::buf_pool::BufPoolStats;
 pub use self::base::crypto::{Cipher, MemLimit, OpsLimit};
+pub use self::base::metrics::{
+    CacheStats, CryptoStats, DedupStats, IndexStats, LatencyStats, OpenStats,
+    StorageStats, TxStats,
+};
 pub use self::base::{init_env, zbox_version};
+pub use self::content::Chunking;
 pub use self::error::{Error, Result};
 pub use self::file::{File, VersionReader};
 pub use self::fs::fnode::{DirEntry, FileType, Metadata, Version};
-pub use self::repo::{OpenOptions, Repo, RepoInfo, RepoOpener};
+pub use self::repo::{
+    Batch, OpenOptions, Repo, RepoInfo, RepoOpener, RepoStats,
+};
 pub use self::trans::Eid;
+pub use self::volume::CompressStats;
 
 #[macro_use]
 extern crate lazy_static;
@@ -150,6 +161,10 @@ extern crate lazy_static;
 #[cfg(any(feature = "storage-faulty", feature = "storage-zbox-faulty"))]
 pub use self::volume::FaultyController;
 
+#[cfg(feature = "test-perf")]
+#[doc(hidden)]
+pub use self::base::bench;
+
 #[cfg(feature = "storage-sqlite")]
 extern crate libsqlite3_sys;
 
@@ -1,14 +1,40 @@
 use std::fmt::{self, Debug};
 use std::io::SeekFrom;
+use std::mem;
 use std::path::Path;
-use std::time::SystemTime;
+use std::sync::mpsc::{channel, RecvTimeoutError, Sender};
+use std::sync::Arc;
+use std::thread::{self, JoinHandle};
+use std::time::{Duration, SystemTime};
 
 use super::{File, Result};
+use base::buf_pool::BufPoolStats;
 use base::crypto::{Cipher, Cost, MemLimit, OpsLimit};
-use base::{self, Time};
+use base::metrics::{
+    CacheStats, CryptoStats, DedupStats, IndexStats, Metrics, OpenStats,
+    StorageStats, TxStats,
+};
+use base::{self, lz4, Time};
+use content::Chunking;
 use error::Error;
-use fs::{Config, DirEntry, FileType, Fs, Metadata, Options, Version};
+use fs::{BatchOp, Config, DirEntry, FileType, Fs, Metadata, Options, Version};
 use trans::Eid;
+use volume::CompressStats;
+
+// periodic statistics callback
+#[derive(Clone)]
+struct StatsCallback {
+    interval: Duration,
+    callback: Arc<dyn Fn(&RepoStats) + Send + Sync>,
+}
+
+impl Debug for StatsCallback {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        f.debug_struct("StatsCallback")
+            .field("interval", &self.interval)
+            .finish()
+    }
+}
 
 /// A builder used to create a repository [`Repo`] in various manners.
 ///
@@ -68,6 +94,7 @@ pub struct RepoOpener {
     create_new: bool,
     read_only: bool,
     force: bool,
+    stats_callback: Option<StatsCallback>,
 }
 
 impl RepoOpener {
@@ -137,6 +164,36 @@ impl RepoOpener {
         self
     }
 
+    /// Sets the compression level used when writing data.
+    ///
+    /// Level 0 is the LZ4 fast mode, levels from 1 to 12 use LZ4 high
+    /// compression mode, which compresses better but is much slower to
+    /// write, so it suits cold data. Decompression speed is not affected.
+    /// Data frames which cannot be compressed enough, for example media
+    /// files, are always stored uncompressed. Default is 0.
+    ///
+    /// This option is only used when compression is enabled, it is not
+    /// persisted and can be different each time the repository is opened.
+    /// Invalid level will cause `Error::InvalidArgument` when opening the
+    /// repository.
+    pub fn compress_level(&mut self, compress_level: u32) -> &mut Self {
+        self.cfg.compress_level = compress_level;
+        self
+    }
+
+    /// Sets the content chunking algorithm.
+    ///
+    /// File content is split into chunks using this algorithm before being
+    /// deduplicated and stored. `Chunking::Rabin` is the default,
+    /// `Chunking::FastCdc` is usually much faster. Invalid chunk sizes will
+    /// cause `Error::InvalidArgument` when opening the repository.
+    ///
+    /// This option is only used when creating a repository.
+    pub fn chunking(&mut self, chunking: Chunking) -> &mut Self {
+        self.cfg.chunking = chunking;
+        self
+    }
+
     /// Sets the default maximum number of file version.
     ///
     /// The `version_limit` must be within [1, 255], default is 1. This
@@ -175,6 +232,112 @@ impl RepoOpener {
         self
     }
 
+    /// Sets the option for repository-wide chunk index.
+    ///
+    /// By default, data chunk deduplication is only done within a file. If
+    /// this option is true, an index of all data chunks is maintained in
+    /// the repository, so files with [`dedup_chunk`] enabled can also share
+    /// chunks with other files. Note that updating the index makes file
+    /// writing transactions contend on the repository-wide store. Default
+    /// is false.
+    ///
+    /// This option is only used when creating a repository.
+    ///
+    /// [`dedup_chunk`]: struct.RepoOpener.html#method.dedup_chunk
+    pub fn chunk_index(&mut self, chunk_index: bool) -> &mut Self {
+        self.cfg.chunk_index = chunk_index;
+        self
+    }
+
+    /// Sets the number of worker threads used for frame encryption.
+    ///
+    /// When it is greater than 0, data frames are encrypted and written to
+    /// storage by a pool of background threads while the caller keeps
+    /// writing, which can speed up writing large files. Default is 0, that
+    /// is, data frames are encrypted on the writing thread.
+    pub fn encrypt_workers(&mut self, encrypt_workers: usize) -> &mut Self {
+        self.cfg.encrypt_workers = encrypt_workers;
+        self
+    }
+
+    /// Sets the maximum read-ahead window, in number of data frames.
+    ///
+    /// When a large file is read sequentially, the following data frames
+    /// are read and decrypted in background, the window grows up to this
+    /// size as the reading continues. This can speed up streaming reads,
+    /// especially on remote storage. Default is 0, which disables
+    /// read-ahead.
+    pub fn read_ahead(&mut self, read_ahead: usize) -> &mut Self {
+        self.cfg.read_ahead = read_ahead;
+        self
+    }
+
+    /// Sets the number of data frames read sequentially before read-ahead
+    /// starts.
+    ///
+    /// Until this many frames are read one after another, frames are read
+    /// on demand, so random reads don't trigger useless background reads.
+    /// It is only used when [`read_ahead`] is greater than 0. Default is 2.
+    ///
+    /// [`read_ahead`]: struct.RepoOpener.html#method.read_ahead
+    pub fn read_ahead_trigger(&mut self, trigger: usize) -> &mut Self {
+        self.cfg.read_ahead_trigger = trigger;
+        self
+    }
+
+    /// Sets the number of threads used to hash file content.
+    ///
+    /// If it is greater than 0, data chunks and merkle tree pieces are
+    /// hashed in a thread pool when writing, so writing large files is not
+    /// limited by single-core hashing speed. Default is 0, that is, hashing
+    /// is done on the writing thread.
+    pub fn hash_workers(&mut self, hash_workers: usize) -> &mut Self {
+        self.cfg.hash_workers = hash_workers;
+        self
+    }
+
+    /// Sets the maximum number of file nodes kept in memory.
+    ///
+    /// Recently used file and directory nodes are cached so they don't need
+    /// to be read and decrypted from storage again. It must be greater than
+    /// 0, otherwise `Error::InvalidArgument` will be returned when opening
+    /// the repository. Default is 16.
+    pub fn fnode_cache_size(&mut self, fnode_cache_size: usize) -> &mut Self {
+        self.cfg.fnode_cache_size = fnode_cache_size;
+        self
+    }
+
+    /// Sets the maximum number of resolved paths kept in memory.
+    ///
+    /// Resolved paths are cached so that repeatedly accessed paths, for
+    /// example by [`metadata`] or [`open_file`], don't need to be looked up
+    /// through each of their parent directories. The cache doesn't keep
+    /// file nodes in memory by itself, so it works best along with a large
+    /// enough [`fnode_cache_size`]. Default is 1024, 0 disables the cache.
+    ///
+    /// [`metadata`]: struct.Repo.html#method.metadata
+    /// [`open_file`]: struct.Repo.html#method.open_file
+    /// [`fnode_cache_size`]: struct.RepoOpener.html#method.fnode_cache_size
+    pub fn dentry_cache_size(&mut self, dentry_cache_size: usize) -> &mut Self {
+        self.cfg.dentry_cache_size = dentry_cache_size;
+        self
+    }
+
+    /// Sets the maximum number of not existing paths kept in memory.
+    ///
+    /// Paths which are looked up but don't exist are cached, so checking
+    /// them again, for example by [`path_exists`], is fast. Default is 256,
+    /// 0 disables the cache.
+    ///
+    /// [`path_exists`]: struct.Repo.html#method.path_exists
+    pub fn neg_dentry_cache_size(
+        &mut self,
+        neg_dentry_cache_size: usize,
+    ) -> &mut Self {
+        self.cfg.neg_dentry_cache_size = neg_dentry_cache_size;
+        self
+    }
+
     /// Sets the option for read-only mode.
     ///
     /// This option cannot be true with either `create` or `create_new` is true.
@@ -194,6 +357,47 @@ impl RepoOpener {
         self
     }
 
+    /// Sets the option to cache the password derived key in memory.
+    ///
+    /// Deriving key from password is deliberately slow and it dominates
+    /// the time of opening a repository. When this option is true, the key
+    /// derived from the password is cached in this process after the
+    /// repository is opened successfully, opening the same repository again
+    /// with the same password can skip the derivation. The plaintext
+    /// password is not kept, but the cached key stays in memory until the
+    /// process exits, so only use it when the process is trusted. Default
+    /// is false.
+    ///
+    /// This option is only used when opening an existing repository.
+    pub fn key_cache(&mut self, key_cache: bool) -> &mut Self {
+        self.cfg.key_cache = key_cache;
+        self
+    }
+
+    /// Sets a callback to receive repository statistics periodically.
+    ///
+    /// After the repository is opened, the callback is called with a
+    /// [`RepoStats`] snapshot on a background thread every `interval`,
+    /// until the repository is closed. This is same as calling
+    /// [`Repo::stats`] periodically. Default is no callback.
+    ///
+    /// [`RepoStats`]: struct.RepoStats.html
+    /// [`Repo::stats`]: struct.Repo.html#method.stats
+    pub fn stats_callback<F>(
+        &mut self,
+        interval: Duration,
+        callback: F,
+    ) -> &mut Self
+    where
+        F: Fn(&RepoStats) + Send + Sync + 'static,
+    {
+        self.stats_callback = Some(StatsCallback {
+            interval,
+            callback: Arc::new(callback),
+        });
+        self
+    }
+
     /// Opens a repository at URI with the password and options specified by
     /// `self`.
     ///
@@ -225,6 +429,20 @@ impl RepoOpener {
     ///
     ///   For example, `file://./foo/bar` or `file://C:/Users/foo bar/dir`.
     ///
+    ///   Optional parameters can be appended to the path:
+    ///
+    ///   `file://<path>[?data_handles=<count>&mmap=<bool>&shrink_rate=<size>]`
+    ///
+    ///   - data_handles: max number of data files kept open, default is
+    ///     64, must be at least 1
+    ///   - mmap: memory map finished data files for reading, default is
+    ///     false, this is only supported on Unix and ignored on others
+    ///   - shrink_rate: max speed of reclaiming space from data files
+    ///     in background, in MB per second, for example `16mb`. Default
+    ///     is `32mb`, `0mb` means unlimited
+    ///
+    ///   For example, `file://./foo/bar?data_handles=128&mmap=true`.
+    ///
     ///   This storage must be enabled by Cargo feature `storage-file`.
     ///
     /// - SQLite storage, URI identifier is `sqlite://`
@@ -234,6 +452,23 @@ impl RepoOpener {
     ///
     ///   For example, `sqlite://./foobar.sqlite`.
     ///
+    ///   Optional parameters can be appended to the path:
+    ///
+    ///   `sqlite://<path>[?journal_mode=<mode>&synchronous=<level>&cache_size=<size>&readers=<count>]`
+    ///
+    ///   - journal_mode: `delete` or `wal`, default is `delete`. WAL mode
+    ///     lets block reads run concurrently on read-only connections
+    ///   - synchronous: `off`, `normal`, `full` or `extra`, default is
+    ///     SQLite's own default
+    ///   - cache_size: page cache size of each connection, for example
+    ///     `8mb`, default is SQLite's own default
+    ///   - readers: number of read-only connections, default is 4 in WAL
+    ///     mode and 0 otherwise
+    ///
+    ///   WAL mode and readers cannot be used with in-memory database.
+    ///
+    ///   For example, `sqlite://./foobar.sqlite?journal_mode=wal`.
+    ///
     ///   This storage must be enabled by Cargo feature `storage-sqlite`.
     ///
     /// - Redis storage, URI identifier is `redis://`
@@ -241,7 +476,11 @@ impl RepoOpener {
     ///   After the identifier is the path to a Redis instance. Unix socket is
     ///   supported. The URI format is:
     ///
-    ///   `redis://[+unix+][:<passwd>@]<hostname>[:port][/<db>]`
+    ///   `redis://[+unix+][:<passwd>@]<hostname>[:port][/<db>][?pool_size=<size>]`
+    ///
+    ///   The optional `pool_size` parameter is the number of connections
+    ///   kept to Redis, so multiple readers can run concurrently. Default
+    ///   is 4.
     ///
     ///   This storage must be enabled by Cargo feature `storage-redis`.
     ///
@@ -261,7 +500,29 @@ impl RepoOpener {
             return Err(Error::InvalidArgument);
         }
 
-        if self.create {
+        // chunk sizes must be valid
+        if !self.cfg.chunking.is_valid() {
+            return Err(Error::InvalidArgument);
+        }
+
+        // fnode cache must not be empty
+        if self.cfg.fnode_cache_size == 0 {
+            return Err(Error::InvalidArgument);
+        }
+
+        // compression level must be supported by lz4
+        if self.cfg.compress_level > lz4::HC_LEVEL_MAX {
+            return Err(Error::InvalidArgument);
+        }
+
+        // stats callback interval must not be zero
+        if let Some(ref cb) = self.stats_callback {
+            if cb.interval == Duration::default() {
+                return Err(Error::InvalidArgument);
+            }
+        }
+
+        let mut repo = if self.create {
             if self.read_only {
                 return Err(Error::InvalidArgument);
             }
@@ -269,13 +530,19 @@ impl RepoOpener {
                 if self.create_new {
                     return Err(Error::RepoExists);
                 }
-                Repo::open(uri, pwd, self.read_only, self.force)
+                Repo::open(uri, pwd, &self.cfg, self.read_only, self.force)?
             } else {
-                Repo::create(uri, pwd, &self.cfg)
+                Repo::create(uri, pwd, &self.cfg)?
             }
         } else {
-            Repo::open(uri, pwd, self.read_only, self.force)
+            Repo::open(uri, pwd, &self.cfg, self.read_only, self.force)?
+        };
+
+        if let Some(ref cb) = self.stats_callback {
+            repo.reporter = Some(StatsReporter::start(&repo.fs, cb)?);
         }
+
+        Ok(repo)
     }
 }
 
@@ -443,6 +710,121 @@ impl OpenOptions {
     }
 }
 
+/// A batch of directories and files creation.
+///
+/// This structure is returned from [`Repo::batch`]. It is used to import a
+/// large number of small files efficiently. Queued operations are applied
+/// in transactions of bounded size, in which each parent directory is
+/// updated only once and file contents are packed together in shared
+/// segments.
+///
+/// Each transaction is atomic, but the batch as a whole is **not**. Queued
+/// operations not applied yet are discarded if the batch is dropped without
+/// calling [`commit`].
+///
+/// # Examples
+///
+/// ```
+/// # #![allow(unused_mut, unused_variables, dead_code)]
+/// # use zbox::{init_env, Result, RepoOpener};
+/// # fn foo() -> Result<()> {
+/// # init_env();
+/// # let mut repo = RepoOpener::new().create(true).open("mem://foo", "pwd")?;
+/// let mut batch = repo.batch();
+/// batch.create_dir("/foo")?;
+/// batch.create_file("/foo/bar.txt", b"Hello, world!")?;
+/// batch.commit()?;
+///
+/// assert!(repo.is_file("/foo/bar.txt")?);
+/// # Ok(())
+/// # }
+/// # foo().unwrap();
+/// ```
+///
+/// [`Repo::batch`]: struct.Repo.html#method.batch
+/// [`commit`]: struct.Batch.html#method.commit
+#[derive(Debug)]
+pub struct Batch<'a> {
+    fs: &'a mut Fs,
+    ops: Vec<BatchOp>,
+    data_len: usize,
+}
+
+impl<'a> Batch<'a> {
+    // maximum size of file data in one transaction
+    const TX_DATA_LEN: usize = 16 * 1024 * 1024;
+
+    fn new(fs: &'a mut Fs) -> Self {
+        Batch {
+            fs,
+            ops: Vec::new(),
+            data_len: 0,
+        }
+    }
+
+    // queue an operation, apply queued operations if the batch is full
+    fn push(&mut self, op: BatchOp, data_len: usize) -> Result<()> {
+        if self.fs.is_read_only() {
+            return Err(Error::ReadOnly);
+        }
+        self.ops.push(op);
+        self.data_len += data_len;
+        if self.ops.len() >= Fs::BATCH_TX_OPS
+            || self.data_len >= Self::TX_DATA_LEN
+        {
+            self.flush()?;
+        }
+        Ok(())
+    }
+
+    // apply queued operations in one transaction
+    fn flush(&mut self) -> Result<()> {
+        let ops = mem::replace(&mut self.ops, Vec::new());
+        self.data_len = 0;
+        self.fs.apply_batch(&ops)
+    }
+
+    /// Queue creating a directory at the specified path.
+    ///
+    /// Its parent must exist or be created earlier in the batch. It does
+    /// nothing if the directory already exists.
+    ///
+    /// `path` must be an absolute path.
+    pub fn create_dir<P: AsRef<Path>>(&mut self, path: P) -> Result<()> {
+        let path = path.as_ref();
+        if !path.has_root() {
+            return Err(Error::InvalidPath);
+        }
+        self.push(BatchOp::CreateDir(path.to_path_buf()), 0)
+    }
+
+    /// Queue creating a file with its whole content.
+    ///
+    /// Its parent must exist or be created earlier in the batch. If the
+    /// file already exists, `data` will be added as its new version.
+    ///
+    /// `path` must be an absolute path.
+    pub fn create_file<P: AsRef<Path>>(
+        &mut self,
+        path: P,
+        data: &[u8],
+    ) -> Result<()> {
+        let path = path.as_ref();
+        if !path.has_root() {
+            return Err(Error::InvalidPath);
+        }
+        self.push(
+            BatchOp::CreateFile(path.to_path_buf(), data.to_vec()),
+            data.len(),
+        )
+    }
+
+    /// Apply all the queued operations.
+    pub fn commit(mut self) -> Result<()> {
+        self.flush()
+    }
+}
+
 /// Information about a repository.
 ///
 /// This structure is returned from the [`Repo::info`] represents known metadata
@@ -545,6 +927,134 @@ impl RepoInfo {
     }
 }
 
+/// Runtime statistics of a repository.
+///
+/// This structure is returned from the [`Repo::stats`] and is a snapshot
+/// of the counters and latency histograms maintained while the repository
+/// is running. All of them are accumulated since the repository is opened.
+///
+/// Cache statistics can be used to tune cache sizes, for example, a low
+/// `frame_cache` hit ratio on a small file workload may suggest the frame
+/// cache is too small.
+///
+/// [`Repo::stats`]: struct.Repo.html#method.stats
+#[derive(Debug, Clone, Default)]
+pub struct RepoStats {
+    /// Decrypted data frame cache in storage
+    pub frame_cache: CacheStats,
+
+    /// Entity address cache in storage
+    pub addr_cache: CacheStats,
+
+    /// Segment data chunk cache
+    pub data_cache: CacheStats,
+
+    /// Cache of fnodes, contents, segments and other internal objects
+    pub cow_cache: CacheStats,
+
+    /// Local cache of remote objects, only used by zbox storage
+    pub local_cache: CacheStats,
+
+    /// Encryption and decryption
+    pub crypto: CryptoStats,
+
+    /// Data compression
+    pub compress: CompressStats,
+
+    /// Frame buffer pool
+    pub buf_pool: BufPoolStats,
+
+    /// Chunk and file content deduplication
+    pub dedup: DedupStats,
+
+    /// Storage address index
+    pub index: IndexStats,
+
+    /// Operations on the underlying storage
+    pub storage: StorageStats,
+
+    /// Transaction begin, commit and abort
+    pub tx: TxStats,
+
+    /// Time spent in each phase of opening the repository
+    pub open: OpenStats,
+}
+
+impl RepoStats {
+    fn new(
+        metrics: &Metrics,
+        compress: CompressStats,
+        buf_pool: BufPoolStats,
+    ) -> Self {
+        RepoStats {
+            frame_cache: metrics.frame_cache.snapshot(),
+            addr_cache: metrics.addr_cache.snapshot(),
+            data_cache: metrics.data_cache.snapshot(),
+            cow_cache: metrics.cow_cache.snapshot(),
+            local_cache: metrics.local_cache.snapshot(),
+            crypto: metrics.crypto_stats(),
+            compress,
+            buf_pool,
+            dedup: metrics.dedup_stats(),
+            index: metrics.index_stats(),
+            storage: metrics.storage_stats(),
+            tx: metrics.tx_stats(),
+            open: metrics.open_stats(),
+        }
+    }
+}
+
+// background thread calling stats callback periodically, it is stopped
+// when dropped
+struct StatsReporter {
+    stop: Sender<()>,
+    handle: Option<JoinHandle<()>>,
+}
+
+impl StatsReporter {
+    fn start(fs: &Fs, cb: &StatsCallback) -> Result<Self> {
+        let (stop, rx) = channel::<()>();
+        let vol = fs.get_vol_weak();
+        let cb = cb.clone();
+
+        let handle = thread::Builder::new()
+            .name("zbox-stats".to_string())
+            .spawn(move || loop {
+                match rx.recv_timeout(cb.interval) {
+                    Err(RecvTimeoutError::Timeout) => {}
+                    _ => break,
+                }
+                let vol = match vol.upgrade() {
+                    Some(vol) => vol,
+                    None => break,
+                };
+                let stats = {
+                    let vol = vol.read().unwrap();
+                    RepoStats::new(
+                        &vol.metrics(),
+                        vol.compress_stats(),
+                        vol.buf_pool_stats(),
+                    )
+                };
+                (cb.callback)(&stats);
+            })?;
+
+        Ok(StatsReporter {
+            stop,
+            handle: Some(handle),
+        })
+    }
+}
+
+impl Drop for StatsReporter {
+    fn drop(&mut self) {
+        let _ = self.stop.send(());
+        if let Some(handle) = self.handle.take() {
+            let _ = handle.join();
+        }
+    }
+}
+
 // open a regular file with options
 fn open_file_with_options<P: AsRef<Path>>(
     fs: &mut Fs,
@@ -700,6 +1210,8 @@ fn open_file_with_options<P: AsRef<Path>>(
 /// [`RepoOpener`]: struct.RepoOpener.html
 /// [`read-only`]: struct.RepoOpener.html#method.read_only
 pub struct Repo {
+    // stats reporter must be stopped before fs is closed
+    reporter: Option<StatsReporter>,
     fs: Fs,
 }
 
@@ -714,7 +1226,7 @@ impl Repo {
     #[inline]
     fn create(uri: &str, pwd: &str, cfg: &Config) -> Result<Repo> {
         let fs = Fs::create(uri, pwd, cfg)?;
-        Ok(Repo { fs })
+        Ok(Repo { reporter: None, fs })
     }
 
     // open repo
@@ -722,11 +1234,12 @@ impl Repo {
     fn open(
         uri: &str,
         pwd: &str,
+        cfg: &Config,
         read_only: bool,
         force: bool,
     ) -> Result<Repo> {
-        let fs = Fs::open(uri, pwd, read_only, force)?;
-        Ok(Repo { fs })
+        let fs = Fs::open(uri, pwd, cfg, read_only, force)?;
+        Ok(Repo { reporter: None, fs })
     }
 
     /// Get repository metadata information.
@@ -747,6 +1260,62 @@ impl Repo {
         })
     }
 
+    /// Get data compression statistics since the repository is opened.
+    ///
+    /// The statistics show how many bytes were compressed and stored, and
+    /// how many were skipped because they are not compressible. They are
+    /// all zero if compression is not enabled.
+    #[inline]
+    pub fn compress_stats(&self) -> CompressStats {
+        self.fs.compress_stats()
+    }
+
+    /// Get frame buffer pool statistics since the repository is opened.
+    ///
+    /// Data frame buffers used by reading, writing and caching are taken
+    /// from a pool and returned to it after use. The statistics show how
+    /// often a buffer is reused rather than newly allocated.
+    #[inline]
+    pub fn buf_pool_stats(&self) -> BufPoolStats {
+        self.fs.buf_pool_stats()
+    }
+
+    /// Get runtime statistics since the repository is opened.
+    ///
+    /// The statistics include cache hits and misses, encryption and
+    /// deduplication counters, storage operation and transaction
+    /// latencies. See [`RepoStats`] for details.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// # use zbox::{init_env, Result, RepoOpener};
+    /// # use std::io::Write;
+    /// # fn foo() -> Result<()> {
+    /// # init_env();
+    /// let mut repo = RepoOpener::new().create(true).open("mem://foo", "pwd")?;
+    /// let mut file = repo.create_file("/foo.txt")?;
+    /// file.write_once(b"Hello, World!")?;
+    ///
+    /// let stats = repo.stats();
+    /// assert!(stats.tx.commit.count > 0);
+    /// assert!(stats.crypto.encrypted_bytes > 0);
+    /// println!("{:?}", stats.frame_cache);
+    /// # Ok(())
+    /// # }
+    /// # foo().unwrap();
+    /// ```
+    ///
+    /// [`RepoStats`]: struct.RepoStats.html
+    #[inline]
+    pub fn stats(&self) -> RepoStats {
+        RepoStats::new(
+            &self.fs.metrics(),
+            self.fs.compress_stats(),
+            self.fs.buf_pool_stats(),
+        )
+    }
+
     /// Reset password for the repository.
     ///
     /// Note: if this method failed due to IO error, super block might be
@@ -892,9 +1461,24 @@ impl Repo {
         self.fs.create_dir_all(path.as_ref())
     }
 
+    /// Creates a batch for creating many directories and files.
+    ///
+    /// See [`Batch`] for more details.
+    ///
+    /// [`Batch`]: struct.Batch.html
+    #[inline]
+    pub fn batch(&mut self) -> Batch {
+        Batch::new(&mut self.fs)
+    }
+
     /// Returns a vector of all the entries within a directory.
     ///
     /// `path` must be an absolute path.
+    ///
+    /// Entries of a directory with up to 256 children are returned in the
+    /// order they were added. Children of a larger directory are indexed by
+    /// name, so its entries are returned in name order, and they stay in
+    /// name order until the directory becomes empty.
     #[inline]
     pub fn read_dir<P: AsRef<Path>>(&self, path: P) -> Result<Vec<DirEntry>> {
         self.fs.read_dir(path.as_ref())
@@ -470,6 +470,12 @@ where
     T: Cowable,
 {
     fn is_pinned(&self, item: &CowRef<T>) -> bool {
+        // cow still referred outside cache must be kept in cache, otherwise
+        // another copy of it could be loaded and added to transaction
+        if Arc::strong_count(item) > 1 {
+            return true;
+        }
+
         // cow in transaction must be kept in cache,
         // if cannot read the inner cow entity, we assume it is pinned
         match item.try_read() {
@@ -500,6 +506,13 @@ where
     pub fn get(&self, id: &Eid, vol: &VolumeRef) -> Result<CowRef<T>> {
         let mut lru = self.lru.write().unwrap();
 
+        // caches are created before volume is known, so counters are bound
+        // at the first lookup
+        if !lru.has_counters() {
+            let vol = vol.read().unwrap();
+            lru.set_counters(&vol.metrics().cow_cache);
+        }
+
         // get from cache first
         if let Some(val) = lru.get_refresh(id) {
             return Ok(val.clone());
@@ -577,6 +590,8 @@ mod tests {
 
     impl Cowable for Obj {}
 
+    impl<'de> IntoCow<'de> for Obj {}
+
     #[test]
     fn inner_obj_ref() {
         let vol = setup_vol("inner_obj_ref");
@@ -628,4 +643,34 @@ mod tests {
             let _ = t.join();
         }
     }
+
+    #[test]
+    fn cache_keeps_referred_cow() {
+        let vol = setup_vol("cache_keeps_referred_cow");
+        let txmgr = TxMgr::new(&Eid::new(), &vol).into_ref();
+        let mut ids = Vec::new();
+        TxMgr::begin_trans(&txmgr)
+            .unwrap()
+            .run_all(|| {
+                for val in 0..2 {
+                    let cow_ref = Obj::new(val).into_cow(&txmgr)?;
+                    ids.push(cow_ref.read().unwrap().id().clone());
+                }
+                Ok(())
+            })
+            .unwrap();
+
+        // cow still referred must not be evicted, otherwise another copy
+        // of it would be loaded
+        let cache = CowCache::<Obj>::new(1);
+        let a = cache.get(&ids[0], &vol).unwrap();
+        let b = cache.get(&ids[1], &vol).unwrap();
+        assert!(Arc::ptr_eq(&a, &cache.get(&ids[0], &vol).unwrap()));
+        assert!(Arc::ptr_eq(&b, &cache.get(&ids[1], &vol).unwrap()));
+
+        // unreferred cow can be evicted
+        drop(a);
+        let c = cache.get(&ids[0], &vol).unwrap();
+        assert_eq!(c.read().unwrap().val, 0);
+    }
 }
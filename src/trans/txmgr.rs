@@ -1,16 +1,80 @@
 use std::collections::HashMap;
 use std::fmt::{self, Debug};
-use std::sync::{Arc, Mutex, RwLock, Weak};
+use std::io::{Error as IoError, ErrorKind};
+use std::mem;
+use std::sync::{Arc, Condvar, Mutex, RwLock, Weak};
+use std::time::Instant;
 
 use linked_hash_map::LinkedHashMap;
 
 use super::trans::{Action, Trans, TransRef, TransableRef};
-use super::wal::{EntityType, WalQueueMgr};
+use super::wal::{EntityType, Wal, WalQueueMgr};
 use super::{Eid, Txid};
+use base::metrics::MetricsRef;
 use base::IntoRef;
 use error::{Error, Result};
 use volume::{Arm, VolumeRef};
 
+// commit group state
+#[derive(Default)]
+struct GroupState {
+    // is group leader flushing wal queue
+    is_flushing: bool,
+
+    // transactions prepared and waiting for the next flush
+    staged: Vec<(Txid, Wal)>,
+
+    // commit results which are not taken by their owners yet
+    results: HashMap<Txid, Result<()>>,
+}
+
+/// Group commit
+///
+/// Transactions are prepared in their own threads concurrently and then
+/// staged in the group. The first staged transaction thread becomes the
+/// leader, it takes all staged transactions and commits them to wal queue
+/// with only one wal queue saving and volume flush. Transactions staged
+/// during the flush will wait and be committed by the next leader.
+#[derive(Default)]
+struct CommitGroup {
+    state: Mutex<GroupState>,
+    flushed: Condvar,
+}
+
+impl CommitGroup {
+    fn commit(&self, txid: Txid, wal: Wal, txmgr: &TxMgrRef) -> Result<()> {
+        let mut state = self.state.lock().unwrap();
+        state.staged.push((txid, wal));
+
+        loop {
+            // tx has been committed by a group leader
+            if let Some(result) = state.results.remove(&txid) {
+                return result;
+            }
+
+            if state.is_flushing {
+                state = self.flushed.wait(state).unwrap();
+                continue;
+            }
+
+            // become group leader and commit all the staged txs
+            state.is_flushing = true;
+            let staged = mem::replace(&mut state.staged, Vec::new());
+            drop(state);
+
+            let results = {
+                let mut tm = txmgr.write().unwrap();
+                tm.commit_group(staged)
+            };
+
+            state = self.state.lock().unwrap();
+            state.is_flushing = false;
+            state.results.extend(results);
+            self.flushed.notify_all();
+        }
+    }
+}
+
 /// Tranaction manager
 #[derive(Default)]
 pub struct TxMgr {
@@ -24,6 +88,12 @@ pub struct TxMgr {
     walq_mgr: WalQueueMgr,
 
     vol: VolumeRef,
+
+    // commit group
+    group: Arc<CommitGroup>,
+
+    // tx latencies are recorded in volume metrics
+    metrics: MetricsRef,
 }
 
 impl TxMgr {
@@ -33,6 +103,8 @@ impl TxMgr {
             ents: HashMap::new(),
             walq_mgr: WalQueueMgr::new(walq_id, vol),
             vol: vol.clone(),
+            group: Arc::new(CommitGroup::default()),
+            metrics: vol.read().unwrap().metrics(),
         }
     }
 
@@ -50,6 +122,7 @@ impl TxMgr {
             return Err(Error::InTrans);
         }
 
+        let begin = Instant::now();
         let mut tm = txmgr.write().unwrap();
 
         // try to redo abort tx if any tx failed abortion before,
@@ -78,8 +151,10 @@ impl TxMgr {
         };
         if let Err(err) = result {
             tm.abort_trans(txid);
+            Txid::reset_current();
             return Err(err);
         }
+        tm.metrics.tx_begin.record_since(begin);
 
         Ok(TxHandle {
             txid,
@@ -109,49 +184,63 @@ impl TxMgr {
         tx.add_entity(id, entity, action, ent_type, arm)
     }
 
+    // remove tx from tx manager, the thread tx mark is not reset here
+    // because the tx could be removed by other thread in group commit
     #[inline]
     fn remove_trans(&mut self, txid: Txid) {
         self.txs.remove(&txid);
         self.ents.retain(|_, &mut v| v != txid);
-        Txid::reset_current();
     }
 
-    // commit transaction
-    fn commit_trans(&mut self, txid: Txid) -> Result<()> {
-        let result = {
-            let tx_ref = self.txs.get(&txid).unwrap().clone();
-            let mut tx = tx_ref.write().unwrap();
-
-            // commit tx, if any errors then abort the tx
-            match tx
-                .commit(&self.vol)
-                .and_then(|wal| self.walq_mgr.commit_trans(wal))
-            {
-                Ok(_) => {
-                    tx.complete_commit();
+    // commit a group of prepared transactions
+    fn commit_group(
+        &mut self,
+        staged: Vec<(Txid, Wal)>,
+    ) -> Vec<(Txid, Result<()>)> {
+        let (txids, wals): (Vec<Txid>, Vec<Wal>) = staged.into_iter().unzip();
+
+        match self.walq_mgr.commit_trans(wals) {
+            Ok(_) => txids
+                .into_iter()
+                .map(|txid| {
+                    {
+                        let tx_ref = self.txs.get(&txid).unwrap().clone();
+                        let mut tx = tx_ref.write().unwrap();
+                        tx.complete_commit();
+                    }
                     debug!("tx#{} committed", txid);
-                    Ok(())
-                }
-                Err(err) => Err(err),
-            }
-        };
 
-        if result.is_err() {
-            // error happened during commit, abort the tx
-            debug!("commit tx failed: {:?}", result);
-            self.abort_trans(txid);
-        } else {
-            // commit succeed, remove tx from tx manager
-            self.remove_trans(txid);
+                    // commit succeed, remove tx from tx manager
+                    self.remove_trans(txid);
+                    (txid, Ok(()))
+                })
+                .collect(),
+            Err(err) => {
+                // error happened during commit, abort all the txs in group,
+                // the leading tx gets the original error and the others get
+                // an io error with the same description as Error is not
+                // clonable
+                debug!("commit tx group {:?} failed: {:?}", txids, err);
+                let desc = err.to_string();
+                let mut err = Some(err);
+                txids
+                    .into_iter()
+                    .map(|txid| {
+                        self.abort_trans(txid);
+                        let err = err.take().unwrap_or_else(|| {
+                            Error::from(IoError::new(ErrorKind::Other, &*desc))
+                        });
+                        (txid, Err(err))
+                    })
+                    .collect()
+            }
         }
-
-        // return the original result during commit
-        result
     }
 
     // abort transaction
     fn abort_trans(&mut self, txid: Txid) {
         debug!("abort tx#{}", txid);
+        let begin = Instant::now();
 
         {
             let tx_ref = self.txs.get(&txid).unwrap().clone();
@@ -170,6 +259,7 @@ impl TxMgr {
 
         // remove tx from tx manager
         self.remove_trans(txid);
+        self.metrics.tx_abort.record_since(begin);
     }
 }
 
@@ -237,11 +327,51 @@ impl TxHandle {
     }
 
     /// Commit a transaction
-    #[inline]
+    ///
+    /// The transaction is prepared without holding tx manager lock, then
+    /// it is committed to wal queue together with other concurrently
+    /// committing transactions.
     pub fn commit(&self) -> Result<()> {
+        let begin = Instant::now();
         let txmgr = self.txmgr.upgrade().ok_or(Error::RepoClosed)?;
-        let mut tm = txmgr.write().unwrap();
-        tm.commit_trans(self.txid)
+        let (tx_ref, vol, group, metrics) = {
+            let tm = txmgr.read().unwrap();
+            let tx_ref = tm.txs.get(&self.txid).ok_or(Error::NoTrans)?;
+            (
+                tx_ref.clone(),
+                tm.vol.clone(),
+                tm.group.clone(),
+                tm.metrics.clone(),
+            )
+        };
+
+        // prepare tx and get its wal
+        let result = {
+            let mut tx = tx_ref.write().unwrap();
+            tx.commit(&vol)
+        };
+
+        let result = match result {
+            Ok(wal) => group.commit(self.txid, wal, &txmgr),
+            Err(err) => {
+                // error happened during commit, abort the tx
+                debug!("commit tx#{} failed: {:?}", self.txid, err);
+                let mut tm = txmgr.write().unwrap();
+                tm.abort_trans(self.txid);
+                Err(err)
+            }
+        };
+
+        // tx is completed, remove the thread tx mark
+        Txid::reset_current();
+
+        // failed commit is recorded as an abort
+        if result.is_ok() {
+            metrics.tx_commit.record_since(begin);
+        }
+
+        // return the original result during commit
+        result
     }
 
     /// Abort a transaction
@@ -251,6 +381,7 @@ impl TxHandle {
 
         debug!("run tx failed: {:?}", err);
         tm.abort_trans(self.txid);
+        Txid::reset_current();
 
         // return the original error
         Err(err)
@@ -264,6 +395,7 @@ mod tests {
     #[cfg(feature = "storage-file")]
     use self::tempdir::TempDir;
     use super::*;
+    use std::thread;
 
     use base::init_env;
     use fs::Config;
@@ -449,6 +581,49 @@ mod tests {
         .unwrap();
     }
 
+    fn trans_group(vol: VolumeRef) {
+        let tm = TxMgr::new(&Eid::new(), &vol).into_ref();
+        let thread_cnt = 4;
+        let round = 10;
+
+        // concurrent txs in multiple threads
+        let children: Vec<_> = (0..thread_cnt)
+            .map(|i| {
+                let tm = tm.clone();
+                thread::spawn(move || {
+                    let mut a = Arc::default();
+                    let tx = TxMgr::begin_trans(&tm).unwrap();
+                    tx.run_all(|| {
+                        a = Obj::new(i).into_cow(&tm)?;
+                        Ok(())
+                    })
+                    .unwrap();
+                    assert!(!Txid::is_in_trans());
+
+                    for j in 0..round {
+                        let tx = TxMgr::begin_trans(&tm).unwrap();
+                        tx.run_all(|| {
+                            let mut a_cow = a.write().unwrap();
+                            let a = a_cow.make_mut(&tm)?;
+                            a.val = i + j;
+                            Ok(())
+                        })
+                        .unwrap();
+                        assert!(!Txid::is_in_trans());
+                    }
+                    Obj::ensure(&a, i + round - 1, Arm::Right);
+                })
+            })
+            .collect();
+        for child in children {
+            child.join().unwrap();
+        }
+
+        let tm = tm.read().unwrap();
+        assert!(tm.txs.is_empty());
+        assert!(tm.ents.is_empty());
+    }
+
     #[test]
     fn test_trans_mem() {
         {
@@ -459,6 +634,10 @@ mod tests {
             let vol = setup_mem_vol("txmgr.bar");
             trans_abort(vol);
         }
+        {
+            let vol = setup_mem_vol("txmgr.baz");
+            trans_group(vol);
+        }
     }
 
     #[cfg(feature = "storage-file")]
@@ -472,6 +651,10 @@ mod tests {
             let (vol, _tmpdir) = setup_file_vol();
             trans_abort(vol);
         }
+        {
+            let (vol, _tmpdir) = setup_file_vol();
+            trans_group(vol);
+        }
     }
 
     #[cfg(feature = "storage-zbox")]
@@ -525,16 +525,18 @@ impl WalQueueMgr {
         })
     }
 
-    pub fn commit_trans(&mut self, wal: Wal) -> Result<()> {
+    // commit a group of transactions with one wal queue saving
+    pub fn commit_trans(&mut self, wals: Vec<Wal>) -> Result<()> {
         self.backup_walq();
-        self.walq
-            .commit_trans(wal)
-            .and_then(|_| self.save_walq())
-            .or_else(|err| {
-                // if commit failed, restore the walq backup
-                self.restore_walq();
-                Err(err)
-            })
+        let result = {
+            let walq = &mut self.walq;
+            wals.into_iter().try_for_each(|wal| walq.commit_trans(wal))
+        };
+        result.and_then(|_| self.save_walq()).or_else(|err| {
+            // if commit failed, restore the walq backup
+            self.restore_walq();
+            Err(err)
+        })
     }
 
     #[inline]
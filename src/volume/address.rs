@@ -94,10 +94,17 @@ impl LocSpan {
 }
 
 /// Entity address
+///
+/// The seek index is set by upper layer and opaque to storage, it is a list
+/// of offsets in the decrypted entity where each compressed frame starts.
+/// It is empty for uncompressed entities and addresses saved by earlier
+/// versions.
 #[derive(Debug, Clone, Default, Deserialize, Serialize)]
 pub struct Addr {
     pub len: usize,
     pub list: Vec<LocSpan>,
+    #[serde(default)]
+    pub seek_index: Vec<u64>,
 }
 
 impl Addr {
@@ -124,7 +131,7 @@ impl Addr {
         self.len += len;
     }
 
-    // divide address to frames
+    // divide address to frames, seek index is not included in the frames
     pub fn divide_to_frames(&self) -> Vec<Addr> {
         let mut frames = vec![Addr::default()];
         let mut frm_idx = 0;
@@ -184,8 +191,31 @@ impl Index<usize> for Addr {
 
 #[cfg(test)]
 mod tests {
+    use rmp_serde::{Deserializer, Serializer};
+    use serde::{Deserialize, Serialize};
+
     use super::*;
 
+    #[test]
+    fn addr_seek_index() {
+        let addr = Addr {
+            len: 3,
+            list: vec![LocSpan::new(0, 1, 0)],
+            seek_index: vec![4, 100, 2000],
+        };
+        let mut buf = Vec::new();
+        addr.serialize(&mut Serializer::new(&mut buf)).unwrap();
+        let addr2: Addr =
+            Deserialize::deserialize(&mut Deserializer::new(&buf[..])).unwrap();
+        assert_eq!(addr2.len, addr.len);
+        assert_eq!(addr2.list, addr.list);
+        assert_eq!(addr2.seek_index, addr.seek_index);
+
+        // seek index is not in divided frames
+        let frms = addr.divide_to_frames();
+        assert!(frms[0].seek_index.is_empty());
+    }
+
     #[test]
     fn split_addr() {
         // #1, address is smaller than a frame
@@ -193,6 +223,7 @@ mod tests {
         let addr = Addr {
             len: 3,
             list: vec![lspan.clone()],
+            ..Default::default()
         };
         let frms = addr.divide_to_frames();
         assert_eq!(frms.len(), 1);
@@ -204,6 +235,7 @@ mod tests {
         let addr = Addr {
             len: FRAME_SIZE,
             list: vec![lspan.clone()],
+            ..Default::default()
         };
         let frms = addr.divide_to_frames();
         assert_eq!(frms.len(), 1);
@@ -215,6 +247,7 @@ mod tests {
         let addr = Addr {
             len: FRAME_SIZE + 3,
             list: vec![lspan.clone()],
+            ..Default::default()
         };
         let frms = addr.divide_to_frames();
         assert_eq!(frms.len(), 2);
@@ -232,6 +265,7 @@ mod tests {
         let addr = Addr {
             len: BLK_SIZE + 3,
             list: vec![lspan.clone(), lspan2.clone()],
+            ..Default::default()
         };
         let frms = addr.divide_to_frames();
         assert_eq!(frms.len(), 1);
@@ -246,6 +280,7 @@ mod tests {
         let addr = Addr {
             len: BLK_SIZE + FRAME_SIZE,
             list: vec![lspan.clone(), lspan2.clone()],
+            ..Default::default()
         };
         let frms = addr.divide_to_frames();
         assert_eq!(frms.len(), 2);
@@ -268,6 +303,7 @@ mod tests {
         let addr = Addr {
             len: FRAME_SIZE * 2 + 3,
             list: vec![lspan.clone()],
+            ..Default::default()
         };
         let frms = addr.divide_to_frames();
         assert_eq!(frms.len(), 3);
@@ -0,0 +1,581 @@
+use std::cmp::{max, min};
+use std::io::{
+    Error as IoError, ErrorKind, Read, Result as IoResult, Seek, SeekFrom,
+    Write,
+};
+use std::mem;
+use std::sync::atomic::{AtomicU64, Ordering};
+use std::sync::Arc;
+
+use base::lz4;
+
+// entity header magic for framed compression format, it is different from
+// LZ4 frame magic, so entities written as a single LZ4 stream by older
+// versions can still be recognised
+pub const MAGIC: [u8; 4] = [0x5a, 0x42, 0x43, 0x01];
+
+// uncompressed frame size, the last frame of an entity can be shorter
+pub const FRAME_LEN: usize = 64 * 1024;
+
+// frame header is a little endian u32, the highest bit indicates the frame
+// is stored raw and the rest is the stored frame length
+const HEADER_LEN: usize = 4;
+const RAW_FLAG: u32 = 1 << 31;
+
+// frames with sampled entropy above this, in bits per byte, are considered
+// already compressed and stored raw without trying compression
+const MAX_ENTROPY: f64 = 7.9;
+
+// number of bytes sampled for entropy estimation
+const SAMPLE_LEN: usize = 4096;
+
+// compression must save at least 1/32 of frame size, otherwise the frame is
+// stored raw
+const MIN_SAVING_SHIFT: usize = 5;
+
+// estimate order-0 entropy of data by sampling, in bits per byte
+fn sample_entropy(data: &[u8]) -> f64 {
+    let step = max(data.len() / SAMPLE_LEN, 1);
+    let mut hist = [0u32; 256];
+    let mut cnt = 0;
+    for byte in data.iter().step_by(step) {
+        hist[*byte as usize] += 1;
+        cnt += 1;
+    }
+
+    let cnt = f64::from(cnt);
+    hist.iter()
+        .filter(|n| **n > 0)
+        .map(|n| {
+            let p = f64::from(*n) / cnt;
+            -p * p.log2()
+        })
+        .sum()
+}
+
+/// Compression statistics
+///
+/// Counters are accumulated since the repository is opened.
+#[derive(Debug, Clone, Copy, Default)]
+pub struct CompressStats {
+    /// Number of frames stored compressed
+    pub compressed_frames: u64,
+
+    /// Number of frames stored raw because they are not compressible
+    pub skipped_frames: u64,
+
+    /// Total bytes before compression
+    pub input_bytes: u64,
+
+    /// Total bytes stored, including frame headers
+    pub output_bytes: u64,
+
+    /// Bytes stored raw in the skipped frames
+    pub skipped_bytes: u64,
+}
+
+impl CompressStats {
+    /// Returns the ratio of stored bytes to input bytes
+    ///
+    /// It is 1.0 if nothing is written yet.
+    pub fn ratio(&self) -> f64 {
+        if self.input_bytes == 0 {
+            return 1.0;
+        }
+        self.output_bytes as f64 / self.input_bytes as f64
+    }
+}
+
+// compression counters shared by volume writers
+#[derive(Debug, Default)]
+pub struct CompressCounters {
+    compressed_frames: AtomicU64,
+    skipped_frames: AtomicU64,
+    input_bytes: AtomicU64,
+    output_bytes: AtomicU64,
+    skipped_bytes: AtomicU64,
+}
+
+impl CompressCounters {
+    fn add_compressed(&self, input: usize, output: usize) {
+        self.compressed_frames.fetch_add(1, Ordering::Relaxed);
+        self.input_bytes.fetch_add(input as u64, Ordering::Relaxed);
+        self.output_bytes
+            .fetch_add(output as u64, Ordering::Relaxed);
+    }
+
+    fn add_skipped(&self, input: usize) {
+        self.skipped_frames.fetch_add(1, Ordering::Relaxed);
+        self.input_bytes.fetch_add(input as u64, Ordering::Relaxed);
+        self.output_bytes
+            .fetch_add((input + HEADER_LEN) as u64, Ordering::Relaxed);
+        self.skipped_bytes
+            .fetch_add(input as u64, Ordering::Relaxed);
+    }
+
+    pub fn snapshot(&self) -> CompressStats {
+        CompressStats {
+            compressed_frames: self.compressed_frames.load(Ordering::Relaxed),
+            skipped_frames: self.skipped_frames.load(Ordering::Relaxed),
+            input_bytes: self.input_bytes.load(Ordering::Relaxed),
+            output_bytes: self.output_bytes.load(Ordering::Relaxed),
+            skipped_bytes: self.skipped_bytes.load(Ordering::Relaxed),
+        }
+    }
+}
+
+/// Adaptive frame compressor
+///
+/// Data is split into frames and each frame is compressed independently.
+/// Frames look like already compressed data, or cannot be compressed
+/// enough, are stored raw.
+///
+/// The stored offset of each frame is recorded in a seek index, which is
+/// returned by `finish` and should be saved along with the entity.
+pub struct Compressor<W: Write> {
+    inner: W,
+    level: u32,
+    buf: Vec<u8>,
+    out: Vec<u8>,
+    counters: Arc<CompressCounters>,
+
+    // bytes written to inner writer and the frame offsets
+    offset: u64,
+    seek_index: Vec<u64>,
+}
+
+impl<W: Write> Compressor<W> {
+    pub fn new(
+        mut inner: W,
+        level: u32,
+        counters: &Arc<CompressCounters>,
+    ) -> IoResult<Self> {
+        inner.write_all(&MAGIC)?;
+        Ok(Compressor {
+            inner,
+            level,
+            buf: Vec::with_capacity(FRAME_LEN),
+            out: vec![0u8; HEADER_LEN + lz4::compress_bound(FRAME_LEN)],
+            counters: counters.clone(),
+            offset: MAGIC.len() as u64,
+            seek_index: Vec::new(),
+        })
+    }
+
+    // compress buffered data as one frame and write it to inner writer
+    fn write_frame(&mut self) -> IoResult<()> {
+        let len = self.buf.len();
+        if len == 0 {
+            return Ok(());
+        }
+
+        let mut comp_len = 0;
+        if sample_entropy(&self.buf) <= MAX_ENTROPY {
+            comp_len = lz4::compress_block(
+                &self.buf,
+                &mut self.out[HEADER_LEN..],
+                self.level,
+            )?;
+        }
+
+        let stored_len =
+            if comp_len > 0 && comp_len + (len >> MIN_SAVING_SHIFT) < len {
+                let header = comp_len as u32;
+                self.out[..HEADER_LEN].copy_from_slice(&header.to_le_bytes());
+                self.inner.write_all(&self.out[..HEADER_LEN + comp_len])?;
+                self.counters.add_compressed(len, HEADER_LEN + comp_len);
+                HEADER_LEN + comp_len
+            } else {
+                let header = len as u32 | RAW_FLAG;
+                self.inner.write_all(&header.to_le_bytes())?;
+                self.inner.write_all(&self.buf)?;
+                self.counters.add_skipped(len);
+                HEADER_LEN + len
+            };
+
+        self.seek_index.push(self.offset);
+        self.offset += stored_len as u64;
+        self.buf.clear();
+        Ok(())
+    }
+
+    /// Write the last frame, return the inner writer and the seek index
+    pub fn finish(mut self) -> (W, IoResult<Vec<u64>>) {
+        let result = self.write_frame();
+        let seek_index = mem::replace(&mut self.seek_index, Vec::new());
+        (self.inner, result.map(|_| seek_index))
+    }
+}
+
+impl<W: Write> Write for Compressor<W> {
+    fn write(&mut self, mut buf: &[u8]) -> IoResult<usize> {
+        let written = buf.len();
+        while !buf.is_empty() {
+            let len = min(FRAME_LEN - self.buf.len(), buf.len());
+            self.buf.extend_from_slice(&buf[..len]);
+            buf = &buf[len..];
+            if self.buf.len() >= FRAME_LEN {
+                self.write_frame()?;
+            }
+        }
+        Ok(written)
+    }
+
+    // buffered partial frame is not written until finish, so all frames
+    // except the last one have the same length
+    #[inline]
+    fn flush(&mut self) -> IoResult<()> {
+        self.inner.flush()
+    }
+}
+
+/// Frame decompressor
+///
+/// The inner reader must be already positioned after the entity magic.
+/// Seeking needs the seek index written by the compressor, only the frame
+/// containing the new position will be read and decompressed.
+pub struct Decompressor<R: Read> {
+    inner: R,
+    src: Vec<u8>,
+    frame: Vec<u8>,
+    pos: usize,
+    len: usize,
+
+    // seek index and index of the next frame to load
+    seek_index: Vec<u64>,
+    next: usize,
+}
+
+impl<R: Read> Decompressor<R> {
+    pub fn new(inner: R, seek_index: Vec<u64>) -> Self {
+        Decompressor {
+            inner,
+            src: vec![0u8; lz4::compress_bound(FRAME_LEN)],
+            frame: vec![0u8; FRAME_LEN],
+            pos: 0,
+            len: 0,
+            seek_index,
+            next: 0,
+        }
+    }
+
+    // check if seeking can use the seek index
+    #[inline]
+    pub fn is_seekable(&self) -> bool {
+        !self.seek_index.is_empty()
+    }
+
+    // read frame header, return None if it is the end of entity
+    fn read_header(&mut self) -> IoResult<Option<u32>> {
+        let mut header = [0u8; HEADER_LEN];
+        let mut read = 0;
+        while read < HEADER_LEN {
+            match self.inner.read(&mut header[read..]) {
+                Ok(0) if read == 0 => return Ok(None),
+                Ok(0) => {
+                    return Err(IoError::new(
+                        ErrorKind::UnexpectedEof,
+                        "Truncated compression frame header",
+                    ));
+                }
+                Ok(n) => read += n,
+                Err(ref err) if err.kind() == ErrorKind::Interrupted => {}
+                Err(err) => return Err(err),
+            }
+        }
+        Ok(Some(u32::from_le_bytes(header)))
+    }
+
+    // load next frame, return false if it is the end of entity
+    fn load_frame(&mut self) -> IoResult<bool> {
+        let header = match self.read_header()? {
+            Some(header) => header,
+            None => return Ok(false),
+        };
+        let len = (header & !RAW_FLAG) as usize;
+
+        if header & RAW_FLAG != 0 {
+            if len > FRAME_LEN {
+                return Err(IoError::new(
+                    ErrorKind::InvalidData,
+                    "Invalid compression frame length",
+                ));
+            }
+            self.inner.read_exact(&mut self.frame[..len])?;
+            self.len = len;
+        } else {
+            if len > self.src.len() {
+                return Err(IoError::new(
+                    ErrorKind::InvalidData,
+                    "Invalid compression frame length",
+                ));
+            }
+            self.inner.read_exact(&mut self.src[..len])?;
+            self.len =
+                lz4::decompress_block(&self.src[..len], &mut self.frame)?;
+        }
+        self.pos = 0;
+        self.next += 1;
+
+        Ok(true)
+    }
+}
+
+impl<R: Read> Read for Decompressor<R> {
+    fn read(&mut self, buf: &mut [u8]) -> IoResult<usize> {
+        if buf.is_empty() {
+            return Ok(0);
+        }
+        while self.pos >= self.len {
+            if !self.load_frame()? {
+                return Ok(0);
+            }
+        }
+        let len = min(self.len - self.pos, buf.len());
+        buf[..len].copy_from_slice(&self.frame[self.pos..self.pos + len]);
+        self.pos += len;
+        Ok(len)
+    }
+}
+
+impl<R: Read + Seek> Seek for Decompressor<R> {
+    // seek to a decompressed position, seeking from end is not supported
+    // because the last frame length is unknown until it is decompressed
+    fn seek(&mut self, pos: SeekFrom) -> IoResult<u64> {
+        let new_pos = match pos {
+            SeekFrom::Start(pos) => pos,
+            _ => {
+                return Err(IoError::new(
+                    ErrorKind::InvalidInput,
+                    "Only seek from start is supported",
+                ));
+            }
+        };
+        let frm_idx = (new_pos / FRAME_LEN as u64) as usize;
+        let offset = (new_pos % FRAME_LEN as u64) as usize;
+
+        // reuse the loaded frame if the new position is in it
+        if self.len > 0 && frm_idx + 1 == self.next {
+            self.pos = min(offset, self.len);
+            return Ok(new_pos);
+        }
+
+        if frm_idx < self.seek_index.len() {
+            self.inner.seek(SeekFrom::Start(self.seek_index[frm_idx]))?;
+            self.next = frm_idx;
+            if self.load_frame()? {
+                self.pos = min(offset, self.len);
+            }
+        } else {
+            // seek beyond the last frame
+            self.inner.seek(SeekFrom::End(0))?;
+            self.next = self.seek_index.len();
+            self.pos = 0;
+            self.len = 0;
+        }
+
+        Ok(new_pos)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use std::io::Cursor;
+
+    use super::*;
+    use base::crypto::{Crypto, RandomSeed, RANDOM_SEED_SIZE};
+    use base::init_env;
+
+    fn compress(data: &[u8], level: u32) -> (Vec<u8>, Vec<u64>) {
+        let counters = Arc::new(CompressCounters::default());
+        let mut comp = Compressor::new(Vec::new(), level, &counters).unwrap();
+        comp.write_all(data).unwrap();
+        let (out, result) = comp.finish();
+        (out, result.unwrap())
+    }
+
+    fn decompressor(
+        out: &[u8],
+        seek_index: Vec<u64>,
+    ) -> Decompressor<Cursor<&[u8]>> {
+        let mut rdr = Cursor::new(out);
+        rdr.seek(SeekFrom::Start(MAGIC.len() as u64)).unwrap();
+        Decompressor::new(rdr, seek_index)
+    }
+
+    fn round_trip(data: &[u8], level: u32) -> (Vec<u8>, CompressStats) {
+        let counters = Arc::new(CompressCounters::default());
+        let mut comp = Compressor::new(Vec::new(), level, &counters).unwrap();
+        comp.write_all(data).unwrap();
+        let (out, result) = comp.finish();
+        let seek_index = result.unwrap();
+        assert_eq!(&out[..MAGIC.len()], &MAGIC[..]);
+        assert_eq!(seek_index.len(), (data.len() + FRAME_LEN - 1) / FRAME_LEN);
+
+        let mut dst = Vec::new();
+        let mut decomp = decompressor(&out, seek_index);
+        decomp.read_to_end(&mut dst).unwrap();
+        assert_eq!(&dst[..], data);
+
+        (out, counters.snapshot())
+    }
+
+    #[test]
+    fn adaptive_compress() {
+        init_env();
+
+        // empty data
+        let (out, stats) = round_trip(&[], 0);
+        assert_eq!(out.len(), MAGIC.len());
+        assert_eq!(stats.input_bytes, 0);
+
+        // compressible data is compressed in both modes
+        let text: Vec<u8> = b"the quick brown fox jumps over the lazy dog "
+            .iter()
+            .cycle()
+            .take(FRAME_LEN * 2 + 123)
+            .cloned()
+            .collect();
+        for level in [0, 9].iter() {
+            let (out, stats) = round_trip(&text, *level);
+            assert!(out.len() < text.len() / 4);
+            assert_eq!(stats.compressed_frames, 3);
+            assert_eq!(stats.skipped_frames, 0);
+            assert_eq!(stats.input_bytes, text.len() as u64);
+            assert_eq!(stats.output_bytes, (out.len() - MAGIC.len()) as u64);
+            assert!(stats.ratio() < 0.25);
+        }
+
+        // random data is stored raw
+        let mut rnd = vec![0u8; FRAME_LEN + 100];
+        let seed = RandomSeed::from(&[0u8; RANDOM_SEED_SIZE]);
+        Crypto::random_buf_deterministic(&mut rnd, &seed);
+        let (_, stats) = round_trip(&rnd, 0);
+        assert_eq!(stats.compressed_frames, 0);
+        assert_eq!(stats.skipped_frames, 2);
+        assert_eq!(stats.skipped_bytes, rnd.len() as u64);
+
+        // mixed data
+        let mut mixed = text.clone();
+        mixed.extend_from_slice(&rnd);
+        let (_, stats) = round_trip(&mixed, 0);
+        assert!(stats.compressed_frames > 0);
+        assert!(stats.skipped_frames > 0);
+    }
+
+    #[test]
+    fn seek_compressed() {
+        init_env();
+
+        // half compressible and half random data
+        let mut data: Vec<u8> = b"the quick brown fox jumps over the lazy dog "
+            .iter()
+            .cycle()
+            .take(FRAME_LEN * 2 + 100)
+            .cloned()
+            .collect();
+        let mut rnd = vec![0u8; FRAME_LEN * 2 + 200];
+        let seed = RandomSeed::from(&[0u8; RANDOM_SEED_SIZE]);
+        Crypto::random_buf_deterministic(&mut rnd, &seed);
+        data.extend_from_slice(&rnd);
+
+        let (out, seek_index) = compress(&data, 0);
+        assert_eq!(seek_index[0], MAGIC.len() as u64);
+        let mut decomp = decompressor(&out, seek_index);
+        assert!(decomp.is_seekable());
+
+        // seek forward and backward, across and within frames
+        let mut buf = vec![0u8; 300];
+        for pos in [
+            FRAME_LEN * 3 + 7,
+            10,
+            FRAME_LEN - 100,
+            FRAME_LEN * 2 + 50,
+            FRAME_LEN * 2 + 60,
+            FRAME_LEN * 2,
+            data.len() - buf.len(),
+        ]
+        .iter()
+        {
+            decomp.seek(SeekFrom::Start(*pos as u64)).unwrap();
+            decomp.read_exact(&mut buf).unwrap();
+            assert_eq!(&buf[..], &data[*pos..*pos + buf.len()]);
+        }
+
+        // seek to the end and beyond
+        for pos in
+            [data.len(), data.len() + 5, data.len() + FRAME_LEN * 2].iter()
+        {
+            decomp.seek(SeekFrom::Start(*pos as u64)).unwrap();
+            assert_eq!(decomp.read(&mut buf).unwrap(), 0);
+        }
+
+        // read to end after seek
+        let mut dst = Vec::new();
+        decomp.seek(SeekFrom::Start(FRAME_LEN as u64 + 1)).unwrap();
+        decomp.read_to_end(&mut dst).unwrap();
+        assert_eq!(&dst[..], &data[FRAME_LEN + 1..]);
+
+        // only seek from start is supported
+        assert!(decomp.seek(SeekFrom::Current(1)).is_err());
+        assert!(decomp.seek(SeekFrom::End(0)).is_err());
+    }
+
+    #[cfg(feature = "test-perf")]
+    #[test]
+    fn bench_lz4() {
+        use base::bench::{Bench, Work};
+
+        init_env();
+        let bench = Bench::from_env();
+
+        // make compressible data from random slices of a small dictionary
+        const DATA_LEN: usize = 16 * 1024 * 1024;
+        let mut dict = vec![0u8; 64 * 1024];
+        let seed = RandomSeed::from(&[0u8; RANDOM_SEED_SIZE]);
+        Crypto::random_buf_deterministic(&mut dict, &seed);
+        let mut data = Vec::with_capacity(DATA_LEN);
+        while data.len() < DATA_LEN {
+            let len = 64 + Crypto::random_u32(960) as usize;
+            let pos = Crypto::random_u32((dict.len() - len) as u32) as usize;
+            data.extend_from_slice(&dict[pos..pos + len]);
+        }
+        data.truncate(DATA_LEN);
+
+        // each thread compresses and decompresses its own share of data
+        for &(name, level) in [("lz4_fast", 0), ("lz4_hc", 9)].iter() {
+            for &threads in bench.threads() {
+                let share = DATA_LEN / threads;
+                let work = Work::Bytes(share * threads);
+                bench.run_threads(
+                    &format!("{}_compress", name),
+                    "none",
+                    threads,
+                    work,
+                    |idx| {
+                        compress(&data[idx * share..(idx + 1) * share], level);
+                    },
+                );
+
+                let outs: Vec<(Vec<u8>, Vec<u64>)> = (0..threads)
+                    .map(|idx| {
+                        compress(&data[idx * share..(idx + 1) * share], level)
+                    })
+                    .collect();
+                bench.run_threads(
+                    &format!("{}_decompress", name),
+                    "none",
+                    threads,
+                    work,
+                    |idx| {
+                        let (ref out, ref seek_index) = outs[idx];
+                        let mut dst = Vec::with_capacity(share);
+                        decompressor(out, seek_index.clone())
+                            .read_to_end(&mut dst)
+                            .unwrap();
+                    },
+                );
+            }
+        }
+    }
+}
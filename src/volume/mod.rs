@@ -5,6 +5,7 @@
 mod address;
 mod allocator;
 mod armor;
+mod compress;
 mod storage;
 mod super_block;
 mod volume;
@@ -13,6 +14,7 @@ pub use self::allocator::{Allocator, AllocatorRef};
 pub use self::armor::{
     Arm, ArmAccess, Armor, Seq, VolumeArmor, VolumeWalArmor,
 };
+pub use self::compress::CompressStats;
 pub use self::storage::StorageRef;
 pub use self::volume::{
     Info, Reader, Volume, VolumeRef, VolumeWeakRef, Writer,
@@ -103,6 +103,17 @@ impl Storable for FaultyStorage {
         self.inner.get_blocks(dst, span)
     }
 
+    #[inline]
+    fn can_read_shared(&self) -> bool {
+        self.inner.can_read_shared()
+    }
+
+    #[inline]
+    fn get_blocks_shared(&self, dst: &mut [u8], span: Span) -> Result<()> {
+        self.ctlr.make_random_error()?;
+        self.inner.get_blocks_shared(dst, span)
+    }
+
     #[inline]
     fn put_blocks(&mut self, span: Span, blks: &[u8]) -> Result<()> {
         self.ctlr.make_random_error()?;
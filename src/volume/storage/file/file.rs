@@ -3,8 +3,9 @@ use std::io::{ErrorKind, Read, Write};
 use std::path::{Path, PathBuf};
 
 use super::file_armor::FileArmor;
-use super::sector::SectorMgr;
+use super::sector::{SectorMgr, DEFAULT_DATA_HANDLES, DEFAULT_SHRINK_RATE};
 use base::crypto::{Crypto, Key};
+use base::metrics::MetricsRef;
 use base::utils;
 use base::vio;
 use error::{Error, Result};
@@ -13,6 +14,70 @@ use volume::address::Span;
 use volume::storage::index_mgr::{IndexMgr, Lsmt, MemTab, Tab};
 use volume::storage::Storable;
 
+// parse file storage location, its format is:
+//   path[?data_handles=64&mmap=false&shrink_rate=32mb]
+// path can contain '?', so only the trailing query whose keys are all known
+// parameters is parsed as parameters, otherwise it is part of the path. A
+// query mixing known and unknown parameters is mistyped and rejected.
+// parameters:
+//   data_handles: max number of opened sector data files, must be >= 1
+//   mmap: memory map finished sector data files for reading, unix only
+//   shrink_rate: background sector shrinking rate per second, 0 means
+//                unlimited
+// return: (
+//   base: &Path,
+//   data_handles: usize,
+//   use_mmap: bool,
+//   shrink_rate: usize,
+// )
+fn parse_loc(loc: &str) -> Result<(&Path, usize, bool, usize)> {
+    let (path, params) =
+        utils::split_loc_query(loc, &["data_handles", "mmap", "shrink_rate"])?;
+    if path.is_empty() {
+        return Err(Error::InvalidUri);
+    }
+
+    // set default value for parameters
+    let mut data_handles = DEFAULT_DATA_HANDLES;
+    let mut use_mmap = false;
+    let mut shrink_rate = DEFAULT_SHRINK_RATE;
+
+    // parse parameters
+    if !params.is_empty() {
+        for param in params.split('&') {
+            let idx = param.find('=').ok_or(Error::InvalidUri)?;
+            let key = &param[..idx];
+            let value = &param[idx + 1..];
+
+            match key {
+                "data_handles" => {
+                    data_handles = value
+                        .parse::<usize>()
+                        .map_err(|_| Error::InvalidUri)?;
+                    if data_handles < 1 {
+                        return Err(Error::InvalidUri);
+                    }
+                }
+                "mmap" => {
+                    use_mmap =
+                        value.parse::<bool>().map_err(|_| Error::InvalidUri)?;
+                }
+                "shrink_rate" => {
+                    let value = value.to_lowercase();
+                    let idx = value.find("mb").ok_or(Error::InvalidUri)?;
+                    let rate = value[..idx]
+                        .parse::<usize>()
+                        .map_err(|_| Error::InvalidUri)?;
+                    shrink_rate = rate * 1024 * 1024;
+                }
+                _ => return Err(Error::InvalidUri),
+            }
+        }
+    }
+
+    Ok((Path::new(path), data_handles, use_mmap, shrink_rate))
+}
+
 /// File Storage
 pub struct FileStorage {
     is_attached: bool, // attached to underlying os file system
@@ -38,7 +103,25 @@ impl FileStorage {
     const SUBKEY_ID_INDEX: u64 = 42;
     const SUBKEY_ID_SECTOR: u64 = 43;
 
+    // create file storage with default options
+    #[cfg(test)]
+    #[inline]
     pub fn new(base: &Path) -> Self {
+        Self::with_opts(base, DEFAULT_DATA_HANDLES, false, DEFAULT_SHRINK_RATE)
+    }
+
+    // create file storage from location string with optional parameters
+    pub fn from_loc(loc: &str) -> Result<Self> {
+        let (base, data_handles, use_mmap, shrink_rate) = parse_loc(loc)?;
+        Ok(Self::with_opts(base, data_handles, use_mmap, shrink_rate))
+    }
+
+    fn with_opts(
+        base: &Path,
+        data_handles: usize,
+        use_mmap: bool,
+        shrink_rate: usize,
+    ) -> Self {
         let idx_base = base.join(Self::INDEX_DIR);
         let idx_mgr = IndexMgr::new(
             Box::new(FileArmor::<Lsmt>::new(&idx_base)),
@@ -51,7 +134,12 @@ impl FileStorage {
             base: base.to_path_buf(),
             wal_base: base.join(Self::WAL_DIR),
             idx_mgr,
-            sec_mgr: SectorMgr::new(&base.join(Self::DATA_DIR)),
+            sec_mgr: SectorMgr::new(
+                &base.join(Self::DATA_DIR),
+                data_handles,
+                use_mmap,
+                shrink_rate,
+            ),
         }
     }
 
@@ -219,6 +307,16 @@ impl Storable for FileStorage {
         self.sec_mgr.read_blocks(dst, span)
     }
 
+    #[inline]
+    fn can_read_shared(&self) -> bool {
+        true
+    }
+
+    #[inline]
+    fn get_blocks_shared(&self, dst: &mut [u8], span: Span) -> Result<()> {
+        self.sec_mgr.read_blocks(dst, span)
+    }
+
     #[inline]
     fn put_blocks(&mut self, span: Span, blks: &[u8]) -> Result<()> {
         self.sec_mgr.write_blocks(span, blks)
@@ -242,6 +340,11 @@ impl Storable for FileStorage {
         vio::remove_dir_all(&self.base)?;
         Ok(())
     }
+
+    #[inline]
+    fn set_metrics(&mut self, metrics: &MetricsRef) {
+        self.idx_mgr.set_metrics(metrics);
+    }
 }
 
 impl Drop for FileStorage {
@@ -258,6 +361,7 @@ impl Debug for FileStorage {
     fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
         f.debug_struct("FileStorage")
             .field("base", &self.base)
+            .field("sec_mgr", &self.sec_mgr)
             .finish()
     }
 }
@@ -267,6 +371,8 @@ mod tests {
     extern crate tempdir;
 
     use std::fs;
+    use std::sync::atomic::{AtomicBool, Ordering};
+    use std::sync::Arc;
     use std::time::Instant;
 
     use self::tempdir::TempDir;
@@ -275,6 +381,8 @@ mod tests {
     use base::init_env;
     use base::utils::speed_str;
     use error::Error;
+    use volume::storage::file::sector::{BLKS_PER_SECTOR, SECTOR_SIZE};
+    use volume::storage::index_mgr::Accessor;
     use volume::BLK_SIZE;
 
     fn setup() -> (PathBuf, TempDir) {
@@ -463,6 +571,111 @@ mod tests {
         }
     }
 
+    #[test]
+    fn block_oper_shared() {
+        let (dir, _tmpdir) = setup();
+        let loc = format!("{}?data_handles=2&mmap=true", dir.display());
+        let mut fs = FileStorage::from_loc(&loc).unwrap();
+        fs.init(Crypto::default(), Key::new_empty()).unwrap();
+        assert!(fs.can_read_shared());
+
+        // write 3 finished sectors and an unfinished sector, block content
+        // is its index
+        let blk_cnt = BLKS_PER_SECTOR * 3 + 4;
+        let mut blks = vec![0u8; BLK_SIZE * 4];
+        for idx in (0..blk_cnt).step_by(4) {
+            for i in 0..4 {
+                let blk = &mut blks[BLK_SIZE * i..BLK_SIZE * (i + 1)];
+                blk[..8].copy_from_slice(&((idx + i) as u64).to_le_bytes());
+            }
+            fs.put_blocks(Span::new(idx, 4), &blks).unwrap();
+        }
+
+        // read blocks across sectors, more sectors than data handles
+        let mut tgt = vec![0u8; BLK_SIZE * 2];
+        for _ in 0..2 {
+            for idx in (1..blk_cnt - 1).step_by(BLKS_PER_SECTOR / 2 - 1) {
+                fs.get_blocks_shared(&mut tgt, Span::new(idx, 2)).unwrap();
+                for i in 0..2 {
+                    let mut buf = [0u8; 8];
+                    buf.copy_from_slice(&tgt[BLK_SIZE * i..BLK_SIZE * i + 8]);
+                    assert_eq!(u64::from_le_bytes(buf), (idx + i) as u64);
+                }
+            }
+        }
+
+        // shrink sector #1 in background and read during and after it
+        fs.del_blocks(Span::new(BLKS_PER_SECTOR, BLKS_PER_SECTOR - 4))
+            .unwrap();
+        let idx = BLKS_PER_SECTOR * 2 - 2;
+        for _ in 0..2 {
+            fs.get_blocks_shared(&mut tgt, Span::new(idx, 2)).unwrap();
+            let mut buf = [0u8; 8];
+            buf.copy_from_slice(&tgt[..8]);
+            assert_eq!(u64::from_le_bytes(buf), idx as u64);
+            assert_eq!(
+                fs.get_blocks_shared(&mut tgt, Span::new(BLKS_PER_SECTOR, 2))
+                    .unwrap_err(),
+                Error::NotFound
+            );
+            fs.sec_mgr.wait_shrink();
+        }
+
+        let stats = fs.sec_mgr.shrink_stats();
+        assert_eq!(stats.shrunk, 1);
+        assert_eq!(stats.reclaimed as usize, SECTOR_SIZE - BLK_SIZE * 4);
+        assert_eq!(stats.pending, 0);
+    }
+
+    #[test]
+    fn parse_location() {
+        let (base, handles, mmap, rate) = parse_loc("./foo/bar").unwrap();
+        assert_eq!(base, Path::new("./foo/bar"));
+        assert_eq!(handles, DEFAULT_DATA_HANDLES);
+        assert!(!mmap);
+        assert_eq!(rate, DEFAULT_SHRINK_RATE);
+        let (base, handles, mmap, rate) =
+            parse_loc("/foo?data_handles=8&mmap=true&shrink_rate=0mb").unwrap();
+        assert_eq!(base, Path::new("/foo"));
+        assert_eq!(handles, 8);
+        assert!(mmap);
+        assert_eq!(rate, 0);
+        assert_eq!(
+            parse_loc("foo?shrink_rate=8").unwrap_err(),
+            Error::InvalidUri
+        );
+        assert_eq!(parse_loc("?mmap=true").unwrap_err(), Error::InvalidUri);
+        assert_eq!(parse_loc("foo?mmap").unwrap_err(), Error::InvalidUri);
+        assert_eq!(parse_loc("foo?mmap=1").unwrap_err(), Error::InvalidUri);
+        assert_eq!(
+            parse_loc("foo?data_handles=0").unwrap_err(),
+            Error::InvalidUri
+        );
+
+        // path contains '?'
+        let (base, handles, _, _) =
+            parse_loc("/foo?bar/baz?data_handles=8").unwrap();
+        assert_eq!(base, Path::new("/foo?bar/baz"));
+        assert_eq!(handles, 8);
+        let (base, _, _, _) = parse_loc("/foo?bar").unwrap();
+        assert_eq!(base, Path::new("/foo?bar"));
+
+        // unknown parameters only, used as path with a warning
+        let (base, handles, _, _) = parse_loc("foo?bar=1").unwrap();
+        assert_eq!(base, Path::new("foo?bar=1"));
+        assert_eq!(handles, DEFAULT_DATA_HANDLES);
+
+        // mistyped parameters
+        assert_eq!(
+            parse_loc("foo?mmap=true&bar=1").unwrap_err(),
+            Error::InvalidUri
+        );
+        assert_eq!(
+            parse_loc("foo?data_handle=8&mmap=true").unwrap_err(),
+            Error::InvalidUri
+        );
+    }
+
     #[test]
     fn index_manager() {
         let (dir, _tmpdir) = setup();
@@ -530,6 +743,12 @@ mod tests {
         );
         idx_mgr.set_crypto_ctx(crypto.clone(), key.clone());
         idx_mgr.open().unwrap();
+        assert!(!idx_mgr.is_lsmt_loaded());
+
+        // latest address is in memtab, lsmt is not needed
+        let dst = idx_mgr.get(&ids[cnt - 1]).unwrap();
+        assert_eq!(dst[..], addrs[cnt - 1][..]);
+        assert!(!idx_mgr.is_lsmt_loaded());
 
         // verify again
         let dst = idx_mgr.get(&ids[42]).unwrap();
@@ -538,6 +757,88 @@ mod tests {
         assert_eq!(dst[..], buf3[..]);
         assert_eq!(idx_mgr.get(&ids[44]).unwrap_err(), Error::NotFound);
         assert_eq!(idx_mgr.get(&ids[45]).unwrap_err(), Error::NotFound);
+
+        // all the other addresses should survive background compaction
+        for i in (46..cnt).step_by(7) {
+            let dst = idx_mgr.get(&ids[i]).unwrap();
+            assert_eq!(dst[..], addrs[i][..]);
+        }
+        assert!(idx_mgr.is_lsmt_loaded());
+    }
+
+    // tab accessor which can be set to fail loading tabs, so background
+    // compaction can be failed
+    struct FailingTabArmor {
+        inner: FileArmor<Tab>,
+        fail: Arc<AtomicBool>,
+    }
+
+    impl Accessor for FailingTabArmor {
+        type Item = Tab;
+
+        fn set_crypto_ctx(&mut self, crypto: Crypto, key: Key) {
+            self.inner.set_crypto_ctx(crypto, key);
+        }
+
+        fn load(&self, id: &Eid) -> Result<Tab> {
+            if self.fail.load(Ordering::SeqCst) {
+                return Err(Error::Io(ErrorKind::Other.into()));
+            }
+            self.inner.load(id)
+        }
+
+        fn save(&self, item: &mut Tab) -> Result<()> {
+            self.inner.save(item)
+        }
+
+        fn remove(&self, id: &Eid) -> Result<()> {
+            self.inner.remove(id)
+        }
+    }
+
+    #[test]
+    fn index_manager_compaction_failure() {
+        let (dir, _tmpdir) = setup();
+        let fail = Arc::new(AtomicBool::new(true));
+        let mut idx_mgr = IndexMgr::new(
+            Box::new(FileArmor::<Lsmt>::new(&dir)),
+            Box::new(FileArmor::<MemTab>::new(&dir)),
+            Box::new(FailingTabArmor {
+                inner: FileArmor::<Tab>::new(&dir),
+                fail: fail.clone(),
+            }),
+        );
+        idx_mgr.set_crypto_ctx(Crypto::default(), Key::new_empty());
+        idx_mgr.init().unwrap();
+
+        // compaction keeps failing, so level 0 will be filled up and the
+        // compaction error must be returned
+        let mut ids = Vec::new();
+        let mut failed = false;
+        for i in 0..32 * 1024u32 {
+            let id = Eid::new();
+            match idx_mgr.insert(&id, &i.to_le_bytes()) {
+                Ok(_) => ids.push((id, i)),
+                Err(_) => {
+                    failed = true;
+                    break;
+                }
+            }
+        }
+        assert!(failed);
+
+        // compaction is retried and succeeds after the failure is gone
+        fail.store(false, Ordering::SeqCst);
+        for i in 0..8 * 1024u32 {
+            let id = Eid::new();
+            idx_mgr.insert(&id, &i.to_le_bytes()).unwrap();
+            ids.push((id, i));
+        }
+        idx_mgr.flush().unwrap();
+        for (id, i) in ids.iter().step_by(7) {
+            let dst = idx_mgr.get(id).unwrap();
+            assert_eq!(dst[..], i.to_le_bytes()[..]);
+        }
     }
 
     #[test]
@@ -569,4 +870,57 @@ mod tests {
             speed_str(&write_time, DATA_LEN)
         );
     }
+
+    #[cfg(feature = "test-perf")]
+    #[test]
+    fn bench_index() {
+        use base::bench::{Bench, Work};
+
+        let (dir, _tmpdir) = setup();
+        let bench = Bench::from_env();
+        const CNT: usize = 50_000;
+
+        let mut round = 0;
+        let mut new_idx_mgr = || {
+            let sub_dir = dir.join(format!("idx{}", round));
+            round += 1;
+            fs::create_dir_all(&sub_dir).unwrap();
+            let mut idx_mgr = IndexMgr::new(
+                Box::new(FileArmor::<Lsmt>::new(&sub_dir)),
+                Box::new(FileArmor::<MemTab>::new(&sub_dir)),
+                Box::new(FileArmor::<Tab>::new(&sub_dir)),
+            );
+            idx_mgr.set_crypto_ctx(Crypto::default(), Key::new_empty());
+            idx_mgr.init().unwrap();
+            idx_mgr
+        };
+        let ids: Vec<Eid> = (0..CNT).map(|_| Eid::new()).collect();
+        let insert_all = |idx_mgr: &mut IndexMgr| {
+            for (i, id) in ids.iter().enumerate() {
+                idx_mgr.insert(id, &(i as u32).to_le_bytes()).unwrap();
+            }
+        };
+
+        // index manager needs mutable access, so index benchmarks are
+        // single-threaded
+        bench.run("index_insert", "file", Work::Ops(CNT), || {
+            let mut idx_mgr = new_idx_mgr();
+            Bench::time(|| insert_all(&mut idx_mgr))
+        });
+
+        if bench.is_selected("index_get") {
+            let mut idx_mgr = new_idx_mgr();
+            insert_all(&mut idx_mgr);
+            let lookups: Vec<usize> = (0..CNT)
+                .map(|_| Crypto::random_u32(CNT as u32) as usize)
+                .collect();
+            bench.run("index_get", "file", Work::Ops(CNT), || {
+                Bench::time(|| {
+                    for &i in lookups.iter() {
+                        idx_mgr.get(&ids[i]).unwrap();
+                    }
+                })
+            });
+        }
+    }
 }
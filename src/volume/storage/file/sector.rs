@@ -1,6 +1,10 @@
+use std::collections::VecDeque;
 use std::fmt::{self, Debug};
-use std::io::{Read, Seek, SeekFrom, Write};
+use std::io::Write;
 use std::path::{Path, PathBuf};
+use std::sync::{Arc, Condvar, Mutex};
+use std::thread;
+use std::time::{Duration, Instant};
 use std::u16;
 
 use linked_hash_map::LinkedHashMap;
@@ -8,6 +12,7 @@ use linked_hash_map::LinkedHashMap;
 use super::file_armor::FileArmor;
 use base::crypto::{Crypto, HashKey, Key};
 use base::lru::{CountMeter, Lru, PinChecker};
+use base::thread_pool::ThreadPool;
 use base::utils::{ensure_parents_dir, remove_empty_parent_dir};
 use base::vio;
 use error::{Error, Result};
@@ -28,8 +33,14 @@ const BLK_DELETE_MARK: u16 = u16::MAX;
 // sector cache size
 const SECTOR_CACHE_SIZE: usize = 16;
 
-// sector data file cache size
-const SECTOR_DATA_CACHE_SIZE: usize = 4;
+// default max number of opened sector data files
+pub const DEFAULT_DATA_HANDLES: usize = 64;
+
+// default background sector shrinking rate, in bytes per second
+pub const DEFAULT_SHRINK_RATE: usize = 32 * 1024 * 1024;
+
+// number of blocks copied between two shrinking rate checks
+const SHRINK_BATCH_BLKS: usize = 64;
 
 // sector
 #[derive(Default, Clone, Deserialize, Serialize)]
@@ -144,47 +155,122 @@ impl Debug for Sector {
     }
 }
 
-// sector manager
-pub struct SectorMgr {
+// opened sector data file
+//
+// Data file is read and written using positional I/O, so it can be shared
+// by concurrent readers. Finished sector data file can also be memory
+// mapped as it will not be changed anymore.
+struct SectorData {
+    file: vio::File,
+    #[cfg(unix)]
+    mmap: Option<vio::Mmap>,
+}
+
+impl SectorData {
+    fn new(file: vio::File, map: bool) -> Self {
+        #[cfg(unix)]
+        {
+            let mmap = if map {
+                match vio::Mmap::map(&file) {
+                    Ok(mmap) => Some(mmap),
+                    Err(err) => {
+                        warn!("map sector data file failed: {}", err);
+                        None
+                    }
+                }
+            } else {
+                None
+            };
+            SectorData { file, mmap }
+        }
+        #[cfg(not(unix))]
+        {
+            let _ = map;
+            SectorData { file }
+        }
+    }
+
+    fn read_at(&self, dst: &mut [u8], offset: u64) -> Result<()> {
+        #[cfg(unix)]
+        {
+            if let Some(ref mmap) = self.mmap {
+                let begin = offset as usize;
+                let end = begin + dst.len();
+                if end <= mmap.len() {
+                    dst.copy_from_slice(&mmap[begin..end]);
+                    return Ok(());
+                }
+            }
+        }
+        vio::read_exact_at(&self.file, dst, offset)?;
+        Ok(())
+    }
+
+    #[inline]
+    fn write_at(&self, blks: &[u8], offset: u64) -> Result<()> {
+        vio::write_all_at(&self.file, blks, offset)?;
+        Ok(())
+    }
+}
+
+/// Background sector shrinking statistics
+#[derive(Debug, Default, Clone, Copy)]
+pub struct ShrinkStats {
+    /// Number of shrunk sectors
+    pub shrunk: u64,
+
+    /// Reclaimed space in bytes
+    pub reclaimed: u64,
+
+    /// Time spent on shrinking
+    pub elapsed: Duration,
+
+    /// Number of sectors waiting to be shrunk
+    pub pending: usize,
+}
+
+// background sector shrinking queue
+#[derive(Default)]
+struct ShrinkQueue {
+    pending: VecDeque<usize>,
+    is_running: bool,
+    is_stopping: bool,
+    stats: ShrinkStats,
+}
+
+// sector caches and accessors, shared with background shrinking
+struct Shared {
     base: PathBuf,
 
     sec_armor: FileArmor<Sector>,
 
     // sector cache
-    sec_cache: Lru<usize, Sector, CountMeter<Sector>, PinChecker<Sector>>,
+    sec_cache:
+        Mutex<Lru<usize, Sector, CountMeter<Sector>, PinChecker<Sector>>>,
 
     // sector data file cache
-    sec_data_cache: LinkedHashMap<usize, vio::File>,
+    sec_data_cache: Mutex<LinkedHashMap<usize, Arc<SectorData>>>,
+
+    // max number of opened sector data files
+    data_handles: usize,
+
+    // memory map finished sector data files for reading
+    use_mmap: bool,
+
+    // shrinking rate limit in bytes per second, 0 means unlimited
+    shrink_rate: usize,
+
+    shrink_queue: Mutex<ShrinkQueue>,
+    shrunk: Condvar,
 
     hash_key: HashKey,
 }
 
-impl SectorMgr {
+impl Shared {
     // sector data and shrink file file extensions
     const SECTOR_DATA_EXT: &'static str = "data";
     const SECTOR_SHRINK_EXT: &'static str = "shrink";
 
-    pub fn new(base: &Path) -> Self {
-        SectorMgr {
-            base: base.to_path_buf(),
-            sec_armor: FileArmor::new(base),
-            sec_cache: Lru::new(SECTOR_CACHE_SIZE),
-            sec_data_cache: LinkedHashMap::new(),
-            hash_key: HashKey::new_empty(),
-        }
-    }
-
-    #[inline]
-    pub fn set_crypto_ctx(
-        &mut self,
-        crypto: Crypto,
-        key: Key,
-        hash_key: HashKey,
-    ) {
-        self.sec_armor.set_crypto_ctx(crypto, key);
-        self.hash_key = hash_key;
-    }
-
     // convert sector index to Eid
     fn sector_idx_to_id(&self, sec_idx: usize) -> Eid {
         let buf = (sec_idx as u64).to_le_bytes();
@@ -200,19 +286,21 @@ impl SectorMgr {
         path
     }
 
-    // open a sector where the block index sits in
-    fn open_sector(
-        &mut self,
-        sec_idx: usize,
-        create: bool,
-    ) -> Result<&mut Sector> {
-        if !self.sec_cache.contains_key(&sec_idx) {
+    // open a sector where the block index sits in and run a function on it,
+    // sector cache is locked while the function is running
+    fn with_sector<F, R>(&self, sec_idx: usize, create: bool, f: F) -> Result<R>
+    where
+        F: FnOnce(&mut Sector) -> R,
+    {
+        let mut sec_cache = self.sec_cache.lock().unwrap();
+
+        if !sec_cache.contains_key(&sec_idx) {
             let sec_id = self.sector_idx_to_id(sec_idx);
 
             // load sector and insert into cache
             match self.sec_armor.load_item(&sec_id) {
                 Ok(sec) => {
-                    self.sec_cache.insert(sec_idx, sec);
+                    sec_cache.insert(sec_idx, sec);
                 }
                 Err(ref err) if *err == Error::NotFound => {
                     if create {
@@ -220,7 +308,7 @@ impl SectorMgr {
                         // and save it to cache
                         let mut sec = Sector::new(&sec_id, sec_idx);
                         self.sec_armor.save_item(&mut sec)?;
-                        self.sec_cache.insert(sec_idx, sec);
+                        sec_cache.insert(sec_idx, sec);
                     } else {
                         return Err(Error::NotFound);
                     }
@@ -229,24 +317,28 @@ impl SectorMgr {
             }
         }
 
-        let sec = self.sec_cache.get_refresh(&sec_idx).unwrap();
+        let sec = sec_cache.get_refresh(&sec_idx).unwrap();
 
-        Ok(sec)
+        Ok(f(sec))
     }
 
     // save sector to file
-    fn save_sector(&mut self, sec_idx: usize) -> Result<()> {
-        let mut sec = self.sec_cache.get_refresh(&sec_idx).unwrap();
+    fn save_sector(&self, sec_idx: usize) -> Result<()> {
+        let mut sec_cache = self.sec_cache.lock().unwrap();
+        let mut sec = sec_cache.get_refresh(&sec_idx).unwrap();
         self.sec_armor.save_item(&mut sec)
     }
 
-    // open sector data file
+    // open sector data file, set map to true to memory map the file
     fn open_sector_data(
-        &mut self,
+        &self,
         sec_idx: usize,
         create: bool,
-    ) -> Result<vio::File> {
-        if !self.sec_data_cache.contains_key(&sec_idx) {
+        map: bool,
+    ) -> Result<Arc<SectorData>> {
+        let mut sec_data_cache = self.sec_data_cache.lock().unwrap();
+
+        if !sec_data_cache.contains_key(&sec_idx) {
             // open sector data file and save it to cache
             let path = self.sector_data_path(sec_idx);
             if !create && !path.exists() {
@@ -258,42 +350,310 @@ impl SectorMgr {
                 .write(true)
                 .create(true)
                 .open(&path)?;
-            self.sec_data_cache.insert(sec_idx, data_file);
-            if self.sec_data_cache.len() >= SECTOR_DATA_CACHE_SIZE {
-                self.sec_data_cache.pop_front();
+            let sec_data = SectorData::new(data_file, map);
+            sec_data_cache.insert(sec_idx, Arc::new(sec_data));
+            while sec_data_cache.len() > self.data_handles {
+                sec_data_cache.pop_front();
+            }
+        }
+
+        let sec_data = sec_data_cache.get_refresh(&sec_idx).unwrap();
+        Ok(sec_data.clone())
+    }
+
+    // close sector data file in cache
+    #[inline]
+    fn close_sector_data(&self, sec_idx: usize) {
+        self.sec_data_cache.lock().unwrap().remove(&sec_idx);
+    }
+
+    // shrink queued sectors until the queue is empty or it is stopped
+    fn shrink(&self) {
+        loop {
+            let sec_idx = {
+                let mut queue = self.shrink_queue.lock().unwrap();
+                if queue.is_stopping {
+                    queue.pending.clear();
+                }
+                match queue.pending.pop_front() {
+                    Some(sec_idx) => sec_idx,
+                    None => {
+                        queue.is_running = false;
+                        self.shrunk.notify_all();
+                        break;
+                    }
+                }
+            };
+
+            let now = Instant::now();
+            match self.shrink_sector(sec_idx) {
+                Ok(Some(reclaimed)) => {
+                    let elapsed = now.elapsed();
+                    let mut queue = self.shrink_queue.lock().unwrap();
+                    queue.stats.shrunk += 1;
+                    queue.stats.reclaimed += reclaimed as u64;
+                    queue.stats.elapsed += elapsed;
+                    debug!(
+                        "sector #{} shrunk, reclaimed {} bytes in {:?}",
+                        sec_idx, reclaimed, elapsed
+                    );
+                }
+                Ok(None) => {}
+                Err(err) => warn!("shrink sector #{} failed: {}", sec_idx, err),
+            }
+        }
+    }
+
+    #[inline]
+    fn is_stopping(&self) -> bool {
+        self.shrink_queue.lock().unwrap().is_stopping
+    }
+
+    // shrink a sector and return reclaimed size, blocks are copied without
+    // holding the sector cache lock so the sector can still be read and
+    // deleted from, the shrunk data file is switched in afterwards
+    fn shrink_sector(&self, sec_idx: usize) -> Result<Option<usize>> {
+        // take snapshot of the sector and its data file, sector could be
+        // removed or not shrinkable anymore when it was waiting in queue
+        let snapshot = match self.with_sector(sec_idx, false, |sec| {
+            if sec.is_finished() && sec.actual_size > 0 && sec.is_shrinkable() {
+                self.open_sector_data(sec_idx, false, false)
+                    .map(|sec_data| Some((sec.clone(), sec_data)))
+            } else {
+                Ok(None)
+            }
+        }) {
+            Ok(snapshot) => snapshot?,
+            Err(ref err) if *err == Error::NotFound => None,
+            Err(err) => return Err(err),
+        };
+        let (sec, sec_data) = match snapshot {
+            Some(snapshot) => snapshot,
+            None => return Ok(None),
+        };
+
+        // open shrink destination file
+        let data_file_path = self.sector_data_path(sec_idx);
+        let mut dst_path = data_file_path.clone();
+        dst_path.set_extension(Self::SECTOR_SHRINK_EXT);
+        let mut dst_file = vio::OpenOptions::new()
+            .write(true)
+            .create(true)
+            .truncate(true)
+            .open(&dst_path)?;
+
+        // copy all not deleted blocks to destination file and build the new
+        // block offset map, copy speed is limited by shrinking rate
+        let mut blk_map = vec![BLK_DELETE_MARK; BLKS_PER_SECTOR];
+        let mut buf = vec![0u8; BLK_SIZE];
+        let mut written_blk_cnt = 0;
+        let now = Instant::now();
+        for (map_idx, insec_idx) in sec.blk_map.iter().enumerate() {
+            // skip deleted block
+            if *insec_idx == BLK_DELETE_MARK {
+                continue;
+            }
+
+            let data_offset = *insec_idx as usize * BLK_SIZE;
+            if data_offset >= sec.curr_size {
+                break;
+            }
+
+            // read from sector and write to destination
+            sec_data.read_at(&mut buf, data_offset as u64)?;
+            dst_file.write_all(&buf)?;
+
+            blk_map[map_idx] = written_blk_cnt;
+            written_blk_cnt += 1;
+
+            if written_blk_cnt as usize % SHRINK_BATCH_BLKS == 0 {
+                if self.is_stopping() {
+                    drop(dst_file);
+                    vio::remove_file(&dst_path)?;
+                    return Ok(None);
+                }
+                self.throttle(&now, written_blk_cnt as usize * BLK_SIZE);
+            }
+        }
+        drop(dst_file);
+        drop(sec_data);
+
+        // switch to the shrunk data file, blocks deleted during copying
+        // are kept deleted
+        let mut sec_cache = self.sec_cache.lock().unwrap();
+        let sec = if sec_cache.contains_key(&sec_idx) {
+            sec_cache.get_refresh(&sec_idx).unwrap()
+        } else {
+            match self.sec_armor.load_item(&sec.id) {
+                Ok(sec) => {
+                    sec_cache.insert(sec_idx, sec);
+                    sec_cache.get_refresh(&sec_idx).unwrap()
+                }
+                Err(ref err) if *err == Error::NotFound => {
+                    // sector is removed during copying
+                    vio::remove_file(&dst_path)?;
+                    return Ok(None);
+                }
+                Err(err) => return Err(err),
+            }
+        };
+        let mut live_blk_cnt = 0;
+        for (insec_idx, new_idx) in sec.blk_map.iter_mut().zip(blk_map.iter()) {
+            if *insec_idx != BLK_DELETE_MARK {
+                *insec_idx = *new_idx;
+                live_blk_cnt += 1;
             }
         }
+        let reclaimed = sec.curr_size - written_blk_cnt as usize * BLK_SIZE;
+        sec.curr_size = written_blk_cnt as usize * BLK_SIZE;
+        sec.actual_size = live_blk_cnt * BLK_SIZE;
+        self.sec_armor.save_item(sec)?;
+
+        // close all opened sector data files and switch it, readers which
+        // still hold the old data file can finish reading from it
+        self.close_sector_data(sec_idx);
+        vio::rename(&dst_path, &data_file_path)?;
 
-        let data_file = self.sec_data_cache.get_refresh(&sec_idx).unwrap();
-        let data_file = data_file.try_clone()?;
-        Ok(data_file)
+        Ok(Some(reclaimed))
     }
 
-    // read data blocks
-    pub fn read_blocks(&mut self, dst: &mut [u8], span: Span) -> Result<()> {
+    // sleep if copied too fast than shrinking rate
+    fn throttle(&self, start: &Instant, copied: usize) {
+        if self.shrink_rate == 0 {
+            return;
+        }
+        let expected = Duration::from_millis(
+            (copied as u64 * 1000) / self.shrink_rate as u64,
+        );
+        let elapsed = start.elapsed();
+        if expected > elapsed {
+            thread::sleep(expected - elapsed);
+        }
+    }
+}
+
+// sector manager
+pub struct SectorMgr {
+    shared: Arc<Shared>,
+
+    // background sector shrinking worker, created when it is needed firstly
+    shrinker: Option<ThreadPool>,
+}
+
+impl SectorMgr {
+    pub fn new(
+        base: &Path,
+        data_handles: usize,
+        use_mmap: bool,
+        shrink_rate: usize,
+    ) -> Self {
+        assert!(data_handles > 0);
+        SectorMgr {
+            shared: Arc::new(Shared {
+                base: base.to_path_buf(),
+                sec_armor: FileArmor::new(base),
+                sec_cache: Mutex::new(Lru::new(SECTOR_CACHE_SIZE)),
+                sec_data_cache: Mutex::new(LinkedHashMap::new()),
+                data_handles,
+                use_mmap,
+                shrink_rate,
+                shrink_queue: Mutex::new(ShrinkQueue::default()),
+                shrunk: Condvar::new(),
+                hash_key: HashKey::new_empty(),
+            }),
+            shrinker: None,
+        }
+    }
+
+    pub fn set_crypto_ctx(
+        &mut self,
+        crypto: Crypto,
+        key: Key,
+        hash_key: HashKey,
+    ) {
+        // wait for background shrinking to finish, so the shared caches
+        // are not referenced by it anymore
+        self.shrinker.take();
+        let shared = Arc::get_mut(&mut self.shared).unwrap();
+        shared.sec_armor.set_crypto_ctx(crypto, key);
+        shared.hash_key = hash_key;
+    }
+
+    // put a sector in background shrinking queue
+    fn schedule_shrink(&mut self, sec_idx: usize) -> Result<()> {
+        {
+            let mut queue = self.shared.shrink_queue.lock().unwrap();
+            if !queue.pending.contains(&sec_idx) {
+                queue.pending.push_back(sec_idx);
+            }
+            if queue.is_running {
+                return Ok(());
+            }
+            queue.is_running = true;
+        }
+
+        if self.shrinker.is_none() {
+            self.shrinker = Some(ThreadPool::new("zbox-shrink", 1)?);
+        }
+        let shared = self.shared.clone();
+        self.shrinker
+            .as_ref()
+            .unwrap()
+            .execute(move || shared.shrink());
+
+        Ok(())
+    }
+
+    // wait until all queued sectors are shrunk
+    #[cfg(test)]
+    pub fn wait_shrink(&self) {
+        let mut queue = self.shared.shrink_queue.lock().unwrap();
+        while queue.is_running {
+            queue = self.shared.shrunk.wait(queue).unwrap();
+        }
+    }
+
+    // get background shrinking statistics
+    pub fn shrink_stats(&self) -> ShrinkStats {
+        let queue = self.shared.shrink_queue.lock().unwrap();
+        let mut stats = queue.stats;
+        stats.pending = queue.pending.len();
+        stats
+    }
+
+    // read data blocks, this can be called concurrently
+    pub fn read_blocks(&self, dst: &mut [u8], span: Span) -> Result<()> {
         assert_eq!(dst.len(), span.bytes_len());
 
+        let shared = &self.shared;
         let mut read = 0;
         for sec_span in span.divide_by(BLKS_PER_SECTOR) {
             let sec_idx = sec_span.begin / BLKS_PER_SECTOR;
-            let mut sec_data = self.open_sector_data(sec_idx, false)?;
-            let blk_offset = {
-                let sec = self.open_sector(sec_idx, false)?;
-                let map_idx = sec_span.begin % BLKS_PER_SECTOR;
-                let insec_idx = sec.blk_map[map_idx];
-                if sec.blk_map[map_idx..map_idx + sec_span.cnt]
-                    .iter()
-                    .any(|b| *b == BLK_DELETE_MARK)
-                {
-                    return Err(Error::NotFound);
-                }
-                u64::from(insec_idx) * BLK_SIZE as u64
-            };
+
+            // get block offset and data file together, so they are not
+            // changed by background shrinking in between
+            let (blk_offset, sec_data) =
+                shared.with_sector(sec_idx, false, |sec| {
+                    let map_idx = sec_span.begin % BLKS_PER_SECTOR;
+                    let insec_idx = sec.blk_map[map_idx];
+                    if sec.blk_map[map_idx..map_idx + sec_span.cnt]
+                        .iter()
+                        .any(|b| *b == BLK_DELETE_MARK)
+                    {
+                        return Err(Error::NotFound);
+                    }
+                    let blk_offset = u64::from(insec_idx) * BLK_SIZE as u64;
+                    let sec_data = shared.open_sector_data(
+                        sec_idx,
+                        false,
+                        shared.use_mmap && sec.is_finished(),
+                    )?;
+                    Ok((blk_offset, sec_data))
+                })??;
 
             // read blocks bytes
             let read_len = sec_span.bytes_len();
-            sec_data.seek(SeekFrom::Start(blk_offset))?;
-            sec_data.read_exact(&mut dst[read..read + read_len])?;
+            sec_data.read_at(&mut dst[read..read + read_len], blk_offset)?;
             read += read_len;
         }
 
@@ -306,13 +666,13 @@ impl SectorMgr {
 
         for sec_span in span.divide_by(BLKS_PER_SECTOR) {
             let sec_idx = sec_span.begin / BLKS_PER_SECTOR;
-            let mut sec_data = self.open_sector_data(sec_idx, true)?;
+            let sec_data =
+                self.shared.open_sector_data(sec_idx, true, false)?;
             let blk_offset = (sec_span.begin % BLKS_PER_SECTOR) * BLK_SIZE;
 
             // write blocks bytes to sector data file
             let write_len = sec_span.bytes_len();
-            sec_data.seek(SeekFrom::Start(blk_offset as u64))?;
-            sec_data.write_all(&blks[..write_len])?;
+            sec_data.write_at(&blks[..write_len], blk_offset as u64)?;
             blks = &blks[write_len..];
             drop(sec_data);
 
@@ -320,49 +680,52 @@ impl SectorMgr {
             // and that deletes blocks in the same sector, the blocks will
             // remain as deleted if the tx aborted. This is to deal with
             // that situation by overwriting the deletion mark.
-            let corrected_blk_cnt = {
-                // this will ensure sector is created as well
-                let sec = self.open_sector(sec_idx, true)?;
-
-                assert!(!sec.is_finished());
-                let map_idx = sec_span.begin % BLKS_PER_SECTOR;
-                let mut corrected = 0;
-                for i in map_idx..map_idx + sec_span.cnt {
-                    if sec.blk_map[i] == BLK_DELETE_MARK {
-                        sec.blk_map[i] = i as u16;
-                        corrected += 1;
+            // This will ensure sector is created as well.
+            let corrected_blk_cnt =
+                self.shared.with_sector(sec_idx, true, |sec| {
+                    assert!(!sec.is_finished());
+                    let map_idx = sec_span.begin % BLKS_PER_SECTOR;
+                    let mut corrected = 0;
+                    for i in map_idx..map_idx + sec_span.cnt {
+                        if sec.blk_map[i] == BLK_DELETE_MARK {
+                            sec.blk_map[i] = i as u16;
+                            corrected += 1;
+                        }
                     }
-                }
-                corrected
-            };
+                    corrected
+                })?;
             if corrected_blk_cnt > 0 {
                 warn!(
                     "corrected {} deleted block when write blocks",
                     corrected_blk_cnt
                 );
-                self.save_sector(sec_idx)?;
+                self.shared.save_sector(sec_idx)?;
             }
 
             // if we reached the end of sector, mark it as finished
             if sec_span.end() % BLKS_PER_SECTOR == 0 {
-                let is_shrinkable = {
-                    let sec = self.open_sector(sec_idx, false)?;
-                    sec.curr_size = SECTOR_SIZE;
-                    sec.actual_size = BLK_SIZE
-                        * sec
-                            .blk_map
-                            .iter()
-                            .filter(|b| **b != BLK_DELETE_MARK)
-                            .count() as usize;
-                    sec.is_shrinkable()
-                };
+                let is_shrinkable =
+                    self.shared.with_sector(sec_idx, false, |sec| {
+                        sec.curr_size = SECTOR_SIZE;
+                        sec.actual_size = BLK_SIZE
+                            * sec
+                                .blk_map
+                                .iter()
+                                .filter(|b| **b != BLK_DELETE_MARK)
+                                .count() as usize;
+                        sec.is_shrinkable()
+                    })?;
+
+                // save sector and re-open data file next time, so it can
+                // be mapped
+                self.shared.save_sector(sec_idx)?;
+                if self.shared.use_mmap {
+                    self.shared.close_sector_data(sec_idx);
+                }
 
+                // shrink sector in background
                 if is_shrinkable {
-                    // shrink sector
-                    self.shrink_sector(sec_idx)?;
-                } else {
-                    // save sector
-                    self.save_sector(sec_idx)?;
+                    self.schedule_shrink(sec_idx)?;
                 }
             }
         }
@@ -370,103 +733,51 @@ impl SectorMgr {
         Ok(())
     }
 
-    // shrink a sector
-    fn shrink_sector(&mut self, sec_idx: usize) -> Result<()> {
-        let mut sec = self.open_sector(sec_idx, false)?.clone();
-        let mut sec_data = self.open_sector_data(sec_idx, false)?;
-
-        // open shrink destination file
-        let data_file_path = self.sector_data_path(sec.idx);
-        let mut dst_path = data_file_path.clone();
-        dst_path.set_extension(Self::SECTOR_SHRINK_EXT);
-        let mut dst_file = vio::OpenOptions::new()
-            .write(true)
-            .create(true)
-            .truncate(true)
-            .open(&dst_path)?;
-
-        // copy all not deleted blocks to destination file
-        let mut buf = vec![0u8; BLK_SIZE];
-        let mut written_blk_cnt = 0;
-        for insec_idx in sec.blk_map.iter_mut() {
-            // skip deleted block
-            if *insec_idx == BLK_DELETE_MARK {
-                continue;
-            }
-
-            let data_offset = *insec_idx as usize * BLK_SIZE;
-            if data_offset >= sec.curr_size {
-                break;
-            }
-
-            // read from sector and write to destination
-            sec_data.seek(SeekFrom::Start(data_offset as u64))?;
-            sec_data.read_exact(&mut buf)?;
-            dst_file.write_all(&buf)?;
-
-            *insec_idx = written_blk_cnt;
-            written_blk_cnt += 1;
-        }
-
-        // set sector new size, save sector and update sector in cache
-        sec.actual_size = written_blk_cnt as usize * BLK_SIZE;
-        sec.curr_size = sec.actual_size;
-        self.sec_armor.save_item(&mut sec)?;
-        self.sec_cache.insert(sec.idx, sec);
-
-        // close all opened sector data files and switch it
-        drop(sec_data);
-        self.sec_data_cache.remove(&sec_idx);
-        vio::rename(&dst_path, &data_file_path)?;
-
-        Ok(())
-    }
-
     // delete data blocks
     pub fn del_blocks(&mut self, span: Span) -> Result<()> {
         for sec_span in span.divide_by(BLKS_PER_SECTOR) {
             let sec_idx = sec_span.begin / BLKS_PER_SECTOR;
-            let sec_id;
-            let actual_size;
-            let is_finished;
-            let is_shrinkable;
-
-            {
-                match self.open_sector(sec_idx, false) {
-                    Ok(sec) => {
-                        // mark blocks as deleted
-                        sec.mark_blocks_deletion(sec_span);
-
-                        sec_id = sec.id.clone();
-                        actual_size = sec.actual_size;
-                        is_finished = sec.is_finished();
-                        is_shrinkable = sec.is_shrinkable();
-                    }
+            let (sec_id, actual_size, is_finished, is_shrinkable) =
+                match self.shared.with_sector(sec_idx, false, |sec| {
+                    // mark blocks as deleted
+                    sec.mark_blocks_deletion(sec_span);
+                    (
+                        sec.id.clone(),
+                        sec.actual_size,
+                        sec.is_finished(),
+                        sec.is_shrinkable(),
+                    )
+                }) {
+                    Ok(ret) => ret,
                     Err(ref err) if *err == Error::NotFound => continue,
                     Err(err) => return Err(err),
-                }
-            }
+                };
 
             // if this sector is not finished yet, save the sector
             if !is_finished {
-                self.save_sector(sec_idx)?;
+                self.shared.save_sector(sec_idx)?;
                 continue;
             }
 
             // if all blocks are deleted, remove the whole sector
-            // including sector and sector data file
+            // including sector and sector data file, sector cache is
+            // locked during removal so it won't interleave with shrinking
             if actual_size == 0 {
-                self.sec_armor.remove_all_arms(&sec_id)?;
-                let sec_data_path = self.sector_data_path(sec_idx);
+                let shared = &self.shared;
+                let mut sec_cache = shared.sec_cache.lock().unwrap();
+                shared.sec_armor.remove_all_arms(&sec_id)?;
+                shared.close_sector_data(sec_idx);
+                let sec_data_path = shared.sector_data_path(sec_idx);
                 vio::remove_file(&sec_data_path)?;
                 remove_empty_parent_dir(&sec_data_path)?;
-                self.sec_cache.remove(&sec_idx);
-            } else if is_shrinkable {
-                // shrink sector if possible
-                self.shrink_sector(sec_idx)?;
-            } else {
-                // otherwise, save the sector
-                self.save_sector(sec_idx)?;
+                sec_cache.remove(&sec_idx);
+                continue;
+            }
+
+            // otherwise, save the sector and shrink it in background
+            self.shared.save_sector(sec_idx)?;
+            if is_shrinkable {
+                self.schedule_shrink(sec_idx)?;
             }
         }
 
@@ -474,10 +785,22 @@ impl SectorMgr {
     }
 }
 
+impl Drop for SectorMgr {
+    fn drop(&mut self) {
+        // stop background shrinking, the unfinished sectors will be shrunk
+        // again when blocks are deleted from them next time
+        self.shared.shrink_queue.lock().unwrap().is_stopping = true;
+    }
+}
+
 impl Debug for SectorMgr {
     fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
         f.debug_struct("SectorMgr")
-            .field("hash_key", &self.hash_key)
+            .field("data_handles", &self.shared.data_handles)
+            .field("use_mmap", &self.shared.use_mmap)
+            .field("shrink_rate", &self.shared.shrink_rate)
+            .field("shrink_stats", &self.shrink_stats())
+            .field("hash_key", &self.shared.hash_key)
             .finish()
     }
 }
@@ -2,11 +2,15 @@ use std::cmp::Ordering;
 use std::fmt::{self, Debug};
 use std::iter::FromIterator;
 use std::ops::Deref;
+use std::sync::{Arc, Condvar, Mutex};
 
 use linked_hash_map::LinkedHashMap;
 
+use base::bloom::BloomFilter;
 use base::crypto::{Crypto, Key};
 use base::lru::{CountMeter, Lru, PinChecker};
+use base::metrics::{Metrics, MetricsRef};
+use base::thread_pool::ThreadPool;
 use error::{Error, Result};
 use trans::{Eid, Id};
 use volume::{Arm, ArmAccess, Seq};
@@ -245,21 +249,32 @@ impl Debug for Tab {
     }
 }
 
+// Tab info, it has a bloom filter of the tab items so the tab doesn't need
+// to be loaded if it doesn't contain an id. The filter is empty for tab info
+// created by older versions.
 #[derive(Debug, Clone, Deserialize, Serialize)]
 struct TabInfo {
     id: Eid,
     begin: Eid,
     end: Eid,
     cnt: usize,
+
+    #[serde(default)]
+    bloom: BloomFilter,
 }
 
 impl TabInfo {
     fn new(tab: &Tab) -> Self {
+        let mut bloom = BloomFilter::new(tab.len());
+        for item in tab.iter() {
+            bloom.insert(item.id().as_ref());
+        }
         TabInfo {
             id: tab.id().clone(),
             begin: tab.first().unwrap().id().clone(),
             end: tab.last().unwrap().id().clone(),
             cnt: tab.len(),
+            bloom,
         }
     }
 
@@ -268,6 +283,11 @@ impl TabInfo {
         self.begin <= *id && *id <= self.end
     }
 
+    #[inline]
+    fn may_contain(&self, id: &Eid) -> bool {
+        self.contains(id) && self.bloom.may_contain(id.as_ref())
+    }
+
     #[inline]
     fn is_overlapping(&self, begin: &Eid, end: &Eid) -> bool {
         !(*end < self.begin || self.end < *begin)
@@ -307,11 +327,12 @@ impl Level {
         self.item_cnt() >= Self::item_cap(self.num)
     }
 
+    // find tabs which may contain the id
     fn find_tabs_contain(&self, id: &Eid) -> Vec<Eid> {
         self.tabs
             .iter()
             .rev()
-            .filter(|t| t.contains(id))
+            .filter(|t| t.may_contain(id))
             .map(|t| t.id.clone())
             .collect()
     }
@@ -327,14 +348,6 @@ impl Level {
         let pos = self.tabs.iter().position(|t| t.id == *tab_id).unwrap();
         self.tabs.remove(pos);
     }
-
-    fn clear(&mut self, tab_armor: &TabArmor) -> Result<()> {
-        for tab_info in self.tabs.iter() {
-            tab_armor.remove(&tab_info.id)?;
-        }
-        self.tabs.clear();
-        Ok(())
-    }
 }
 
 // Log Structured Merge Tree
@@ -350,12 +363,19 @@ pub struct Lsmt {
 
     #[serde(skip_serializing, skip_deserializing, default)]
     tab_cache: Lru<Eid, Tab, CountMeter<Tab>, PinChecker<Tab>>,
+
+    #[serde(skip_serializing, skip_deserializing, default)]
+    is_compacting: bool,
 }
 
 impl Lsmt {
     const TAB_CNT_BASE: usize = 4;
     const TAB_CACHE_SIZE: usize = 4;
 
+    // max number of tabs in level 0, if there are more young tabs,
+    // insertion will wait for the compaction
+    const MAX_LVL0_TABS: usize = 4 * Self::TAB_CNT_BASE;
+
     fn new() -> Self {
         Lsmt {
             id: Eid::new_empty(),
@@ -363,6 +383,7 @@ impl Lsmt {
             arm: Arm::default(),
             lvls: vec![Level::new(0)],
             tab_cache: Lru::new(Self::TAB_CACHE_SIZE),
+            is_compacting: false,
         }
     }
 
@@ -374,15 +395,18 @@ impl Lsmt {
         Ok(())
     }
 
+    // find address in tabs, number of tabs probed is added to probed
     fn get_address(
         &mut self,
         id: &Eid,
         tab_armor: &TabArmor,
+        probed: &mut usize,
     ) -> Result<Vec<u8>> {
         for lvl_idx in 0..self.lvls.len() {
             let lvl = &self.lvls[lvl_idx];
 
             for tab_id in lvl.find_tabs_contain(id) {
+                *probed += 1;
                 if !self.tab_cache.contains_key(&tab_id) {
                     // load tab into cache
                     let tab = tab_armor.load(&tab_id)?;
@@ -403,129 +427,147 @@ impl Lsmt {
         Err(Error::NotFound)
     }
 
-    // read all tabs in specified level
-    fn read_all_tabs_in_level(
-        &self,
-        lvl_num: usize,
-        tab_armor: &TabArmor,
-    ) -> Result<Tab> {
-        let lvl = &self.lvls[lvl_num];
-        let mut ret = Tab::with_capacity(lvl.item_cnt());
-
-        for tab_info in lvl.tabs.iter() {
-            let mut tab = tab_armor.load(&tab_info.id)?;
-            ret.append(&mut tab);
-        }
+    // find the first full level, return compaction plan for it
+    fn plan_compaction(&self) -> Option<Compaction> {
+        let curr = self.lvls.iter().position(|lvl| lvl.is_full())?;
+        let tabs = self.lvls[curr].tabs.clone();
+        let next = curr + 1;
 
-        // if it is level 0, tabs may be overlapping so we need to
-        // sort all items
-        if lvl_num == 0 {
-            ret.sort_unstable();
-        }
+        // find all overlapping tabs in next level
+        let overlap = if next < self.lvls.len() {
+            let begin = tabs.iter().map(|t| &t.begin).min().unwrap();
+            let end = tabs.iter().map(|t| &t.end).max().unwrap();
+            self.lvls[next]
+                .tabs
+                .iter()
+                .filter(|t| t.is_overlapping(begin, end))
+                .cloned()
+                .collect()
+        } else {
+            Vec::new()
+        };
+
+        Some(Compaction {
+            curr,
+            tabs,
+            overlap,
+            is_new_lvl: next >= self.lvls.len(),
+        })
+    }
 
-        Ok(ret)
+    #[inline]
+    fn need_compaction(&self) -> bool {
+        self.lvls.iter().any(|lvl| lvl.is_full())
     }
 
-    // read and combine specified tabs
-    fn combine_tabs(
-        &self,
-        tabs: &[TabInfo],
-        tab_armor: &TabArmor,
-    ) -> Result<Tab> {
-        let mut ret = Tab::new();
-        for tab_info in tabs.iter() {
-            let mut tab = tab_armor.load(&tab_info.id)?;
-            ret.append(&mut tab);
+    // install compacted tabs, the compacted tabs in current level and the
+    // overlapping tabs in next level are replaced by the merged tabs
+    fn install_compaction(&mut self, plan: &Compaction, merged: &[Tab]) {
+        let next = plan.curr + 1;
+
+        for tab_info in plan.tabs.iter() {
+            self.lvls[plan.curr].remove(&tab_info.id);
+            self.tab_cache.remove(&tab_info.id);
+        }
+        if next >= self.lvls.len() {
+            self.lvls.push(Level::new(next));
+        }
+        for tab_info in plan.overlap.iter() {
+            self.lvls[next].remove(&tab_info.id);
+            self.tab_cache.remove(&tab_info.id);
+        }
+        for tab in merged.iter() {
+            self.lvls[next].push(tab);
         }
-        Ok(ret)
     }
 
-    // find all overlapping tabs in specified level
-    fn find_overlapping(&self, lvl_num: usize, tab: &Tab) -> Vec<TabInfo> {
-        let lvl = &self.lvls[lvl_num];
-        let begin = tab.items.first().unwrap();
-        let end = tab.items.last().unwrap();
-        lvl.tabs
-            .iter()
-            .filter(|t| t.is_overlapping(begin.id(), end.id()))
-            .cloned()
-            .collect()
+    // add young tab to lsmt, compaction is not done here
+    fn push_young(
+        &mut self,
+        young: &mut Tab,
+        tab_armor: &TabArmor,
+    ) -> Result<()> {
+        // save young tab and push young tab to level 0
+        tab_armor.save(young)?;
+        self.lvls[0].push(young);
+        Ok(())
     }
+}
 
-    // compact current level tab against next level
-    fn compact(&mut self, curr: usize, tab_armor: &TabArmor) -> Result<()> {
-        // combine all tabs in current level
-        let mut tab = self.read_all_tabs_in_level(curr, tab_armor)?;
+// Compaction plan of a level against its next level
+#[derive(Debug)]
+struct Compaction {
+    curr: usize,
+    tabs: Vec<TabInfo>, // all tabs in current level, from old to new
+    overlap: Vec<TabInfo>, // overlapping tabs in next level
+    is_new_lvl: bool,   // next level is not created yet
+}
 
-        let next = curr + 1;
+impl Compaction {
+    // read and merge tabs, save and return the merged tabs, this doesn't
+    // change lsmt so it can be done without locking lsmt
+    fn run(&self, tab_armor: &TabArmor) -> Result<Vec<Tab>> {
+        let next = self.curr + 1;
+
+        // combine all tabs in current level, tabs in level 0 may be
+        // overlapping so we need to sort all items and keep the newest one
+        // of duplicated ids
+        let mut tab = Tab::with_capacity(self.tabs.iter().map(|t| t.cnt).sum());
+        for tab_info in self.tabs.iter().rev() {
+            let mut t = tab_armor.load(&tab_info.id)?;
+            tab.append(&mut t);
+        }
+        if self.curr == 0 {
+            tab.items.sort_by(|a, b| a.id().cmp(b.id()));
+            tab.items.dedup_by(|a, b| a.id() == b.id());
+        } else {
+            tab.sort_unstable();
+        }
 
-        // next level is not created yet
-        if next >= self.lvls.len() {
+        // next level is not created yet, save the combined tab there
+        if self.is_new_lvl {
             debug!(
                 "compaction: {} -> {} (new), tab.len: {}",
-                curr,
+                self.curr,
                 next,
                 tab.len()
             );
-            // save merged tab and clear current level
             tab_armor.save(&mut tab)?;
-            self.lvls[curr].clear(tab_armor)?;
-
-            // create the next level
-            let mut new_lvl = Level::new(next);
-            new_lvl.push(&tab);
-            self.lvls.push(new_lvl);
-
-            return Ok(());
+            return Ok(vec![tab]);
         }
 
-        debug!("compaction: {} -> {}, tab.len: {}", curr, next, tab.len());
+        debug!(
+            "compaction: {} -> {}, tab.len: {}",
+            self.curr,
+            next,
+            tab.len()
+        );
 
         // read overlapping tabs from next level and merge with the combined
         // tab from current level
-        let overlap = self.find_overlapping(next, &tab);
-        let overlap_tab = self.combine_tabs(&overlap, tab_armor)?;
-        let merged = tab.merge(&overlap_tab);
-
-        // remove overlapping tabs in next level
-        for tab_info in overlap.iter() {
-            tab_armor.remove(&tab_info.id)?;
-            self.lvls[next].remove(&tab_info.id);
+        let mut overlap_tab = Tab::new();
+        for tab_info in self.overlap.iter() {
+            let mut t = tab_armor.load(&tab_info.id)?;
+            overlap_tab.append(&mut t);
         }
+        let merged = tab.merge(&overlap_tab);
 
-        // save merged tab to next level
+        // save merged tabs for next level
         let item_cap =
-            Level::item_cap(next) / (Self::TAB_CNT_BASE * (next + 1));
-        for mut tab in merged.divide(item_cap) {
-            tab_armor.save(&mut tab)?;
-            self.lvls[next].push(&tab);
+            Level::item_cap(next) / (Lsmt::TAB_CNT_BASE * (next + 1));
+        let mut ret = merged.divide(item_cap);
+        for tab in ret.iter_mut() {
+            tab_armor.save(tab)?;
         }
 
-        // clear current level
-        self.lvls[curr].clear(tab_armor)?;
-
-        Ok(())
+        Ok(ret)
     }
 
-    // add young tab to lsmt
-    fn push_young(
-        &mut self,
-        young: &mut Tab,
-        tab_armor: &TabArmor,
-    ) -> Result<()> {
-        // save young tab and push young tab to level 0
-        tab_armor.save(young)?;
-        self.lvls[0].push(young);
-
-        // iterate all levels and try to do compaction
-        let lvl_cnt = self.lvls.len();
-        for curr in 0..lvl_cnt {
-            // if current level is full then do compaction
-            if self.lvls[curr].is_full() {
-                self.compact(curr, tab_armor)?;
-            }
+    // remove the replaced tabs
+    fn remove_tabs(&self, tab_armor: &TabArmor) -> Result<()> {
+        for tab_info in self.tabs.iter().chain(self.overlap.iter()) {
+            tab_armor.remove(&tab_info.id)?;
         }
-
         Ok(())
     }
 }
@@ -690,13 +732,83 @@ impl Debug for MemTab {
     }
 }
 
+// Lsmt and its accessors, shared with background compaction
+struct Shared {
+    lsmt: Mutex<Lsmt>,
+    compacted: Condvar,
+
+    // error of the last failed background compaction, it is returned by
+    // the next insertion or flush
+    compact_err: Mutex<Option<Error>>,
+
+    lsmt_armor: LsmtArmor,
+    tab_armor: TabArmor,
+    metrics: MetricsRef,
+}
+
+impl Shared {
+    // run compactions until no level is full, merging is done without
+    // holding the lsmt lock so lookups and insertions are not blocked
+    fn compact(&self) {
+        loop {
+            let plan = {
+                let lsmt = self.lsmt.lock().unwrap();
+                match lsmt.plan_compaction() {
+                    Some(plan) => plan,
+                    None => break,
+                }
+            };
+
+            if let Err(err) = self.compact_level(&plan) {
+                warn!("index compaction failed: {}", err);
+                *self.compact_err.lock().unwrap() = Some(err);
+                break;
+            }
+        }
+
+        let mut lsmt = self.lsmt.lock().unwrap();
+        lsmt.is_compacting = false;
+        self.compacted.notify_all();
+    }
+
+    fn compact_level(&self, plan: &Compaction) -> Result<()> {
+        let merged = plan.run(&self.tab_armor)?;
+
+        // install merged tabs and save lsmt, lookups may still use the old
+        // tabs until now
+        {
+            let mut lsmt = self.lsmt.lock().unwrap();
+            lsmt.install_compaction(plan, &merged);
+            self.lsmt_armor.save(&mut lsmt)?;
+            self.compacted.notify_all();
+        }
+        self.metrics.add_index_compaction();
+
+        // old tabs can be removed only after the lsmt is saved
+        plan.remove_tabs(&self.tab_armor)
+    }
+
+    // take out the last background compaction error if any
+    fn take_compact_err(&self) -> Result<()> {
+        match self.compact_err.lock().unwrap().take() {
+            Some(err) => Err(err),
+            None => Ok(()),
+        }
+    }
+}
+
 // Index manager
 pub struct IndexMgr {
-    lsmt: Lsmt,
+    shared: Arc<Shared>,
     memtab: MemTab,
-    lsmt_armor: LsmtArmor,
     memtab_armor: MemTabArmor,
-    tab_armor: TabArmor,
+
+    // lsmt is loaded when it is needed firstly, most of the recent
+    // addresses are found in memtab so opening doesn't need to load it
+    is_lsmt_loaded: bool,
+
+    // background compaction worker, created when it is needed firstly
+    compactor: Option<ThreadPool>,
 }
 
 impl IndexMgr {
@@ -711,42 +823,110 @@ impl IndexMgr {
         tab_armor: TabArmor,
     ) -> Self {
         IndexMgr {
-            lsmt: Lsmt::new(),
+            shared: Arc::new(Shared {
+                lsmt: Mutex::new(Lsmt::new()),
+                compacted: Condvar::new(),
+                compact_err: Mutex::new(None),
+                lsmt_armor,
+                tab_armor,
+                metrics: Metrics::new_ref(),
+            }),
             memtab: MemTab::new(),
-            lsmt_armor,
             memtab_armor,
-            tab_armor,
+            is_lsmt_loaded: false,
+            compactor: None,
         }
     }
 
     pub fn set_crypto_ctx(&mut self, crypto: Crypto, key: Key) {
+        // wait for background compaction to finish, so the shared lsmt
+        // is not referenced by it anymore
+        self.compactor.take();
+        let shared = Arc::get_mut(&mut self.shared).unwrap();
+
         let sub_key = key.derive(Self::SUBKEY_ID_LSMT);
-        *self.lsmt.id_mut() = Eid::from_slice(sub_key.derive(0).as_slice());
-        self.lsmt_armor.set_crypto_ctx(crypto.clone(), sub_key);
+        let lsmt = shared.lsmt.get_mut().unwrap();
+        *lsmt.id_mut() = Eid::from_slice(sub_key.derive(0).as_slice());
+        shared.lsmt_armor.set_crypto_ctx(crypto.clone(), sub_key);
 
         let sub_key = key.derive(Self::SUBKEY_ID_MEMTAB);
         *self.memtab.id_mut() = Eid::from_slice(sub_key.derive(0).as_slice());
         self.memtab_armor.set_crypto_ctx(crypto.clone(), sub_key);
 
         let sub_key = key.derive(Self::SUBKEY_ID_TAB);
-        self.tab_armor.set_crypto_ctx(crypto.clone(), sub_key);
+        shared.tab_armor.set_crypto_ctx(crypto.clone(), sub_key);
+    }
+
+    pub fn set_metrics(&mut self, metrics: &MetricsRef) {
+        self.compactor.take();
+        let shared = Arc::get_mut(&mut self.shared).unwrap();
+        shared.metrics = metrics.clone();
     }
 
     pub fn init(&mut self) -> Result<()> {
-        self.lsmt_armor.save(&mut self.lsmt)?;
+        {
+            let mut lsmt = self.shared.lsmt.lock().unwrap();
+            self.shared.lsmt_armor.save(&mut lsmt)?;
+        }
         self.memtab_armor.save(&mut self.memtab)?;
+        self.is_lsmt_loaded = true;
         Ok(())
     }
 
     pub fn open(&mut self) -> Result<()> {
-        self.lsmt.open(&self.lsmt_armor)?;
         self.memtab = self.memtab_armor.load(self.memtab.id())?;
+        self.is_lsmt_loaded = false;
+        Ok(())
+    }
+
+    #[cfg(test)]
+    #[inline]
+    pub fn is_lsmt_loaded(&self) -> bool {
+        self.is_lsmt_loaded
+    }
+
+    // load lsmt if it is not loaded yet
+    fn ensure_lsmt(&mut self) -> Result<()> {
+        if self.is_lsmt_loaded {
+            return Ok(());
+        }
+        {
+            let mut lsmt = self.shared.lsmt.lock().unwrap();
+            lsmt.open(&self.shared.lsmt_armor)?;
+        }
+        self.is_lsmt_loaded = true;
+
+        // continue unfinished compaction if any
+        self.schedule_compaction()
+    }
+
+    // start background compaction if it is needed and not running yet
+    fn schedule_compaction(&mut self) -> Result<()> {
+        {
+            let mut lsmt = self.shared.lsmt.lock().unwrap();
+            if lsmt.is_compacting || !lsmt.need_compaction() {
+                return Ok(());
+            }
+            lsmt.is_compacting = true;
+        }
+
+        if self.compactor.is_none() {
+            self.compactor = Some(ThreadPool::new("zbox-compact", 1)?);
+        }
+        let shared = self.shared.clone();
+        self.compactor
+            .as_ref()
+            .unwrap()
+            .execute(move || shared.compact());
+
         Ok(())
     }
 
     pub fn get(&mut self, id: &Eid) -> Result<Vec<u8>> {
         match self.memtab.get_address(id) {
             Some(addr) => {
+                self.shared.metrics.add_index_lookup(0);
+
                 // empty address is a deletion mark
                 if addr.is_empty() {
                     Err(Error::NotFound)
@@ -754,28 +934,66 @@ impl IndexMgr {
                     Ok(addr.clone())
                 }
             }
-            None => self.lsmt.get_address(id, &self.tab_armor),
+            None => {
+                self.ensure_lsmt()?;
+                let mut probed = 0;
+                let ret = {
+                    let mut lsmt = self.shared.lsmt.lock().unwrap();
+                    lsmt.get_address(id, &self.shared.tab_armor, &mut probed)
+                };
+                self.shared.metrics.add_index_lookup(probed);
+                ret
+            }
+        }
+    }
+
+    // wait until level 0 has room for a young tab, compaction is started
+    // if it is not running yet
+    fn wait_for_lvl0(&mut self) -> Result<()> {
+        loop {
+            self.shared.take_compact_err()?;
+            {
+                let shared = &self.shared;
+                let lsmt = shared.lsmt.lock().unwrap();
+                if lsmt.lvls[0].tabs.len() < Lsmt::MAX_LVL0_TABS {
+                    return Ok(());
+                }
+                if lsmt.is_compacting {
+                    let _lsmt = shared.compacted.wait(lsmt).unwrap();
+                    continue;
+                }
+            }
+            self.schedule_compaction()?;
         }
     }
 
     pub fn insert(&mut self, id: &Eid, addr: &[u8]) -> Result<()> {
+        self.shared.take_compact_err()?;
         self.memtab.insert(id, addr);
 
         if !self.memtab.is_full() {
             return Ok(());
         }
 
+        self.ensure_lsmt()?;
+
         // extract young tab from memtable
         let mut young = self.memtab.extract_young();
 
-        // push young tab to lsmt and save lsmt
-        self.lsmt.push_young(&mut young, &self.tab_armor)?;
-        self.lsmt_armor.save(&mut self.lsmt)?;
+        // push young tab to lsmt and save lsmt, if there are too many young
+        // tabs wait for the compaction to catch up
+        self.wait_for_lvl0()?;
+        {
+            let shared = &self.shared;
+            let mut lsmt = shared.lsmt.lock().unwrap();
+            lsmt.push_young(&mut young, &shared.tab_armor)?;
+            shared.lsmt_armor.save(&mut lsmt)?;
+        }
 
         // evict young tab from memtable
         self.memtab.evict_young(&young);
 
-        Ok(())
+        self.schedule_compaction()
     }
 
     #[inline]
@@ -788,15 +1006,47 @@ impl IndexMgr {
             self.memtab_armor.save(&mut self.memtab)?;
             self.memtab.is_changed = false;
         }
-        Ok(())
+        self.shared.take_compact_err()
     }
 }
 
 impl Debug for IndexMgr {
     fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
         f.debug_struct("IndexMgr")
-            .field("lsmt", &self.lsmt)
+            .field("lsmt", &*self.shared.lsmt.lock().unwrap())
             .field("memtab", &self.memtab)
             .finish()
     }
 }
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use base::init_env;
+
+    #[test]
+    fn tab_info() {
+        init_env();
+
+        let mut tab: Tab = (0..1000u32)
+            .map(|i| TabItem((Eid::new(), i.to_le_bytes().to_vec())))
+            .collect();
+        tab.sort_unstable();
+        let info = TabInfo::new(&tab);
+
+        // all items may be contained
+        for item in tab.iter() {
+            assert!(info.may_contain(item.id()));
+            assert_eq!(tab.search(item.id()).unwrap(), item.addr());
+        }
+
+        // most of missing ids are filtered out
+        let fp = (0..1000).filter(|_| info.may_contain(&Eid::new())).count();
+        assert!(fp < 30);
+
+        // tab info without filter
+        let mut info = info.clone();
+        info.bloom = BloomFilter::default();
+        assert!(info.may_contain(tab[42].id()));
+    }
+}
@@ -1,6 +1,6 @@
 use std::collections::HashMap;
 use std::fmt::{self, Debug};
-use std::sync::Mutex;
+use std::sync::RwLock;
 
 use base::crypto::{Crypto, Key};
 use base::IntoRef;
@@ -33,8 +33,8 @@ impl Depot {
 
 lazy_static! {
     // static hashmap to keep memory storage depots
-    static ref STORAGES: Mutex<HashMap<String, Depot>> =
-        Mutex::new(HashMap::with_capacity(1));
+    static ref STORAGES: RwLock<HashMap<String, Depot>> =
+        RwLock::new(HashMap::with_capacity(1));
 }
 
 /// Mem Storage
@@ -53,7 +53,7 @@ impl MemStorage {
     }
 
     fn lock_repo(&mut self, force: bool) -> Result<()> {
-        let mut storages = STORAGES.lock().unwrap();
+        let mut storages = STORAGES.write().unwrap();
         let depot = storages.get_mut(&self.loc).unwrap();
         if depot.is_opened {
             if force {
@@ -71,7 +71,7 @@ impl MemStorage {
 impl Storable for MemStorage {
     #[inline]
     fn exists(&self) -> Result<bool> {
-        Ok(STORAGES.lock().unwrap().contains_key(&self.loc))
+        Ok(STORAGES.read().unwrap().contains_key(&self.loc))
     }
 
     #[inline]
@@ -81,7 +81,7 @@ impl Storable for MemStorage {
 
     fn init(&mut self, _crypto: Crypto, _key: Key) -> Result<()> {
         {
-            let mut storages = STORAGES.lock().unwrap();
+            let mut storages = STORAGES.write().unwrap();
             storages.insert(self.loc.to_string(), Depot::new());
         }
         self.lock_repo(false)
@@ -93,7 +93,7 @@ impl Storable for MemStorage {
     }
 
     fn get_super_block(&mut self, suffix: u64) -> Result<Vec<u8>> {
-        let storages = STORAGES.lock().unwrap();
+        let storages = STORAGES.read().unwrap();
         let depot = storages.get(&self.loc).ok_or(Error::NotFound)?;
         depot
             .super_blk_map
@@ -103,14 +103,14 @@ impl Storable for MemStorage {
     }
 
     fn put_super_block(&mut self, super_blk: &[u8], suffix: u64) -> Result<()> {
-        let mut storages = STORAGES.lock().unwrap();
+        let mut storages = STORAGES.write().unwrap();
         let depot = storages.get_mut(&self.loc).unwrap();
         depot.super_blk_map.insert(suffix, super_blk.to_vec());
         Ok(())
     }
 
     fn get_wal(&mut self, id: &Eid) -> Result<Vec<u8>> {
-        let storages = STORAGES.lock().unwrap();
+        let storages = STORAGES.read().unwrap();
         let depot = storages.get(&self.loc).unwrap();
         depot
             .wal_map
@@ -120,42 +120,52 @@ impl Storable for MemStorage {
     }
 
     fn put_wal(&mut self, id: &Eid, wal: &[u8]) -> Result<()> {
-        let mut storages = STORAGES.lock().unwrap();
+        let mut storages = STORAGES.write().unwrap();
         let depot = storages.get_mut(&self.loc).unwrap();
         depot.wal_map.insert(id.clone(), wal.to_vec());
         Ok(())
     }
 
     fn del_wal(&mut self, id: &Eid) -> Result<()> {
-        let mut storages = STORAGES.lock().unwrap();
+        let mut storages = STORAGES.write().unwrap();
         let depot = storages.get_mut(&self.loc).unwrap();
         depot.wal_map.remove(id);
         Ok(())
     }
 
     fn get_address(&mut self, id: &Eid) -> Result<Vec<u8>> {
-        let storages = STORAGES.lock().unwrap();
+        let storages = STORAGES.read().unwrap();
         let depot = storages.get(&self.loc).unwrap();
         depot.addr_map.get(id).cloned().ok_or(Error::NotFound)
     }
 
     fn put_address(&mut self, id: &Eid, addr: &[u8]) -> Result<()> {
-        let mut storages = STORAGES.lock().unwrap();
+        let mut storages = STORAGES.write().unwrap();
         let depot = storages.get_mut(&self.loc).unwrap();
         depot.addr_map.insert(id.clone(), addr.to_vec());
         Ok(())
     }
 
     fn del_address(&mut self, id: &Eid) -> Result<()> {
-        let mut storages = STORAGES.lock().unwrap();
+        let mut storages = STORAGES.write().unwrap();
         let depot = storages.get_mut(&self.loc).unwrap();
         depot.addr_map.remove(id);
         Ok(())
     }
 
+    #[inline]
     fn get_blocks(&mut self, dst: &mut [u8], span: Span) -> Result<()> {
+        self.get_blocks_shared(dst, span)
+    }
+
+    #[inline]
+    fn can_read_shared(&self) -> bool {
+        true
+    }
+
+    fn get_blocks_shared(&self, dst: &mut [u8], span: Span) -> Result<()> {
         assert_eq!(dst.len(), span.bytes_len());
-        let storages = STORAGES.lock().unwrap();
+        let storages = STORAGES.read().unwrap();
         let depot = storages.get(&self.loc).unwrap();
         let mut read = 0;
         for blk_idx in span {
@@ -172,7 +182,7 @@ impl Storable for MemStorage {
 
     fn put_blocks(&mut self, span: Span, mut blks: &[u8]) -> Result<()> {
         assert_eq!(blks.len(), span.bytes_len());
-        let mut storages = STORAGES.lock().unwrap();
+        let mut storages = STORAGES.write().unwrap();
         let depot = storages.get_mut(&self.loc).unwrap();
         for blk_idx in span {
             depot.blk_map.insert(blk_idx, blks[..BLK_SIZE].to_vec());
@@ -182,7 +192,7 @@ impl Storable for MemStorage {
     }
 
     fn del_blocks(&mut self, span: Span) -> Result<()> {
-        let mut storages = STORAGES.lock().unwrap();
+        let mut storages = STORAGES.write().unwrap();
         let depot = storages.get_mut(&self.loc).unwrap();
         for blk_idx in span {
             depot.blk_map.remove(&blk_idx);
@@ -196,7 +206,7 @@ impl Storable for MemStorage {
     }
 
     fn destroy(&mut self) -> Result<()> {
-        let mut storages = STORAGES.lock().unwrap();
+        let mut storages = STORAGES.write().unwrap();
         if let Some(depot) = storages.remove(&self.loc) {
             if depot.is_opened {
                 warn!("Destroyed an opened repo");
@@ -209,7 +219,7 @@ impl Storable for MemStorage {
 impl Drop for MemStorage {
     fn drop(&mut self) {
         if self.is_attached {
-            let mut storages = STORAGES.lock().unwrap();
+            let mut storages = STORAGES.write().unwrap();
             if let Some(depot) = storages.get_mut(&self.loc) {
                 depot.is_opened = false;
             }
@@ -219,7 +229,7 @@ impl Drop for MemStorage {
 
 impl Debug for MemStorage {
     fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
-        let storages = STORAGES.lock().unwrap();
+        let storages = STORAGES.read().unwrap();
         let depot = storages.get(&self.loc).unwrap();
         f.debug_struct("MemStorage")
             .field("super_blk_map", &depot.super_blk_map.len())
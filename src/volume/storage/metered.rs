@@ -0,0 +1,193 @@
+use std::time::Instant;
+
+use base::crypto::{Crypto, Key};
+use base::metrics::{MetricsRef, StorageOp};
+use error::Result;
+use trans::Eid;
+use volume::address::Span;
+use volume::storage::Storable;
+
+// run a depot operation and record its latency
+macro_rules! timed {
+    ($self:ident, $op:ident, $call:expr) => {{
+        let begin = Instant::now();
+        let ret = $call;
+        $self.metrics.record_storage_op(StorageOp::$op, begin);
+        ret
+    }};
+}
+
+// run a batched depot operation and record it as one operation per span
+macro_rules! timed_batch {
+    ($self:ident, $op:ident, $spans:expr, $call:expr) => {{
+        let begin = Instant::now();
+        let ret = $call;
+        $self
+            .metrics
+            .record_storage_batch(StorageOp::$op, begin, $spans);
+        ret
+    }};
+}
+
+/// Metered Storage
+///
+/// This storage wraps another storage and records count and latency of
+/// each operation.
+#[derive(Debug)]
+pub struct MeteredStorage {
+    inner: Box<dyn Storable>,
+    metrics: MetricsRef,
+}
+
+impl MeteredStorage {
+    pub fn new(mut inner: Box<dyn Storable>, metrics: &MetricsRef) -> Self {
+        inner.set_metrics(metrics);
+        MeteredStorage {
+            inner,
+            metrics: metrics.clone(),
+        }
+    }
+}
+
+impl Storable for MeteredStorage {
+    #[inline]
+    fn exists(&self) -> Result<bool> {
+        self.inner.exists()
+    }
+
+    #[inline]
+    fn connect(&mut self, force: bool) -> Result<()> {
+        self.inner.connect(force)
+    }
+
+    #[inline]
+    fn init(&mut self, crypto: Crypto, key: Key) -> Result<()> {
+        self.inner.init(crypto, key)
+    }
+
+    #[inline]
+    fn open(&mut self, crypto: Crypto, key: Key, force: bool) -> Result<()> {
+        self.inner.open(crypto, key, force)
+    }
+
+    #[inline]
+    fn get_super_block(&mut self, suffix: u64) -> Result<Vec<u8>> {
+        timed!(self, GetSuperBlock, self.inner.get_super_block(suffix))
+    }
+
+    #[inline]
+    fn put_super_block(&mut self, super_blk: &[u8], suffix: u64) -> Result<()> {
+        timed!(
+            self,
+            PutSuperBlock,
+            self.inner.put_super_block(super_blk, suffix)
+        )
+    }
+
+    #[inline]
+    fn get_wal(&mut self, id: &Eid) -> Result<Vec<u8>> {
+        timed!(self, GetWal, self.inner.get_wal(id))
+    }
+
+    #[inline]
+    fn put_wal(&mut self, id: &Eid, wal: &[u8]) -> Result<()> {
+        timed!(self, PutWal, self.inner.put_wal(id, wal))
+    }
+
+    #[inline]
+    fn del_wal(&mut self, id: &Eid) -> Result<()> {
+        timed!(self, DelWal, self.inner.del_wal(id))
+    }
+
+    #[inline]
+    fn get_address(&mut self, id: &Eid) -> Result<Vec<u8>> {
+        timed!(self, GetAddress, self.inner.get_address(id))
+    }
+
+    #[inline]
+    fn put_address(&mut self, id: &Eid, addr: &[u8]) -> Result<()> {
+        timed!(self, PutAddress, self.inner.put_address(id, addr))
+    }
+
+    #[inline]
+    fn del_address(&mut self, id: &Eid) -> Result<()> {
+        timed!(self, DelAddress, self.inner.del_address(id))
+    }
+
+    #[inline]
+    fn get_blocks(&mut self, dst: &mut [u8], span: Span) -> Result<()> {
+        timed!(self, GetBlocks, self.inner.get_blocks(dst, span))
+    }
+
+    #[inline]
+    fn put_blocks(&mut self, span: Span, blks: &[u8]) -> Result<()> {
+        timed!(self, PutBlocks, self.inner.put_blocks(span, blks))
+    }
+
+    #[inline]
+    fn del_blocks(&mut self, span: Span) -> Result<()> {
+        timed!(self, DelBlocks, self.inner.del_blocks(span))
+    }
+
+    #[inline]
+    fn can_read_shared(&self) -> bool {
+        self.inner.can_read_shared()
+    }
+
+    #[inline]
+    fn get_blocks_shared(&self, dst: &mut [u8], span: Span) -> Result<()> {
+        timed!(self, GetBlocks, self.inner.get_blocks_shared(dst, span))
+    }
+
+    #[inline]
+    fn get_blocks_batch(
+        &mut self,
+        blks: &mut [(Span, &mut [u8])],
+    ) -> Result<()> {
+        timed_batch!(
+            self,
+            GetBlocks,
+            blks.len(),
+            self.inner.get_blocks_batch(blks)
+        )
+    }
+
+    #[inline]
+    fn get_blocks_batch_shared(
+        &self,
+        blks: &mut [(Span, &mut [u8])],
+    ) -> Result<()> {
+        timed_batch!(
+            self,
+            GetBlocks,
+            blks.len(),
+            self.inner.get_blocks_batch_shared(blks)
+        )
+    }
+
+    #[inline]
+    fn put_blocks_batch(&mut self, blks: &[(Span, &[u8])]) -> Result<()> {
+        timed_batch!(
+            self,
+            PutBlocks,
+            blks.len(),
+            self.inner.put_blocks_batch(blks)
+        )
+    }
+
+    #[inline]
+    fn flush(&mut self) -> Result<()> {
+        timed!(self, Flush, self.inner.flush())
+    }
+
+    #[inline]
+    fn destroy(&mut self) -> Result<()> {
+        self.inner.destroy()
+    }
+
+    #[inline]
+    fn set_metrics(&mut self, metrics: &MetricsRef) {
+        self.inner.set_metrics(metrics);
+        self.metrics = metrics.clone();
+    }
+}
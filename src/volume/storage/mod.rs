@@ -1,5 +1,6 @@
 #![allow(clippy::module_inception)]
 
+mod metered;
 mod storage;
 
 pub use self::storage::{
@@ -34,9 +35,11 @@ mod zbox;
 mod index_mgr;
 
 use std::fmt::Debug;
+use std::io::{Error as IoError, ErrorKind};
 
 use base::crypto::{Crypto, Key};
-use error::Result;
+use base::metrics::MetricsRef;
+use error::{Error, Result};
 use trans::Eid;
 use volume::address::Span;
 
@@ -80,12 +83,65 @@ pub trait Storable: Debug + Send + Sync {
     fn put_blocks(&mut self, span: Span, blks: &[u8]) -> Result<()>;
     fn del_blocks(&mut self, span: Span) -> Result<()>;
 
+    // shared block read, can be called concurrently from multiple readers.
+    // storage which can read blocks without exclusive access should
+    // return true in can_read_shared() and implement get_blocks_shared(),
+    // otherwise get_blocks() will be used. Shared read cannot fall back to
+    // get_blocks() as it needs exclusive access, so it fails by default.
+    #[inline]
+    fn can_read_shared(&self) -> bool {
+        false
+    }
+
+    #[inline]
+    fn get_blocks_shared(&self, _dst: &mut [u8], _span: Span) -> Result<()> {
+        Err(Error::from(IoError::new(
+            ErrorKind::Other,
+            "Shared block read not supported",
+        )))
+    }
+
+    // vectored block read/write, each span is read to or written from its
+    // own buffer. Storage which can batch multiple spans in one round trip
+    // should override these, otherwise each span is read or written
+    // separately.
+    fn get_blocks_batch(
+        &mut self,
+        blks: &mut [(Span, &mut [u8])],
+    ) -> Result<()> {
+        for (span, dst) in blks.iter_mut() {
+            self.get_blocks(dst, *span)?;
+        }
+        Ok(())
+    }
+
+    fn get_blocks_batch_shared(
+        &self,
+        blks: &mut [(Span, &mut [u8])],
+    ) -> Result<()> {
+        for (span, dst) in blks.iter_mut() {
+            self.get_blocks_shared(dst, *span)?;
+        }
+        Ok(())
+    }
+
+    fn put_blocks_batch(&mut self, blks: &[(Span, &[u8])]) -> Result<()> {
+        for (span, src) in blks.iter() {
+            self.put_blocks(*span, src)?;
+        }
+        Ok(())
+    }
+
     // flush possibly buffered wal, address and block to storage,
     // storage must gurantee write is persistent
     fn flush(&mut self) -> Result<()>;
 
     // permanently destroy this storage
     fn destroy(&mut self) -> Result<()>;
+
+    // set runtime metrics for storage internals, such as index lookups
+    #[inline]
+    fn set_metrics(&mut self, _metrics: &MetricsRef) {}
 }
 
 /// Dummy storage
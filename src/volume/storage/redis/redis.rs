@@ -1,7 +1,8 @@
 use std::fmt::{self, Debug};
+use std::sync::atomic::{AtomicUsize, Ordering};
 use std::sync::Mutex;
 
-use redis::{self, Client, Commands, Connection};
+use redis::{self, Client, Commands, Connection, RedisResult};
 
 use base::crypto::{Crypto, Key};
 use base::IntoRef;
@@ -41,18 +42,57 @@ fn blk_key(blk_idx: usize) -> String {
     format!("block:{}", blk_idx)
 }
 
+// default number of connections in pool
+const DEFAULT_POOL_SIZE: usize = 4;
+
+// extract pool size parameter from redis location and return the rest
+// of the location, which is passed to redis client
+fn parse_pool_size(path: &str) -> Result<(String, usize)> {
+    let idx = match path.find('?') {
+        Some(idx) => idx,
+        None => return Ok((path.to_string(), DEFAULT_POOL_SIZE)),
+    };
+
+    let mut pool_size = DEFAULT_POOL_SIZE;
+    let mut params = Vec::new();
+    for param in path[idx + 1..].split('&') {
+        if param.starts_with("pool_size=") {
+            pool_size = param[10..]
+                .parse::<usize>()
+                .map_err(|_| Error::InvalidUri)?;
+            if pool_size < 1 {
+                return Err(Error::InvalidUri);
+            }
+        } else {
+            params.push(param);
+        }
+    }
+
+    let mut loc = path[..idx].to_string();
+    if !params.is_empty() {
+        loc.push('?');
+        loc.push_str(&params.join("&"));
+    }
+    Ok((loc, pool_size))
+}
+
 /// Redis Storage
 pub struct RedisStorage {
     is_attached: bool, // attached to redis
     client: Client,
-    conn: Option<Mutex<Connection>>,
+
+    // connection pool
+    conns: Vec<Mutex<Connection>>,
+    pool_size: usize,
+    next_conn: AtomicUsize,
 }
 
 impl RedisStorage {
     pub fn new(path: &str) -> Result<Self> {
         // url format:
-        // redis://[:<passwd>@]<hostname>[:port][/<db>]
-        // redis+unix:///[:<passwd>@]<path>[?db=<db>]
+        // redis://[:<passwd>@]<hostname>[:port][/<db>][?pool_size=<size>]
+        // redis+unix:///[:<passwd>@]<path>[?db=<db>&pool_size=<size>]
+        let (path, pool_size) = parse_pool_size(path)?;
         let url = if path.starts_with("+unix+") {
             format!("redis+unix:///{}", &path[6..])
         } else {
@@ -63,44 +103,45 @@ impl RedisStorage {
         Ok(RedisStorage {
             is_attached: false,
             client,
-            conn: None,
+            conns: Vec::new(),
+            pool_size,
+            next_conn: AtomicUsize::new(0),
         })
     }
 
-    fn get_bytes(&self, key: &str) -> Result<Vec<u8>> {
-        match self.conn {
-            Some(ref conn) => {
-                let mut conn = conn.lock().unwrap();
-                if !conn.exists::<&str, bool>(key)? {
-                    return Err(Error::NotFound);
-                }
-                let ret = conn.get(key)?;
-                Ok(ret)
+    // run a function on a connection from pool, idle connection is
+    // preferred so concurrent readers don't wait for each other
+    fn with_conn<F, T>(&self, f: F) -> Result<T>
+    where
+        F: FnOnce(&mut Connection) -> RedisResult<T>,
+    {
+        assert!(!self.conns.is_empty());
+        let start = self.next_conn.fetch_add(1, Ordering::Relaxed);
+        let cnt = self.conns.len();
+        for i in 0..cnt {
+            if let Ok(mut conn) = self.conns[(start + i) % cnt].try_lock() {
+                return f(&mut *conn).map_err(Error::from);
             }
-            None => unreachable!(),
         }
+
+        // all connections are busy, wait for one of them
+        let mut conn = self.conns[start % cnt].lock().unwrap();
+        f(&mut *conn).map_err(Error::from)
+    }
+
+    fn get_bytes(&self, key: &str) -> Result<Vec<u8>> {
+        let ret: Option<Vec<u8>> = self.with_conn(|conn| conn.get(key))?;
+        ret.ok_or(Error::NotFound)
     }
 
+    #[inline]
     fn set_bytes(&self, key: &str, val: &[u8]) -> Result<()> {
-        match self.conn {
-            Some(ref conn) => {
-                let mut conn = conn.lock().unwrap();
-                conn.set(key, val)?;
-                Ok(())
-            }
-            None => unreachable!(),
-        }
+        self.with_conn(|conn| conn.set(key, val))
     }
 
+    #[inline]
     fn del(&self, key: &str) -> Result<()> {
-        match self.conn {
-            Some(ref conn) => {
-                let mut conn = conn.lock().unwrap();
-                conn.del(key)?;
-                Ok(())
-            }
-            None => unreachable!(),
-        }
+        self.with_conn(|conn| conn.del(key))
     }
 
     fn lock_repo(&mut self, force: bool) -> Result<()> {
@@ -132,8 +173,11 @@ impl Storable for RedisStorage {
     }
 
     fn connect(&mut self, _force: bool) -> Result<()> {
-        let conn = self.client.get_connection()?;
-        self.conn = Some(Mutex::new(conn));
+        self.conns.clear();
+        for _ in 0..self.pool_size {
+            let conn = self.client.get_connection()?;
+            self.conns.push(Mutex::new(conn));
+        }
         Ok(())
     }
 
@@ -195,35 +239,91 @@ impl Storable for RedisStorage {
         self.del(&key)
     }
 
+    #[inline]
     fn get_blocks(&mut self, dst: &mut [u8], span: Span) -> Result<()> {
-        let mut read = 0;
-        for blk_idx in span {
-            let key = blk_key(blk_idx);
-            let blk = self.get_bytes(&key)?;
-            assert_eq!(blk.len(), BLK_SIZE);
-            dst[read..read + BLK_SIZE].copy_from_slice(&blk);
-            read += BLK_SIZE;
+        self.get_blocks_shared(dst, span)
+    }
+
+    #[inline]
+    fn can_read_shared(&self) -> bool {
+        true
+    }
+
+    #[inline]
+    fn get_blocks_shared(&self, dst: &mut [u8], span: Span) -> Result<()> {
+        self.get_blocks_batch_shared(&mut [(span, dst)])
+    }
+
+    #[inline]
+    fn get_blocks_batch(
+        &mut self,
+        blks: &mut [(Span, &mut [u8])],
+    ) -> Result<()> {
+        self.get_blocks_batch_shared(blks)
+    }
+
+    fn get_blocks_batch_shared(
+        &self,
+        blks: &mut [(Span, &mut [u8])],
+    ) -> Result<()> {
+        // get all blocks in one MGET command
+        let keys: Vec<String> = blks
+            .iter()
+            .flat_map(|(span, _)| span.into_iter().map(blk_key))
+            .collect();
+        if keys.is_empty() {
+            return Ok(());
+        }
+        let vals: Vec<Option<Vec<u8>>> =
+            self.with_conn(|conn| redis::cmd("MGET").arg(keys).query(conn))?;
+
+        // copy blocks to destinations
+        let mut vals = vals.into_iter();
+        for (_, dst) in blks.iter_mut() {
+            for blk_dst in dst.chunks_mut(BLK_SIZE) {
+                let blk = match vals.next() {
+                    Some(Some(blk)) => blk,
+                    _ => return Err(Error::NotFound),
+                };
+                assert_eq!(blk.len(), BLK_SIZE);
+                blk_dst.copy_from_slice(&blk);
+            }
         }
 
         Ok(())
     }
 
-    fn put_blocks(&mut self, span: Span, mut blks: &[u8]) -> Result<()> {
-        for blk_idx in span {
-            let key = blk_key(blk_idx);
-            self.set_bytes(&key, &blks[..BLK_SIZE])?;
-            blks = &blks[BLK_SIZE..];
+    #[inline]
+    fn put_blocks(&mut self, span: Span, blks: &[u8]) -> Result<()> {
+        self.put_blocks_batch(&[(span, blks)])
+    }
+
+    fn put_blocks_batch(&mut self, blks: &[(Span, &[u8])]) -> Result<()> {
+        // set all blocks in one MSET command, which is atomic, so blocks
+        // are checked before it to not leave a batch half-written
+        if blks.iter().any(|(span, src)| src.len() != span.bytes_len()) {
+            return Err(Error::InvalidArgument);
+        }
+        if blks.iter().all(|(span, _)| span.cnt == 0) {
+            return Ok(());
+        }
+        let mut cmd = redis::cmd("MSET");
+        for (span, src) in blks.iter() {
+            for (blk_idx, blk) in span.into_iter().zip(src.chunks(BLK_SIZE)) {
+                cmd.arg(blk_key(blk_idx)).arg(blk);
+            }
         }
 
-        Ok(())
+        self.with_conn(|conn| cmd.query(conn))
     }
 
     fn del_blocks(&mut self, span: Span) -> Result<()> {
-        for blk_idx in span {
-            let key = blk_key(blk_idx);
-            self.del(&key)?;
+        // delete all blocks in one DEL command
+        if span.cnt == 0 {
+            return Ok(());
         }
-        Ok(())
+        let keys: Vec<String> = span.into_iter().map(blk_key).collect();
+        self.with_conn(|conn| conn.del(keys))
     }
 
     #[inline]
@@ -240,14 +340,7 @@ impl Storable for RedisStorage {
             warn!("Destroy an opened repo");
         }
 
-        match self.conn {
-            Some(ref conn) => {
-                let mut conn = conn.lock().unwrap();
-                redis::cmd("FLUSHDB").execute(&mut *conn);
-                Ok(())
-            }
-            None => unreachable!(),
-        }
+        self.with_conn(|conn| redis::cmd("FLUSHDB").query(conn))
     }
 }
 
@@ -276,6 +369,81 @@ mod tests {
     use super::*;
     use base::init_env;
 
+    #[test]
+    fn redis_pool_size() {
+        let (loc, size) = parse_pool_size("127.0.0.1").unwrap();
+        assert_eq!(loc, "127.0.0.1");
+        assert_eq!(size, DEFAULT_POOL_SIZE);
+        let (loc, size) =
+            parse_pool_size("+unix+/tmp/redis.sock?db=1&pool_size=8").unwrap();
+        assert_eq!(loc, "+unix+/tmp/redis.sock?db=1");
+        assert_eq!(size, 8);
+        let (loc, size) = parse_pool_size("127.0.0.1/2?pool_size=2").unwrap();
+        assert_eq!(loc, "127.0.0.1/2");
+        assert_eq!(size, 2);
+        assert_eq!(
+            parse_pool_size("127.0.0.1?pool_size=0").unwrap_err(),
+            Error::InvalidUri
+        );
+    }
+
+    #[test]
+    fn redis_blocks_batch() {
+        init_env();
+        let mut rs = RedisStorage::new("127.0.0.1/1").unwrap();
+        rs.connect(false).unwrap();
+        rs.destroy().unwrap();
+        rs.init(Crypto::default(), Key::new_empty()).unwrap();
+
+        let mut blks = vec![0u8; BLK_SIZE * 6];
+        Crypto::random_buf(&mut blks);
+
+        // batch round trip
+        rs.put_blocks_batch(&[
+            (Span::new(0, 1), &blks[..BLK_SIZE]),
+            (Span::new(5, 2), &blks[BLK_SIZE..BLK_SIZE * 3]),
+            (Span::new(2, 3), &blks[BLK_SIZE * 3..]),
+        ])
+        .unwrap();
+        let mut dst = vec![0u8; BLK_SIZE * 6];
+        {
+            let (dst1, rest) = dst.split_at_mut(BLK_SIZE * 3);
+            let (dst2, dst3) = rest.split_at_mut(BLK_SIZE * 2);
+            let mut batch = [
+                (Span::new(2, 3), dst1),
+                (Span::new(5, 2), dst2),
+                (Span::new(0, 1), dst3),
+            ];
+            rs.get_blocks_batch(&mut batch).unwrap();
+        }
+        assert_eq!(&dst[..BLK_SIZE * 3], &blks[BLK_SIZE * 3..]);
+        assert_eq!(
+            &dst[BLK_SIZE * 3..BLK_SIZE * 5],
+            &blks[BLK_SIZE..BLK_SIZE * 3]
+        );
+        assert_eq!(&dst[BLK_SIZE * 5..], &blks[..BLK_SIZE]);
+
+        // failed batch leaves nothing written, the second span is short of
+        // one block
+        assert_eq!(
+            rs.put_blocks_batch(&[
+                (Span::new(10, 2), &blks[..BLK_SIZE * 2]),
+                (Span::new(12, 2), &blks[BLK_SIZE * 2..BLK_SIZE * 3]),
+            ])
+            .unwrap_err(),
+            Error::InvalidArgument
+        );
+        for blk_idx in 10..14 {
+            assert_eq!(
+                rs.get_blocks(&mut dst[..BLK_SIZE], Span::new(blk_idx, 1))
+                    .unwrap_err(),
+                Error::NotFound
+            );
+        }
+
+        rs.destroy().unwrap();
+    }
+
     #[test]
     fn redis_storage() {
         init_env();
@@ -285,7 +453,8 @@ mod tests {
 
         let id = Eid::new();
         let buf = vec![1, 2, 3];
-        let blks = vec![42u8; BLK_SIZE * 3];
+        let mut blks = vec![0u8; BLK_SIZE * 3];
+        Crypto::random_buf(&mut blks);
         let mut dst = vec![0u8; BLK_SIZE * 3];
 
         // super block
@@ -312,6 +481,13 @@ mod tests {
         rs.put_blocks(span, &blks).unwrap();
         rs.get_blocks(&mut dst, span).unwrap();
         assert_eq!(&dst[..], &blks[..]);
+        {
+            let (dst1, dst2) = dst.split_at_mut(BLK_SIZE);
+            let mut batch = [(Span::new(2, 1), dst1), (Span::new(0, 2), dst2)];
+            rs.get_blocks_batch(&mut batch).unwrap();
+        }
+        assert_eq!(&dst[..BLK_SIZE], &blks[BLK_SIZE * 2..]);
+        assert_eq!(&dst[BLK_SIZE..], &blks[..BLK_SIZE * 2]);
         rs.del_blocks(Span::new(1, 2)).unwrap();
         assert_eq!(
             rs.get_blocks(&mut dst, Span::new(0, 3)).unwrap_err(),
@@ -327,6 +503,15 @@ mod tests {
                 .unwrap_err(),
             Error::NotFound
         );
+        let mut blks2 = vec![0u8; BLK_SIZE * 3];
+        Crypto::random_buf(&mut blks2);
+        rs.put_blocks_batch(&[
+            (Span::new(3, 1), &blks2[..BLK_SIZE]),
+            (Span::new(4, 2), &blks2[BLK_SIZE..]),
+        ])
+        .unwrap();
+        rs.get_blocks(&mut dst, Span::new(3, 3)).unwrap();
+        assert_eq!(&dst[..], &blks2[..]);
 
         // re-open
         drop(rs);
@@ -2,11 +2,14 @@ use std::ffi::{CStr, CString};
 use std::fmt::{self, Debug};
 use std::os::raw::{c_int, c_void};
 use std::ptr;
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::sync::Mutex;
 use std::thread::panicking;
 
 use libsqlite3_sys as ffi;
 
 use base::crypto::{Crypto, Key};
+use base::utils;
 use base::vio;
 use error::{Error, Result};
 use trans::Eid;
@@ -23,10 +26,10 @@ fn check_result(result: c_int) -> Result<()> {
     Ok(())
 }
 
-// reset and clean up statement
+// reset and clean up statement, the result of reset is ignored as it
+// is the error of last failed step, which has been reported already
 fn reset_stmt(stmt: *mut ffi::sqlite3_stmt) -> Result<()> {
-    let result = unsafe { ffi::sqlite3_reset(stmt) };
-    check_result(result)?;
+    unsafe { ffi::sqlite3_reset(stmt) };
     let result = unsafe { ffi::sqlite3_clear_bindings(stmt) };
     check_result(result)?;
     Ok(())
@@ -87,6 +90,50 @@ fn run_dml(stmt: *mut ffi::sqlite3_stmt) -> Result<()> {
     }
 }
 
+// run SELECT statement on a range of blocks, blocks must be continuous
+fn run_select_blocks(
+    stmt: *mut ffi::sqlite3_stmt,
+    dst: &mut [u8],
+    span: Span,
+) -> Result<()> {
+    bind_int(stmt, 1, span.begin)?;
+    bind_int(stmt, 2, span.end())?;
+
+    let mut read = 0;
+    for blk_idx in span {
+        let result = unsafe { ffi::sqlite3_step(stmt) };
+        match result {
+            ffi::SQLITE_ROW => {
+                // missing block in the range
+                let idx = unsafe { ffi::sqlite3_column_int64(stmt, 0) };
+                if idx as usize != blk_idx {
+                    return Err(Error::NotFound);
+                }
+
+                let (data, data_len) = unsafe {
+                    (
+                        ffi::sqlite3_column_blob(stmt, 1),
+                        ffi::sqlite3_column_bytes(stmt, 1) as usize,
+                    )
+                };
+                assert_eq!(data_len, BLK_SIZE);
+                unsafe {
+                    ptr::copy_nonoverlapping(
+                        data,
+                        dst[read..].as_mut_ptr() as *mut c_void,
+                        data_len,
+                    );
+                }
+                read += BLK_SIZE;
+            }
+            ffi::SQLITE_DONE => return Err(Error::NotFound),
+            _ => return Err(Error::from(ffi::Error::new(result))),
+        }
+    }
+
+    Ok(())
+}
+
 // run SELECT statement on a blob column
 fn run_select_blob(stmt: *mut ffi::sqlite3_stmt) -> Result<Vec<u8>> {
     let result = unsafe { ffi::sqlite3_step(stmt) };
@@ -116,12 +163,250 @@ fn run_select_blob(stmt: *mut ffi::sqlite3_stmt) -> Result<Vec<u8>> {
     }
 }
 
+// read blocks in a span, using single block query if there is only one
+// block, otherwise using range query
+fn select_blocks(
+    blk_stmt: *mut ffi::sqlite3_stmt,
+    range_stmt: *mut ffi::sqlite3_stmt,
+    dst: &mut [u8],
+    span: Span,
+) -> Result<()> {
+    let ret = if span.cnt == 1 {
+        reset_stmt(blk_stmt)?;
+        bind_int(blk_stmt, 1, span.begin)?;
+        run_select_blob(blk_stmt).map(|blk| {
+            assert_eq!(blk.len(), BLK_SIZE);
+            dst.copy_from_slice(&blk);
+        })
+    } else {
+        reset_stmt(range_stmt)?;
+        run_select_blocks(range_stmt, dst, span)
+    };
+
+    // reset statements, so they won't keep the read transaction open
+    reset_stmt(blk_stmt)?;
+    reset_stmt(range_stmt)?;
+    ret
+}
+
+// prepare one sql statement on a connection
+fn prepare_stmt(
+    db: *mut ffi::sqlite3,
+    sql: &str,
+) -> Result<*mut ffi::sqlite3_stmt> {
+    let mut stmt = ptr::null_mut();
+    let sql = CString::new(sql).unwrap();
+    let result = unsafe {
+        ffi::sqlite3_prepare_v2(
+            db,
+            sql.as_ptr(),
+            -1,
+            &mut stmt,
+            ptr::null_mut(),
+        )
+    };
+    check_result(result)?;
+    Ok(stmt)
+}
+
+// execute sql statements and ignore their results
+fn exec_sql(db: *mut ffi::sqlite3, sql: &str) -> Result<()> {
+    let sql = CString::new(sql).unwrap();
+    let result = unsafe {
+        ffi::sqlite3_exec(
+            db,
+            sql.as_ptr(),
+            None,
+            ptr::null_mut(),
+            ptr::null_mut(),
+        )
+    };
+    check_result(result)
+}
+
+// open a database connection
+fn open_db(file_path: &CStr, flags: c_int) -> Result<*mut ffi::sqlite3> {
+    let mut db = ptr::null_mut();
+    let result = unsafe {
+        ffi::sqlite3_open_v2(file_path.as_ptr(), &mut db, flags, ptr::null())
+    };
+    if result != ffi::SQLITE_OK {
+        let err = ffi::Error::new(result);
+        if !db.is_null() {
+            unsafe { ffi::sqlite3_close(db) };
+        }
+        return Err(Error::from(err));
+    }
+
+    // wait for a while if database is locked by other connections
+    let result = unsafe { ffi::sqlite3_busy_timeout(db, BUSY_TIMEOUT) };
+    if result != ffi::SQLITE_OK {
+        unsafe { ffi::sqlite3_close(db) };
+        return Err(Error::from(ffi::Error::new(result)));
+    }
+
+    Ok(db)
+}
+
+// busy timeout for database connections, in milliseconds
+const BUSY_TIMEOUT: c_int = 5000;
+
+// default number of read-only connections in WAL journal mode
+const DEFAULT_READERS: usize = 4;
+
+// sqlite storage options
+#[derive(Debug, Clone, Default, PartialEq)]
+struct Opts {
+    // use WAL journal mode
+    wal: bool,
+
+    // synchronous level, use sqlite default if it is None
+    synchronous: Option<String>,
+
+    // page cache size in KiB, use sqlite default if it is None
+    cache_size: Option<usize>,
+
+    // number of read-only connections for shared block reads
+    readers: usize,
+}
+
+// parse sqlite storage location, its format is:
+//   path[?journal_mode=wal&synchronous=normal&cache_size=8mb&readers=4]
+// path can contain '?', so only the trailing query whose keys are all known
+// parameters is parsed as parameters, otherwise it is part of the path. A
+// query mixing known and unknown parameters is mistyped and rejected.
+// parameters:
+//   journal_mode: delete or wal, default is delete
+//   synchronous: off, normal, full or extra, default is sqlite default
+//   cache_size: page cache size, default is sqlite default
+//   readers: number of read-only connections, default is 4 in wal journal
+//            mode and 0 in delete journal mode
+fn parse_loc(loc: &str) -> Result<(&str, Opts)> {
+    let (path, params) = utils::split_loc_query(
+        loc,
+        &["journal_mode", "synchronous", "cache_size", "readers"],
+    )?;
+    if path.is_empty() {
+        return Err(Error::InvalidUri);
+    }
+
+    let mut opts = Opts::default();
+    let mut readers = None;
+
+    if !params.is_empty() {
+        for param in params.split('&') {
+            let idx = param.find('=').ok_or(Error::InvalidUri)?;
+            let key = &param[..idx];
+            let value = param[idx + 1..].to_lowercase();
+
+            match key {
+                "journal_mode" => match value.as_str() {
+                    "wal" => opts.wal = true,
+                    "delete" => opts.wal = false,
+                    _ => return Err(Error::InvalidUri),
+                },
+                "synchronous" => match value.as_str() {
+                    "off" | "normal" | "full" | "extra" => {
+                        opts.synchronous = Some(value)
+                    }
+                    _ => return Err(Error::InvalidUri),
+                },
+                "cache_size" => {
+                    let idx = value.find("mb").ok_or(Error::InvalidUri)?;
+                    let size = value[..idx]
+                        .parse::<usize>()
+                        .map_err(|_| Error::InvalidUri)?;
+                    opts.cache_size = Some(size * 1024);
+                }
+                "readers" => {
+                    let cnt = value
+                        .parse::<usize>()
+                        .map_err(|_| Error::InvalidUri)?;
+                    readers = Some(cnt);
+                }
+                _ => return Err(Error::InvalidUri),
+            }
+        }
+    }
+
+    // in-memory database cannot be shared by other connections
+    if path == ":memory:" && (opts.wal || readers.unwrap_or(0) > 0) {
+        return Err(Error::InvalidUri);
+    }
+
+    opts.readers =
+        readers.unwrap_or(if opts.wal { DEFAULT_READERS } else { 0 });
+
+    Ok((path, opts))
+}
+
+// read-only connection for shared block reads
+struct Reader {
+    db: *mut ffi::sqlite3,
+    blk_stmt: *mut ffi::sqlite3_stmt,
+    range_stmt: *mut ffi::sqlite3_stmt,
+}
+
+impl Reader {
+    fn open(file_path: &CStr) -> Result<Self> {
+        let db = open_db(
+            file_path,
+            ffi::SQLITE_OPEN_READONLY | ffi::SQLITE_OPEN_NOMUTEX,
+        )?;
+        let mut rdr = Reader {
+            db,
+            blk_stmt: ptr::null_mut(),
+            range_stmt: ptr::null_mut(),
+        };
+        rdr.blk_stmt = prepare_stmt(
+            db,
+            &format!(
+                "SELECT data FROM {} WHERE blk_idx = ?",
+                SqliteStorage::TBL_BLOCKS
+            ),
+        )?;
+        rdr.range_stmt = prepare_stmt(
+            db,
+            &format!(
+                "SELECT blk_idx, data FROM {} WHERE blk_idx >= ? AND blk_idx < ? ORDER BY blk_idx",
+                SqliteStorage::TBL_BLOCKS
+            ),
+        )?;
+        Ok(rdr)
+    }
+
+    #[inline]
+    fn read_blocks(&self, dst: &mut [u8], span: Span) -> Result<()> {
+        select_blocks(self.blk_stmt, self.range_stmt, dst, span)
+    }
+}
+
+impl Drop for Reader {
+    fn drop(&mut self) {
+        unsafe {
+            ffi::sqlite3_finalize(self.blk_stmt);
+            ffi::sqlite3_finalize(self.range_stmt);
+            ffi::sqlite3_close(self.db);
+        }
+    }
+}
+
+unsafe impl Send for Reader {}
+
 /// Sqlite Storage
 pub struct SqliteStorage {
     is_attached: bool,  // attached to sqlite db
     file_path: CString, // database file path
+    opts: Opts,
     db: *mut ffi::sqlite3,
     stmts: Vec<*mut ffi::sqlite3_stmt>,
+
+    // transaction for buffered updates is started
+    in_trans: bool,
+
+    // read-only connection pool
+    readers: Vec<Mutex<Reader>>,
+    next_reader: AtomicUsize,
 }
 
 impl SqliteStorage {
@@ -132,37 +417,107 @@ impl SqliteStorage {
     const TBL_ADDRESSES: &'static str = "addresses";
     const TBL_BLOCKS: &'static str = "blocks";
 
-    pub fn new(file_path: &str) -> Self {
-        SqliteStorage {
+    // number of prepared statements
+    const STMT_CNT: usize = 18;
+
+    pub fn new(loc: &str) -> Result<Self> {
+        let (file_path, opts) = parse_loc(loc)?;
+        Ok(SqliteStorage {
             is_attached: false,
             file_path: CString::new(file_path).unwrap(),
+            opts,
             db: ptr::null_mut(),
-            stmts: Vec::with_capacity(14),
-        }
+            stmts: Vec::with_capacity(Self::STMT_CNT),
+            in_trans: false,
+            readers: Vec::new(),
+            next_reader: AtomicUsize::new(0),
+        })
     }
 
     // prepare one sql statement
     fn prepare_sql(&mut self, sql: String) -> Result<()> {
-        let mut stmt = ptr::null_mut();
-        let sql = CString::new(sql).unwrap();
-        let result = unsafe {
-            ffi::sqlite3_prepare_v2(
-                self.db,
-                sql.as_ptr(),
-                -1,
-                &mut stmt,
-                ptr::null_mut(),
-            )
-        };
-        check_result(result)?;
+        let stmt = prepare_stmt(self.db, &sql)?;
         self.stmts.push(stmt);
         Ok(())
     }
 
+    // set journal mode and other tunables
+    fn set_pragmas(&self) -> Result<()> {
+        if self.opts.wal {
+            exec_sql(self.db, "PRAGMA journal_mode = WAL")?;
+        }
+        if let Some(ref synchronous) = self.opts.synchronous {
+            exec_sql(
+                self.db,
+                &format!("PRAGMA synchronous = {}", synchronous),
+            )?;
+        }
+        if let Some(cache_size) = self.opts.cache_size {
+            // negative cache size is in KiB
+            exec_sql(self.db, &format!("PRAGMA cache_size = -{}", cache_size))?;
+        }
+        Ok(())
+    }
+
+    // open read-only connection pool
+    fn open_readers(&mut self) -> Result<()> {
+        self.readers.clear();
+        for _ in 0..self.opts.readers {
+            let rdr = Reader::open(&self.file_path)?;
+            self.readers.push(Mutex::new(rdr));
+        }
+        Ok(())
+    }
+
+    // run a function on a reader from pool, idle reader is preferred
+    fn with_reader<F, T>(&self, f: F) -> Result<T>
+    where
+        F: FnOnce(&Reader) -> Result<T>,
+    {
+        let start = self.next_reader.fetch_add(1, Ordering::Relaxed);
+        let cnt = self.readers.len();
+        for i in 0..cnt {
+            if let Ok(rdr) = self.readers[(start + i) % cnt].try_lock() {
+                return f(&rdr);
+            }
+        }
+
+        // all readers are busy, wait for one of them
+        let rdr = self.readers[start % cnt].lock().unwrap();
+        f(&rdr)
+    }
+
+    // run a statement of begin, commit or rollback transaction
+    #[inline]
+    fn run_trans_stmt(&mut self, stmt_idx: usize) -> Result<()> {
+        let stmt = self.stmts[stmt_idx];
+        let ret = reset_stmt(stmt).and_then(|_| run_dml(stmt));
+        self.in_trans = unsafe { ffi::sqlite3_get_autocommit(self.db) } == 0;
+        ret
+    }
+
+    // start transaction for buffered updates if it is not started yet
+    #[inline]
+    fn begin_trans(&mut self) -> Result<()> {
+        if self.in_trans {
+            return Ok(());
+        }
+        self.run_trans_stmt(15)
+    }
+
+    // commit buffered updates if there are any
+    #[inline]
+    fn commit_trans(&mut self) -> Result<()> {
+        if !self.in_trans {
+            return Ok(());
+        }
+        self.run_trans_stmt(16)
+    }
+
     // prepare and cache all sql statements
     fn prepare_stmts(&mut self) -> Result<()> {
         // check if all statements are prepared
-        if self.stmts.len() == 14 {
+        if self.stmts.len() == Self::STMT_CNT {
             return Ok(());
         }
 
@@ -261,6 +616,62 @@ impl SqliteStorage {
         ",
             Self::TBL_BLOCKS
         ))?;
+        self.prepare_sql(format!(
+            "
+            SELECT blk_idx, data FROM {}
+            WHERE blk_idx >= ? AND blk_idx < ?
+            ORDER BY blk_idx
+        ",
+            Self::TBL_BLOCKS
+        ))?;
+
+        // transaction sql
+        self.prepare_sql("BEGIN".to_string())?;
+        self.prepare_sql("COMMIT".to_string())?;
+        self.prepare_sql("ROLLBACK".to_string())?;
+
+        Ok(())
+    }
+
+    // run a function in its own transaction, roll back if it failed,
+    // buffered updates are committed before that
+    fn run_in_trans<F>(&mut self, f: F) -> Result<()>
+    where
+        F: FnOnce(&mut Self) -> Result<()>,
+    {
+        self.commit_trans()?;
+        self.run_trans_stmt(15)?;
+
+        match f(self) {
+            Ok(_) => self.run_trans_stmt(16),
+            Err(err) => {
+                let _ = self.run_trans_stmt(17);
+                Err(err)
+            }
+        }
+    }
+
+    // read blocks in a span on main connection
+    #[inline]
+    fn select_blocks(&self, dst: &mut [u8], span: Span) -> Result<()> {
+        select_blocks(self.stmts[11], self.stmts[14], dst, span)
+    }
+
+    // insert blocks in a span
+    fn insert_blocks(&self, span: Span, mut blks: &[u8]) -> Result<()> {
+        let stmt = self.stmts[12];
+
+        for blk_idx in span {
+            // reset statement and binding
+            reset_stmt(stmt)?;
+
+            // bind parameters and run sql
+            bind_int(stmt, 1, blk_idx)?;
+            bind_blob(stmt, 2, &blks[..BLK_SIZE])?;
+            run_dml(stmt)?;
+
+            blks = &blks[BLK_SIZE..];
+        }
 
         Ok(())
     }
@@ -311,26 +722,13 @@ impl Storable for SqliteStorage {
     }
 
     fn connect(&mut self, _force: bool) -> Result<()> {
-        let result = unsafe {
-            ffi::sqlite3_open_v2(
-                self.file_path.as_ptr(),
-                &mut self.db,
-                ffi::SQLITE_OPEN_READWRITE
-                    | ffi::SQLITE_OPEN_CREATE
-                    | ffi::SQLITE_OPEN_FULLMUTEX,
-                ptr::null(),
-            )
-        };
-        if result != ffi::SQLITE_OK {
-            let err = ffi::Error::new(result);
-            if !self.db.is_null() {
-                unsafe { ffi::sqlite3_close(self.db) };
-                self.db = ptr::null_mut();
-            }
-            return Err(Error::from(err));
-        }
-
-        Ok(())
+        self.db = open_db(
+            &self.file_path,
+            ffi::SQLITE_OPEN_READWRITE
+                | ffi::SQLITE_OPEN_CREATE
+                | ffi::SQLITE_OPEN_FULLMUTEX,
+        )?;
+        self.set_pragmas()
     }
 
     fn init(&mut self, _crypto: Crypto, _key: Key) -> Result<()> {
@@ -363,26 +761,18 @@ impl Storable for SqliteStorage {
             Self::TBL_ADDRESSES,
             Self::TBL_BLOCKS
         );
-        let sql = CString::new(sql).unwrap();
-        let result = unsafe {
-            ffi::sqlite3_exec(
-                self.db,
-                sql.as_ptr(),
-                None,
-                ptr::null_mut(),
-                ptr::null_mut(),
-            )
-        };
-        check_result(result)?;
+        exec_sql(self.db, &sql)?;
 
         self.prepare_stmts()?;
-        self.lock_repo(false)
+        self.lock_repo(false)?;
+        self.open_readers()
     }
 
     #[inline]
     fn open(&mut self, _crypto: Crypto, _key: Key, force: bool) -> Result<()> {
         self.prepare_stmts()?;
-        self.lock_repo(force)
+        self.lock_repo(force)?;
+        self.open_readers()
     }
 
     fn get_super_block(&mut self, suffix: u64) -> Result<Vec<u8>> {
@@ -404,7 +794,10 @@ impl Storable for SqliteStorage {
         // bind parameters and run sql
         bind_int(stmt, 1, suffix as usize)?;
         bind_blob(stmt, 2, super_blk)?;
-        run_dml(stmt)
+        run_dml(stmt)?;
+
+        // super block must be persistent, commit it with buffered updates
+        self.commit_trans()
     }
 
     fn get_wal(&mut self, id: &Eid) -> Result<Vec<u8>> {
@@ -425,10 +818,14 @@ impl Storable for SqliteStorage {
         let id_str = CString::new(id.to_string()).unwrap();
         bind_id(stmt, 1, &id_str)?;
         bind_blob(stmt, 2, wal)?;
-        run_dml(stmt)
+        run_dml(stmt)?;
+
+        // wal must be persistent, commit it with buffered updates
+        self.commit_trans()
     }
 
     fn del_wal(&mut self, id: &Eid) -> Result<()> {
+        self.begin_trans()?;
         let stmt = self.stmts[7];
         reset_stmt(stmt)?;
 
@@ -449,6 +846,7 @@ impl Storable for SqliteStorage {
     }
 
     fn put_address(&mut self, id: &Eid, addr: &[u8]) -> Result<()> {
+        self.begin_trans()?;
         let stmt = self.stmts[9];
         reset_stmt(stmt)?;
 
@@ -460,6 +858,7 @@ impl Storable for SqliteStorage {
     }
 
     fn del_address(&mut self, id: &Eid) -> Result<()> {
+        self.begin_trans()?;
         let stmt = self.stmts[10];
         reset_stmt(stmt)?;
 
@@ -469,44 +868,69 @@ impl Storable for SqliteStorage {
         run_dml(stmt)
     }
 
+    #[inline]
     fn get_blocks(&mut self, dst: &mut [u8], span: Span) -> Result<()> {
-        let stmt = self.stmts[11];
-
-        let mut read = 0;
-        for blk_idx in span {
-            // reset statement and binding
-            reset_stmt(stmt)?;
-
-            // bind parameters and run sql
-            bind_int(stmt, 1, blk_idx)?;
-            let blk = run_select_blob(stmt)?;
-            assert_eq!(blk.len(), BLK_SIZE);
-            dst[read..read + BLK_SIZE].copy_from_slice(&blk);
-            read += BLK_SIZE;
-        }
-
-        Ok(())
+        self.select_blocks(dst, span)
     }
 
-    fn put_blocks(&mut self, span: Span, mut blks: &[u8]) -> Result<()> {
-        let stmt = self.stmts[12];
+    #[inline]
+    fn can_read_shared(&self) -> bool {
+        !self.readers.is_empty()
+    }
 
-        for blk_idx in span {
-            // reset statement and binding
-            reset_stmt(stmt)?;
+    // blocks are always committed when they are written, so they can be
+    // read from the read-only connections
+    #[inline]
+    fn get_blocks_shared(&self, dst: &mut [u8], span: Span) -> Result<()> {
+        self.with_reader(|rdr| rdr.read_blocks(dst, span))
+    }
 
-            // bind parameters and run sql
-            bind_int(stmt, 1, blk_idx)?;
-            bind_blob(stmt, 2, &blks[..BLK_SIZE])?;
-            run_dml(stmt)?;
+    fn get_blocks_batch_shared(
+        &self,
+        blks: &mut [(Span, &mut [u8])],
+    ) -> Result<()> {
+        self.with_reader(|rdr| {
+            for (span, dst) in blks.iter_mut() {
+                rdr.read_blocks(dst, *span)?;
+            }
+            Ok(())
+        })
+    }
 
-            blks = &blks[BLK_SIZE..];
+    fn get_blocks_batch(
+        &mut self,
+        blks: &mut [(Span, &mut [u8])],
+    ) -> Result<()> {
+        // read through the read-only connections if there are any, an
+        // explicit transaction on main connection would commit the
+        // buffered updates
+        if self.can_read_shared() {
+            return self.get_blocks_batch_shared(blks);
+        }
+        for (span, dst) in blks.iter_mut() {
+            self.select_blocks(dst, *span)?;
         }
-
         Ok(())
     }
 
+    #[inline]
+    fn put_blocks(&mut self, span: Span, blks: &[u8]) -> Result<()> {
+        self.put_blocks_batch(&[(span, blks)])
+    }
+
+    fn put_blocks_batch(&mut self, blks: &[(Span, &[u8])]) -> Result<()> {
+        // insert all blocks in one transaction, otherwise each insertion
+        // is committed separately
+        self.run_in_trans(|ss| {
+            for (span, src) in blks.iter() {
+                ss.insert_blocks(*span, src)?;
+            }
+            Ok(())
+        })
+    }
+
     fn del_blocks(&mut self, span: Span) -> Result<()> {
+        self.begin_trans()?;
         let stmt = self.stmts[13];
 
         for blk_idx in span {
@@ -523,7 +947,7 @@ impl Storable for SqliteStorage {
 
     #[inline]
     fn flush(&mut self) -> Result<()> {
-        Ok(())
+        self.commit_trans()
     }
 
     #[inline]
@@ -544,6 +968,12 @@ impl Storable for SqliteStorage {
 
 impl Drop for SqliteStorage {
     fn drop(&mut self) {
+        // close readers and commit buffered updates
+        self.readers.clear();
+        if self.in_trans {
+            let _ = self.commit_trans();
+        }
+
         // release repo lock and ignore the result
         if self.is_attached {
             let stmt = self.stmts[2];
@@ -577,6 +1007,8 @@ impl Debug for SqliteStorage {
     fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
         f.debug_struct("SqliteStorage")
             .field("file_path", &self.file_path)
+            .field("opts", &self.opts)
+            .field("readers", &self.readers.len())
             .finish()
     }
 }
@@ -599,14 +1031,15 @@ mod tests {
         init_env();
         let tmpdir = TempDir::new("zbox_test").expect("Create temp dir failed");
         let dir = tmpdir.path().join("storage.db");
-        let mut ss = SqliteStorage::new(dir.to_str().unwrap());
+        let mut ss = SqliteStorage::new(dir.to_str().unwrap()).unwrap();
 
         ss.connect(false).unwrap();
         ss.init(Crypto::default(), Key::new_empty()).unwrap();
 
         let id = Eid::new();
         let buf = vec![1, 2, 3];
-        let blks = vec![42u8; BLK_SIZE * 3];
+        let mut blks = vec![0u8; BLK_SIZE * 3];
+        Crypto::random_buf(&mut blks);
         let mut dst = vec![0u8; BLK_SIZE * 3];
 
         // super block
@@ -633,8 +1066,24 @@ mod tests {
         ss.put_blocks(span, &blks).unwrap();
         ss.get_blocks(&mut dst, span).unwrap();
         assert_eq!(&dst[..], &blks[..]);
+        {
+            let (dst1, dst2) = dst.split_at_mut(BLK_SIZE);
+            let mut batch = [(Span::new(2, 1), dst1), (Span::new(0, 2), dst2)];
+            ss.get_blocks_batch(&mut batch).unwrap();
+        }
+        assert_eq!(&dst[..BLK_SIZE], &blks[BLK_SIZE * 2..]);
+        assert_eq!(&dst[BLK_SIZE..], &blks[..BLK_SIZE * 2]);
         ss.del_blocks(Span::new(1, 2)).unwrap();
         assert_eq!(ss.get_blocks(&mut dst, span).unwrap_err(), Error::NotFound);
+        let mut blks2 = vec![0u8; BLK_SIZE * 3];
+        Crypto::random_buf(&mut blks2);
+        ss.put_blocks_batch(&[
+            (Span::new(3, 1), &blks2[..BLK_SIZE]),
+            (Span::new(4, 2), &blks2[BLK_SIZE..]),
+        ])
+        .unwrap();
+        ss.get_blocks(&mut dst, Span::new(3, 3)).unwrap();
+        assert_eq!(&dst[..], &blks2[..]);
         assert_eq!(
             ss.get_blocks(&mut dst[..BLK_SIZE], Span::new(1, 1))
                 .unwrap_err(),
@@ -648,7 +1097,7 @@ mod tests {
 
         // re-open
         drop(ss);
-        let mut ss = SqliteStorage::new(dir.to_str().unwrap());
+        let mut ss = SqliteStorage::new(dir.to_str().unwrap()).unwrap();
         ss.connect(false).unwrap();
         ss.open(Crypto::default(), Key::new_empty(), false).unwrap();
 
@@ -666,4 +1115,162 @@ mod tests {
             Error::NotFound
         );
     }
+
+    #[test]
+    fn sqlite_blocks_batch() {
+        init_env();
+        let tmpdir = TempDir::new("zbox_test").expect("Create temp dir failed");
+        let dir = tmpdir.path().join("storage.db");
+        let mut ss = SqliteStorage::new(dir.to_str().unwrap()).unwrap();
+        ss.connect(false).unwrap();
+        ss.init(Crypto::default(), Key::new_empty()).unwrap();
+
+        let mut blks = vec![0u8; BLK_SIZE * 6];
+        Crypto::random_buf(&mut blks);
+
+        // batch round trip
+        ss.put_blocks_batch(&[
+            (Span::new(0, 1), &blks[..BLK_SIZE]),
+            (Span::new(5, 2), &blks[BLK_SIZE..BLK_SIZE * 3]),
+            (Span::new(2, 3), &blks[BLK_SIZE * 3..]),
+        ])
+        .unwrap();
+        let mut dst = vec![0u8; BLK_SIZE * 6];
+        {
+            let (dst1, rest) = dst.split_at_mut(BLK_SIZE * 3);
+            let (dst2, dst3) = rest.split_at_mut(BLK_SIZE * 2);
+            let mut batch = [
+                (Span::new(2, 3), dst1),
+                (Span::new(5, 2), dst2),
+                (Span::new(0, 1), dst3),
+            ];
+            ss.get_blocks_batch(&mut batch).unwrap();
+        }
+        assert_eq!(&dst[..BLK_SIZE * 3], &blks[BLK_SIZE * 3..]);
+        assert_eq!(
+            &dst[BLK_SIZE * 3..BLK_SIZE * 5],
+            &blks[BLK_SIZE..BLK_SIZE * 3]
+        );
+        assert_eq!(&dst[BLK_SIZE * 5..], &blks[..BLK_SIZE]);
+
+        // failed batch leaves nothing written, block 0 already exists so
+        // the batch fails after block 10 and 11 are inserted
+        assert!(ss
+            .put_blocks_batch(&[
+                (Span::new(10, 2), &blks[..BLK_SIZE * 2]),
+                (Span::new(0, 1), &blks[BLK_SIZE * 2..BLK_SIZE * 3]),
+            ])
+            .is_err());
+        assert_eq!(
+            ss.get_blocks(&mut dst[..BLK_SIZE], Span::new(10, 1))
+                .unwrap_err(),
+            Error::NotFound
+        );
+        assert_eq!(
+            ss.get_blocks(&mut dst[..BLK_SIZE], Span::new(11, 1))
+                .unwrap_err(),
+            Error::NotFound
+        );
+        ss.get_blocks(&mut dst[..BLK_SIZE], Span::new(0, 1))
+            .unwrap();
+        assert_eq!(&dst[..BLK_SIZE], &blks[..BLK_SIZE]);
+
+        // storage is still usable after the failed batch
+        ss.put_blocks_batch(&[(Span::new(10, 2), &blks[..BLK_SIZE * 2])])
+            .unwrap();
+        ss.get_blocks(&mut dst[..BLK_SIZE * 2], Span::new(10, 2))
+            .unwrap();
+        assert_eq!(&dst[..BLK_SIZE * 2], &blks[..BLK_SIZE * 2]);
+    }
+
+    #[test]
+    fn sqlite_parse_loc() {
+        let (path, opts) = parse_loc("/tmp/db").unwrap();
+        assert_eq!(path, "/tmp/db");
+        assert_eq!(opts, Opts::default());
+
+        let (path, opts) = parse_loc(
+            "/tmp/db?journal_mode=wal&synchronous=normal&cache_size=8mb",
+        )
+        .unwrap();
+        assert_eq!(path, "/tmp/db");
+        assert!(opts.wal);
+        assert_eq!(opts.synchronous, Some("normal".to_string()));
+        assert_eq!(opts.cache_size, Some(8 * 1024));
+        assert_eq!(opts.readers, DEFAULT_READERS);
+
+        let (_, opts) =
+            parse_loc("/tmp/db?journal_mode=wal&readers=0").unwrap();
+        assert_eq!(opts.readers, 0);
+
+        assert!(parse_loc(":memory:").is_ok());
+        assert_eq!(
+            parse_loc(":memory:?journal_mode=wal").unwrap_err(),
+            Error::InvalidUri
+        );
+        assert_eq!(
+            parse_loc("/tmp/db?journal_mode=xxx").unwrap_err(),
+            Error::InvalidUri
+        );
+        assert_eq!(
+            parse_loc("/tmp/db?cache_size=8").unwrap_err(),
+            Error::InvalidUri
+        );
+
+        // path contains '?'
+        let (path, opts) =
+            parse_loc("/tmp/a?b/db?journal_mode=wal&readers=0").unwrap();
+        assert_eq!(path, "/tmp/a?b/db");
+        assert!(opts.wal);
+        assert_eq!(opts.readers, 0);
+        let (path, opts) = parse_loc("/tmp/db?foo=1").unwrap();
+        assert_eq!(path, "/tmp/db?foo=1");
+        assert_eq!(opts, Opts::default());
+        assert_eq!(parse_loc("/tmp/db?foo").unwrap().0, "/tmp/db?foo");
+
+        // mistyped parameters
+        assert_eq!(
+            parse_loc("/tmp/db?journal_mode=wal&reader=2").unwrap_err(),
+            Error::InvalidUri
+        );
+    }
+
+    #[test]
+    fn sqlite_shared_read() {
+        init_env();
+        let tmpdir = TempDir::new("zbox_test").expect("Create temp dir failed");
+        let dir = tmpdir.path().join("storage.db");
+        let loc = format!("{}?journal_mode=wal&readers=2", dir.display());
+        let mut ss = SqliteStorage::new(&loc).unwrap();
+        ss.connect(false).unwrap();
+        ss.init(Crypto::default(), Key::new_empty()).unwrap();
+        assert!(ss.can_read_shared());
+
+        let mut blks = vec![0u8; BLK_SIZE * 3];
+        Crypto::random_buf(&mut blks);
+        ss.put_blocks(Span::new(0, 3), &blks).unwrap();
+
+        let mut dst = vec![0u8; BLK_SIZE * 3];
+        ss.get_blocks_shared(&mut dst, Span::new(0, 3)).unwrap();
+        assert_eq!(&dst[..], &blks[..]);
+        ss.get_blocks_shared(&mut dst[..BLK_SIZE], Span::new(1, 1))
+            .unwrap();
+        assert_eq!(&dst[..BLK_SIZE], &blks[BLK_SIZE..BLK_SIZE * 2]);
+        {
+            let (dst1, dst2) = dst.split_at_mut(BLK_SIZE);
+            let mut batch = [(Span::new(2, 1), dst1), (Span::new(0, 2), dst2)];
+            ss.get_blocks_batch(&mut batch).unwrap();
+        }
+        assert_eq!(&dst[..BLK_SIZE], &blks[BLK_SIZE * 2..]);
+        assert_eq!(&dst[BLK_SIZE..], &blks[..BLK_SIZE * 2]);
+
+        // buffered deletion is visible to readers after flush
+        ss.del_blocks(Span::new(1, 1)).unwrap();
+        ss.flush().unwrap();
+        assert_eq!(
+            ss.get_blocks_shared(&mut dst[..BLK_SIZE], Span::new(1, 1))
+                .unwrap_err(),
+            Error::NotFound
+        );
+    }
 }
@@ -1,20 +1,29 @@
 use std::cmp::min;
+use std::collections::{HashMap, VecDeque};
 use std::error::Error as StdError;
 use std::fmt::{self, Debug, Display};
-use std::io::{Error as IoError, ErrorKind, Read, Result as IoResult, Write};
-use std::sync::{Arc, RwLock, Weak};
+use std::io::{
+    Error as IoError, ErrorKind, Read, Result as IoResult, Seek, SeekFrom,
+    Write,
+};
+use std::mem;
+use std::sync::{Arc, Mutex, RwLock, Weak};
 
 use rmp_serde::{Deserializer, Serializer};
 use serde::{Deserialize, Serialize};
 
+use super::metered::MeteredStorage;
 use super::{DummyStorage, Storable};
+use base::buf_pool::{BufPool, BufPoolStats, PoolBuf};
 use base::crypto::{Cipher, Cost, Crypto, Key};
 use base::lru::{CountMeter, Lru, Meter, PinChecker};
+use base::metrics::{Metrics, MetricsRef};
+use base::thread_pool::{JobResult, ThreadPool};
 use base::utils::align_ceil_chunk;
 use base::IntoRef;
 use error::{Error, Result};
 use trans::{Eid, Finish};
-use volume::address::Addr;
+use volume::address::{Addr, Span};
 use volume::{Allocator, AllocatorRef, BLKS_PER_FRAME, BLK_SIZE, FRAME_SIZE};
 
 // parse storage part in uri
@@ -45,8 +54,7 @@ fn parse_uri(uri: &str) -> Result<Box<dyn Storable>> {
         "file" => {
             #[cfg(feature = "storage-file")]
             {
-                let path = std::path::Path::new(loc);
-                let depot = super::file::FileStorage::new(path);
+                let depot = super::file::FileStorage::from_loc(loc)?;
                 Ok(Box::new(depot))
             }
             #[cfg(not(feature = "storage-file"))]
@@ -57,7 +65,7 @@ fn parse_uri(uri: &str) -> Result<Box<dyn Storable>> {
         "sqlite" => {
             #[cfg(feature = "storage-sqlite")]
             {
-                let depot = super::sqlite::SqliteStorage::new(loc);
+                let depot = super::sqlite::SqliteStorage::new(loc)?;
                 Ok(Box::new(depot))
             }
             #[cfg(not(feature = "storage-sqlite"))]
@@ -102,34 +110,65 @@ fn parse_uri(uri: &str) -> Result<Box<dyn Storable>> {
     }
 }
 
-// frame cache meter, measured by frame byte size
+// frame cache meter, measured by the pooled buffer size rather than frame
+// length, as a short frame still holds a whole pool buffer
 #[derive(Debug, Default)]
 struct FrameCacheMeter;
 
-impl Meter<Vec<u8>> for FrameCacheMeter {
+impl Meter<Arc<PoolBuf>> for FrameCacheMeter {
     #[inline]
-    fn measure(&self, item: &Vec<u8>) -> isize {
-        item.len() as isize
+    fn measure(&self, item: &Arc<PoolBuf>) -> isize {
+        item.capacity() as isize
     }
 }
 
+// decrypted frame cache, frames are shared with readers so they can be
+// copied out without holding the cache lock, evicted frames go back to
+// buffer pool once no reader is using them
+type FrameCache =
+    Lru<usize, Arc<PoolBuf>, FrameCacheMeter, PinChecker<Arc<PoolBuf>>>;
+
+// entity address cache
+type AddrCache = Lru<Eid, Addr, CountMeter<Addr>, PinChecker<Addr>>;
+
 /// Storage
+///
+/// Readers only need shared access to storage, so the depot and caches
+/// are behind their own locks. Block read, decryption and copy out are
+/// done outside of those locks if the depot supports shared read.
 pub struct Storage {
     // underlying storage layer
-    depot: Box<dyn Storable>,
+    depot: RwLock<Box<dyn Storable>>,
 
     // block allocator
     allocator: AllocatorRef,
 
-    // crypto context
+    // crypto context, key is shared with frame encryption workers
     crypto: Crypto,
-    key: Key,
+    key: Arc<Key>,
 
     // decrypted frame cache, key is the begin block index
-    frame_cache: Lru<usize, Vec<u8>, FrameCacheMeter, PinChecker<Vec<u8>>>,
+    frame_cache: Mutex<FrameCache>,
 
     // entity address cache
-    addr_cache: Lru<Eid, Addr, CountMeter<Addr>, PinChecker<Addr>>,
+    addr_cache: Mutex<AddrCache>,
+
+    // frame buffer pool shared by readers, writers and frame cache
+    buf_pool: Arc<BufPool>,
+
+    // frame encryption workers for pipelined writer, None means frames
+    // are encrypted synchronously on the writing thread
+    encrypt_pool: Option<Arc<ThreadPool>>,
+
+    // maximum read-ahead window in frames, number of sequentially read
+    // frames to trigger read-ahead and its workers, None means read-ahead
+    // is disabled
+    read_ahead: usize,
+    read_ahead_trigger: usize,
+    read_ahead_pool: Option<Arc<ThreadPool>>,
+
+    // runtime metrics shared with the components using this storage
+    metrics: MetricsRef,
 }
 
 impl Storage {
@@ -144,20 +183,46 @@ impl Storage {
     // address cache size
     const ADDRESS_CACHE_SIZE: usize = 64;
 
+    // maximum number of read-ahead workers
+    const MAX_READ_AHEAD_WORKERS: usize = 4;
+
+    // default number of sequentially read frames to trigger read-ahead
+    const READ_AHEAD_TRIGGER: usize = 2;
+
+    // maximum number of free frame buffers kept in buffer pool
+    const BUF_POOL_SIZE: usize = 64;
+
     pub fn new(uri: &str) -> Result<Self> {
-        let depot = parse_uri(uri)?;
-        let frame_cache = Lru::new(Self::FRAME_CACHE_SIZE);
+        let metrics = Metrics::new_ref();
+        let depot = MeteredStorage::new(parse_uri(uri)?, &metrics);
+        let mut frame_cache = Lru::new(Self::FRAME_CACHE_SIZE);
+        frame_cache.set_counters(&metrics.frame_cache);
+        let mut addr_cache = Lru::new(Self::ADDRESS_CACHE_SIZE);
+        addr_cache.set_counters(&metrics.addr_cache);
 
         Ok(Storage {
-            depot,
+            depot: RwLock::new(Box::new(depot)),
             allocator: Allocator::new().into_ref(),
             crypto: Crypto::default(),
-            key: Key::new_empty(),
-            frame_cache,
-            addr_cache: Lru::new(Self::ADDRESS_CACHE_SIZE),
+            key: Arc::new(Key::new_empty()),
+            frame_cache: Mutex::new(frame_cache),
+            addr_cache: Mutex::new(addr_cache),
+            buf_pool: BufPool::new(FRAME_SIZE, Self::BUF_POOL_SIZE),
+            encrypt_pool: None,
+            read_ahead: 0,
+            read_ahead_trigger: Self::READ_AHEAD_TRIGGER,
+            read_ahead_pool: None,
+            metrics,
         })
     }
 
+    // get depot for exclusive access, no locking is needed here as we
+    // already have exclusive access to storage
+    #[inline]
+    fn depot_mut(&mut self) -> &mut dyn Storable {
+        &mut **self.depot.get_mut().unwrap()
+    }
+
     #[inline]
     pub fn get_key(&self) -> &Key {
         &self.key
@@ -165,21 +230,22 @@ impl Storage {
 
     #[inline]
     pub fn exists(&self) -> Result<bool> {
-        self.depot.exists()
+        self.depot.read().unwrap().exists()
     }
 
     #[inline]
     pub fn connect(&mut self, force: bool) -> Result<()> {
-        self.depot.connect(force)
+        self.depot_mut().connect(force)
     }
 
     pub fn init(&mut self, cost: Cost, cipher: Cipher) -> Result<()> {
         // create crypto and master key
         self.crypto = Crypto::new(cost, cipher)?;
-        self.key = Crypto::gen_master_key();
+        self.key = Arc::new(Crypto::gen_master_key());
 
         // initialise depot
-        self.depot.init(self.crypto.clone(), self.key.derive(0))
+        let (crypto, key) = (self.crypto.clone(), self.key.derive(0));
+        self.depot_mut().init(crypto, key)
     }
 
     pub fn open(
@@ -190,11 +256,11 @@ impl Storage {
         force: bool,
     ) -> Result<()> {
         self.crypto = Crypto::new(cost, cipher)?;
-        self.key = key;
+        self.key = Arc::new(key);
 
         // open depot
-        self.depot
-            .open(self.crypto.clone(), self.key.derive(0), force)
+        let (crypto, key) = (self.crypto.clone(), self.key.derive(0));
+        self.depot_mut().open(crypto, key, force)
     }
 
     #[inline]
@@ -202,9 +268,45 @@ impl Storage {
         self.allocator.clone()
     }
 
+    #[inline]
+    pub fn metrics(&self) -> MetricsRef {
+        self.metrics.clone()
+    }
+
+    // set number of frame encryption workers, 0 means disable pipelined
+    // writing
+    pub fn set_encrypt_workers(&mut self, workers: usize) -> Result<()> {
+        self.encrypt_pool = if workers > 0 {
+            let pool = ThreadPool::new("zbox-encrypt", workers)?;
+            Some(Arc::new(pool))
+        } else {
+            None
+        };
+        Ok(())
+    }
+
+    // set maximum read-ahead window in frames, 0 means disable read-ahead,
+    // and number of sequentially read frames to trigger it
+    pub fn set_read_ahead(
+        &mut self,
+        window: usize,
+        trigger: usize,
+    ) -> Result<()> {
+        self.read_ahead = window;
+        self.read_ahead_trigger = trigger;
+        self.read_ahead_pool = if window > 0 {
+            let workers = min(window, Self::MAX_READ_AHEAD_WORKERS);
+            let pool = ThreadPool::new("zbox-read-ahead", workers)?;
+            Some(Arc::new(pool))
+        } else {
+            None
+        };
+        Ok(())
+    }
+
     #[inline]
     pub fn get_super_block(&mut self, suffix: u64) -> Result<Vec<u8>> {
-        self.depot.get_super_block(suffix)
+        self.depot_mut().get_super_block(suffix)
     }
 
     #[inline]
@@ -213,24 +315,29 @@ impl Storage {
         super_blk: &[u8],
         suffix: u64,
     ) -> Result<()> {
-        self.depot.put_super_block(super_blk, suffix)
+        self.depot_mut().put_super_block(super_blk, suffix)
     }
 
     // read entity address from depot and save to address cache
-    fn get_address(&mut self, id: &Eid) -> Result<Addr> {
+    fn get_address(&self, id: &Eid) -> Result<Addr> {
         // get from address cache first
-        if let Some(addr) = self.addr_cache.get_refresh(id) {
-            return Ok(addr.clone());
+        {
+            let mut addr_cache = self.addr_cache.lock().unwrap();
+            if let Some(addr) = addr_cache.get_refresh(id) {
+                return Ok(addr.clone());
+            }
         }
 
         // if not in the cache, load if from depot
-        let buf = self.depot.get_address(id)?;
+        let buf = self.depot.write().unwrap().get_address(id)?;
         let buf = self.crypto.decrypt(&buf, &self.key)?;
+        self.metrics.add_decrypted(buf.len());
         let mut de = Deserializer::new(&buf[..]);
         let addr: Addr = Deserialize::deserialize(&mut de)?;
 
         // and then insert into address cache
-        self.addr_cache.insert(id.clone(), addr.clone());
+        let mut addr_cache = self.addr_cache.lock().unwrap();
+        addr_cache.insert(id.clone(), addr.clone());
 
         Ok(addr)
     }
@@ -240,11 +347,13 @@ impl Storage {
         // serialize address and encrypt address
         let mut buf = Vec::new();
         addr.serialize(&mut Serializer::new(&mut buf))?;
+        self.metrics.add_encrypted(buf.len());
         let buf = self.crypto.encrypt(&buf, &self.key)?;
 
         // write to depot and remove address from cache
-        self.depot.put_address(id, &buf)?;
-        self.addr_cache.insert(id.clone(), addr.clone());
+        self.depot_mut().put_address(id, &buf)?;
+        let addr_cache = self.addr_cache.get_mut().unwrap();
+        addr_cache.insert(id.clone(), addr.clone());
 
         Ok(())
     }
@@ -256,7 +365,7 @@ impl Storage {
             let blk_cnt = loc_span.span.cnt;
 
             // delete blocks
-            self.depot.del_blocks(loc_span.span)?;
+            self.depot_mut().del_blocks(loc_span.span)?;
 
             let mut blk_idx = loc_span.span.begin;
             let end_idx = inaddr_idx + blk_cnt;
@@ -264,7 +373,7 @@ impl Storage {
             while inaddr_idx < end_idx {
                 let offset = inaddr_idx % BLKS_PER_FRAME;
                 if offset == 0 {
-                    self.frame_cache.remove(&blk_idx);
+                    self.frame_cache.get_mut().unwrap().remove(&blk_idx);
                 }
                 let step = min(end_idx - inaddr_idx, BLKS_PER_FRAME - offset);
                 inaddr_idx += step;
@@ -276,7 +385,7 @@ impl Storage {
 
     #[inline]
     pub fn del_wal(&mut self, id: &Eid) -> Result<()> {
-        self.depot.del_wal(id)
+        self.depot_mut().del_wal(id)
     }
 
     // delete an entity, including data and address
@@ -292,8 +401,8 @@ impl Storage {
         self.remove_address_blocks(&addr)?;
 
         // remove address
-        self.depot.del_address(id)?;
-        self.addr_cache.remove(id);
+        self.depot_mut().del_address(id)?;
+        self.addr_cache.get_mut().unwrap().remove(id);
 
         Ok(())
     }
@@ -301,12 +410,55 @@ impl Storage {
     // flush underlying storage
     #[inline]
     pub fn flush(&mut self) -> Result<()> {
-        self.depot.flush()
+        self.depot_mut().flush()
     }
 
     #[inline]
     pub fn destroy(&mut self) -> Result<()> {
-        self.depot.destroy()
+        self.depot_mut().destroy()
+    }
+
+    // get frame buffer pool statistics
+    #[inline]
+    pub fn buf_pool_stats(&self) -> BufPoolStats {
+        self.buf_pool.stats()
+    }
+
+    // get decrypted frame from frame cache
+    #[inline]
+    fn get_cached_frame(&self, frm_key: usize) -> Option<Arc<PoolBuf>> {
+        let mut frame_cache = self.frame_cache.lock().unwrap();
+        frame_cache.get_refresh(&frm_key).cloned()
+    }
+
+    // insert decrypted frame to frame cache
+    #[inline]
+    fn cache_frame(&self, frm_key: usize, dec_frame: Arc<PoolBuf>) {
+        let mut frame_cache = self.frame_cache.lock().unwrap();
+        frame_cache.insert(frm_key, dec_frame);
+    }
+
+    // read blocks of a frame from depot in one batch, using shared read if
+    // it is supported by depot
+    fn get_frame_blocks(&self, dst: &mut [u8], frm_addr: &Addr) -> Result<()> {
+        // split destination for each block span of the frame
+        let mut blks = Vec::with_capacity(frm_addr.list.len());
+        let mut rest = dst;
+        for loc_span in frm_addr.iter() {
+            let (buf, tail) = rest.split_at_mut(loc_span.span.bytes_len());
+            blks.push((loc_span.span, buf));
+            rest = tail;
+        }
+
+        {
+            let depot = self.depot.read().unwrap();
+            if depot.can_read_shared() {
+                return depot.get_blocks_batch_shared(&mut blks);
+            }
+        }
+
+        let mut depot = self.depot.write().unwrap();
+        depot.get_blocks_batch(&mut blks)
     }
 }
 
@@ -314,12 +466,18 @@ impl Default for Storage {
     #[inline]
     fn default() -> Self {
         Storage {
-            depot: Box::new(DummyStorage::default()),
+            depot: RwLock::new(Box::new(DummyStorage::default())),
             allocator: Allocator::default().into_ref(),
             crypto: Crypto::default(),
-            key: Key::new_empty(),
-            frame_cache: Lru::default(),
-            addr_cache: Lru::default(),
+            key: Arc::new(Key::new_empty()),
+            frame_cache: Mutex::new(Lru::new(0)),
+            addr_cache: Mutex::new(Lru::default()),
+            buf_pool: BufPool::new(FRAME_SIZE, Self::BUF_POOL_SIZE),
+            encrypt_pool: None,
+            read_ahead: 0,
+            read_ahead_trigger: Self::READ_AHEAD_TRIGGER,
+            read_ahead_pool: None,
+            metrics: Metrics::new_ref(),
         }
     }
 }
@@ -327,7 +485,7 @@ impl Default for Storage {
 impl Debug for Storage {
     fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
         f.debug_struct("Storage")
-            .field("depot", &self.depot)
+            .field("depot", &*self.depot.read().unwrap())
             .field("allocator", &self.allocator)
             .finish()
     }
@@ -336,7 +494,7 @@ impl Debug for Storage {
 impl Display for Storage {
     #[inline]
     fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
-        write!(f, "Storage({:?})", self.depot)
+        write!(f, "Storage({:?})", *self.depot.read().unwrap())
     }
 }
 
@@ -369,10 +527,11 @@ impl WalReader {
 impl Read for WalReader {
     fn read(&mut self, buf: &mut [u8]) -> IoResult<usize> {
         if self.wal.is_empty() {
-            let mut storage = self.storage.write().unwrap();
+            let storage = self.storage.read().unwrap();
 
             // read wal bytes from underlying storage layer
-            let wal = storage.depot.get_wal(&self.id).map_err(|err| {
+            let wal = storage.depot.write().unwrap().get_wal(&self.id);
+            let wal = wal.map_err(|err| {
                 if err == Error::NotFound {
                     IoError::new(ErrorKind::NotFound, "Wal not found")
                 } else {
@@ -383,6 +542,7 @@ impl Read for WalReader {
             // decrypt wal
             self.wal =
                 map_io_err!(storage.crypto.decrypt(&wal, &storage.key,))?;
+            storage.metrics.add_decrypted(self.wal.len());
         }
 
         let copy_len = min(self.wal.len() - self.read, buf.len());
@@ -394,6 +554,152 @@ impl Read for WalReader {
     }
 }
 
+// encrypted and decrypted frame buffers used by read-ahead
+type ReadAheadBufs = (PoolBuf, PoolBuf);
+
+// read a frame from depot and decrypt it, return decrypted length
+fn decrypt_frame(
+    storage: &Storage,
+    frame: &mut [u8],
+    dec_frame: &mut [u8],
+    frm_addr: &Addr,
+) -> Result<usize> {
+    storage.get_frame_blocks(frame, frm_addr)?;
+    let len = storage.crypto.decrypt_to(
+        dec_frame,
+        &frame[..frm_addr.len],
+        &storage.key,
+    )?;
+    storage.metrics.add_decrypted(len);
+    Ok(len)
+}
+
+// convert frame loading error to IO error
+fn to_io_err(err: Error) -> IoError {
+    if err == Error::NotFound {
+        IoError::new(ErrorKind::NotFound, "Blocks not found")
+    } else {
+        IoError::new(ErrorKind::Other, err.description())
+    }
+}
+
+// Sequential frame read-ahead
+//
+// Frames after the current one are read and decrypted in background.
+// The window starts from one frame and grows on every frame taken from
+// it until it reaches the maximum, so the buffered frames are bounded.
+struct ReadAhead {
+    pool: Arc<ThreadPool>,
+    window: usize,
+    max_window: usize,
+
+    // next frame index to be requested
+    next_idx: usize,
+
+    // requested frames which are not taken yet
+    requested: HashMap<usize, JobResult<Result<(ReadAheadBufs, usize)>>>,
+
+    // frame buffers are taken from pool
+    buf_pool: Arc<BufPool>,
+    dec_frame_size: usize,
+}
+
+impl ReadAhead {
+    fn new(
+        pool: &Arc<ThreadPool>,
+        max_window: usize,
+        buf_pool: &Arc<BufPool>,
+        dec_frame_size: usize,
+    ) -> Self {
+        ReadAhead {
+            pool: pool.clone(),
+            window: 1,
+            max_window,
+            next_idx: 0,
+            requested: HashMap::new(),
+            buf_pool: buf_pool.clone(),
+            dec_frame_size,
+        }
+    }
+
+    // request frames in the window after the specified frame
+    fn request(
+        &mut self,
+        frm_idx: usize,
+        addrs: &[Addr],
+        storage: &StorageRef,
+    ) {
+        if self.next_idx <= frm_idx {
+            self.next_idx = frm_idx + 1;
+        }
+        let end_idx = min(frm_idx + 1 + self.window, addrs.len());
+
+        while self.next_idx < end_idx {
+            let idx = self.next_idx;
+            let frm_addr = addrs[idx].clone();
+            let mut frame = BufPool::get(&self.buf_pool, FRAME_SIZE);
+            let mut dec_frame =
+                BufPool::get(&self.buf_pool, self.dec_frame_size);
+            let storage = storage.clone();
+
+            let result = self.pool.submit(move || {
+                let result = {
+                    let storage = storage.read().unwrap();
+                    decrypt_frame(
+                        &storage,
+                        &mut frame,
+                        &mut dec_frame,
+                        &frm_addr,
+                    )
+                };
+                result.map(|len| ((frame, dec_frame), len))
+            });
+            self.requested.insert(idx, result);
+
+            self.next_idx += 1;
+        }
+    }
+
+    // discard all the requested frames and shrink window back, frames still
+    // in flight will be discarded once they are finished
+    fn reset(&mut self) {
+        self.requested.clear();
+        self.window = 1;
+        self.next_idx = 0;
+    }
+
+    // take a requested frame, wait for it if it is not finished yet,
+    // return None if the frame was not requested
+    fn take(
+        &mut self,
+        frm_idx: usize,
+    ) -> Option<Result<(ReadAheadBufs, usize)>> {
+        let mut result = self.requested.remove(&frm_idx)?;
+
+        // grow window as reading is still sequential
+        self.window = min(self.window * 2, self.max_window);
+
+        // worker failed without sending the frame back
+        Some(result.wait().unwrap_or_else(|| {
+            Err(Error::from(IoError::new(
+                ErrorKind::Other,
+                "Read-ahead worker failed",
+            )))
+        }))
+    }
+}
+
+impl Debug for ReadAhead {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        f.debug_struct("ReadAhead")
+            .field("pool", &self.pool)
+            .field("window", &self.window)
+            .field("max_window", &self.max_window)
+            .field("next_idx", &self.next_idx)
+            .finish()
+    }
+}
+
 /// Storage Reader
 #[derive(Debug)]
 pub struct Reader {
@@ -405,8 +711,11 @@ pub struct Reader {
     // entity length in storage
     ent_len: usize,
 
+    // entity decrypted length
+    dec_len: usize,
+
     // encrypted frame read from depot
-    frame: Vec<u8>,
+    frame: PoolBuf,
 
     // frame index
     frm_idx: usize,
@@ -415,40 +724,100 @@ pub struct Reader {
     frm_key: usize,
 
     // decrypted frame
-    dec_frame: Vec<u8>,
+    dec_frame: PoolBuf,
     dec_frame_len: usize,
 
+    // decrypted frame shared with frame cache
+    cached_frame: Option<Arc<PoolBuf>>,
+
+    // sequential read-ahead, only used for entity not using frame cache,
+    // and number of sequentially read frames to trigger it
+    read_ahead: Option<ReadAhead>,
+    read_ahead_trigger: usize,
+
+    // frame index where current sequential reading started
+    seq_begin: usize,
+
     // total decryped bytes read out so far
     read: usize,
+
+    // seek index saved with entity address
+    seek_index: Vec<u64>,
 }
 
 impl Reader {
     pub fn new(id: &Eid, storage: &StorageRef) -> Result<Self> {
-        let (addr, dec_frame_size) = {
-            let mut storage = storage.write().unwrap();
+        let (
+            mut addr,
+            dec_frame_size,
+            dec_last_len,
+            read_ahead,
+            read_ahead_trigger,
+            buf_pool,
+        ) = {
+            let storage = storage.read().unwrap();
             let addr = storage.get_address(id)?;
-            (addr, storage.crypto.decrypted_len(FRAME_SIZE))
+            let dec_frame_size = storage.crypto.decrypted_len(FRAME_SIZE);
+            let read_ahead = match storage.read_ahead_pool {
+                Some(ref pool)
+                    if addr.len >= Storage::FRAME_CACHE_THRESHOLD =>
+                {
+                    Some(ReadAhead::new(
+                        pool,
+                        storage.read_ahead,
+                        &storage.buf_pool,
+                        dec_frame_size,
+                    ))
+                }
+                _ => None,
+            };
+            let last_len = addr.len - (addr.len - 1) / FRAME_SIZE * FRAME_SIZE;
+            let dec_last_len = storage.crypto.decrypted_len(last_len);
+            (
+                addr,
+                dec_frame_size,
+                dec_last_len,
+                read_ahead,
+                storage.read_ahead_trigger,
+                storage.buf_pool.clone(),
+            )
         };
 
         // split address to frames and set the first frame key
+        let seek_index = mem::replace(&mut addr.seek_index, Vec::new());
         let addrs = addr.divide_to_frames();
         let frm_key = addrs[0].list[0].span.begin;
+        let dec_len = (addrs.len() - 1) * dec_frame_size + dec_last_len;
 
-        let mut rdr = Reader {
+        Ok(Reader {
             storage: storage.clone(),
             addrs,
             ent_len: addr.len,
-            frame: vec![0u8; FRAME_SIZE],
+            dec_len,
+            frame: BufPool::get(&buf_pool, FRAME_SIZE),
             frm_idx: 0,
             frm_key,
-            dec_frame: vec![0u8; dec_frame_size],
+            dec_frame: BufPool::get(&buf_pool, dec_frame_size),
             dec_frame_len: 0,
+            cached_frame: None,
+            read_ahead,
+            read_ahead_trigger,
+            seq_begin: 0,
             read: 0,
-        };
+            seek_index,
+        })
+    }
 
-        rdr.frame.shrink_to_fit();
+    // get entity decrypted length
+    #[inline]
+    pub fn data_len(&self) -> usize {
+        self.dec_len
+    }
 
-        Ok(rdr)
+    // get seek index saved with entity address
+    #[inline]
+    pub fn seek_index(&self) -> &[u64] {
+        &self.seek_index
     }
 
     // copy data out from decrypte frame to destination
@@ -464,85 +833,169 @@ impl Reader {
         dst[..copy_len].copy_from_slice(&dec_frame[begin..end]);
         (copy_len, end >= dec_frame.len())
     }
+
+    // set current frame and discard the loaded one
+    fn set_frame(&mut self, frm_idx: usize) {
+        self.frm_idx = frm_idx;
+        self.dec_frame_len = 0;
+        self.cached_frame = None;
+        if frm_idx < self.addrs.len() {
+            self.frm_key = self.addrs[frm_idx].list[0].span.begin;
+        }
+    }
+
+    // check if current frame can be decrypted directly to destination, that
+    // is, the frame is not loaded yet, will not go to frame cache, won't be
+    // provided by read-ahead, and destination can hold the whole frame
+    fn can_read_direct(&self, dst_len: usize) -> bool {
+        let frm_size = self.dec_frame.len();
+        self.dec_frame_len == 0
+            && self.cached_frame.is_none()
+            && self.ent_len >= Storage::FRAME_CACHE_THRESHOLD
+            && self.read % frm_size == 0
+            && (self.read_ahead.is_none()
+                || self.frm_idx - self.seq_begin < self.read_ahead_trigger)
+            && dst_len >= min(frm_size, self.dec_len - self.read)
+    }
+
+    // read current frame from depot and decrypt it directly to destination
+    fn read_frame_direct(&mut self, dst: &mut [u8]) -> Result<usize> {
+        let frm_len = min(self.dec_frame.len(), self.dec_len - self.read);
+        let storage = self.storage.read().unwrap();
+        decrypt_frame(
+            &storage,
+            &mut self.frame,
+            &mut dst[..frm_len],
+            &self.addrs[self.frm_idx],
+        )
+    }
+
+    // load current frame from frame cache, read-ahead or underlying depot
+    fn load_frame(&mut self) -> Result<()> {
+        let use_cache = self.ent_len < Storage::FRAME_CACHE_THRESHOLD;
+
+        if use_cache {
+            let storage = self.storage.read().unwrap();
+            self.cached_frame = storage.get_cached_frame(self.frm_key);
+            if self.cached_frame.is_some() {
+                return Ok(());
+            }
+        }
+
+        // once enough frames are read sequentially, take the frame from
+        // read-ahead and keep the read-ahead window filled
+        if self.frm_idx - self.seq_begin >= self.read_ahead_trigger {
+            if let Some(ref mut read_ahead) = self.read_ahead {
+                let taken = read_ahead.take(self.frm_idx);
+                read_ahead.request(self.frm_idx, &self.addrs, &self.storage);
+                if let Some(result) = taken {
+                    let ((frame, dec_frame), dec_frame_len) = result?;
+                    self.frame = frame;
+                    self.dec_frame = dec_frame;
+                    self.dec_frame_len = dec_frame_len;
+                    return Ok(());
+                }
+            }
+        }
+
+        // read a frame from depot and decrypt it
+        let storage = self.storage.read().unwrap();
+        self.dec_frame_len = decrypt_frame(
+            &storage,
+            &mut self.frame,
+            &mut self.dec_frame,
+            &self.addrs[self.frm_idx],
+        )?;
+
+        // and then add the decrypted frame to cache if it is not too big,
+        // the frame buffer is moved to cache and replaced with a new one
+        if use_cache {
+            let new_frame =
+                BufPool::get(&storage.buf_pool, self.dec_frame.len());
+            let mut dec_frame = mem::replace(&mut self.dec_frame, new_frame);
+            dec_frame.set_len(self.dec_frame_len);
+            let dec_frame = Arc::new(dec_frame);
+            storage.cache_frame(self.frm_key, dec_frame.clone());
+            self.cached_frame = Some(dec_frame);
+            self.dec_frame_len = 0;
+        }
+
+        Ok(())
+    }
 }
 
 impl Read for Reader {
     fn read(&mut self, buf: &mut [u8]) -> IoResult<usize> {
-        if self.frm_idx >= self.addrs.len() || buf.is_empty() {
+        if self.read >= self.dec_len || buf.is_empty() {
             return Ok(0);
         }
 
-        let mut storage = self.storage.write().unwrap();
-
-        // if decrypted frame has been exhausted and the
-        // frame is not in the frame cache, read it from underlying depot
-        // and save to cache if it is necessary
-        if self.dec_frame_len == 0
-            && !storage.frame_cache.contains_key(&self.frm_key)
-        {
-            // read a frame from depot
-            let mut read = 0;
-            for loc_span in self.addrs[self.frm_idx].iter() {
-                let read_len = loc_span.span.bytes_len();
-                storage
-                    .depot
-                    .get_blocks(
-                        &mut self.frame[read..read + read_len],
-                        loc_span.span,
-                    )
-                    .map_err(|err| {
-                        if err == Error::NotFound {
-                            IoError::new(
-                                ErrorKind::NotFound,
-                                "Blocks not found",
-                            )
-                        } else {
-                            IoError::new(ErrorKind::Other, err.description())
-                        }
-                    })?;
-                read += read_len;
-            }
+        // if destination can hold the whole frame, decrypt the frame
+        // straight into it to avoid extra copy
+        if self.can_read_direct(buf.len()) {
+            let read = self.read_frame_direct(buf).map_err(to_io_err)?;
+            self.read += read;
+            let frm_idx = self.frm_idx + 1;
+            self.set_frame(frm_idx);
+            return Ok(read);
+        }
 
-            // decrypt frame
-            self.dec_frame_len = map_io_err!(storage.crypto.decrypt_to(
-                &mut self.dec_frame,
-                &self.frame[..self.addrs[self.frm_idx].len],
-                &storage.key,
-            ))?;
-
-            // and then add the decrypted frame to cache if it is not too big
-            if self.ent_len < Storage::FRAME_CACHE_THRESHOLD {
-                storage.frame_cache.insert(
-                    self.frm_key,
-                    self.dec_frame[..self.dec_frame_len].to_vec(),
-                );
-            }
+        // if decrypted frame has been exhausted, load the next one
+        if self.dec_frame_len == 0 && self.cached_frame.is_none() {
+            self.load_frame().map_err(to_io_err)?;
         }
 
         // copy decryped frame out to destination
-        let (copy_len, frm_is_exhausted) =
-            if self.ent_len < Storage::FRAME_CACHE_THRESHOLD {
-                let dec_frame =
-                    storage.frame_cache.get_refresh(&self.frm_key).unwrap();
-                self.copy_frame_out(buf, dec_frame)
-            } else {
+        let (copy_len, frm_is_exhausted) = match self.cached_frame {
+            Some(ref dec_frame) => self.copy_frame_out(buf, dec_frame),
+            None => {
                 self.copy_frame_out(buf, &self.dec_frame[..self.dec_frame_len])
-            };
+            }
+        };
         self.read += copy_len;
 
         // if frame is exhausted, advance to the next frame
         if frm_is_exhausted {
-            self.frm_idx += 1;
-            self.dec_frame_len = 0;
-            if self.frm_idx < self.addrs.len() {
-                self.frm_key = self.addrs[self.frm_idx].list[0].span.begin;
-            }
+            let frm_idx = self.frm_idx + 1;
+            self.set_frame(frm_idx);
         }
 
         Ok(copy_len)
     }
 }
 
+impl Seek for Reader {
+    fn seek(&mut self, pos: SeekFrom) -> IoResult<u64> {
+        let new_pos = match pos {
+            SeekFrom::Start(pos) => pos as i64,
+            SeekFrom::End(pos) => self.dec_len as i64 + pos,
+            SeekFrom::Current(pos) => self.read as i64 + pos,
+        };
+        if new_pos < 0 {
+            return Err(IoError::new(
+                ErrorKind::InvalidInput,
+                "Invalid seek to a negative position",
+            ));
+        }
+
+        // if seek within current frame, the loaded frame can be reused,
+        // otherwise the frame index is re-positioned and sequential reading,
+        // as well as read-ahead, will start over from there
+        let new_pos = new_pos as usize;
+        let frm_idx = new_pos / self.dec_frame.len();
+        if frm_idx != self.frm_idx {
+            self.set_frame(frm_idx);
+            self.seq_begin = frm_idx;
+            if let Some(ref mut read_ahead) = self.read_ahead {
+                read_ahead.reset();
+            }
+        }
+        self.read = new_pos;
+
+        Ok(new_pos as u64)
+    }
+}
+
 /// Storage Wal Writer
 pub struct WalWriter {
     id: Eid,
@@ -579,7 +1032,69 @@ impl Finish for WalWriter {
 
         // encrypt wal and save to underlying storage
         let enc = storage.crypto.encrypt(&self.wal, &storage.key)?;
-        storage.depot.put_wal(&self.id, &enc)
+        storage.metrics.add_encrypted(self.wal.len());
+        storage.depot_mut().put_wal(&self.id, &enc)
+    }
+}
+
+// encrypt a staged frame and add padding bytes, return the encrypted
+// frame and its encrypted length
+fn encrypt_frame(
+    crypto: &Crypto,
+    key: &Key,
+    mut frame: PoolBuf,
+    stg: &[u8],
+) -> Result<(PoolBuf, usize)> {
+    let enc_len = crypto.encrypt_to(&mut frame, stg, key)?;
+    let aligned_len = align_ceil_chunk(enc_len, BLK_SIZE) * BLK_SIZE;
+    Crypto::random_buf(&mut frame[enc_len..aligned_len]);
+    Ok((frame, enc_len))
+}
+
+// Frame encryption pipeline
+//
+// Staged frames are sent to the encryption workers, while the writer
+// keeps filling the next stage buffer. Workers only encrypt frames, the
+// writer takes them back in the order they are sent and writes them to
+// depot, so blocks are allocated in frame order.
+struct Pipeline {
+    pool: Arc<ThreadPool>,
+
+    // maximum number of in-flight frames
+    depth: usize,
+
+    // in-flight frames in send order
+    frames: VecDeque<JobResult<Result<(PoolBuf, usize)>>>,
+}
+
+impl Pipeline {
+    fn new(pool: &Arc<ThreadPool>) -> Self {
+        Pipeline {
+            pool: pool.clone(),
+            depth: pool.size() * 2,
+            frames: VecDeque::new(),
+        }
+    }
+
+    // wait for the first in-flight frame to finish
+    fn recv(&mut self) -> Result<Option<(PoolBuf, usize)>> {
+        match self.frames.pop_front() {
+            // worker failed without a result, treat it as encryption error
+            Some(mut frame) => {
+                frame.wait().unwrap_or(Err(Error::Encrypt)).map(Some)
+            }
+            None => Ok(None),
+        }
+    }
+}
+
+impl Debug for Pipeline {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        f.debug_struct("Pipeline")
+            .field("pool", &self.pool)
+            .field("depth", &self.depth)
+            .field("in_flight", &self.frames.len())
+            .finish()
     }
 }
 
@@ -589,32 +1104,54 @@ pub struct Writer {
     addr: Addr,
     storage: StorageWeakRef,
 
-    // encrypted frame
-    frame: Vec<u8>,
+    // encrypted frames which are not written to depot yet and their
+    // encrypted lengths, frame buffers are kept for reuse after pending
+    // frames are written
+    frames: Vec<PoolBuf>,
+    pending: Vec<usize>,
 
     // stage data buffer, length is decrypted_len(FRAME_SIZE)
-    stg: Vec<u8>,
+    stg: PoolBuf,
     stg_len: usize,
+
+    buf_pool: Arc<BufPool>,
+
+    // pipelined frame encryption, only used when storage has encryption
+    // workers
+    pipeline: Option<Pipeline>,
 }
 
 impl Writer {
+    // max number of encrypted frames written to depot in one batch
+    const WRITE_BATCH_FRAMES: usize = 4;
+
     pub fn new(id: &Eid, storage: &StorageWeakRef) -> Result<Self> {
-        let stg_size = {
+        let (stg_size, pipeline, buf_pool) = {
             let storage = storage.upgrade().ok_or(Error::RepoClosed)?;
             let storage = storage.read().unwrap();
-            storage.crypto.decrypted_len(FRAME_SIZE)
+            (
+                storage.crypto.decrypted_len(FRAME_SIZE),
+                storage.encrypt_pool.as_ref().map(Pipeline::new),
+                storage.buf_pool.clone(),
+            )
         };
-        let mut wtr = Writer {
+        Ok(Writer {
             id: id.clone(),
             addr: Addr::default(),
             storage: storage.clone(),
-            frame: vec![0u8; FRAME_SIZE],
-            stg: vec![0u8; stg_size],
+            frames: Vec::new(),
+            pending: Vec::new(),
+            stg: BufPool::get(&buf_pool, stg_size),
             stg_len: 0,
-        };
-        wtr.frame.shrink_to_fit();
-        wtr.stg.shrink_to_fit();
-        Ok(wtr)
+            pipeline,
+            buf_pool,
+        })
+    }
+
+    // set seek index which will be saved with entity address
+    #[inline]
+    pub fn set_seek_index(&mut self, seek_index: Vec<u64>) {
+        self.addr.seek_index = seek_index;
     }
 
     // encrypt to frame and write to depot
@@ -624,37 +1161,174 @@ impl Writer {
         }
 
         let storage = self.storage.upgrade().ok_or(Error::RepoClosed)?;
+
+        if self.pipeline.is_some() {
+            return self.send_frame(&storage);
+        }
+
         let mut storage = storage.write().unwrap();
 
-        // encrypt source data to frame
+        // encrypt source data to the next free frame
+        let frm_idx = self.pending.len();
+        if self.frames.len() <= frm_idx {
+            self.frames.push(BufPool::get(&self.buf_pool, FRAME_SIZE));
+        }
+        let frame = &mut self.frames[frm_idx];
         let enc_len = storage.crypto.encrypt_to(
-            &mut self.frame,
+            frame,
             &self.stg[..self.stg_len],
             &storage.key,
         )?;
+        storage.metrics.add_encrypted(self.stg_len);
 
-        let blk_cnt = align_ceil_chunk(enc_len, BLK_SIZE);
-        let aligned_len = blk_cnt * BLK_SIZE;
+        let aligned_len = align_ceil_chunk(enc_len, BLK_SIZE) * BLK_SIZE;
 
         // add padding bytes
-        Crypto::random_buf(&mut self.frame[enc_len..aligned_len]);
+        Crypto::random_buf(&mut frame[enc_len..aligned_len]);
 
-        // allocate blocks
-        let span = {
+        // reset stage buffer
+        self.pending.push(enc_len);
+        self.stg_len = 0;
+
+        // write frames to depot once there are enough of them
+        if self.pending.len() >= Self::WRITE_BATCH_FRAMES {
+            self.put_frames(&mut storage)?;
+        }
+
+        Ok(())
+    }
+
+    // write pending frames to depot in one batch
+    //
+    // Blocks are allocated here rather than when frames are encrypted, so
+    // allocation and writing are done under the same storage lock and
+    // blocks are always written in allocation order. Depot like file
+    // storage requires that, as it finishes a sector once its last block
+    // is written.
+    fn put_frames(&mut self, storage: &mut Storage) -> Result<()> {
+        if self.pending.is_empty() {
+            return Ok(());
+        }
+
+        // allocate blocks and append to address
+        let spans: Vec<Span> = {
             let allocator_ref = storage.get_allocator();
             let mut allocator = allocator_ref.write().unwrap();
-            allocator.allocate(blk_cnt)
+            let addr = &mut self.addr;
+            self.pending
+                .iter()
+                .map(|&enc_len| {
+                    let span =
+                        allocator.allocate(align_ceil_chunk(enc_len, BLK_SIZE));
+                    addr.append(span, enc_len);
+                    span
+                })
+                .collect()
         };
 
-        // write frame to depot
-        storage.depot.put_blocks(span, &self.frame[..aligned_len])?;
+        {
+            let blks: Vec<(Span, &[u8])> = spans
+                .iter()
+                .enumerate()
+                .map(|(idx, span)| {
+                    (*span, &self.frames[idx][..span.bytes_len()])
+                })
+                .collect();
+            storage.depot_mut().put_blocks_batch(&blks)?;
+        }
+        self.pending.clear();
+
+        Ok(())
+    }
+
+    // send stage buffer to encryption pipeline
+    fn send_frame(&mut self, storage: &StorageRef) -> Result<()> {
+        let (crypto, key, metrics) = {
+            let storage = storage.read().unwrap();
+            (
+                storage.crypto.clone(),
+                storage.key.clone(),
+                storage.metrics.clone(),
+            )
+        };
+
+        // if pipeline is full, write the first frame to depot
+        let is_full = {
+            let pipeline = self.pipeline.as_ref().unwrap();
+            pipeline.frames.len() >= pipeline.depth
+        };
+        if is_full {
+            self.put_pipelined(storage, 1)?;
+        }
 
-        // append to address and reset stage buffer
-        self.addr.append(span, enc_len);
+        // swap out stage buffer, so we can keep writing while it is
+        // being encrypted
+        let frame = BufPool::get(&self.buf_pool, FRAME_SIZE);
+        let new_stg = BufPool::get(&self.buf_pool, self.stg.len());
+        let stg = mem::replace(&mut self.stg, new_stg);
+        let stg_len = self.stg_len;
         self.stg_len = 0;
 
+        let pipeline = self.pipeline.as_mut().unwrap();
+        let result = pipeline.pool.submit(move || {
+            let result = encrypt_frame(&crypto, &key, frame, &stg[..stg_len]);
+            if result.is_ok() {
+                metrics.add_encrypted(stg_len);
+            }
+            result
+        });
+        pipeline.frames.push_back(result);
+
         Ok(())
     }
+
+    // write the first `cnt` in-flight frames to depot in one batch
+    //
+    // Blocks are allocated and written under the depot lock, so they are
+    // written in allocation order as put_frames() does, but other storage
+    // users are not blocked by an exclusive storage lock.
+    fn put_pipelined(
+        &mut self,
+        storage: &StorageRef,
+        cnt: usize,
+    ) -> Result<()> {
+        let mut frames = Vec::with_capacity(cnt);
+        {
+            let pipeline = self.pipeline.as_mut().unwrap();
+            for _ in 0..cnt {
+                match pipeline.recv()? {
+                    Some(frame) => frames.push(frame),
+                    None => break,
+                }
+            }
+        }
+        if frames.is_empty() {
+            return Ok(());
+        }
+
+        let storage = storage.read().unwrap();
+        let mut depot = storage.depot.write().unwrap();
+        let spans: Vec<Span> = {
+            let allocator_ref = storage.get_allocator();
+            let mut allocator = allocator_ref.write().unwrap();
+            let addr = &mut self.addr;
+            frames
+                .iter()
+                .map(|&(_, enc_len)| {
+                    let span =
+                        allocator.allocate(align_ceil_chunk(enc_len, BLK_SIZE));
+                    addr.append(span, enc_len);
+                    span
+                })
+                .collect()
+        };
+        let blks: Vec<(Span, &[u8])> = spans
+            .iter()
+            .zip(frames.iter())
+            .map(|(span, (frame, _))| (*span, &frame[..span.bytes_len()]))
+            .collect();
+        depot.put_blocks_batch(&blks)
+    }
 }
 
 impl Write for Writer {
@@ -682,9 +1356,16 @@ impl Finish for Writer {
         // write data frame
         self.write_frame()?;
 
-        // if the old address exists, remove all of its blocks
+        // write the remaining pending or in-flight frames
         let storage = self.storage.upgrade().ok_or(Error::RepoClosed)?;
+        if self.pipeline.is_some() {
+            let in_flight = self.pipeline.as_ref().unwrap().frames.len();
+            self.put_pipelined(&storage, in_flight)?;
+        }
         let mut storage = storage.write().unwrap();
+        self.put_frames(&mut storage)?;
+
+        // if the old address exists, remove all of its blocks
         match storage.get_address(&self.id) {
             Ok(old_addr) => {
                 storage.remove_address_blocks(&old_addr)?;
@@ -702,6 +1383,8 @@ impl Finish for Writer {
 mod tests {
     extern crate tempdir;
 
+    use std::sync::Barrier;
+    use std::thread;
     use std::time::Instant;
 
     #[cfg(feature = "storage-file")]
@@ -881,11 +1564,121 @@ mod tests {
         assert_eq!(Reader::new(&id, storage).unwrap_err(), Error::NotFound);
     }
 
+    fn seek_test(storage: &StorageRef) {
+        let id = Eid::new();
+        let mut buf = vec![0u8; 8 * FRAME_SIZE + 42];
+        let seed = RandomSeed::from(&[0u8; RANDOM_SEED_SIZE]);
+        Crypto::random_buf_deterministic(&mut buf, &seed);
+
+        let mut wtr = Writer::new(&id, &Arc::downgrade(storage)).unwrap();
+        wtr.write_all(&buf).unwrap();
+        wtr.finish().unwrap();
+
+        let mut rdr = Reader::new(&id, storage).unwrap();
+        let mut dst = vec![0u8; 100];
+
+        // seek forward across frames
+        let pos = 3 * FRAME_SIZE + 7;
+        assert_eq!(rdr.seek(SeekFrom::Start(pos as u64)).unwrap(), pos as u64);
+        rdr.read_exact(&mut dst).unwrap();
+        assert_eq!(&dst[..], &buf[pos..pos + dst.len()]);
+
+        // seek backward within the same frame
+        let pos = 3 * FRAME_SIZE + 3;
+        rdr.seek(SeekFrom::Current(-104)).unwrap();
+        rdr.read_exact(&mut dst).unwrap();
+        assert_eq!(&dst[..], &buf[pos..pos + dst.len()]);
+
+        // seek backward across frames and read sequentially to the end
+        let pos = FRAME_SIZE - 5;
+        rdr.seek(SeekFrom::Start(pos as u64)).unwrap();
+        let mut rest = Vec::new();
+        rdr.read_to_end(&mut rest).unwrap();
+        assert_eq!(&rest[..], &buf[pos..]);
+
+        // seek from end and beyond end
+        rdr.seek(SeekFrom::End(-10)).unwrap();
+        let mut rest = Vec::new();
+        rdr.read_to_end(&mut rest).unwrap();
+        assert_eq!(&rest[..], &buf[buf.len() - 10..]);
+        rdr.seek(SeekFrom::End(10)).unwrap();
+        assert_eq!(rdr.read(&mut dst).unwrap(), 0);
+        assert!(rdr
+            .seek(SeekFrom::Current(-(buf.len() as i64) - 11))
+            .is_err());
+    }
+
+    fn direct_read_test(storage: &StorageRef) {
+        let id = Eid::new();
+        let mut buf = vec![0u8; 8 * FRAME_SIZE + 42];
+        let seed = RandomSeed::from(&[1u8; RANDOM_SEED_SIZE]);
+        Crypto::random_buf_deterministic(&mut buf, &seed);
+
+        let mut wtr = Writer::new(&id, &Arc::downgrade(storage)).unwrap();
+        wtr.write_all(&buf).unwrap();
+        wtr.finish().unwrap();
+
+        // read with destination larger than frame, mixed with partial
+        // frame reads
+        let mut rdr = Reader::new(&id, storage).unwrap();
+        let mut dst = vec![0u8; buf.len()];
+        let mut pos = 0;
+        for len in [3 * FRAME_SIZE, 7, 2 * FRAME_SIZE].iter().cloned() {
+            rdr.read_exact(&mut dst[pos..pos + len]).unwrap();
+            pos += len;
+        }
+        rdr.read_exact(&mut dst[pos..]).unwrap();
+        assert_eq!(rdr.read(&mut dst).unwrap(), 0);
+        assert_eq!(&dst[..], &buf[..]);
+
+        // read whole entity at once
+        rdr.seek(SeekFrom::Start(0)).unwrap();
+        let mut dst = vec![0u8; buf.len() * 2];
+        let mut read = 0;
+        loop {
+            let len = rdr.read(&mut dst[read..]).unwrap();
+            if len == 0 {
+                break;
+            }
+            read += len;
+        }
+        assert_eq!(&dst[..read], &buf[..]);
+    }
+
+    fn buf_pool_test(storage: &StorageRef) {
+        let id = Eid::new();
+        let buf = vec![42u8; 123];
+        let mut wtr = Writer::new(&id, &Arc::downgrade(storage)).unwrap();
+        wtr.write_all(&buf).unwrap();
+        wtr.finish().unwrap();
+
+        let read_entity = || {
+            let mut rdr = Reader::new(&id, storage).unwrap();
+            let mut dst = Vec::new();
+            rdr.read_to_end(&mut dst).unwrap();
+            assert_eq!(&dst[..], &buf[..]);
+        };
+
+        // frame buffers should be reused after the first read
+        read_entity();
+        let stats = storage.read().unwrap().buf_pool_stats();
+        for _ in 0..50 {
+            read_entity();
+        }
+        let new_stats = storage.read().unwrap().buf_pool_stats();
+        assert_eq!(new_stats.allocs, stats.allocs);
+        assert!(new_stats.hits >= stats.hits + 100);
+        assert!(new_stats.free > 0);
+    }
+
     fn test_depot(storage: StorageRef) {
         single_span_addr_test(&storage);
         multi_span_addr_test(&storage);
         overwrite_test(&storage);
         delete_test(&storage);
+        seek_test(&storage);
+        direct_read_test(&storage);
+        buf_pool_test(&storage);
     }
 
     #[test]
@@ -897,6 +1690,50 @@ mod tests {
         test_depot(storage.into_ref());
     }
 
+    #[test]
+    fn mem_depot_pipelined() {
+        init_env();
+        let mut storage =
+            Storage::new("mem://storage.mem_depot_pipelined").unwrap();
+        storage.init(Cost::default(), Cipher::default()).unwrap();
+        storage.set_encrypt_workers(4).unwrap();
+        let storage = storage.into_ref();
+        test_depot(storage.clone());
+
+        // frames finished out of order are still allocated in frame order
+        let id = Eid::new();
+        let mut buf = vec![0u8; 32 * FRAME_SIZE];
+        Crypto::random_buf(&mut buf);
+        let mut wtr = Writer::new(&id, &Arc::downgrade(&storage)).unwrap();
+        wtr.write_all(&buf).unwrap();
+        wtr.finish().unwrap();
+        let addr = storage.read().unwrap().get_address(&id).unwrap();
+        for pair in addr.list.windows(2) {
+            assert!(pair[0].span.end() <= pair[1].span.begin);
+        }
+    }
+
+    #[test]
+    fn mem_depot_read_ahead() {
+        init_env();
+        let mut storage =
+            Storage::new("mem://storage.mem_depot_read_ahead").unwrap();
+        storage.init(Cost::default(), Cipher::default()).unwrap();
+        storage.set_read_ahead(4, 2).unwrap();
+        test_depot(storage.into_ref());
+    }
+
+    #[test]
+    fn mem_depot_read_ahead_no_trigger() {
+        init_env();
+        let mut storage =
+            Storage::new("mem://storage.mem_depot_read_ahead_no_trigger")
+                .unwrap();
+        storage.init(Cost::default(), Cipher::default()).unwrap();
+        storage.set_read_ahead(4, 0).unwrap();
+        test_depot(storage.into_ref());
+    }
+
     #[cfg(feature = "storage-file")]
     #[test]
     fn file_depot() {
@@ -991,6 +1828,249 @@ mod tests {
         perf_test(&storage, "File storage");
     }
 
+    #[test]
+    fn mem_pipelined_perf() {
+        init_env();
+        let mut storage =
+            Storage::new("mem://storage.mem_pipelined_perf").unwrap();
+        storage.init(Cost::default(), Cipher::default()).unwrap();
+        storage.set_encrypt_workers(4).unwrap();
+        let storage = storage.into_ref();
+        perf_test(&storage, "Memory storage (pipelined)");
+    }
+
+    #[cfg(feature = "storage-file")]
+    #[test]
+    fn file_read_ahead_perf() {
+        init_env();
+        let tmpdir = TempDir::new("zbox_test").expect("Create temp dir failed");
+        let uri = format!("file://{}", tmpdir.path().display());
+        let mut storage = Storage::new(&uri).unwrap();
+        storage.init(Cost::default(), Cipher::default()).unwrap();
+        storage.set_read_ahead(8, 2).unwrap();
+        let storage = storage.into_ref();
+        perf_test(&storage, "File storage (read-ahead)");
+    }
+
+    // concurrent writers must not finish a file storage sector before all of
+    // its blocks are written
+    #[cfg(feature = "storage-file")]
+    fn concurrent_write_test(encrypt_workers: usize) {
+        init_env();
+        let tmpdir = TempDir::new("zbox_test").expect("Create temp dir failed");
+        let uri = format!("file://{}", tmpdir.path().display());
+        let mut storage = Storage::new(&uri).unwrap();
+        storage.init(Cost::default(), Cipher::default()).unwrap();
+        storage.set_encrypt_workers(encrypt_workers).unwrap();
+        let storage = storage.into_ref();
+
+        // 4 writers write 40MB in total, which is more than one sector
+        const ENT_LEN: usize = 10 * 1024 * 1024;
+        let barrier = Arc::new(Barrier::new(4));
+        let workers: Vec<_> = (0..4u8)
+            .map(|i| {
+                let storage = Arc::downgrade(&storage);
+                let barrier = barrier.clone();
+                thread::spawn(move || {
+                    barrier.wait();
+                    let id = Eid::new();
+                    let buf = vec![i; ENT_LEN];
+                    let mut wtr = Writer::new(&id, &storage).unwrap();
+                    for chunk in buf.chunks(64 * 1024) {
+                        wtr.write_all(chunk).unwrap();
+                    }
+                    wtr.finish().unwrap();
+                    (id, i)
+                })
+            })
+            .collect();
+        for worker in workers {
+            let (id, i) = worker.join().unwrap();
+            let mut rdr = Reader::new(&id, &storage).unwrap();
+            let mut dst = Vec::new();
+            rdr.read_to_end(&mut dst).unwrap();
+            assert_eq!(dst.len(), ENT_LEN);
+            assert!(dst.iter().all(|b| *b == i));
+        }
+    }
+
+    #[cfg(feature = "storage-file")]
+    #[test]
+    fn file_concurrent_write() {
+        concurrent_write_test(0);
+    }
+
+    #[cfg(feature = "storage-file")]
+    #[test]
+    fn file_concurrent_write_pipelined() {
+        concurrent_write_test(4);
+    }
+
+    fn concurrent_perf_test(storage: &StorageRef, prefix: &str) {
+        const DATA_LEN: usize = 32 * 1024 * 1024;
+        const MAX_THREADS: usize = 16;
+        const ENT_LEN: usize = DATA_LEN / MAX_THREADS;
+        let mut buf = vec![0u8; ENT_LEN];
+        let seed = RandomSeed::from(&[0u8; RANDOM_SEED_SIZE]);
+        Crypto::random_buf_deterministic(&mut buf, &seed);
+
+        // write entities, each reader thread will read its own share of them
+        let ids: Vec<Eid> = (0..MAX_THREADS).map(|_| Eid::new()).collect();
+        for id in ids.iter() {
+            let mut wtr = Writer::new(id, &Arc::downgrade(storage)).unwrap();
+            wtr.write_all(&buf).unwrap();
+            wtr.finish().unwrap();
+        }
+
+        // read the same amount of data with different number of threads
+        let mut thread_cnt = 1;
+        while thread_cnt <= MAX_THREADS {
+            let now = Instant::now();
+            let workers: Vec<_> = (0..thread_cnt)
+                .map(|thread_idx| {
+                    let storage = storage.clone();
+                    let ids: Vec<Eid> = ids
+                        .iter()
+                        .skip(thread_idx)
+                        .step_by(thread_cnt)
+                        .cloned()
+                        .collect();
+                    thread::spawn(move || {
+                        let mut dst = Vec::with_capacity(ENT_LEN);
+                        for id in ids.iter() {
+                            let mut rdr = Reader::new(id, &storage).unwrap();
+                            dst.clear();
+                            let read = rdr.read_to_end(&mut dst).unwrap();
+                            assert_eq!(read, ENT_LEN);
+                        }
+                    })
+                })
+                .collect();
+            for worker in workers {
+                worker.join().unwrap();
+            }
+            let read_time = now.elapsed();
+
+            println!(
+                "{} concurrent read perf: {} threads: {}",
+                prefix,
+                thread_cnt,
+                speed_str(&read_time, DATA_LEN)
+            );
+
+            thread_cnt *= 2;
+        }
+    }
+
+    #[test]
+    fn mem_concurrent_perf() {
+        init_env();
+        let mut storage =
+            Storage::new("mem://storage.mem_concurrent_perf").unwrap();
+        storage.init(Cost::default(), Cipher::default()).unwrap();
+        let storage = storage.into_ref();
+        concurrent_perf_test(&storage, "Memory storage");
+    }
+
+    #[cfg(feature = "storage-file")]
+    #[test]
+    fn file_concurrent_perf() {
+        init_env();
+        let tmpdir = TempDir::new("zbox_test").expect("Create temp dir failed");
+        let uri = format!("file://{}", tmpdir.path().display());
+        let mut storage = Storage::new(&uri).unwrap();
+        storage.init(Cost::default(), Cipher::default()).unwrap();
+        let storage = storage.into_ref();
+        concurrent_perf_test(&storage, "File storage");
+    }
+
+    #[cfg(feature = "test-perf")]
+    fn bench_storage(storage: &StorageRef, backend: &str) {
+        use base::bench::{Bench, Work};
+
+        const ENT_LEN: usize = 256 * 1024;
+        const ENT_CNT: usize = 64;
+        let bench = Bench::from_env();
+        let mut buf = vec![0u8; ENT_LEN];
+        let seed = RandomSeed::from(&[0u8; RANDOM_SEED_SIZE]);
+        Crypto::random_buf_deterministic(&mut buf, &seed);
+
+        let write = |id: &Eid| {
+            let mut wtr = Writer::new(id, &Arc::downgrade(storage)).unwrap();
+            wtr.write_all(&buf).unwrap();
+            wtr.finish().unwrap();
+        };
+        let read = |id: &Eid| {
+            let mut rdr = Reader::new(id, storage).unwrap();
+            let mut dst = Vec::with_capacity(ENT_LEN);
+            rdr.read_to_end(&mut dst).unwrap();
+            assert_eq!(dst.len(), ENT_LEN);
+        };
+
+        // 64 entities of 256KB exceed the frame cache, so cycling through
+        // all of them always misses, while reading one entity always hits
+        let ids: Vec<Eid> = (0..ENT_CNT).map(|_| Eid::new()).collect();
+        for id in ids.iter() {
+            write(id);
+        }
+
+        for &threads in bench.threads() {
+            bench.run_threads(
+                "storage_write",
+                backend,
+                threads,
+                Work::Bytes(ENT_LEN * ENT_CNT),
+                |idx| {
+                    for _ in (idx..ENT_CNT).step_by(threads) {
+                        write(&Eid::new());
+                    }
+                },
+            );
+            bench.run_threads(
+                "storage_read_cache_miss",
+                backend,
+                threads,
+                Work::Bytes(ENT_LEN * ENT_CNT),
+                |idx| {
+                    for id in ids.iter().skip(idx).step_by(threads) {
+                        read(id);
+                    }
+                },
+            );
+            bench.run_threads(
+                "storage_read_cache_hit",
+                backend,
+                threads,
+                Work::Bytes(ENT_LEN * ENT_CNT),
+                |idx| {
+                    for _ in (idx..ENT_CNT).step_by(threads) {
+                        read(&ids[0]);
+                    }
+                },
+            );
+        }
+    }
+
+    #[cfg(feature = "test-perf")]
+    #[test]
+    fn mem_bench() {
+        init_env();
+        let mut storage = Storage::new("mem://storage.mem_bench").unwrap();
+        storage.init(Cost::default(), Cipher::default()).unwrap();
+        bench_storage(&storage.into_ref(), "mem");
+    }
+
+    #[cfg(all(feature = "test-perf", feature = "storage-file"))]
+    #[test]
+    fn file_bench() {
+        init_env();
+        let tmpdir = TempDir::new("zbox_test").expect("Create temp dir failed");
+        let uri = format!("file://{}", tmpdir.path().display());
+        let mut storage = Storage::new(&uri).unwrap();
+        storage.init(Cost::default(), Cipher::default()).unwrap();
+        bench_storage(&storage.into_ref(), "file");
+    }
+
     #[test]
     #[ignore]
     fn crypto_perf_test() {
@@ -353,6 +353,90 @@ impl HttpClient {
         Ok(buf)
     }
 
+    // send get requests for multiple objects concurrently
+    fn send_get_many_req(
+        &self,
+        uris: &[Uri],
+        cache_ctl: CacheControl,
+    ) -> Vec<Result<Response>> {
+        let headers = self
+            .headers
+            .clone()
+            .bearer_auth(&self.session_token)
+            .cache_control(cache_ctl);
+        let reqs: Vec<(Uri, HeaderMap)> = uris
+            .iter()
+            .map(|uri| (uri.clone(), headers.as_ref().clone()))
+            .collect();
+        self.transport
+            .get_many(&reqs)
+            .into_iter()
+            .map(|resp| {
+                resp.and_then(|resp| resp.error_for_status())
+                    .map_err(|err| {
+                        if err == Error::HttpStatus(StatusCode::NOT_FOUND) {
+                            Error::NotFound
+                        } else {
+                            err
+                        }
+                    })
+            })
+            .collect()
+    }
+
+    // get multiple objects, the results are in the same order as paths
+    pub fn get_many(
+        &mut self,
+        rel_paths: &[PathBuf],
+        cache_ctl: CacheControl,
+    ) -> Result<Vec<Result<Vec<u8>>>> {
+        trace!("get many {} objects", rel_paths.len());
+
+        let mut ret: Vec<Result<Vec<u8>>> =
+            rel_paths.iter().map(|_| Err(Error::NotFound)).collect();
+
+        // objects already in deletion bulk are not sent
+        let mut idxs = Vec::new();
+        let mut uris = Vec::new();
+        for (idx, rel_path) in rel_paths.iter().enumerate() {
+            if !self.del_bulk.iter().any(|p| p == rel_path) {
+                idxs.push(idx);
+                uris.push(self.make_uri(rel_path)?);
+            }
+        }
+
+        let mut resps = self.send_get_many_req(&uris, cache_ctl);
+
+        // reopen remote session once if it is expired and resend the
+        // unauthorized requests
+        let unauth = Error::HttpStatus(StatusCode::UNAUTHORIZED);
+        let retry: Vec<usize> = resps
+            .iter()
+            .enumerate()
+            .filter(|(_, resp)| resp.as_ref().err() == Some(&unauth))
+            .map(|(i, _)| i)
+            .collect();
+        if !retry.is_empty() {
+            self.open_session(false)?;
+            let retry_uris: Vec<Uri> =
+                retry.iter().map(|i| uris[*i].clone()).collect();
+            let retry_resps = self.send_get_many_req(&retry_uris, cache_ctl);
+            for (i, resp) in retry.into_iter().zip(retry_resps) {
+                resps[i] = resp;
+            }
+        }
+
+        for (idx, resp) in idxs.into_iter().zip(resps) {
+            ret[idx] = resp.and_then(|mut resp| {
+                let mut buf: Vec<u8> = Vec::new();
+                resp.copy_to(&mut buf)?;
+                Ok(buf)
+            });
+        }
+
+        Ok(ret)
+    }
+
     // send put request
     fn send_put_req(
         &mut self,
@@ -579,7 +663,7 @@ mod tests {
         assert_eq!(dst.len(), blks.len() + 3);
 
         // open session again should fail
-        assert_eq!(client.open_session(false).unwrap_err(), Error::Opened);
+        assert_eq!(client.open_session(false).unwrap_err(), Error::RepoOpened);
 
         // test delete
         client.del(&rel_path).unwrap();
@@ -1,6 +1,9 @@
+use std::collections::VecDeque;
 use std::fmt::{self, Debug};
 use std::path::{Path, PathBuf};
-use std::sync::{Arc, RwLock};
+use std::sync::{Arc, Condvar, Mutex, RwLock};
+use std::thread;
+use std::time::Duration;
 
 use linked_hash_map::LinkedHashMap;
 use rmp_serde::{Deserializer, Serializer};
@@ -9,6 +12,8 @@ use serde::{Deserialize, Serialize};
 use super::super::http_client::{CacheControl, HttpClient};
 use super::{CacheBackend, CacheType, DummyBackend};
 use base::crypto::{Crypto, Key};
+use base::metrics::CacheCounters;
+use base::thread_pool::ThreadPool;
 use base::IntoRef;
 use error::{Error, Result};
 
@@ -41,6 +46,241 @@ struct CacheMeta {
     lru: LinkedHashMap<PathBuf, CacheItem>,
 }
 
+// max size of objects waiting to be uploaded in write-back mode, writers
+// will be blocked when it is exceeded
+const MAX_PENDING_BYTES: usize = 8 * 1024 * 1024;
+
+// upload retry count and base delay in milliseconds
+const UPLOAD_RETRY: u64 = 3;
+const UPLOAD_RETRY_DELAY: u64 = 200;
+
+// object waiting to be uploaded, only unpinned objects are uploaded in
+// background
+#[derive(Clone)]
+struct Upload {
+    rel_path: PathBuf,
+    offset: usize,
+    obj: Vec<u8>,
+}
+
+impl Upload {
+    // try to merge a later put to the same object into this one, it can
+    // be merged if it is appended right after or covers this one
+    fn merge(&mut self, offset: usize, obj: &[u8]) -> bool {
+        let end = self.offset + self.obj.len();
+        if offset == end {
+            self.obj.extend_from_slice(obj);
+            true
+        } else if offset <= self.offset && offset + obj.len() >= end {
+            self.offset = offset;
+            self.obj.clear();
+            self.obj.extend_from_slice(obj);
+            true
+        } else {
+            false
+        }
+    }
+}
+
+// pending upload saved in upload journal, object contents are saved
+// after the entry list in the same order
+#[derive(Debug, Deserialize, Serialize)]
+struct JournalEntry {
+    rel_path: PathBuf,
+    offset: usize,
+    len: usize,
+}
+
+// write-back upload queue
+#[derive(Default)]
+struct UploadQueue {
+    pending: VecDeque<Upload>,
+    pending_bytes: usize,
+
+    // object being uploaded, it is kept here until it is uploaded so it
+    // can still be saved in upload journal
+    in_flight: Option<Arc<Upload>>,
+
+    is_running: bool,
+
+    // error of last failed upload, the failed object is kept in queue
+    error: Option<Error>,
+
+    // queue change flag since upload journal is saved
+    is_changed: bool,
+}
+
+impl UploadQueue {
+    #[inline]
+    fn is_in_flight(&self, rel_path: &Path) -> bool {
+        self.in_flight
+            .as_ref()
+            .map(|u| u.rel_path == rel_path)
+            .unwrap_or(false)
+    }
+
+    #[inline]
+    fn is_dirty(&self, rel_path: &Path) -> bool {
+        self.is_in_flight(rel_path)
+            || self.pending.iter().any(|u| u.rel_path == rel_path)
+    }
+
+    // serialize all pending uploads to journal, in upload order
+    fn to_journal(&self) -> Result<Vec<u8>> {
+        let uploads: Vec<&Upload> = self
+            .in_flight
+            .iter()
+            .map(|u| &**u)
+            .chain(self.pending.iter())
+            .collect();
+        let entries: Vec<JournalEntry> = uploads
+            .iter()
+            .map(|u| JournalEntry {
+                rel_path: u.rel_path.clone(),
+                offset: u.offset,
+                len: u.obj.len(),
+            })
+            .collect();
+
+        // journal layout: entry list length, entry list, object contents
+        let mut ent_buf = Vec::new();
+        entries.serialize(&mut Serializer::new(&mut ent_buf))?;
+        let mut buf =
+            Vec::with_capacity(8 + ent_buf.len() + self.pending_bytes);
+        buf.extend_from_slice(&(ent_buf.len() as u64).to_le_bytes());
+        buf.extend_from_slice(&ent_buf);
+        for upload in uploads {
+            buf.extend_from_slice(&upload.obj);
+        }
+        Ok(buf)
+    }
+
+    // deserialize pending uploads from journal
+    fn from_journal(buf: &[u8]) -> Result<Vec<Upload>> {
+        if buf.len() < 8 {
+            return Err(Error::Corrupted);
+        }
+        let mut len = [0u8; 8];
+        len.copy_from_slice(&buf[..8]);
+        let ent_len = u64::from_le_bytes(len) as usize;
+        if buf.len() < 8 + ent_len {
+            return Err(Error::Corrupted);
+        }
+        let mut de = Deserializer::new(&buf[8..8 + ent_len]);
+        let entries: Vec<JournalEntry> = Deserialize::deserialize(&mut de)?;
+
+        let mut objs = &buf[8 + ent_len..];
+        let mut uploads = Vec::with_capacity(entries.len());
+        for ent in entries {
+            if objs.len() < ent.len {
+                return Err(Error::Corrupted);
+            }
+            let (obj, rest) = objs.split_at(ent.len);
+            uploads.push(Upload {
+                rel_path: ent.rel_path,
+                offset: ent.offset,
+                obj: obj.to_vec(),
+            });
+            objs = rest;
+        }
+        Ok(uploads)
+    }
+}
+
+// states shared with uploader
+struct Shared {
+    client: Mutex<HttpClient>,
+    queue: Mutex<UploadQueue>,
+    uploaded: Condvar,
+}
+
+impl Shared {
+    fn new(client: HttpClient) -> Self {
+        Shared {
+            client: Mutex::new(client),
+            queue: Mutex::new(UploadQueue::default()),
+            uploaded: Condvar::new(),
+        }
+    }
+
+    // uploader loop, upload queued objects one by one in order and stop
+    // when the queue is empty or an upload is failed
+    fn upload(&self) {
+        loop {
+            let upload = {
+                let mut queue = self.queue.lock().unwrap();
+                match queue.pending.pop_front() {
+                    Some(upload) => {
+                        let upload = Arc::new(upload);
+                        queue.in_flight = Some(upload.clone());
+                        upload
+                    }
+                    None => {
+                        // journal can be removed now
+                        queue.is_running = false;
+                        queue.is_changed = true;
+                        self.uploaded.notify_all();
+                        return;
+                    }
+                }
+            };
+
+            let result = self.put_with_retry(&upload);
+
+            let mut queue = self.queue.lock().unwrap();
+            queue.in_flight = None;
+            let upload =
+                Arc::try_unwrap(upload).unwrap_or_else(|u| (*u).clone());
+            match result {
+                Ok(_) => {
+                    queue.pending_bytes -= upload.obj.len();
+                    queue.error = None;
+                    self.uploaded.notify_all();
+                }
+                Err(err) => {
+                    warn!("upload {:?} failed: {}", upload.rel_path, err);
+                    queue.pending.push_front(upload);
+                    queue.error = Some(err);
+                    queue.is_running = false;
+                    self.uploaded.notify_all();
+                    return;
+                }
+            }
+        }
+    }
+
+    fn put_with_retry(&self, upload: &Upload) -> Result<()> {
+        let mut retry = 0;
+        loop {
+            let result = {
+                let mut client = self.client.lock().unwrap();
+                client.put(
+                    &upload.rel_path,
+                    upload.offset,
+                    CacheControl::Long,
+                    &upload.obj,
+                )
+            };
+            match result {
+                Ok(_) => return Ok(()),
+                Err(err) => {
+                    if retry >= UPLOAD_RETRY {
+                        return Err(err);
+                    }
+                    retry += 1;
+                    debug!(
+                        "upload {:?} failed: {}, retry {}",
+                        upload.rel_path, err, retry
+                    );
+                    thread::sleep(Duration::from_millis(
+                        UPLOAD_RETRY_DELAY * retry,
+                    ));
+                }
+            }
+        }
+    }
+}
+
 pub struct LocalCache {
     meta: CacheMeta,
 
@@ -50,15 +290,23 @@ pub struct LocalCache {
     // local cache change flag
     is_changed: bool,
 
-    // http client
-    client: HttpClient,
+    // http client and upload queue
+    shared: Arc<Shared>,
+
+    // background uploader, only used in write-back mode
+    write_back: bool,
+    uploader: Option<ThreadPool>,
 
     crypto: Crypto,
     key: Key,
+
+    // lookup and eviction counters
+    counters: Option<Arc<CacheCounters>>,
 }
 
 impl LocalCache {
     const META_FILE_NAME: &'static str = "cache_meta";
+    const JOURNAL_FILE_NAME: &'static str = "upload_journal";
 
     pub fn new(
         cache_type: CacheType,
@@ -66,6 +314,7 @@ impl LocalCache {
         base: &Path,
         repo_id: &str,
         access_key: &str,
+        write_back: bool,
     ) -> Result<Self> {
         let capacity = capacity_in_mb * 1024 * 1024; // capacity is in MB
         let client = HttpClient::new(repo_id, access_key)?;
@@ -94,9 +343,12 @@ impl LocalCache {
             meta,
             backend,
             is_changed: false,
-            client,
+            shared: Arc::new(Shared::new(client)),
+            write_back,
+            uploader: None,
             crypto: Crypto::default(),
             key: Key::new_empty(),
+            counters: None,
         })
     }
 
@@ -106,14 +358,21 @@ impl LocalCache {
         self.key = key;
     }
 
+    #[inline]
+    pub fn set_counters(&mut self, counters: &Arc<CacheCounters>) {
+        self.counters = Some(counters.clone());
+    }
+
     #[inline]
     pub fn repo_exists(&self) -> Result<bool> {
-        self.client.repo_exists()
+        let client = self.shared.client.lock().unwrap();
+        client.repo_exists()
     }
 
     #[inline]
     pub fn connect(&mut self, force: bool) -> Result<()> {
-        self.client.open_session(force)?;
+        let mut client = self.shared.client.lock().unwrap();
+        client.open_session(force)?;
         Ok(())
     }
 
@@ -125,6 +384,9 @@ impl LocalCache {
             self.meta.lru.remove(&item.0);
             self.meta.used -= item.1;
         }
+        if let Some(ref counters) = self.counters {
+            counters.evict(to_evict.len());
+        }
 
         Ok(())
     }
@@ -181,25 +443,83 @@ impl LocalCache {
         // if object is already in cache
         if self.backend.contains(rel_path) {
             let _ = self.meta.lru.get_refresh(rel_path);
+            if let Some(ref counters) = self.counters {
+                counters.hit();
+            }
             return Ok(());
         }
+        if let Some(ref counters) = self.counters {
+            counters.miss();
+        }
+
+        // the object could be partially put and still waiting to be
+        // uploaded, in that case remote object is outdated
+        if self.write_back {
+            self.wait_clean(rel_path)?;
+        }
 
         // if object is not in cache, get it from remote and then add
         // to local cache
         let remote = {
-            let obj =
-                self.client.get(rel_path, CacheControl::from(is_pinned))?;
-            self.reserve_place(obj.len())?;
-            obj
+            let mut client = self.shared.client.lock().unwrap();
+            client.get(rel_path, CacheControl::from(is_pinned))?
         };
-        self.backend.insert(rel_path, &remote)?;
+        self.insert_local(rel_path, &remote, is_pinned)
+    }
+
+    // add object to local cache
+    fn insert_local(
+        &mut self,
+        rel_path: &Path,
+        obj: &[u8],
+        is_pinned: bool,
+    ) -> Result<()> {
+        self.reserve_place(obj.len())?;
+        self.backend.insert(rel_path, obj)?;
 
         // add to lru and increase used size
         self.meta.lru.insert(
             rel_path.to_path_buf(),
-            CacheItem::new(remote.len(), is_pinned),
+            CacheItem::new(obj.len(), is_pinned),
         );
-        self.meta.used += remote.len();
+        self.meta.used += obj.len();
+
+        Ok(())
+    }
+
+    // download multiple unpinned objects to local cache concurrently
+    //
+    // Objects already in local cache are skipped. Failed downloads are
+    // ignored here, they will be retried and reported when the objects are
+    // actually read.
+    pub fn prefetch(&mut self, rel_paths: &[PathBuf]) -> Result<()> {
+        let mut to_fetch: Vec<PathBuf> = Vec::new();
+        for rel_path in rel_paths {
+            if !self.backend.contains(rel_path)
+                && !to_fetch.contains(rel_path)
+                && !(self.write_back && self.is_dirty(rel_path))
+            {
+                to_fetch.push(rel_path.clone());
+            }
+        }
+
+        // single object will be downloaded when it is read
+        if to_fetch.len() < 2 {
+            return Ok(());
+        }
+
+        self.is_changed = true;
+
+        let objs = {
+            let mut client = self.shared.client.lock().unwrap();
+            client.get_many(&to_fetch, CacheControl::Long)?
+        };
+        for (rel_path, obj) in to_fetch.iter().zip(objs) {
+            match obj {
+                Ok(obj) => self.insert_local(rel_path, &obj, false)?,
+                Err(err) => debug!("prefetch {:?} failed: {}", rel_path, err),
+            }
+        }
 
         Ok(())
     }
@@ -217,7 +537,7 @@ impl LocalCache {
 
     fn save_meta(&mut self) -> Result<()> {
         // get latest update sequence from http client
-        self.meta.useq = self.client.get_update_seq();
+        self.meta.useq = self.shared.client.lock().unwrap().get_update_seq();
 
         // serialize meta and write it to local cache
         let mut buf = Vec::new();
@@ -239,6 +559,18 @@ impl LocalCache {
             return Ok(());
         }
 
+        // uploads pending when the repo was closed must be resumed even if
+        // local cache is cleared below
+        let uploads = if self.write_back {
+            self.load_journal()?
+        } else {
+            Vec::new()
+        };
+        self.open_meta()?;
+        self.resume_uploads(uploads)
+    }
+
+    fn open_meta(&mut self) -> Result<()> {
         // load cache meta
         match self.load_meta() {
             Ok(meta) => {
@@ -248,7 +580,8 @@ impl LocalCache {
                 }
 
                 // get remote update sequence
-                let remote_useq = self.client.get_update_seq();
+                let remote_useq =
+                    self.shared.client.lock().unwrap().get_update_seq();
 
                 // only if the update sequences are matched, we can then
                 // use the local cache
@@ -302,24 +635,26 @@ impl LocalCache {
         // remove from local cache first
         self.del_local(rel_path)?;
 
-        let cache_ctl = CacheControl::from(is_pinned);
-
-        // then save to remote
-        self.client.put(rel_path, offset, cache_ctl, obj)?;
+        // then save to remote, or queue it for uploading in write-back
+        // mode. Pinned objects, which are wal and super block, are always
+        // saved synchronously as they are the commit points, and all the
+        // queued objects must be uploaded before them, otherwise remote
+        // could refer to objects it doesn't have yet.
+        if self.write_back && !is_pinned {
+            self.enqueue(rel_path, offset, obj)?;
+        } else {
+            if self.write_back {
+                self.cancel_uploads(rel_path);
+                self.wait_uploads()?;
+            }
+            let mut client = self.shared.client.lock().unwrap();
+            client.put(rel_path, offset, CacheControl::from(is_pinned), obj)?;
+        }
 
         // save object to local cache at last and only save when it is
         // a full-put object
         if offset == 0 {
-            self.reserve_place(obj.len())?;
-
-            self.backend.insert(rel_path, obj)?;
-
-            // add to lru and increase used size
-            self.meta.lru.insert(
-                rel_path.to_path_buf(),
-                CacheItem::new(obj.len(), is_pinned),
-            );
-            self.meta.used += obj.len();
+            self.insert_local(rel_path, obj, is_pinned)?;
         }
 
         Ok(())
@@ -351,26 +686,266 @@ impl LocalCache {
         Ok(())
     }
 
-    #[inline]
     pub fn del(&mut self, rel_path: &Path) -> Result<()> {
+        // pending uploads must be cancelled, otherwise the object will be
+        // put back to remote after it is deleted
+        if self.write_back {
+            self.cancel_uploads(rel_path);
+        }
+
         // remove from local cache first then remove from remote
-        self.del_local(rel_path)
-            .and_then(|_| self.client.del(rel_path))
+        self.del_local(rel_path)?;
+        let mut client = self.shared.client.lock().unwrap();
+        client.del(rel_path)
+    }
+
+    // add object to upload queue and start uploader if it is not running
+    fn enqueue(
+        &mut self,
+        rel_path: &Path,
+        offset: usize,
+        obj: &[u8],
+    ) -> Result<()> {
+        {
+            let mut queue = self.shared.queue.lock().unwrap();
+            queue.is_changed = true;
+
+            // wait for uploader if there are too many pending objects
+            while queue.is_running && queue.pending_bytes >= MAX_PENDING_BYTES {
+                queue = self.shared.uploaded.wait(queue).unwrap();
+            }
+
+            // coalesce with the last put to the same object, only the last
+            // one can be merged so the upload order is kept
+            let is_merged = match queue.pending.back_mut() {
+                Some(last) if last.rel_path == rel_path => {
+                    let old_len = last.obj.len();
+                    if last.merge(offset, obj) {
+                        let new_len = last.obj.len();
+                        Some((old_len, new_len))
+                    } else {
+                        None
+                    }
+                }
+                _ => None,
+            };
+            match is_merged {
+                Some((old_len, new_len)) => {
+                    queue.pending_bytes =
+                        queue.pending_bytes - old_len + new_len;
+                }
+                None => {
+                    queue.pending.push_back(Upload {
+                        rel_path: rel_path.to_path_buf(),
+                        offset,
+                        obj: obj.to_vec(),
+                    });
+                    queue.pending_bytes += obj.len();
+                }
+            }
+
+            if queue.is_running {
+                return Ok(());
+            }
+            queue.is_running = true;
+        }
+
+        self.start_uploader()
+    }
+
+    fn start_uploader(&mut self) -> Result<()> {
+        if self.uploader.is_none() {
+            match ThreadPool::new("zbox-upload", 1) {
+                Ok(pool) => self.uploader = Some(pool),
+                Err(err) => {
+                    let mut queue = self.shared.queue.lock().unwrap();
+                    queue.is_running = false;
+                    return Err(err);
+                }
+            }
+        }
+        let shared = self.shared.clone();
+        self.uploader
+            .as_ref()
+            .unwrap()
+            .execute(move || shared.upload());
+        Ok(())
+    }
+
+    #[inline]
+    fn is_dirty(&self, rel_path: &Path) -> bool {
+        let queue = self.shared.queue.lock().unwrap();
+        queue.is_dirty(rel_path)
+    }
+
+    // restart uploader if it is stopped by a failed upload and there are
+    // still pending objects
+    fn restart_uploader(&mut self) -> Result<()> {
+        {
+            let mut queue = self.shared.queue.lock().unwrap();
+            if queue.is_running || queue.pending.is_empty() {
+                return Ok(());
+            }
+            queue.is_running = true;
+        }
+        self.start_uploader()
+    }
+
+    // wait until an object is uploaded, return the upload error if the
+    // uploader is stopped before that
+    fn wait_clean(&mut self, rel_path: &Path) -> Result<()> {
+        if self.is_dirty(rel_path) {
+            self.restart_uploader()?;
+        }
+
+        let mut queue = self.shared.queue.lock().unwrap();
+        while queue.is_running && queue.is_dirty(rel_path) {
+            queue = self.shared.uploaded.wait(queue).unwrap();
+        }
+        if queue.is_dirty(rel_path) {
+            // uploader only stops early on a failed upload, the error could
+            // only be missing if it is already reported
+            return Err(queue.error.take().unwrap_or(Error::NotInSync));
+        }
+        Ok(())
+    }
+
+    // remove pending uploads of an object
+    fn cancel_uploads(&self, rel_path: &Path) {
+        let mut queue = self.shared.queue.lock().unwrap();
+        while queue.is_in_flight(rel_path) {
+            queue = self.shared.uploaded.wait(queue).unwrap();
+        }
+        let mut cancelled = 0;
+        queue.pending.retain(|u| {
+            if u.rel_path == rel_path {
+                cancelled += u.obj.len();
+                false
+            } else {
+                true
+            }
+        });
+        if cancelled > 0 {
+            queue.pending_bytes -= cancelled;
+            queue.is_changed = true;
+        }
+    }
+
+    // wait until all pending objects are uploaded
+    fn wait_uploads(&mut self) -> Result<()> {
+        self.restart_uploader()?;
+
+        let mut queue = self.shared.queue.lock().unwrap();
+        while queue.is_running {
+            queue = self.shared.uploaded.wait(queue).unwrap();
+        }
+        match queue.error.take() {
+            Some(err) => Err(err),
+            None => Ok(()),
+        }
+    }
+
+    fn load_journal(&mut self) -> Result<Vec<Upload>> {
+        let path = Path::new(Self::JOURNAL_FILE_NAME);
+        match self.backend.get(&path) {
+            Ok(buf) => {
+                let buf = self.crypto.decrypt(&buf, &self.key)?;
+                UploadQueue::from_journal(&buf)
+            }
+            Err(ref err) if *err == Error::NotFound => Ok(Vec::new()),
+            Err(err) => Err(err),
+        }
+    }
+
+    // save pending uploads to upload journal if upload queue is changed,
+    // the journal is removed once there is no pending upload
+    fn save_journal(&mut self) -> Result<()> {
+        let buf = {
+            let mut queue = self.shared.queue.lock().unwrap();
+            if !queue.is_changed {
+                return Ok(());
+            }
+            queue.is_changed = false;
+            if queue.in_flight.is_none() && queue.pending.is_empty() {
+                None
+            } else {
+                Some(queue.to_journal()?)
+            }
+        };
+
+        let path = Path::new(Self::JOURNAL_FILE_NAME);
+        match buf {
+            Some(buf) => self
+                .crypto
+                .encrypt(&buf, &self.key)
+                .and_then(|buf| self.backend.insert(&path, &buf)),
+            None => self.backend.remove(&path),
+        }
+    }
+
+    // put uploads loaded from journal back to upload queue and start
+    // uploading them
+    fn resume_uploads(&mut self, uploads: Vec<Upload>) -> Result<()> {
+        if uploads.is_empty() {
+            return Ok(());
+        }
+        debug!("resume {} pending uploads", uploads.len());
+        {
+            let mut queue = self.shared.queue.lock().unwrap();
+            for upload in uploads {
+                queue.pending_bytes += upload.obj.len();
+                queue.pending.push_back(upload);
+            }
+            queue.is_changed = true;
+        }
+
+        // the journal could be cleared with local cache, save it again
+        self.save_journal()?;
+        self.restart_uploader()
     }
 
+    // flush local cache
+    //
+    // In write-back mode, flush waits for all pending uploads. With file
+    // cache, pending uploads are also saved to upload journal before that,
+    // so they will be resumed if the process crashes before they are
+    // uploaded.
     pub fn flush(&mut self) -> Result<()> {
         if self.is_changed {
+            if self.write_back {
+                let is_file = self.meta.cache_type == CacheType::File;
+                if is_file {
+                    self.save_journal()?;
+                }
+                self.wait_uploads()?;
+                if is_file {
+                    // remove the journal as nothing is pending now
+                    self.save_journal()?;
+                }
+            }
             self.save_meta()?;
-            self.client.flush()?;
+            self.shared.client.lock().unwrap().flush()?;
             self.is_changed = false;
         }
         Ok(())
     }
 
     pub fn destroy_repo(&mut self) -> Result<()> {
-        self.client
-            .destroy_repo()
-            .and_then(|_| self.backend.clear())
+        // discard all pending uploads and wait for the in-flight one
+        {
+            let mut queue = self.shared.queue.lock().unwrap();
+            let cancelled: usize =
+                queue.pending.drain(..).map(|u| u.obj.len()).sum();
+            queue.pending_bytes -= cancelled;
+            while queue.is_running {
+                queue = self.shared.uploaded.wait(queue).unwrap();
+            }
+            queue.error = None;
+            queue.is_changed = false;
+        }
+
+        self.shared.client.lock().unwrap().destroy_repo()?;
+        self.backend.clear()
     }
 }
 
@@ -381,9 +956,12 @@ impl Default for LocalCache {
             meta: CacheMeta::default(),
             backend: Box::new(DummyBackend::default()),
             is_changed: false,
-            client: HttpClient::default(),
+            shared: Arc::new(Shared::new(HttpClient::default())),
+            write_back: false,
+            uploader: None,
             crypto: Crypto::default(),
             key: Key::new_empty(),
+            counters: None,
         }
     }
 }
@@ -393,6 +971,7 @@ impl Debug for LocalCache {
         f.debug_struct("LocalCache")
             .field("meta", &self.meta)
             .field("is_changed", &self.is_changed)
+            .field("write_back", &self.write_back)
             .finish()
     }
 }
@@ -409,13 +988,19 @@ mod tests {
     use super::*;
     use base::init_env;
 
-    fn test_local_cache(cache_type: CacheType, base: &Path) {
+    fn test_local_cache(cache_type: CacheType, base: &Path, write_back: bool) {
         init_env();
         let repo_id = "repo456";
         let access_key = "accessKey456";
-        let mut cache =
-            LocalCache::new(cache_type, 1, base, &repo_id, &access_key)
-                .unwrap();
+        let mut cache = LocalCache::new(
+            cache_type,
+            1,
+            base,
+            &repo_id,
+            &access_key,
+            write_back,
+        )
+        .unwrap();
 
         let k300 = 300 * 1000;
         let k400 = 400 * 1000;
@@ -441,7 +1026,7 @@ mod tests {
         assert!(!cache.repo_exists().unwrap());
 
         // test init
-        cache.connect().unwrap();
+        cache.connect(false).unwrap();
         cache.init().unwrap();
         assert_eq!(cache.meta.lru.len(), 0);
 
@@ -495,10 +1080,16 @@ mod tests {
 
         // re-open local cache with bigger capacity
         drop(cache);
-        let mut cache =
-            LocalCache::new(cache_type, 2, base, &repo_id, &access_key)
-                .unwrap();
-        cache.connect().unwrap();
+        let mut cache = LocalCache::new(
+            cache_type,
+            2,
+            base,
+            &repo_id,
+            &access_key,
+            write_back,
+        )
+        .unwrap();
+        cache.connect(false).unwrap();
         cache.open().unwrap();
 
         // delete object not exists should succeed
@@ -509,13 +1100,22 @@ mod tests {
         cache.put(&rel_path2, 0, &obj2).unwrap();
         cache.put(&rel_path3, 0, &obj3).unwrap();
         cache.flush().unwrap();
+        assert!(!cache.is_dirty(&rel_path));
+        assert!(!cache.is_dirty(&rel_path2));
+        assert!(!cache.is_dirty(&rel_path3));
 
         // re-open cache with smaller capacity
         drop(cache);
-        let mut cache =
-            LocalCache::new(cache_type, 1, base, &repo_id, &access_key)
-                .unwrap();
-        cache.connect().unwrap();
+        let mut cache = LocalCache::new(
+            cache_type,
+            1,
+            base,
+            &repo_id,
+            &access_key,
+            write_back,
+        )
+        .unwrap();
+        cache.connect(false).unwrap();
         cache.open().unwrap();
         if cache_type == CacheType::File {
             assert_eq!(cache.meta.lru.len(), 3);
@@ -527,11 +1127,20 @@ mod tests {
         if cache_type == CacheType::File {
             assert_eq!(cache.meta.lru.len(), 2);
         }
+
+        // pinned object is a commit point, objects put before it must be
+        // uploaded first
+        cache.put(&rel_path2, 0, &obj2).unwrap();
+        cache
+            .put_pinned(Path::new("wal/pinned"), &obj[..100])
+            .unwrap();
+        assert!(!cache.is_dirty(&rel_path));
+        assert!(!cache.is_dirty(&rel_path2));
     }
 
     #[test]
     fn local_cache_mem() {
-        test_local_cache(CacheType::Mem, Path::new(""));
+        test_local_cache(CacheType::Mem, Path::new(""), false);
     }
 
     #[test]
@@ -541,6 +1150,100 @@ mod tests {
         //if base.exists() {
         //std::fs::remove_dir_all(&base).unwrap();
         //}
-        test_local_cache(CacheType::File, &base);
+        test_local_cache(CacheType::File, &base, false);
+    }
+
+    #[test]
+    fn local_cache_write_back_mem() {
+        test_local_cache(CacheType::Mem, Path::new(""), true);
+    }
+
+    #[test]
+    fn local_cache_write_back_file() {
+        let tmpdir = TempDir::new("zbox_test").expect("Create temp dir failed");
+        let base = tmpdir.path().to_path_buf();
+        test_local_cache(CacheType::File, &base, true);
+    }
+
+    #[test]
+    fn local_cache_upload_journal() {
+        init_env();
+        let tmpdir = TempDir::new("zbox_test").expect("Create temp dir failed");
+        let base = tmpdir.path().to_path_buf();
+        let repo_id = "repo789";
+        let access_key = "accessKey789";
+        let rel_path = Path::new("data/cc/dd/journal");
+        let mut obj = vec![0u8; 1000];
+        Crypto::random_buf(&mut obj);
+
+        // journal round trip
+        let mut queue = UploadQueue::default();
+        queue.pending.push_back(Upload {
+            rel_path: rel_path.to_path_buf(),
+            offset: 0,
+            obj: obj[..10].to_vec(),
+        });
+        queue.in_flight = Some(Arc::new(Upload {
+            rel_path: rel_path.to_path_buf(),
+            offset: 10,
+            obj: obj[10..].to_vec(),
+        }));
+        let uploads =
+            UploadQueue::from_journal(&queue.to_journal().unwrap()).unwrap();
+        assert_eq!(uploads.len(), 2);
+        assert_eq!(uploads[0].offset, 10);
+        assert_eq!(&uploads[0].obj[..], &obj[10..]);
+        assert_eq!(uploads[1].offset, 0);
+        assert_eq!(&uploads[1].obj[..], &obj[..10]);
+
+        // save a pending upload to journal without uploading it, as if
+        // repo is closed before it is uploaded
+        let mut cache = LocalCache::new(
+            CacheType::File,
+            1,
+            &base,
+            &repo_id,
+            &access_key,
+            true,
+        )
+        .unwrap();
+        cache.connect(false).unwrap();
+        cache.init().unwrap();
+        {
+            let mut queue = cache.shared.queue.lock().unwrap();
+            queue.pending.push_back(Upload {
+                rel_path: rel_path.to_path_buf(),
+                offset: 0,
+                obj: obj.clone(),
+            });
+            queue.pending_bytes = obj.len();
+            queue.is_changed = true;
+        }
+        cache.save_journal().unwrap();
+        cache.save_meta().unwrap();
+        drop(cache);
+
+        // the upload is resumed when cache is re-opened
+        let mut cache = LocalCache::new(
+            CacheType::File,
+            1,
+            &base,
+            &repo_id,
+            &access_key,
+            true,
+        )
+        .unwrap();
+        cache.connect(false).unwrap();
+        cache.open().unwrap();
+        let mut dst = vec![0u8; obj.len()];
+        cache.get_to(&rel_path, 0, &mut dst).unwrap();
+        assert_eq!(&dst[..], &obj[..]);
+
+        // journal is removed once all uploads are done
+        cache.wait_uploads().unwrap();
+        cache.flush().unwrap();
+        assert!(!cache
+            .backend
+            .contains(Path::new(LocalCache::JOURNAL_FILE_NAME)));
     }
 }
@@ -191,8 +191,56 @@ impl SectorMgr {
         Ok(())
     }
 
+    // download sectors covered by spans to local cache concurrently,
+    // sectors in staging buffer or having deleted blocks are skipped
+    fn prefetch(
+        &self,
+        spans: &[Span],
+        local_cache: &mut LocalCache,
+    ) -> Result<()> {
+        let mut rel_paths = Vec::new();
+        for span in spans {
+            for sec_span in span.divide_by(BLKS_PER_SECTOR) {
+                let sec_idx = sec_span.begin / BLKS_PER_SECTOR;
+                let offset = (sec_span.begin % BLKS_PER_SECTOR) * BLK_SIZE;
+                if (sec_idx == self.sec_idx && offset < self.sec_top)
+                    || self.rmap.has_deleted(sec_idx, sec_span)
+                {
+                    continue;
+                }
+                rel_paths.push(sector_rel_path(sec_idx, &self.hash_key));
+            }
+        }
+        local_cache.prefetch(&rel_paths)
+    }
+
     pub fn get_blocks(&mut self, dst: &mut [u8], span: Span) -> Result<()> {
         let mut local_cache = self.local_cache.write().unwrap();
+        self.prefetch(&[span], &mut local_cache)?;
+        self.read_blocks(dst, span, &mut local_cache)
+    }
+
+    // read blocks in multiple spans, sectors of all the spans are
+    // downloaded together
+    pub fn get_blocks_batch(
+        &mut self,
+        blks: &mut [(Span, &mut [u8])],
+    ) -> Result<()> {
+        let mut local_cache = self.local_cache.write().unwrap();
+        let spans: Vec<Span> = blks.iter().map(|blk| blk.0).collect();
+        self.prefetch(&spans, &mut local_cache)?;
+        for (span, dst) in blks.iter_mut() {
+            self.read_blocks(dst, *span, &mut local_cache)?;
+        }
+        Ok(())
+    }
+
+    fn read_blocks(
+        &self,
+        dst: &mut [u8],
+        span: Span,
+        local_cache: &mut LocalCache,
+    ) -> Result<()> {
         let mut read = 0;
 
         for sec_span in span.divide_by(BLKS_PER_SECTOR) {
@@ -338,9 +386,10 @@ mod tests {
             Path::new(""),
             &repo_id,
             &access_key,
+            false,
         )
         .unwrap();
-        cache.connect().unwrap();
+        cache.connect(false).unwrap();
         cache.init().unwrap();
 
         let mut sec_mgr = SectorMgr::new(&cache.into_ref());
@@ -368,6 +417,20 @@ mod tests {
         sec_mgr.get_blocks(&mut dst, span2).unwrap();
         assert_eq!(&dst, &blks2);
 
+        // batch read
+        {
+            let mut dst = vec![0u8; blks.len()];
+            let mut dst2 = vec![0u8; blks2.len()];
+            sec_mgr
+                .get_blocks_batch(&mut [
+                    (span, &mut dst[..]),
+                    (span2, &mut dst2[..]),
+                ])
+                .unwrap();
+            assert_eq!(&dst, &blks);
+            assert_eq!(&dst2, &blks2);
+        }
+
         sec_mgr.del_blocks(span).unwrap();
         assert_eq!(
             sec_mgr.get_blocks(&mut dst, span).unwrap_err(),
@@ -62,6 +62,14 @@ pub trait Transport: Send + Sync {
     // HTTP GET request
     fn get(&self, uri: &Uri, headers: &HeaderMap) -> Result<Response>;
 
+    // HTTP GET requests for multiple objects, the responses are in the same
+    // order as requests, by default they are sent one by one
+    fn get_many(&self, reqs: &[(Uri, HeaderMap)]) -> Vec<Result<Response>> {
+        reqs.iter()
+            .map(|(uri, headers)| self.get(uri, headers))
+            .collect()
+    }
+
     // HTTP PUT request
     fn put(
         &mut self,
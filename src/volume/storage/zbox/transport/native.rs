@@ -1,11 +1,16 @@
 use http::{HeaderMap, Response as HttpResponse, Uri};
-use std::io::Read;
+use std::io::{Cursor, Read};
+use std::sync::mpsc::channel;
 use std::time::Duration;
 
 use reqwest::{Client, Response as NativeResponse};
 
 use super::{Response, Transport};
-use error::Result;
+use base::thread_pool::ThreadPool;
+use error::{Error, Result};
+
+// max number of concurrent in-flight get requests
+const MAX_IN_FLIGHT: usize = 4;
 
 // convert reqwest response to response
 fn create_response(resp: NativeResponse) -> Result<Response> {
@@ -18,18 +23,44 @@ fn create_response(resp: NativeResponse) -> Result<Response> {
     Ok(ret)
 }
 
+// send get request and read the whole response body, this is run in
+// fetcher threads so the body must not borrow the connection
+fn fetch(
+    client: &Client,
+    url: &str,
+    headers: HeaderMap,
+) -> Result<HttpResponse<Vec<u8>>> {
+    let mut resp = client.get(url).headers(headers).send()?;
+    let mut body = Vec::new();
+    resp.read_to_end(&mut body)?;
+
+    let mut builder = HttpResponse::builder();
+    builder.status(resp.status()).version(resp.version());
+    for (name, value) in resp.headers() {
+        builder.header(name, value);
+    }
+    builder.body(body).map_err(Error::from)
+}
+
 // transport using native http layer
 pub struct NativeTransport {
     client: Client,
+
+    // thread pool for concurrent get requests
+    fetcher: ThreadPool,
 }
 
 impl NativeTransport {
     pub fn new(timeout: u32) -> Result<Self> {
+        // keep enough idle connections alive, so concurrent requests can
+        // reuse them
         let client = Client::builder()
             .timeout(Duration::from_secs(u64::from(timeout)))
+            .max_idle_per_host(MAX_IN_FLIGHT)
             .build()?;
+        let fetcher = ThreadPool::new("zbox-fetch", MAX_IN_FLIGHT)?;
 
-        Ok(NativeTransport { client })
+        Ok(NativeTransport { client, fetcher })
     }
 }
 
@@ -44,6 +75,45 @@ impl Transport for NativeTransport {
         create_response(resp)
     }
 
+    fn get_many(&self, reqs: &[(Uri, HeaderMap)]) -> Vec<Result<Response>> {
+        if reqs.len() < 2 {
+            return reqs
+                .iter()
+                .map(|(uri, headers)| self.get(uri, headers))
+                .collect();
+        }
+
+        trace!("get many: {} requests", reqs.len());
+
+        // send requests to fetcher threads, at most MAX_IN_FLIGHT requests
+        // are in flight at the same time
+        let (tx, rx) = channel();
+        for (idx, (uri, headers)) in reqs.iter().enumerate() {
+            let client = self.client.clone();
+            let url = uri.to_string();
+            let headers = headers.clone();
+            let tx = tx.clone();
+            self.fetcher.execute(move || {
+                let _ = tx.send((idx, fetch(&client, &url, headers)));
+            });
+        }
+        drop(tx);
+
+        // collect responses and put them in request order
+        let mut ret: Vec<Option<Result<Response>>> =
+            (0..reqs.len()).map(|_| None).collect();
+        for (idx, resp) in rx.iter() {
+            ret[idx] = Some(resp.and_then(|resp| {
+                let (parts, body) = resp.into_parts();
+                let body = Box::new(Cursor::new(body)) as Box<dyn Read>;
+                Ok(Response::new(HttpResponse::from_parts(parts, body)))
+            }));
+        }
+        ret.into_iter()
+            .map(|resp| resp.unwrap_or(Err(Error::RequestError)))
+            .collect()
+    }
+
     fn put(
         &mut self,
         uri: &Uri,
@@ -5,6 +5,7 @@ use super::index_accessor::IndexAccessor;
 use super::local_cache::{CacheType, LocalCache, LocalCacheRef};
 use super::sector::SectorMgr;
 use base::crypto::{Crypto, Key};
+use base::metrics::MetricsRef;
 use base::IntoRef;
 use error::{Error, Result};
 use trans::Eid;
@@ -13,15 +14,20 @@ use volume::storage::index_mgr::{IndexMgr, Lsmt, MemTab, Tab};
 use volume::storage::Storable;
 
 // parse uri
-// example: access_key@repo_id?cache_type=mem&cache_size=2mb[&base=path]
+// example:
+//   access_key@repo_id?cache_type=mem&cache_size=2mb[&base=path]
+//   [&write_back=true]
 // return: (
 //   access_key: &str,
 //   repo_id: &str,
 //   cache_type: CacheType,
 //   cache_size: usize,
-//   base: PathBuf
+//   base: PathBuf,
+//   write_back: bool
 // )
-fn parse_uri(mut uri: &str) -> Result<(&str, &str, CacheType, usize, PathBuf)> {
+fn parse_uri(
+    mut uri: &str,
+) -> Result<(&str, &str, CacheType, usize, PathBuf, bool)> {
     if !uri.is_ascii() {
         return Err(Error::InvalidUri);
     }
@@ -48,6 +54,7 @@ fn parse_uri(mut uri: &str) -> Result<(&str, &str, CacheType, usize, PathBuf)> {
     let mut cache_type: Option<CacheType> = Some(CacheType::Mem);
     let mut cache_size: Option<usize> = Some(1);
     let mut base: Option<PathBuf> = None;
+    let mut write_back = false;
 
     // parse parameters
     if !uri.is_empty() {
@@ -77,6 +84,18 @@ fn parse_uri(mut uri: &str) -> Result<(&str, &str, CacheType, usize, PathBuf)> {
                 "base" => {
                     base = Some(PathBuf::from(value));
                 }
+                "write_back" => {
+                    write_back =
+                        value.parse::<bool>().map_err(|_| Error::InvalidUri)?;
+
+                    // write-back needs background thread
+                    #[cfg(target_arch = "wasm32")]
+                    {
+                        if write_back {
+                            return Err(Error::InvalidUri);
+                        }
+                    }
+                }
                 _ => return Err(Error::InvalidUri),
             }
         }
@@ -93,6 +112,7 @@ fn parse_uri(mut uri: &str) -> Result<(&str, &str, CacheType, usize, PathBuf)> {
         cache_type.unwrap(),
         cache_size.unwrap(),
         base.unwrap_or_else(|| PathBuf::from("")),
+        write_back,
     ))
 }
 
@@ -119,12 +139,12 @@ impl ZboxStorage {
     // create zbox storage
     pub fn new(uri: &str) -> Result<Self> {
         // parse uri string
-        let (access_key, repo_id, cache_type, cache_size, base) =
+        let (access_key, repo_id, cache_type, cache_size, base, write_back) =
             parse_uri(uri)?;
 
         // create local cache
         let local_cache = LocalCache::new(
-            cache_type, cache_size, &base, repo_id, access_key,
+            cache_type, cache_size, &base, repo_id, access_key, write_back,
         )?
         .into_ref();
 
@@ -252,6 +272,14 @@ impl Storable for ZboxStorage {
         self.sec_mgr.get_blocks(dst, span)
     }
 
+    #[inline]
+    fn get_blocks_batch(
+        &mut self,
+        blks: &mut [(Span, &mut [u8])],
+    ) -> Result<()> {
+        self.sec_mgr.get_blocks_batch(blks)
+    }
+
     #[inline]
     fn put_blocks(&mut self, span: Span, blks: &[u8]) -> Result<()> {
         assert_eq!(blks.len(), span.bytes_len());
@@ -276,6 +304,14 @@ impl Storable for ZboxStorage {
         let mut local_cache = self.local_cache.write().unwrap();
         local_cache.destroy_repo()
     }
+
+    fn set_metrics(&mut self, metrics: &MetricsRef) {
+        {
+            let mut local_cache = self.local_cache.write().unwrap();
+            local_cache.set_counters(&metrics.local_cache);
+        }
+        self.idx_mgr.set_metrics(metrics);
+    }
 }
 
 impl Debug for ZboxStorage {
@@ -308,12 +344,18 @@ mod tests {
         assert_eq!(parse_uri("zbox://foo@").unwrap_err(), Error::InvalidUri);
         assert!(parse_uri("zbox://foo@bar").is_ok());
         assert!(parse_uri("zbox://foo@bar?").is_ok());
+        assert!(!parse_uri("zbox://foo@bar").unwrap().5);
+        assert!(parse_uri("zbox://foo@bar?write_back=true").unwrap().5);
+        assert_eq!(
+            parse_uri("zbox://foo@bar?write_back=1").unwrap_err(),
+            Error::InvalidUri
+        );
     }
 
     fn do_test(uri: &str) {
         init_env();
         let mut zs = ZboxStorage::new(uri).unwrap();
-        zs.connect().unwrap();
+        zs.connect(false).unwrap();
         zs.init(Crypto::default(), Key::new_empty()).unwrap();
 
         let id = Eid::new();
@@ -362,8 +404,8 @@ mod tests {
         // re-open
         drop(zs);
         let mut zs = ZboxStorage::new(uri).unwrap();
-        zs.connect().unwrap();
-        zs.open(Crypto::default(), Key::new_empty()).unwrap();
+        zs.connect(false).unwrap();
+        zs.open(Crypto::default(), Key::new_empty(), false).unwrap();
 
         zs.get_blocks(&mut dst[..BLK_SIZE], Span::new(0, 1))
             .unwrap();
@@ -385,6 +427,13 @@ mod tests {
         do_test("accessKey456@repo456?cache_type=mem&cache_size=1mb");
     }
 
+    #[test]
+    fn zbox_storage_write_back() {
+        do_test(
+            "accessKey456@repo456?cache_type=mem&cache_size=1mb&write_back=true",
+        );
+    }
+
     #[test]
     fn zbox_storage_file() {
         let tmpdir = TempDir::new("zbox_test").expect("Create temp dir failed");
@@ -1,9 +1,12 @@
+use std::collections::HashMap;
+use std::sync::Mutex;
+
 use rmp_serde::{Deserializer, Serializer};
 use serde::{Deserialize, Serialize};
 
 use super::storage::Storage;
 use super::BLK_SIZE;
-use base::crypto::{Cipher, Cost, Crypto, Key, Salt, SALT_SIZE};
+use base::crypto::{Cipher, Cost, Crypto, Hash, HashKey, Key, Salt, SALT_SIZE};
 use base::{Time, Version};
 use error::{Error, Result};
 use trans::Eid;
@@ -44,6 +47,64 @@ impl Head {
 
         Ok(Head { salt, cost, cipher })
     }
+
+    // check if the other head derives the same volume key
+    #[inline]
+    fn same_key(&self, other: &Head) -> bool {
+        self.salt.as_ref() == other.salt.as_ref()
+            && self.cost.to_u8() == other.cost.to_u8()
+    }
+}
+
+/// Session key cache
+///
+/// Password hashing is deliberately slow, so processes which open the same
+/// repository repeatedly can keep the derived volume keys in memory. Keys
+/// are indexed by a keyed hash of password, salt and cost, the hash key is
+/// random for each process so the plaintext password is never kept. Only
+/// keys which have successfully decrypted a super block are cached.
+struct KeyCache {
+    hash_key: HashKey,
+    keys: HashMap<Hash, Key>,
+}
+
+impl KeyCache {
+    // max number of cached keys, the cache is cleared when it is full
+    const CAPACITY: usize = 16;
+
+    fn new() -> Self {
+        KeyCache {
+            hash_key: Crypto::gen_master_key(),
+            keys: HashMap::new(),
+        }
+    }
+
+    fn digest(&self, pwd: &str, head: &Head) -> Hash {
+        let mut buf = Vec::with_capacity(pwd.len() + Head::BYTES_LEN);
+        buf.extend_from_slice(pwd.as_bytes());
+        buf.extend_from_slice(head.salt.as_ref());
+        buf.push(head.cost.to_u8());
+        Crypto::hash_with_key(&buf, &self.hash_key)
+    }
+
+    fn get(&self, digest: &Hash) -> Option<Key> {
+        self.keys.get(digest).cloned()
+    }
+
+    fn insert(&mut self, digest: Hash, key: &Key) {
+        if self.keys.len() >= Self::CAPACITY {
+            self.keys.clear();
+        }
+        self.keys.insert(digest, key.clone());
+    }
+
+    fn remove(&mut self, digest: &Hash) {
+        self.keys.remove(digest);
+    }
+}
+
+lazy_static! {
+    static ref KEY_CACHE: Mutex<KeyCache> = Mutex::new(KeyCache::new());
 }
 
 /// Super block body, encrypted
@@ -126,21 +187,24 @@ impl SuperBlk {
             .and(storage.put_super_block(&buf, 1))
     }
 
-    // load a specific super block arm
-    fn load_arm(suffix: u64, pwd: &str, storage: &mut Storage) -> Result<Self> {
-        // read raw bytes
-        let buf = storage.get_super_block(suffix)?;
+    // derive volume key from user specified plaintext password
+    fn derive_key(pwd: &str, head: &Head) -> Result<Key> {
+        let crypto = Crypto::new(head.cost, head.cipher)?;
+        let pwd_hash = crypto.hash_pwd(pwd, &head.salt)?;
+        Ok(pwd_hash.value)
+    }
 
-        // read header
+    // read raw bytes and header of a specific super block arm
+    fn read_arm(suffix: u64, storage: &mut Storage) -> Result<(Vec<u8>, Head)> {
+        let buf = storage.get_super_block(suffix)?;
         let head = Head::deseri(&buf)?;
+        Ok((buf, head))
+    }
 
-        // create crypto
+    // decrypt super block arm body using volume key
+    fn open_arm(buf: &[u8], head: Head, vkey: &Key) -> Result<Self> {
         let crypto = Crypto::new(head.cost, head.cipher)?;
 
-        // derive volume key and use it to decrypt body
-        let pwd_hash = crypto.hash_pwd(pwd, &head.salt)?;
-        let vkey = &pwd_hash.value;
-
         // read encryped body
         let comp_buf = crypto.decrypt_with_ad(
             &buf[Head::BYTES_LEN..],
@@ -155,16 +219,69 @@ impl SuperBlk {
         Ok(SuperBlk { head, body })
     }
 
-    // load super block from both left and right arm
-    pub fn load(pwd: &str, storage: &mut Storage) -> Result<Self> {
-        let left = Self::load_arm(0, pwd, storage)?;
-        let right = Self::load_arm(1, pwd, storage)?;
+    // load a specific super block arm
+    fn load_arm(suffix: u64, pwd: &str, storage: &mut Storage) -> Result<Self> {
+        let (buf, head) = Self::read_arm(suffix, storage)?;
+        let vkey = Self::derive_key(pwd, &head)?;
+        Self::open_arm(&buf, head, &vkey)
+    }
+
+    // load super block from both left and right arm, both arms normally
+    // have the same head so the password is hashed only once
+    //
+    // if key_cache is true, the volume key is taken from session key cache
+    // when it is possible, return the super block and whether the key
+    // cache is hit
+    pub fn load(
+        pwd: &str,
+        storage: &mut Storage,
+        key_cache: bool,
+    ) -> Result<(Self, bool)> {
+        let (left_buf, left_head) = Self::read_arm(0, storage)?;
+        let (right_buf, right_head) = Self::read_arm(1, storage)?;
+        let same_key = left_head.same_key(&right_head);
 
-        if left.body.seq == right.body.seq {
-            Ok(left)
+        let mut digest = None;
+        let mut vkey = None;
+        if key_cache {
+            let cache = KEY_CACHE.lock().unwrap();
+            let dgst = cache.digest(pwd, &left_head);
+            vkey = cache.get(&dgst);
+            digest = Some(dgst);
+        }
+        let cached = vkey.is_some();
+        let vkey = match vkey {
+            Some(vkey) => vkey,
+            None => Self::derive_key(pwd, &left_head)?,
+        };
+
+        let left = match Self::open_arm(&left_buf, left_head, &vkey) {
+            Ok(left) => left,
+            Err(err) => {
+                if cached {
+                    KEY_CACHE.lock().unwrap().remove(digest.as_ref().unwrap());
+                }
+                return Err(err);
+            }
+        };
+        let right = if same_key {
+            Self::open_arm(&right_buf, right_head, &vkey)?
         } else {
-            Err(Error::InvalidSuperBlk)
+            let right_vkey = Self::derive_key(pwd, &right_head)?;
+            Self::open_arm(&right_buf, right_head, &right_vkey)?
+        };
+
+        if left.body.seq != right.body.seq {
+            return Err(Error::InvalidSuperBlk);
         }
+
+        if let Some(digest) = digest {
+            if !cached {
+                KEY_CACHE.lock().unwrap().insert(digest, &vkey);
+            }
+        }
+
+        Ok((left, cached))
     }
 
     // try to repair super block using at least one valid
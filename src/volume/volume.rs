@@ -1,15 +1,22 @@
+use std::error::Error as StdError;
 use std::fmt::{self, Debug};
-use std::io::{Read, Result as IoResult, Write};
+use std::io::{
+    copy, sink, Error as IoError, ErrorKind, Read, Result as IoResult, Seek,
+    SeekFrom, Write,
+};
 use std::sync::{Arc, RwLock, Weak};
+use std::time::Instant;
 
 use super::allocator::AllocatorRef;
+use super::compress::{
+    self, CompressCounters, CompressStats, Compressor, Decompressor,
+};
 use super::storage::{self, Storage, StorageRef};
 use super::super_block::SuperBlk;
+use base::buf_pool::BufPoolStats;
 use base::crypto::{Cipher, Cost, Salt};
-use base::lz4::{
-    BlockMode, BlockSize, ContentChecksum, Decoder as Lz4Decoder,
-    Encoder as Lz4Encoder, EncoderBuilder as Lz4EncoderBuilder,
-};
+use base::lz4::{self, Decoder as Lz4Decoder};
+use base::metrics::{MetricsRef, OpenPhase};
 use base::{IntoRef, Time, Version};
 use error::{Error, Result};
 use fs::Config;
@@ -32,6 +39,13 @@ pub struct Info {
 pub struct Volume {
     info: Info,
     storage: StorageRef,
+
+    // compression level for writing, not persisted
+    compress_level: u32,
+    compress_counters: Arc<CompressCounters>,
+
+    // whether to use session key cache when opening, not persisted
+    key_cache: bool,
 }
 
 impl Volume {
@@ -41,7 +55,13 @@ impl Volume {
         info.uri = uri.to_string();
         let storage = Storage::new(uri)?.into_ref();
 
-        Ok(Volume { info, storage })
+        Ok(Volume {
+            info,
+            storage,
+            compress_level: 0,
+            compress_counters: Arc::new(CompressCounters::default()),
+            key_cache: false,
+        })
     }
 
     /// Initialise volume
@@ -89,10 +109,15 @@ impl Volume {
     /// Open volume, return super block payload and meta payload
     pub fn open(&mut self, pwd: &str, force: bool) -> Result<Vec<u8>> {
         let mut storage = self.storage.write().unwrap();
+        let metrics = storage.metrics();
+        let begin = Instant::now();
         storage.connect(force)?;
 
         // load super block from storage
-        let super_blk = SuperBlk::load(pwd, &mut storage)?;
+        let (super_blk, key_cached) =
+            SuperBlk::load(pwd, &mut storage, self.key_cache)?;
+        metrics.record_open_phase(OpenPhase::SuperBlock, begin);
+        metrics.set_key_cached(key_cached);
 
         // check volume version
         if !super_blk.body.ver.match_repo_version() {
@@ -100,12 +125,14 @@ impl Volume {
         }
 
         // open storage
+        let begin = Instant::now();
         storage.open(
             super_blk.head.cost,
             super_blk.head.cipher,
             super_blk.body.key.clone(),
             force,
         )?;
+        metrics.record_open_phase(OpenPhase::Storage, begin);
 
         // set up info
         self.info.id = super_blk.body.volume_id.clone();
@@ -143,7 +170,7 @@ impl Volume {
         let mut storage = self.storage.write().unwrap();
 
         // load old super block
-        let mut super_blk = SuperBlk::load(old_pwd, &mut storage)?;
+        let (mut super_blk, _) = SuperBlk::load(old_pwd, &mut storage, false)?;
 
         // save new super block with new password and cost
         super_blk.head.cost = cost;
@@ -160,6 +187,61 @@ impl Volume {
         self.info.clone()
     }
 
+    // set whether to use session key cache when opening
+    #[inline]
+    pub fn set_key_cache(&mut self, key_cache: bool) {
+        self.key_cache = key_cache;
+    }
+
+    // set number of frame encryption workers
+    #[inline]
+    pub fn set_encrypt_workers(&mut self, workers: usize) -> Result<()> {
+        let mut storage = self.storage.write().unwrap();
+        storage.set_encrypt_workers(workers)
+    }
+
+    // set maximum read-ahead window and its trigger in frames
+    #[inline]
+    pub fn set_read_ahead(
+        &mut self,
+        window: usize,
+        trigger: usize,
+    ) -> Result<()> {
+        let mut storage = self.storage.write().unwrap();
+        storage.set_read_ahead(window, trigger)
+    }
+
+    // set compression level, 0 is fast mode and 1 to 12 are high
+    // compression levels
+    #[inline]
+    pub fn set_compress_level(&mut self, level: u32) -> Result<()> {
+        if level > lz4::HC_LEVEL_MAX {
+            return Err(Error::InvalidArgument);
+        }
+        self.compress_level = level;
+        Ok(())
+    }
+
+    // get compression statistics
+    #[inline]
+    pub fn compress_stats(&self) -> CompressStats {
+        self.compress_counters.snapshot()
+    }
+
+    // get frame buffer pool statistics
+    #[inline]
+    pub fn buf_pool_stats(&self) -> BufPoolStats {
+        let storage = self.storage.read().unwrap();
+        storage.buf_pool_stats()
+    }
+
+    // get runtime metrics from storage
+    #[inline]
+    pub fn metrics(&self) -> MetricsRef {
+        let storage = self.storage.read().unwrap();
+        storage.metrics()
+    }
+
     // get allocator from storage
     #[inline]
     pub fn get_allocator(&self) -> AllocatorRef {
@@ -223,23 +305,72 @@ impl Read for WalReader {
     }
 }
 
+// volume inner reader wrapper
+enum InnerReader {
+    Compress(Decompressor<storage::Reader>),
+    Lz4Stream(Lz4Decoder<storage::Reader>),
+    NoCompress(storage::Reader),
+}
+
+impl InnerReader {
+    fn new(id: &Eid, storage: &StorageRef, compress: bool) -> Result<Self> {
+        let mut rdr = storage::Reader::new(id, storage)?;
+        if !compress {
+            return Ok(InnerReader::NoCompress(rdr));
+        }
+
+        // entities written by older versions are single LZ4 streams, they
+        // are recognised by the missing framed format magic
+        let mut magic = [0u8; 4];
+        let is_framed = match rdr.read_exact(&mut magic) {
+            Ok(_) => magic == compress::MAGIC,
+            Err(ref err) if err.kind() == ErrorKind::UnexpectedEof => false,
+            Err(err) => return Err(Error::from(err)),
+        };
+        if is_framed {
+            let seek_index = rdr.seek_index().to_vec();
+            Ok(InnerReader::Compress(Decompressor::new(rdr, seek_index)))
+        } else {
+            rdr.seek(SeekFrom::Start(0))?;
+            Ok(InnerReader::Lz4Stream(Lz4Decoder::new(rdr)?))
+        }
+    }
+}
+
 /// Volume Reader
+///
+/// Seeking is done directly in storage layer if volume is not compressed.
+/// For compressed entity with seek index, only the frame containing the
+/// new position is decompressed. Otherwise, seeking forward will decompress
+/// and skip data in between, and seeking backward will re-read from the
+/// beginning.
 pub struct Reader {
-    inner: Box<dyn Read>,
+    id: Eid,
+    storage: StorageRef,
+    inner: InnerReader,
+    pos: u64,
 }
 
 impl Reader {
     pub fn new(id: &Eid, vol: &VolumeRef) -> Result<Self> {
         let vol = vol.read().unwrap();
-        let rdr = storage::Reader::new(id, &vol.storage)?;
-        if vol.info.compress {
-            Ok(Reader {
-                inner: Box::new(Lz4Decoder::new(rdr).unwrap()),
-            })
-        } else {
-            Ok(Reader {
-                inner: Box::new(rdr),
-            })
+        let inner = InnerReader::new(id, &vol.storage, vol.info.compress)?;
+        Ok(Reader {
+            id: id.clone(),
+            storage: vol.storage.clone(),
+            inner,
+            pos: 0,
+        })
+    }
+
+    /// Get entity data length if it is known without reading
+    ///
+    /// Length of compressed entity is not known until it is decompressed.
+    #[inline]
+    pub fn len_hint(&self) -> Option<usize> {
+        match self.inner {
+            InnerReader::NoCompress(ref inner) => Some(inner.data_len()),
+            _ => None,
         }
     }
 }
@@ -247,7 +378,62 @@ impl Reader {
 impl Read for Reader {
     #[inline]
     fn read(&mut self, buf: &mut [u8]) -> IoResult<usize> {
-        self.inner.read(buf)
+        let read = match self.inner {
+            InnerReader::Compress(ref mut inner) => inner.read(buf)?,
+            InnerReader::Lz4Stream(ref mut inner) => inner.read(buf)?,
+            InnerReader::NoCompress(ref mut inner) => inner.read(buf)?,
+        };
+        self.pos += read as u64;
+        Ok(read)
+    }
+}
+
+impl Seek for Reader {
+    fn seek(&mut self, pos: SeekFrom) -> IoResult<u64> {
+        let new_pos = match self.inner {
+            InnerReader::NoCompress(ref mut inner) => {
+                self.pos = inner.seek(pos)?;
+                return Ok(self.pos);
+            }
+            InnerReader::Compress(_) | InnerReader::Lz4Stream(_) => match pos {
+                SeekFrom::Start(pos) => pos as i64,
+                SeekFrom::Current(pos) => self.pos as i64 + pos,
+                SeekFrom::End(_) => {
+                    return Err(IoError::new(
+                        ErrorKind::InvalidInput,
+                        "Cannot seek from end in compressed volume",
+                    ));
+                }
+            },
+        };
+        if new_pos < 0 {
+            return Err(IoError::new(
+                ErrorKind::InvalidInput,
+                "Invalid seek to a negative position",
+            ));
+        }
+        let new_pos = new_pos as u64;
+
+        // use the seek index if it is available
+        if let InnerReader::Compress(ref mut inner) = self.inner {
+            if inner.is_seekable() {
+                self.pos = inner.seek(SeekFrom::Start(new_pos))?;
+                return Ok(self.pos);
+            }
+        }
+
+        // restart decompression from the beginning for backward seeking
+        if new_pos < self.pos {
+            self.inner =
+                map_io_err!(InnerReader::new(&self.id, &self.storage, true))?;
+            self.pos = 0;
+        }
+
+        // skip data until the new position, position is advanced by read
+        let skip = new_pos - self.pos;
+        copy(&mut self.by_ref().take(skip), &mut sink())?;
+
+        Ok(self.pos)
     }
 }
 
@@ -294,7 +480,7 @@ impl Finish for WalWriter {
 
 // volume inner writer wrapper
 enum InnerWriter {
-    Compress(Lz4Encoder<storage::Writer>),
+    Compress(Compressor<storage::Writer>),
     NoCompress(storage::Writer),
 }
 
@@ -309,13 +495,11 @@ impl Writer {
         let vol = vol.read().unwrap();
         let wtr = storage::Writer::new(id, &Arc::downgrade(&vol.storage))?;
         let inner = if vol.info.compress {
-            let comp = Lz4EncoderBuilder::new()
-                .block_size(BlockSize::Default)
-                .block_mode(BlockMode::Linked)
-                .checksum(ContentChecksum::NoChecksum)
-                .level(0)
-                .auto_flush(true)
-                .build(wtr)?;
+            let comp = Compressor::new(
+                wtr,
+                vol.compress_level,
+                &vol.compress_counters,
+            )?;
             InnerWriter::Compress(comp)
         } else {
             InnerWriter::NoCompress(wtr)
@@ -344,8 +528,9 @@ impl Finish for Writer {
     fn finish(self) -> Result<()> {
         match self.inner {
             InnerWriter::Compress(inner) => {
-                let (wtr, result) = inner.finish();
-                result.map_err(Error::from)?;
+                let (mut wtr, result) = inner.finish();
+                let seek_index = result.map_err(Error::from)?;
+                wtr.set_seek_index(seek_index);
                 wtr.finish()
             }
             InnerWriter::NoCompress(inner) => inner.finish(),
@@ -373,10 +558,14 @@ mod tests {
     use base::utils::speed_str;
 
     fn setup_mem_vol(loc: &str) -> VolumeRef {
+        setup_mem_vol_with(loc, &Config::default())
+    }
+
+    fn setup_mem_vol_with(loc: &str, cfg: &Config) -> VolumeRef {
         init_env();
         let uri = format!("mem://{}", loc);
         let mut vol = Volume::new(&uri).unwrap();
-        vol.init("pwd", &Config::default(), &Vec::new()).unwrap();
+        vol.init("pwd", cfg, &Vec::new()).unwrap();
         vol.into_ref()
     }
 
@@ -428,6 +617,25 @@ mod tests {
         assert_eq!(Reader::new(&id, &vol).unwrap_err(), Error::NotFound);
     }
 
+    fn seek_test(vol: &VolumeRef) {
+        let id = Eid::new();
+        let mut buf = vec![0u8; 300 * 1024];
+        let seed = RandomSeed::from(&[0u8; RANDOM_SEED_SIZE]);
+        Crypto::random_buf_deterministic(&mut buf, &seed);
+        write_to_entity(&id, &buf, &vol);
+
+        let mut rdr = Reader::new(&id, &vol).unwrap();
+        let mut dst = vec![0u8; 1000];
+        for pos in [200_000, 123, 123_456, 299_000].iter().cloned() {
+            rdr.seek(SeekFrom::Start(pos as u64)).unwrap();
+            rdr.read_exact(&mut dst).unwrap();
+            assert_eq!(&dst[..], &buf[pos..pos + dst.len()]);
+        }
+        rdr.seek(SeekFrom::Current(-2000)).unwrap();
+        rdr.read_exact(&mut dst).unwrap();
+        assert_eq!(&dst[..], &buf[298_000..299_000]);
+    }
+
     #[cfg(any(feature = "storage-file", feature = "storage-zbox"))]
     fn reopen_test(pwd: &str, payload: &[u8], vol: VolumeRef) {
         let id = Eid::new();
@@ -470,6 +678,92 @@ mod tests {
     fn mem_volume() {
         let vol = setup_mem_vol("mem_volume");
         read_write_test(&vol);
+        seek_test(&vol);
+    }
+
+    #[test]
+    fn mem_volume_compress() {
+        let mut cfg = Config::default();
+        cfg.compress = true;
+        let vol = setup_mem_vol_with("mem_volume_compress", &cfg);
+        read_write_test(&vol);
+        seek_test(&vol);
+
+        // random data should skip compression
+        let stats = vol.read().unwrap().compress_stats();
+        assert!(stats.skipped_frames > 0);
+        assert!(stats.skipped_bytes >= 300 * 1024);
+
+        // high compression level
+        {
+            let mut vol = vol.write().unwrap();
+            assert_eq!(
+                vol.set_compress_level(13).unwrap_err(),
+                Error::InvalidArgument
+            );
+            vol.set_compress_level(9).unwrap();
+        }
+        let id = Eid::new();
+        let buf = vec![42u8; 200 * 1024];
+        write_to_entity(&id, &buf, &vol);
+        verify_entity(&id, &buf, &vol);
+        let new_stats = vol.read().unwrap().compress_stats();
+        assert!(new_stats.compressed_frames > stats.compressed_frames);
+        assert!(new_stats.ratio() < stats.ratio());
+
+        // compressed entity is seekable by seek index
+        let mut rdr = Reader::new(&id, &vol).unwrap();
+        match rdr.inner {
+            InnerReader::Compress(ref inner) => assert!(inner.is_seekable()),
+            _ => unreachable!(),
+        }
+        let mut dst = vec![0u8; 1000];
+        for pos in [150_000, 70_000, 199_000].iter().cloned() {
+            rdr.seek(SeekFrom::Start(pos as u64)).unwrap();
+            rdr.read_exact(&mut dst).unwrap();
+            assert_eq!(&dst[..], &buf[pos..pos + dst.len()]);
+        }
+    }
+
+    #[test]
+    fn mem_volume_compress_lz4_stream() {
+        use base::lz4::{
+            BlockMode, BlockSize, ContentChecksum, EncoderBuilder,
+        };
+
+        let mut cfg = Config::default();
+        cfg.compress = true;
+        let vol = setup_mem_vol_with("mem_volume_compress_lz4_stream", &cfg);
+
+        // entity written in linked LZ4 stream format by older versions
+        let id = Eid::new();
+        let mut buf = vec![0u8; 300 * 1024];
+        let seed = RandomSeed::from(&[0u8; RANDOM_SEED_SIZE]);
+        Crypto::random_buf_deterministic(&mut buf[..1000], &seed);
+        {
+            let vol = vol.read().unwrap();
+            let wtr = storage::Writer::new(&id, &Arc::downgrade(&vol.storage))
+                .unwrap();
+            let mut comp = EncoderBuilder::new()
+                .block_size(BlockSize::Default)
+                .block_mode(BlockMode::Linked)
+                .checksum(ContentChecksum::NoChecksum)
+                .level(0)
+                .auto_flush(true)
+                .build(wtr)
+                .unwrap();
+            comp.write_all(&buf).unwrap();
+            let (wtr, result) = comp.finish();
+            result.unwrap();
+            wtr.finish().unwrap();
+        }
+        verify_entity(&id, &buf, &vol);
+
+        let mut rdr = Reader::new(&id, &vol).unwrap();
+        let mut dst = vec![0u8; 1000];
+        rdr.seek(SeekFrom::Start(200_000)).unwrap();
+        rdr.read_exact(&mut dst).unwrap();
+        assert_eq!(&dst[..], &buf[200_000..201_000]);
     }
 
     #[cfg(feature = "storage-file")]
@@ -5,10 +5,11 @@ extern crate zbox;
 
 mod common;
 
+use std::io::Read;
 use std::sync::{Arc, RwLock};
 use std::{thread, time};
 
-use zbox::Error;
+use zbox::{DirEntry, Error, Repo};
 
 #[test]
 fn dir_create_st() {
@@ -65,6 +66,43 @@ fn dir_create_mt() {
     assert_eq!(dirs.len(), worker_cnt * task_cnt);
 }
 
+#[test]
+fn dir_read_mt() {
+    let env = Arc::new(RwLock::new(common::TestEnv::new()));
+    let worker_cnt = 4;
+    let file_cnt = 20;
+
+    {
+        let mut env = env.write().unwrap();
+        env.repo.create_dir_all("/hot/dir").unwrap();
+        for i in 0..file_cnt {
+            env.repo.create_file(format!("/hot/dir/{}", i)).unwrap();
+        }
+    }
+
+    // look up the same directory concurrently, with a fnode cache smaller
+    // than the directory so children are reloaded
+    let mut workers = Vec::new();
+    for i in 0..worker_cnt {
+        let env = env.clone();
+        workers.push(thread::spawn(move || {
+            for j in 0..50 {
+                let env = env.read().unwrap();
+                let path = format!("/hot/dir/{}", (i + j) % file_cnt);
+                assert!(env.repo.metadata(&path).unwrap().is_file());
+                assert!(!env.repo.path_exists("/hot/dir/none").unwrap());
+                if j % 10 == 0 {
+                    let dirs = env.repo.read_dir("/hot/dir").unwrap();
+                    assert_eq!(dirs.len(), file_cnt);
+                }
+            }
+        }));
+    }
+    for w in workers {
+        w.join().unwrap();
+    }
+}
+
 #[test]
 fn dir_read() {
     let mut env = common::TestEnv::new();
@@ -218,3 +256,237 @@ fn dir_copy() {
     repo.copy_dir_all("/ccc/ccc1", "/ccc").unwrap();
     assert!(repo.path_exists("/ccc/ccc11").unwrap());
 }
+
+#[test]
+fn dir_batch() {
+    let mut env = common::TestEnv::new();
+    let repo = &mut env.repo;
+
+    let dir_cnt = 4;
+    let file_cnt = 400;
+
+    fn verify_content(repo: &mut Repo, path: &str, content: &str) {
+        let mut f = repo.open_file(path).unwrap();
+        let mut buf = String::new();
+        f.read_to_string(&mut buf).unwrap();
+        assert_eq!(buf, content);
+    }
+
+    // #1: create dirs and files in batch, more than one transaction
+    {
+        let mut batch = repo.batch();
+        batch.create_dir("/batch").unwrap();
+        for i in 0..dir_cnt {
+            batch.create_dir(format!("/batch/{}", i)).unwrap();
+            for j in 0..file_cnt {
+                let data = format!("{}-{}", i, j);
+                batch
+                    .create_file(format!("/batch/{}/{}", i, j), data.as_bytes())
+                    .unwrap();
+            }
+        }
+        batch.create_dir("/batch/0").unwrap();
+        batch.create_file("/batch/0/0", b"new content").unwrap();
+        batch.commit().unwrap();
+    }
+    for i in 0..dir_cnt {
+        assert_eq!(
+            repo.read_dir(format!("/batch/{}", i)).unwrap().len(),
+            file_cnt
+        );
+        for j in 0..file_cnt {
+            let path = format!("/batch/{}/{}", i, j);
+            if i == 0 && j == 0 {
+                verify_content(repo, &path, "new content");
+            } else {
+                verify_content(repo, &path, &format!("{}-{}", i, j));
+            }
+        }
+    }
+
+    // #2: error cases
+    {
+        let mut batch = repo.batch();
+        assert_eq!(batch.create_dir("batch").unwrap_err(), Error::InvalidPath);
+        batch.create_file("/non-exist/file", b"foo").unwrap();
+        assert_eq!(batch.commit().unwrap_err(), Error::NotFound);
+    }
+    {
+        let mut batch = repo.batch();
+        batch.create_dir("/batch/0/1").unwrap();
+        assert_eq!(batch.commit().unwrap_err(), Error::NotDir);
+    }
+    assert!(!repo.path_exists("/non-exist").unwrap());
+    assert!(repo.is_file("/batch/0/1").unwrap());
+
+    // #3: copy dir tree in batches
+    repo.copy_dir_all("/batch", "/batch2").unwrap();
+    for i in 0..dir_cnt {
+        for j in (0..file_cnt).step_by(50) {
+            let path = format!("/batch2/{}/{}", i, j);
+            if i == 0 && j == 0 {
+                verify_content(repo, &path, "new content");
+            } else {
+                verify_content(repo, &path, &format!("{}-{}", i, j));
+            }
+        }
+    }
+
+    // #4: files with same content in more than one transaction
+    {
+        let mut batch = repo.batch();
+        batch.create_dir("/batch3").unwrap();
+        for i in 0..1100 {
+            batch
+                .create_file(format!("/batch3/{}", i), b"same content")
+                .unwrap();
+        }
+        batch.commit().unwrap();
+    }
+    assert_eq!(repo.read_dir("/batch3").unwrap().len(), 1100);
+    verify_content(repo, "/batch3/1099", "same content");
+}
+
+#[test]
+fn dir_large() {
+    let mut env = common::TestEnv::new();
+    let repo = &mut env.repo;
+
+    let file_cnt = 1300;
+    let name_of = |i: usize| format!("/large/f{:05}", i);
+
+    // #1: create files in batch, children are moved to directory index
+    // and split into several shards
+    repo.create_dir("/large").unwrap();
+    {
+        let mut batch = repo.batch();
+        for i in 0..file_cnt {
+            batch.create_file(name_of(i), b"foo").unwrap();
+        }
+        batch.commit().unwrap();
+    }
+    let dirs = repo.read_dir("/large").unwrap();
+    assert_eq!(dirs.len(), file_cnt);
+    for (i, ent) in dirs.iter().enumerate() {
+        assert_eq!(ent.path().to_str().unwrap(), name_of(i));
+    }
+    for i in (0..file_cnt).step_by(97) {
+        assert!(repo.is_file(name_of(i)).unwrap());
+    }
+
+    // #2: create, remove and rename in indexed directory
+    repo.create_dir("/large/a").unwrap();
+    repo.create_dir("/large/z").unwrap();
+    assert_eq!(
+        repo.create_dir("/large/a").unwrap_err(),
+        Error::AlreadyExists
+    );
+    repo.remove_file(name_of(0)).unwrap();
+    repo.remove_file(name_of(1000)).unwrap();
+    assert!(!repo.path_exists(name_of(0)).unwrap());
+    assert!(!repo.path_exists(name_of(1000)).unwrap());
+    repo.rename(name_of(1), "/large/b").unwrap();
+    repo.rename(name_of(2), "/f2").unwrap();
+    repo.rename("/large/b", name_of(3)).unwrap();
+    assert!(!repo.path_exists(name_of(1)).unwrap());
+    assert!(repo.is_file(name_of(3)).unwrap());
+    assert!(repo.is_file("/f2").unwrap());
+    assert!(repo.is_dir("/large/z").unwrap());
+    let dirs = repo.read_dir("/large").unwrap();
+    assert_eq!(dirs.len(), file_cnt - 2);
+    assert_eq!(dirs[0].path().to_str().unwrap(), "/large/a");
+
+    // #3: remove all children
+    assert_eq!(repo.remove_dir("/large").unwrap_err(), Error::NotEmpty);
+    repo.remove_dir_all("/large").unwrap();
+    assert!(!repo.path_exists("/large").unwrap());
+}
+
+#[test]
+fn dir_read_order() {
+    let mut env = common::TestEnv::new();
+    let repo = &mut env.repo;
+    let names = |dirs: &[DirEntry]| -> Vec<String> {
+        dirs.iter().map(|ent| ent.file_name().to_string()).collect()
+    };
+
+    // #1: small directory lists children in insertion order
+    repo.create_dir("/order").unwrap();
+    let mut added: Vec<String> =
+        (0..256).rev().map(|i| format!("d{:03}", i)).collect();
+    for name in added.iter() {
+        repo.create_dir(format!("/order/{}", name)).unwrap();
+    }
+    assert_eq!(names(&repo.read_dir("/order").unwrap()), added);
+
+    // #2: one more child moves children to directory index, then they are
+    // listed in name order
+    repo.create_dir("/order/a").unwrap();
+    added.push("a".to_string());
+    added.sort();
+    assert_eq!(names(&repo.read_dir("/order").unwrap()), added);
+
+    // #3: name order is kept after shrinking below the threshold
+    for i in 0..128 {
+        repo.remove_dir(format!("/order/d{:03}", i)).unwrap();
+    }
+    added.retain(|name| name.as_str() == "a" || name.as_str() >= "d128");
+    assert_eq!(names(&repo.read_dir("/order").unwrap()), added);
+}
+
+#[test]
+fn dir_dentry_cache() {
+    let mut env = common::TestEnv::new();
+    let repo = &mut env.repo;
+
+    // #1: resolve deep path repeatedly
+    repo.create_dir_all("/a/b/c/d").unwrap();
+    let mut f = repo.create_file("/a/b/c/d/f").unwrap();
+    for _ in 0..10 {
+        assert!(repo.metadata("/a/b/c/d/f").unwrap().is_file());
+        assert!(repo.metadata("/a/b/c/d").unwrap().is_dir());
+    }
+    f.write_once(b"foo").unwrap();
+    drop(f);
+    assert_eq!(repo.metadata("/a/b/c/d/f").unwrap().content_len(), 3);
+
+    // #2: negative entries are invalidated by creation
+    assert!(!repo.path_exists("/a/b/c/d/g").unwrap());
+    assert!(!repo.path_exists("/a/b/c/d/g/h").unwrap());
+    repo.create_dir("/a/b/c/d/g").unwrap();
+    assert!(repo.is_dir("/a/b/c/d/g").unwrap());
+    assert!(!repo.path_exists("/a/b/c/d/g/h").unwrap());
+    {
+        let mut batch = repo.batch();
+        batch.create_file("/a/b/c/d/g/h", b"bar").unwrap();
+        batch.commit().unwrap();
+    }
+    assert!(repo.is_file("/a/b/c/d/g/h").unwrap());
+
+    // #3: entries are invalidated by removal
+    repo.remove_file("/a/b/c/d/f").unwrap();
+    assert!(!repo.path_exists("/a/b/c/d/f").unwrap());
+    repo.create_dir("/a/b/c/d/f").unwrap();
+    assert!(repo.is_dir("/a/b/c/d/f").unwrap());
+    repo.remove_dir("/a/b/c/d/f").unwrap();
+    assert!(!repo.path_exists("/a/b/c/d/f").unwrap());
+
+    // #4: entries under renamed directory are invalidated
+    assert!(!repo.path_exists("/x/d/g/h").unwrap());
+    repo.rename("/a/b/c", "/x").unwrap();
+    assert!(!repo.path_exists("/a/b/c/d/g/h").unwrap());
+    assert!(!repo.path_exists("/a/b/c").unwrap());
+    assert!(repo.is_file("/x/d/g/h").unwrap());
+    repo.create_dir("/a/b/c").unwrap();
+    assert!(!repo.path_exists("/a/b/c/d").unwrap());
+    repo.rename("/x/d/g/h", "/a/b/c/h").unwrap();
+    assert!(!repo.path_exists("/x/d/g/h").unwrap());
+    assert!(repo.is_file("/a/b/c/h").unwrap());
+
+    // #5: copied and removed directory tree
+    repo.copy_dir_all("/x", "/y").unwrap();
+    assert!(repo.is_dir("/y/d/g").unwrap());
+    repo.remove_dir_all("/x").unwrap();
+    assert!(!repo.path_exists("/x/d/g").unwrap());
+    assert!(repo.is_dir("/y/d/g").unwrap());
+}
@@ -9,7 +9,7 @@ mod common;
 
 use rand::{RngCore, SeedableRng};
 use rand_xorshift::XorShiftRng;
-use std::io::{Read, Seek, SeekFrom, Write};
+use std::io::{IoSliceMut, Read, Seek, SeekFrom, Write};
 use std::sync::{Arc, RwLock};
 use std::thread;
 use zbox::{Error, File, OpenOptions};
@@ -579,6 +579,70 @@ fn file_shrink() {
     f.set_len(1).unwrap();
 }
 
+#[test]
+fn file_read_after_shrink() {
+    let mut env = common::TestEnv::new();
+    let mut repo = &mut env.repo;
+
+    let mut rng = XorShiftRng::from_seed([43u8; 16]);
+    let mut buf = vec![0; 1024 * 1024];
+    rng.fill_bytes(&mut buf);
+    let mut buf2 = vec![0; 900 * 1024];
+    rng.fill_bytes(&mut buf2);
+
+    // overwrite the head, so the old segment only has its tail chunks in
+    // use and then is shrunk, the orphan chunks before them keep their
+    // stale positions. Note old versions are only unlinked when file
+    // content dedup is enabled, such as in the memory storage test env.
+    let mut f = OpenOptions::new()
+        .create(true)
+        .version_limit(1)
+        .open(&mut repo, "/file")
+        .unwrap();
+    f.write_once(&buf[..]).unwrap();
+    f.seek(SeekFrom::Start(0)).unwrap();
+    f.write_once(&buf2[..]).unwrap();
+    buf[..buf2.len()].copy_from_slice(&buf2[..]);
+
+    let mut f = repo.open_file("/file").unwrap();
+    let mut dst = Vec::new();
+    f.read_to_end(&mut dst).unwrap();
+    assert_eq!(dst, buf);
+
+    for _ in 0..50 {
+        let offset = buf2.len() - 1000 + rng.next_u32() as usize % 120_000;
+        let len = rng.next_u32() as usize % (64 * 1024);
+        let mut dst = vec![0u8; len];
+        let read = f.read_at(&mut dst, offset as u64).unwrap();
+        let end = std::cmp::min(offset + len, buf.len());
+        assert_eq!(read, end - offset);
+        assert_eq!(&dst[..read], &buf[offset..end]);
+    }
+
+    // vectored read across the overwritten part and the shrunk tail
+    let offset = buf2.len() - 10;
+    let mut dst = vec![0u8; 10];
+    let mut dst2 = vec![0u8; 64 * 1024];
+    let mut dst3 = vec![0u8; buf.len()];
+    let read = f
+        .read_vectored_at(
+            &mut [
+                IoSliceMut::new(&mut dst),
+                IoSliceMut::new(&mut dst2),
+                IoSliceMut::new(&mut dst3),
+            ],
+            offset as u64,
+        )
+        .unwrap();
+    assert_eq!(read, buf.len() - offset);
+    assert_eq!(&dst[..], &buf[offset..offset + 10]);
+    assert_eq!(&dst2[..], &buf[offset + 10..][..64 * 1024]);
+    assert_eq!(
+        &dst3[..read - 10 - 64 * 1024],
+        &buf[offset + 10 + 64 * 1024..]
+    );
+}
+
 #[test]
 fn file_copy() {
     let mut env = common::TestEnv::new();
@@ -733,6 +797,150 @@ fn file_seek() {
         assert_eq!(result, buf.len() * 2 + 1);
         assert_eq!(&dst[..], &[1, 2, 3, 0, 1, 2, 3]);
     }
+
+    // #4: random seek and read in a file spanning multiple segments
+    {
+        let mut buf = vec![0u8; 3 * 1024 * 1024];
+        let mut rng = XorShiftRng::from_seed([42u8; 16]);
+        rng.fill_bytes(&mut buf);
+        let mut f = OpenOptions::new()
+            .create(true)
+            .open(&mut repo, "/file4")
+            .unwrap();
+        f.write_once(&buf[..]).unwrap();
+
+        let mut dst = vec![0u8; 5000];
+        for _ in 0..50 {
+            let pos = rng.next_u32() as usize % (buf.len() - dst.len());
+            f.seek(SeekFrom::Start(pos as u64)).unwrap();
+            f.read_exact(&mut dst).unwrap();
+            assert_eq!(&dst[..], &buf[pos..pos + dst.len()]);
+        }
+
+        // read to end from the middle
+        let mut dst = Vec::new();
+        f.seek(SeekFrom::Start(12345)).unwrap();
+        let result = f.read_to_end(&mut dst).unwrap();
+        assert_eq!(result, buf.len() - 12345);
+        assert_eq!(&dst[..], &buf[12345..]);
+        assert_eq!(f.seek(SeekFrom::Current(0)).unwrap(), buf.len() as u64);
+    }
+}
+
+#[test]
+fn file_read_at() {
+    let mut env = common::TestEnv::new();
+    let mut repo = &mut env.repo;
+    let mut rng = XorShiftRng::from_seed([42u8; 16]);
+
+    // write content and then overwrite its middle, so it has multiple
+    // entries and spans
+    let mut buf = vec![0u8; 1024 * 1024];
+    rng.fill_bytes(&mut buf);
+    let mut buf2 = vec![0u8; 100 * 1024];
+    rng.fill_bytes(&mut buf2);
+    {
+        let mut f = OpenOptions::new()
+            .create(true)
+            .open(&mut repo, "/file")
+            .unwrap();
+        f.write_once(&buf[..]).unwrap();
+        f.seek(SeekFrom::Start(300_000)).unwrap();
+        f.write_once(&buf2[..]).unwrap();
+        buf[300_000..300_000 + buf2.len()].copy_from_slice(&buf2[..]);
+    }
+
+    // #1: read at random offsets
+    let mut f = repo.open_file("/file").unwrap();
+    for _ in 0..100 {
+        let offset = rng.next_u32() as usize % buf.len();
+        let len = rng.next_u32() as usize % (200 * 1024);
+        let mut dst = vec![0u8; len];
+        let read = f.read_at(&mut dst, offset as u64).unwrap();
+        let end = std::cmp::min(offset + len, buf.len());
+        assert_eq!(read, end - offset);
+        assert_eq!(&dst[..read], &buf[offset..end]);
+    }
+
+    // #2: read at or beyond the end
+    let mut dst = [0u8; 10];
+    assert_eq!(f.read_at(&mut dst, buf.len() as u64).unwrap(), 0);
+    assert_eq!(f.read_at(&mut dst, buf.len() as u64 + 10).unwrap(), 0);
+    assert_eq!(f.read_at(&mut [], 0).unwrap(), 0);
+
+    // #3: vectored read across the overwritten part
+    {
+        let mut dst = vec![0u8; 10];
+        let mut dst2 = vec![0u8; 200 * 1024];
+        let mut dst3 = vec![0u8; 10];
+        let read = f
+            .read_vectored_at(
+                &mut [
+                    IoSliceMut::new(&mut dst),
+                    IoSliceMut::new(&mut dst2),
+                    IoSliceMut::new(&mut dst3),
+                ],
+                290_000,
+            )
+            .unwrap();
+        assert_eq!(read, 10 + 200 * 1024 + 10);
+        assert_eq!(&dst[..], &buf[290_000..290_010]);
+        assert_eq!(&dst2[..], &buf[290_010..290_010 + 200 * 1024]);
+        assert_eq!(&dst3[..], &buf[290_010 + 200 * 1024..][..10]);
+
+        // buffers after the end are not read into
+        let mut dst = vec![0u8; 10];
+        let mut dst2 = vec![0u8; 10];
+        let offset = buf.len() as u64 - 5;
+        let read = f
+            .read_vectored_at(
+                &mut [IoSliceMut::new(&mut dst), IoSliceMut::new(&mut dst2)],
+                offset,
+            )
+            .unwrap();
+        assert_eq!(read, 5);
+        assert_eq!(&dst[..5], &buf[buf.len() - 5..]);
+    }
+
+    // #4: file cursor is not changed
+    {
+        let mut dst = Vec::new();
+        let result = f.read_to_end(&mut dst).unwrap();
+        assert_eq!(result, buf.len());
+        assert_eq!(&dst[..], &buf[..]);
+    }
+
+    // #5: concurrent read on the same file
+    let f = Arc::new(f);
+    let buf = Arc::new(buf);
+    let mut workers = Vec::new();
+    for i in 0..4 {
+        let f = f.clone();
+        let buf = buf.clone();
+        workers.push(thread::spawn(move || {
+            let mut rng = XorShiftRng::from_seed([i as u8; 16]);
+            for _ in 0..50 {
+                let offset = rng.next_u32() as usize % buf.len();
+                let len = rng.next_u32() as usize % (64 * 1024);
+                let mut dst = vec![0u8; len];
+                let read = f.read_at(&mut dst, offset as u64).unwrap();
+                let end = std::cmp::min(offset + len, buf.len());
+                assert_eq!(read, end - offset);
+                assert_eq!(&dst[..read], &buf[offset..end]);
+            }
+        }));
+    }
+    for w in workers {
+        w.join().unwrap();
+    }
+
+    // #6: read in write-only file
+    let f = OpenOptions::new()
+        .read(false)
+        .write(true)
+        .open(&mut repo, "/file")
+        .unwrap();
+    assert_eq!(f.read_at(&mut dst, 0).unwrap_err(), Error::CannotRead);
 }
 
 #[test]
@@ -10,16 +10,21 @@ use std::fs;
 use std::io::{self, Read, Seek, SeekFrom, Write};
 use std::path::Path;
 use std::ptr;
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::sync::Mutex;
+use std::thread;
 use std::time::{Duration, Instant};
 
 use rand::{RngCore, SeedableRng};
 use rand_xorshift::XorShiftRng;
+use zbox::bench::{Bench, Work};
 use zbox::{init_env, File, OpenOptions, Repo, RepoOpener};
 
 const DATA_LEN: usize = 60 * 1024 * 1024;
 const FILE_LEN: usize = DATA_LEN / ROUND;
 const ROUND: usize = 3;
 const TX_ROUND: usize = 30;
+const TX_THREADS: usize = 5;
 
 #[inline]
 fn time_str(duration: &Duration) -> String {
@@ -47,12 +52,15 @@ fn print_result(
     read_time: &Duration,
     write_time: &Duration,
     tx_time: &Duration,
+    mt_tx_time: &Duration,
 ) {
     println!(
-        "read: {}, write: {}, tps: {}",
+        "read: {}, write: {}, tps: {}, tps ({} threads): {}",
         speed_str(&read_time),
         speed_str(&write_time),
         tps_str(&tx_time),
+        TX_THREADS,
+        tps_str(&mt_tx_time),
     );
 }
 
@@ -90,7 +98,7 @@ fn test_baseline(data: &Vec<u8>, dir: &Path) {
     }
     let memcpy_time = now.elapsed();
     print!("memcpy: ");
-    print_result(&memcpy_time, &memcpy_time, &tx_time);
+    print_result(&memcpy_time, &memcpy_time, &tx_time, &tx_time);
 
     // test os file system speed
     let now = Instant::now();
@@ -112,7 +120,7 @@ fn test_baseline(data: &Vec<u8>, dir: &Path) {
     let read_time = now.elapsed();
 
     print!("file system: ");
-    print_result(&read_time, &write_time, &tx_time);
+    print_result(&read_time, &write_time, &tx_time, &tx_time);
     println!();
 }
 
@@ -162,8 +170,35 @@ fn test_perf(repo: &mut Repo, files: &mut Vec<File>, data: &[u8]) {
     }
     let tx_time = now.elapsed();
 
+    // multi-thread tx, each thread writes its own file in small txs so
+    // the commits can be grouped together
+    let mut mt_files = Vec::new();
+    for i in 0..TX_THREADS {
+        let file = OpenOptions::new()
+            .create(true)
+            .open(repo, format!("/mt_file_{}", i))
+            .unwrap();
+        mt_files.push(file);
+    }
+    let now = Instant::now();
+    let children: Vec<_> = mt_files
+        .into_iter()
+        .map(|mut file| {
+            let data = data[..TX_ROUND].to_vec();
+            thread::spawn(move || {
+                for i in 0..TX_ROUND / TX_THREADS {
+                    file.write_once(&data[i..i + 1]).unwrap();
+                }
+            })
+        })
+        .collect();
+    for child in children {
+        child.join().unwrap();
+    }
+    let mt_tx_time = now.elapsed();
+
     println!("done");
-    print_result(&read_time, &write_time, &tx_time);
+    print_result(&read_time, &write_time, &tx_time, &mt_tx_time);
     println!();
 }
 
@@ -231,3 +266,184 @@ fn perf_test() {
 
     fs::remove_dir_all(&dir).unwrap();
 }
+
+// storage backends which end-to-end benchmarks run on, each item is a
+// backend name and a function makes repo uri from a unique tag
+fn bench_backends() -> Vec<(&'static str, Box<dyn Fn(&Path, &str) -> String>)> {
+    let mut backends: Vec<(&str, Box<dyn Fn(&Path, &str) -> String>)> = vec![
+        ("mem", Box::new(|_, tag| format!("mem://bench_{}", tag))),
+        (
+            "file",
+            Box::new(|dir, tag| format!("file://{}/{}", dir.display(), tag)),
+        ),
+    ];
+    if cfg!(feature = "storage-faulty") {
+        backends.push((
+            "faulty",
+            Box::new(|dir, tag| {
+                format!("faulty://{}/faulty_{}", dir.display(), tag)
+            }),
+        ));
+    }
+    if cfg!(feature = "storage-sqlite") {
+        backends.push((
+            "sqlite",
+            Box::new(|dir, tag| {
+                format!("sqlite://{}/{}.db", dir.display(), tag)
+            }),
+        ));
+    }
+    if cfg!(feature = "storage-redis") {
+        // redis server must be started locally and cleared before running
+        backends.push((
+            "redis",
+            Box::new(|_, _| "redis://localhost:6379".to_string()),
+        ));
+    }
+    if cfg!(any(
+        feature = "storage-zbox-native",
+        feature = "storage-zbox-faulty"
+    )) {
+        backends.push((
+            "zbox",
+            Box::new(|_, _| {
+                "zbox://accessKey456@repo456?cache_type=mem&cache_size=1mb"
+                    .to_string()
+            }),
+        ));
+    }
+    backends
+}
+
+const BENCH_FILE_LEN: usize = 8 * 1024 * 1024;
+const BENCH_IO_LEN: usize = 4 * 1024;
+const BENCH_IO_CNT: usize = 256;
+const BENCH_TX_WRITES: usize = 32; // committed writes per thread
+const BENCH_SMALL_FILES: usize = 64;
+
+// make files which will be used by benchmark threads
+fn bench_files(repo: &mut Repo, prefix: &str, cnt: usize) -> Vec<Mutex<File>> {
+    (0..cnt)
+        .map(|i| {
+            let file = OpenOptions::new()
+                .create(true)
+                .open(repo, format!("/{}_{}", prefix, i))
+                .unwrap();
+            Mutex::new(file)
+        })
+        .collect()
+}
+
+fn bench_repo(bench: &Bench, backend: &str, uri: &str, data: &[u8]) {
+    let mut repo = RepoOpener::new().create(true).open(uri, "pwd").unwrap();
+    let mut rng = XorShiftRng::from_seed([42u8; 16]);
+
+    for &threads in bench.threads() {
+        // each thread writes and reads its own file sequentially
+        let prefix = format!("seq_{}", threads);
+        let files = bench_files(&mut repo, &prefix, threads);
+        let share = BENCH_FILE_LEN / threads;
+        let work = Work::Bytes(share * threads);
+        bench.run_threads("repo_seq_write", backend, threads, work, |idx| {
+            let mut file = files[idx].lock().unwrap();
+            file.seek(SeekFrom::Start(0)).unwrap();
+            file.write_once(&data[idx * share..(idx + 1) * share])
+                .unwrap();
+        });
+        if !bench.is_selected("repo_seq_write") {
+            for (idx, file) in files.iter().enumerate() {
+                let mut file = file.lock().unwrap();
+                file.write_once(&data[idx * share..(idx + 1) * share])
+                    .unwrap();
+            }
+        }
+        bench.run_threads("repo_seq_read", backend, threads, work, |idx| {
+            let mut file = files[idx].lock().unwrap();
+            let mut dst = Vec::with_capacity(share);
+            file.seek(SeekFrom::Start(0)).unwrap();
+            assert_eq!(file.read_to_end(&mut dst).unwrap(), share);
+        });
+
+        // all threads read the same file at random offsets
+        let offsets: Vec<u64> = (0..BENCH_IO_CNT)
+            .map(|_| {
+                rng.next_u64() % (share - BENCH_IO_LEN) as u64
+                    / BENCH_IO_LEN as u64
+                    * BENCH_IO_LEN as u64
+            })
+            .collect();
+        let shared = files[0].lock().unwrap();
+        let per_thread = BENCH_IO_CNT / threads;
+        let work = Work::Ops(per_thread * threads);
+        bench.run_threads("repo_random_read", backend, threads, work, |idx| {
+            let mut dst = vec![0u8; BENCH_IO_LEN];
+            let offsets = &offsets[idx * per_thread..(idx + 1) * per_thread];
+            for &offset in offsets.iter() {
+                shared.read_at(&mut dst, offset).unwrap();
+            }
+        });
+        drop(shared);
+
+        // each thread overwrites its own file at random offsets, every
+        // write is committed in its own transaction
+        let work = Work::Ops(threads * BENCH_TX_WRITES);
+        bench.run_threads("repo_random_write", backend, threads, work, |idx| {
+            let mut file = files[idx].lock().unwrap();
+            for &offset in offsets[..BENCH_TX_WRITES].iter() {
+                file.seek(SeekFrom::Start(offset)).unwrap();
+                file.write_all(&data[..BENCH_IO_LEN]).unwrap();
+                file.finish().unwrap();
+            }
+        });
+    }
+
+    // creating files and directories needs mutable repo, so threads take
+    // turns through a lock
+    let repo = Mutex::new(repo);
+    let seq = AtomicUsize::new(0);
+    for &threads in bench.threads() {
+        let per_thread = BENCH_SMALL_FILES / threads;
+        let work = Work::Ops(per_thread * threads);
+        bench.run_threads("repo_small_files", backend, threads, work, |_| {
+            for _ in 0..per_thread {
+                let path =
+                    format!("/small_{}", seq.fetch_add(1, Ordering::Relaxed));
+                let mut file = OpenOptions::new()
+                    .create_new(true)
+                    .open(&mut repo.lock().unwrap(), path)
+                    .unwrap();
+                file.write_once(&data[..BENCH_IO_LEN]).unwrap();
+            }
+        });
+        bench.run_threads("repo_tx", backend, threads, work, |_| {
+            for _ in 0..per_thread {
+                let path =
+                    format!("/dir_{}", seq.fetch_add(1, Ordering::Relaxed));
+                repo.lock().unwrap().create_dir(path).unwrap();
+            }
+        });
+    }
+}
+
+#[test]
+fn bench_test() {
+    init_env();
+
+    let mut dir = env::temp_dir();
+    dir.push("zbox_bench_test");
+    if dir.exists() {
+        fs::remove_dir_all(&dir).unwrap();
+    }
+    fs::create_dir(&dir).unwrap();
+
+    let mut data = vec![0u8; BENCH_FILE_LEN];
+    let mut rng = XorShiftRng::from_seed([42u8; 16]);
+    rng.fill_bytes(&mut data);
+
+    let bench = Bench::from_env();
+    for (backend, make_uri) in bench_backends() {
+        bench_repo(&bench, backend, &make_uri(&dir, "repo"), &data);
+    }
+
+    fs::remove_dir_all(&dir).unwrap();
+}
@@ -10,10 +10,14 @@ extern crate tempdir;
 extern crate zbox;
 
 use std::io::{Read, Seek, SeekFrom};
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::sync::Arc;
+use std::time::Duration;
 use tempdir::TempDir;
 #[allow(unused_imports)]
 use zbox::{
-    init_env, Cipher, Error, MemLimit, OpenOptions, OpsLimit, Repo, RepoOpener,
+    init_env, Chunking, Cipher, Error, MemLimit, OpenOptions, OpsLimit, Repo,
+    RepoOpener,
 };
 
 #[cfg(all(
@@ -276,11 +280,431 @@ fn repo_oper() {
         assert!(RepoOpener::new().open(&path, &pwd).is_err());
     }
 
+    // case #14: test pipelined frame encryption
+    {
+        let path = base.clone() + "/repo14";
+        let mut buf = vec![0u8; 3 * 1024 * 1024 + 42];
+        for (i, b) in buf.iter_mut().enumerate() {
+            *b = (i % 251) as u8;
+        }
+        {
+            let mut repo = RepoOpener::new()
+                .create_new(true)
+                .encrypt_workers(2)
+                .open(&path, &pwd)
+                .unwrap();
+            let mut f = OpenOptions::new()
+                .create(true)
+                .open(&mut repo, "/file")
+                .unwrap();
+            f.write_once(&buf[..]).unwrap();
+        }
+        let mut repo = RepoOpener::new().open(&path, &pwd).unwrap();
+        let mut f = repo.open_file("/file").unwrap();
+        let mut dst = Vec::new();
+        f.read_to_end(&mut dst).unwrap();
+        assert_eq!(dst, buf);
+    }
+
+    // case #15: test sequential read-ahead
+    {
+        let path = base.clone() + "/repo15";
+        let mut buf = vec![0u8; 5 * 1024 * 1024 + 42];
+        for (i, b) in buf.iter_mut().enumerate() {
+            *b = (i % 241) as u8;
+        }
+        {
+            let mut repo = RepoOpener::new()
+                .create_new(true)
+                .open(&path, &pwd)
+                .unwrap();
+            let mut f = OpenOptions::new()
+                .create(true)
+                .open(&mut repo, "/file")
+                .unwrap();
+            f.write_once(&buf[..]).unwrap();
+        }
+        let mut repo =
+            RepoOpener::new().read_ahead(4).open(&path, &pwd).unwrap();
+        let mut f = repo.open_file("/file").unwrap();
+        let mut dst = Vec::new();
+        f.read_to_end(&mut dst).unwrap();
+        assert_eq!(dst, buf);
+    }
+
+    // case #16: test FastCDC chunking
+    {
+        let path = base.clone() + "/repo16";
+        assert_eq!(
+            RepoOpener::new()
+                .create_new(true)
+                .chunking(Chunking::FastCdc {
+                    min_size: 4096,
+                    avg_size: 3000,
+                    max_size: 16384,
+                })
+                .open(&path, &pwd)
+                .unwrap_err(),
+            Error::InvalidArgument
+        );
+
+        let mut buf = vec![0u8; 2 * 1024 * 1024 + 42];
+        let mut seed = 42u32;
+        for b in buf.iter_mut() {
+            seed = seed.wrapping_mul(1_103_515_245).wrapping_add(12345);
+            *b = (seed >> 16) as u8;
+        }
+        {
+            let mut repo = RepoOpener::new()
+                .create_new(true)
+                .chunking(Chunking::FastCdc {
+                    min_size: 1024,
+                    avg_size: 4096,
+                    max_size: 16384,
+                })
+                .open(&path, &pwd)
+                .unwrap();
+            let mut f = OpenOptions::new()
+                .create(true)
+                .open(&mut repo, "/file")
+                .unwrap();
+            f.write_once(&buf[..]).unwrap();
+        }
+        let mut repo = RepoOpener::new().open(&path, &pwd).unwrap();
+        let mut f = repo.open_file("/file").unwrap();
+        let mut dst = Vec::new();
+        f.read_to_end(&mut dst).unwrap();
+        assert_eq!(dst, buf);
+    }
+
+    // case #17: test parallel content hashing
+    {
+        let path = base.clone() + "/repo17";
+        let mut buf = vec![0u8; 3 * 1024 * 1024 + 42];
+        let mut seed = 17u32;
+        for b in buf[..1024 * 1024].iter_mut() {
+            seed = seed.wrapping_mul(1_103_515_245).wrapping_add(12345);
+            *b = (seed >> 16) as u8;
+        }
+        let (head, tail) = buf.split_at_mut(1024 * 1024);
+        tail[..1024 * 1024].copy_from_slice(head);
+        {
+            let mut repo = RepoOpener::new()
+                .create_new(true)
+                .dedup_chunk(true)
+                .hash_workers(3)
+                .open(&path, &pwd)
+                .unwrap();
+            let mut f = OpenOptions::new()
+                .create(true)
+                .open(&mut repo, "/file")
+                .unwrap();
+            f.write_once(&buf[..]).unwrap();
+        }
+        let mut repo =
+            RepoOpener::new().hash_workers(2).open(&path, &pwd).unwrap();
+        let mut f = repo.open_file("/file").unwrap();
+        let mut dst = Vec::new();
+        f.read_to_end(&mut dst).unwrap();
+        assert_eq!(dst, buf);
+
+        // write again in the middle of file
+        let mut f = OpenOptions::new()
+            .write(true)
+            .open(&mut repo, "/file")
+            .unwrap();
+        f.seek(SeekFrom::Start(12345)).unwrap();
+        f.write_once(&buf[..1024 * 1024]).unwrap();
+        buf[12345..12345 + 1024 * 1024].copy_from_slice(&dst[..1024 * 1024]);
+        f.seek(SeekFrom::Start(0)).unwrap();
+        let mut dst = Vec::new();
+        f.read_to_end(&mut dst).unwrap();
+        assert_eq!(dst, buf);
+    }
+
+    // case #18: test repo-wide chunk index
+    {
+        let path = base.clone() + "/repo18";
+        let mut buf = vec![0u8; 4 * 1024 * 1024];
+        let mut seed = 18u32;
+        for b in buf.iter_mut() {
+            seed = seed.wrapping_mul(1_103_515_245).wrapping_add(12345);
+            *b = (seed >> 16) as u8;
+        }
+        let mut buf2 = b"some different head".to_vec();
+        buf2.extend_from_slice(&buf[..]);
+
+        // small chunk size so the index will have multiple tables
+        let mut repo = RepoOpener::new()
+            .create_new(true)
+            .dedup_chunk(true)
+            .chunk_index(true)
+            .chunking(Chunking::FastCdc {
+                min_size: 256,
+                avg_size: 1024,
+                max_size: 4096,
+            })
+            .open(&path, &pwd)
+            .unwrap();
+        let mut f = OpenOptions::new()
+            .create(true)
+            .open(&mut repo, "/file")
+            .unwrap();
+        f.write_once(&buf[..]).unwrap();
+        drop(f);
+
+        #[cfg(feature = "storage-file")]
+        let size_before = dir_size(&dir.join("repo18"));
+
+        let mut f = OpenOptions::new()
+            .create(true)
+            .open(&mut repo, "/file2")
+            .unwrap();
+        f.write_once(&buf2[..]).unwrap();
+        drop(f);
+
+        // the duplicated chunks should not be stored again
+        #[cfg(feature = "storage-file")]
+        assert!(dir_size(&dir.join("repo18")) - size_before < buf.len() / 4);
+
+        // remove the first file, its chunks are still used by the second one
+        repo.remove_file("/file").unwrap();
+        drop(repo);
+
+        let mut repo = RepoOpener::new().open(&path, &pwd).unwrap();
+        let mut f = repo.open_file("/file2").unwrap();
+        let mut dst = Vec::new();
+        f.read_to_end(&mut dst).unwrap();
+        assert_eq!(dst, buf2);
+        drop(f);
+
+        // write the same data again to a new file
+        let mut f = OpenOptions::new()
+            .create(true)
+            .open(&mut repo, "/file3")
+            .unwrap();
+        f.write_once(&buf[..]).unwrap();
+        drop(f);
+        repo.remove_file("/file2").unwrap();
+        let mut f = repo.open_file("/file3").unwrap();
+        let mut dst = Vec::new();
+        f.read_to_end(&mut dst).unwrap();
+        assert_eq!(dst, buf);
+    }
+
+    // case #19: test cache sizes
+    {
+        let path = base.clone() + "/repo19";
+        assert_eq!(
+            RepoOpener::new()
+                .create_new(true)
+                .fnode_cache_size(0)
+                .open(&path, &pwd)
+                .unwrap_err(),
+            Error::InvalidArgument
+        );
+
+        let mut repo = RepoOpener::new()
+            .create_new(true)
+            .fnode_cache_size(4)
+            .dentry_cache_size(0)
+            .neg_dentry_cache_size(0)
+            .open(&path, &pwd)
+            .unwrap();
+        repo.create_dir_all("/a/b/c").unwrap();
+        assert!(!repo.path_exists("/a/b/c/d").unwrap());
+        repo.create_dir("/a/b/c/d").unwrap();
+        assert!(repo.is_dir("/a/b/c/d").unwrap());
+        repo.rename("/a/b", "/a/x").unwrap();
+        assert!(!repo.path_exists("/a/b/c/d").unwrap());
+        assert!(repo.is_dir("/a/x/c/d").unwrap());
+    }
+
+    // case #20: test runtime stats
+    {
+        let path = base.clone() + "/repo20";
+        assert_eq!(
+            RepoOpener::new()
+                .create_new(true)
+                .stats_callback(Duration::default(), |_| {})
+                .open(&path, &pwd)
+                .unwrap_err(),
+            Error::InvalidArgument
+        );
+
+        let reports = Arc::new(AtomicUsize::new(0));
+        let reports2 = reports.clone();
+        let mut repo = RepoOpener::new()
+            .create_new(true)
+            .dedup_chunk(true)
+            .dedup_file(true)
+            .stats_callback(Duration::from_millis(10), move |stats| {
+                assert!(stats.tx.begin.count >= stats.tx.commit.count);
+                reports2.fetch_add(1, Ordering::SeqCst);
+            })
+            .open(&path, &pwd)
+            .unwrap();
+
+        let mut buf = vec![0u8; 1024 * 1024];
+        let mut seed = 20u32;
+        for b in buf.iter_mut() {
+            seed = seed.wrapping_mul(1_103_515_245).wrapping_add(12345);
+            *b = (seed >> 16) as u8;
+        }
+
+        // write a new version with same content, both its chunks and content
+        // are duplicated
+        let mut f = repo.create_file("/file").unwrap();
+        f.write_once(&buf[..]).unwrap();
+        f.seek(SeekFrom::Start(0)).unwrap();
+        f.write_once(&buf[..]).unwrap();
+        drop(f);
+
+        // write same content to another file, the content is duplicated
+        let mut f = repo.create_file("/file2").unwrap();
+        f.write_once(&buf[..]).unwrap();
+        f.seek(SeekFrom::Start(0)).unwrap();
+        let mut dst = Vec::new();
+        f.read_to_end(&mut dst).unwrap();
+        assert_eq!(dst, buf);
+        drop(f);
+
+        let stats = repo.stats();
+        assert!(stats.tx.commit.count >= 4);
+        assert!(stats.tx.begin.count >= stats.tx.commit.count);
+        assert!(stats.tx.commit.max >= stats.tx.commit.p50);
+        assert!(stats.crypto.encrypted_bytes >= buf.len() as u64);
+        assert!(stats.crypto.decrypted_bytes >= buf.len() as u64);
+        assert!(stats.dedup.chunk_hits > 0);
+        assert!(stats.dedup.chunk_bytes <= buf.len() as u64);
+        assert_eq!(stats.dedup.content_hits, 2);
+        assert!(stats.storage.put_blocks.count > 0);
+        assert!(stats.storage.put_wal.count > 0);
+        assert!(stats.storage.get_blocks.count > 0);
+        assert!(stats.cow_cache.hits > 0);
+        assert!(stats.addr_cache.hits + stats.addr_cache.misses > 0);
+        #[cfg(feature = "storage-file")]
+        assert!(stats.index.lookups > 0);
+        assert_eq!(stats.local_cache.hits + stats.local_cache.misses, 0);
+
+        // callback is called periodically until repo is closed
+        let begin = std::time::Instant::now();
+        while reports.load(Ordering::SeqCst) < 2 {
+            assert!(begin.elapsed() < Duration::from_secs(10));
+            std::thread::sleep(Duration::from_millis(10));
+        }
+        drop(repo);
+        let cnt = reports.load(Ordering::SeqCst);
+        std::thread::sleep(Duration::from_millis(50));
+        assert_eq!(reports.load(Ordering::SeqCst), cnt);
+    }
+
+    // case #21: test open stats and key cache
+    {
+        let path = base.clone() + "/repo21";
+        let mut repo = RepoOpener::new()
+            .create_new(true)
+            .open(&path, &pwd)
+            .unwrap();
+        let mut f = repo.create_file("/file").unwrap();
+        f.write_once(&[1, 2, 3]).unwrap();
+        drop(f);
+        assert_eq!(repo.stats().open.total, Duration::default());
+        drop(repo);
+
+        // first open derives the key and caches it
+        let repo = RepoOpener::new().key_cache(true).open(&path, &pwd).unwrap();
+        let open = repo.stats().open;
+        assert!(!open.key_cached);
+        assert!(open.super_block > Duration::default());
+        assert!(open.total >= open.super_block + open.storage + open.wal);
+        assert!(open.total >= open.store + open.root);
+        drop(repo);
+
+        // wrong password is still rejected when key cache is used
+        assert_eq!(
+            RepoOpener::new()
+                .key_cache(true)
+                .open(&path, "wrong pwd")
+                .unwrap_err(),
+            Error::Decrypt
+        );
+
+        // second open takes the key from cache
+        let mut repo =
+            RepoOpener::new().key_cache(true).open(&path, &pwd).unwrap();
+        assert!(repo.stats().open.key_cached);
+        let mut f = repo.open_file("/file").unwrap();
+        let mut dst = Vec::new();
+        f.read_to_end(&mut dst).unwrap();
+        assert_eq!(dst, vec![1, 2, 3]);
+        drop(f);
+        repo.reset_password(
+            &pwd,
+            "new pwd",
+            OpsLimit::Interactive,
+            MemLimit::Interactive,
+        )
+        .unwrap();
+        drop(repo);
+
+        // cached key of the old password cannot open the repo
+        assert_eq!(
+            RepoOpener::new()
+                .key_cache(true)
+                .open(&path, &pwd)
+                .unwrap_err(),
+            Error::Decrypt
+        );
+        let repo = RepoOpener::new()
+            .key_cache(true)
+            .open(&path, "new pwd")
+            .unwrap();
+        assert!(!repo.stats().open.key_cached);
+    }
+
+    // case #22: test invalid compression level
+    {
+        let path = base.clone() + "/repo22";
+        assert_eq!(
+            RepoOpener::new()
+                .create_new(true)
+                .compress_level(13)
+                .open(&path, &pwd)
+                .unwrap_err(),
+            Error::InvalidArgument
+        );
+
+        // nothing is created for the rejected level
+        assert!(!Repo::exists(&path).unwrap());
+        RepoOpener::new()
+            .create_new(true)
+            .compress_level(12)
+            .open(&path, &pwd)
+            .unwrap();
+    }
+
     // to suppress unused variable warning
     drop(dir);
     drop(tmpdir);
 }
 
+#[cfg(feature = "storage-file")]
+fn dir_size(path: &std::path::Path) -> usize {
+    std::fs::read_dir(path)
+        .unwrap()
+        .map(|ent| {
+            let ent = ent.unwrap();
+            let md = ent.metadata().unwrap();
+            if md.is_dir() {
+                dir_size(&ent.path())
+            } else {
+                md.len() as usize
+            }
+        })
+        .sum()
+}
+
 fn smoke_test(uri: String) {
     init_env();
 